@@ -57,12 +57,13 @@ void setup() {
 void loop() {
 	piano.updateKeys();
 
-	// Handle keys that are being pressed.
+	// Handle keys that are being pressed and hit their drums together.
 	for (int i = KEY_C; i <= KEY_G; i ++) {
 		if (piano.wasKeyPressed(i) && drums[i] != NO_DRUM) {
-			opl2.playDrum(drums[i], 4, NOTE_C);
+			opl2.queueDrum(drums[i], 4, NOTE_C);
 		}
 	}
+	opl2.triggerDrums();
 
 	delay(20);
 }
@@ -18,6 +18,9 @@
  * files for this example. For more information about the DRO file format please visit
  * http://www.shikadi.net/moddingwiki/DRO_Format
  *
+ * The song is played by the OPLPlayer of the library. Each call to player.service() does a small amount of work and
+ * returns right away, so loop() is free to do other things while the song plays.
+ *
  * Code by Maarten Janssen (maarten@cheerful.nl) 2016-12-17
  * Song Phemo-pop! by Olli Niemitalo/Yehar 1996
  * Most recent version of the library can be found at my GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
@@ -27,84 +30,29 @@
 #include <SPI.h>
 #include <SD.h>
 #include <OPL2.h>
+#include <OPLPlayer.h>
 
 OPL2 opl2;
 File droFile;
-
-unsigned long offset       = 0;
-unsigned long songLength   = 0;
-unsigned long songDuration = 0;
-byte codeShortDelay    = 0;
-byte codeLongDelay     = 0;
-byte registerMapLength = 0;
-byte registerMap[256];
+OPLSDFileStream<File> droStream(droFile);
+OPLPlayer player(&opl2);
 
 
 void setup() {
   opl2.begin();
   SD.begin(7);
 
-  loadDroSong("phemopop.dro");
-  // loadDroSong("strikefo.dro");
-}
-
-
-void loop() {
-  unsigned long time = millis();
-
-  while (songLength > 0) {
-    int wait = playDroSong();
-
-    if (wait > 0) {
-      // Take into account time that was spent on IO.
-      unsigned long ioTime = millis() - time;
-      if (ioTime < wait) {
-        delay(wait - ioTime);
-      }
-      time = millis();
-    }
+  droFile = SD.open("phemopop.dro", FILE_READ);
+  // droFile = SD.open("strikefo.dro", FILE_READ);
 
-    songLength --;
+  if (player.loadDRO(&droStream)) {
+    player.play();
   }
 }
 
 
-void loadDroSong(char* fileName) {
-  droFile = SD.open(fileName, FILE_READ);
-  droFile.seek(12);
-
-  songLength  = droFile.read();
-  songLength += droFile.read() << 8;
-  songLength += droFile.read() << 16;
-  songLength += droFile.read() << 24;
-
-  songDuration  = droFile.read();
-  songDuration += droFile.read() << 8;
-  songDuration += droFile.read() << 16;
-  songDuration += droFile.read() << 24;
-
-  droFile.seek(23);
-  codeShortDelay = droFile.read();
-  codeLongDelay  = droFile.read();
-  registerMapLength = droFile.read();
-
-  for (byte i = 0; i < registerMapLength; i ++) {
-    registerMap[i] = droFile.read();
-  }
-}
-
-
-int playDroSong() {
-  byte code = droFile.read();
-  byte data = droFile.read();
-
-  if (code == codeShortDelay) {
-    return data + 1;
-  } else if (code == codeLongDelay) {
-    return (data + 1) << 8;
-  } else if (code < 128) {
-    opl2.write(registerMap[code], data);
-  }
+void loop() {
+  player.service();
 
-  return 0;
+  // Anything else that needs to be done while the song plays goes here.
 }
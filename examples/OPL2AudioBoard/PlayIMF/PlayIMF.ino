@@ -18,6 +18,9 @@
  * files for this example. For more information about the IMF file format please visit
  * http://www.shikadi.net/moddingwiki/IMF_Format
  *
+ * The song is played by the OPLPlayer of the library. Each call to player.service() does a small amount of work and
+ * returns right away, so loop() is free to do other things while the song plays.
+ *
  * Code by Maarten Janssen (maarten@cheerful.nl) 2016-12-17
  * Songs from the games Bio Menace and Duke Nukem II by Bobby Prince
  * Most recent version of the library can be found at my GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
@@ -27,67 +30,32 @@
 #include <SPI.h>
 #include <SD.h>
 #include <OPL2.h>
+#include <OPLPlayer.h>
 
 OPL2 opl2;
 File imfFile;
+OPLSDFileStream<File> imfStream(imfFile);
+OPLPlayer player(&opl2);
 
-float imfSpeed;
-long songLength = 0;
 
 void setup() {
   opl2.begin();
   SD.begin(7);
 
-  imfSpeed = 560.0;
-  loadImfSong("city.imf");
-
-  // imfSpeed = 280.0;
-  // loadImfSong("kickbuta.imf");
-}
-
-void loop() {
-  unsigned long time = millis();
-
-  while (songLength > 0) {
-    int wait = playImfSong();
-
-    if (wait > 0) {
-      // Take into account time that was spent on IO.
-      unsigned long ioTime = millis() - time;
-      if (ioTime < wait) {
-        delay(wait - ioTime);
-      }
-      time = millis();
-    }
+  imfFile = SD.open("city.imf", FILE_READ);
+  bool loaded = player.loadIMF(&imfStream, 560);
 
-    songLength --;
-  }
-}
-
-
-void loadImfSong(char* fileName) {
-  imfFile = SD.open(fileName, FILE_READ);
-  imfFile.seek(0);
+  // imfFile = SD.open("kickbuta.imf", FILE_READ);
+  // bool loaded = player.loadIMF(&imfStream, 280);
 
-  songLength  = imfFile.read();
-  songLength += imfFile.read() << 8;
-  if (songLength == 0) {
-    songLength = 65535;
-    imfFile.seek(4);
+  if (loaded) {
+    player.play();
   }
 }
 
 
-int playImfSong() {
-  byte reg  = imfFile.read();
-  byte data = imfFile.read();
-  float  wait = imfFile.read();
-  wait += imfFile.read() << 8;
-
-  if (reg != 0x00) {
-    opl2.write(reg, data);
-  }
-  songLength -= 3;
+void loop() {
+  player.service();
 
-  return round(wait * (1000 / imfSpeed));
+  // Anything else that needs to be done while the song plays goes here.
 }
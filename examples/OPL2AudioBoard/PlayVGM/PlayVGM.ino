@@ -55,14 +55,16 @@
 #include <SPI.h>
 #include <SD.h>
 #include <OPL2.h>
+#include <OPLPlayer.h>
 
 OPL2 opl2;
 File vgmFile;
+OPLSDFileStream<File> vgmStream(vgmFile);
+OPLPlayer player(&opl2);
 
 enum playbackStatus{
   PLAYBACK_PLAYING = 1,
   PLAYBACK_COMPLETE = 2,
-  PLAYBACK_ERROR_UNSUPPORTED_CODE = 3,
   PLAYBACK_ERROR_SD_INIT_FAILURE = 4,
   PLAYBACK_ERROR_FILE_OPEN_FAILURE = 5,
   PLAYBACK_ERROR_INVALID_FILE_TYPE = 6,
@@ -73,18 +75,7 @@ const uint32_t SAMPLES_PR_SECOND = 44100;
 const uint8_t OFFSET_GD3 = 0x14;
 const uint8_t OFFSET_SAMPLE_COUNT = 0x18;
 const uint8_t OFFSET_LOOP_OFFSET = 0x1C;
-const uint8_t OFFSET_VGM_DATA_OFFSET = 0x34;
 
-const uint8_t CODE_CHIP_YM3812 = 0x5A;
-const uint8_t CODE_WAIT_N_SAMPLES = 0x61;
-const uint8_t CODE_WAIT_735_SAMPLES = 0x62;
-const uint8_t CODE_WAIT_882_SAMPLES = 0x63;
-const uint8_t CODE_END_OF_DATA = 0x66;
-const uint8_t CODE_WAIT_1_SAMPLE = 0x70;
-const uint8_t CODE_WAIT_16_SAMPLES = 0x7F;
-
-uint32_t relativeLoopOffset = 0;
-uint16_t waitSamples = 0;
 enum playbackStatus PlaybackStatus = PLAYBACK_PLAYING;
 
 const byte filename[] = "stunts01.vgm";
@@ -123,13 +114,13 @@ void loadVgmSong(char* fileName) {
 
   dumpVgmMetadata();
 
-  vgmFile.seek(OFFSET_LOOP_OFFSET); //VGM loop offset, return to this offset when reaching end of song
-  relativeLoopOffset = readUint32FromFile();
-
-  vgmFile.seek(OFFSET_VGM_DATA_OFFSET); //VGM data offset, beginning of song
-  uint32_t relativeVgmOffset  = readUint32FromFile();
-
-  vgmFile.seek(OFFSET_VGM_DATA_OFFSET + relativeVgmOffset);
+  //The player streams the song from SD through a small read window and repeats it from its loop offset
+  if (!player.loadVGM(&vgmStream)) {
+    error(PLAYBACK_ERROR_INVALID_FILE_TYPE);
+    return;
+  }
+  player.setLoop(true);
+  player.play();
 }
 
 uint32_t readUint32FromFile() {
@@ -214,74 +205,11 @@ void printStringln(byte *p) {
 }
 
 void loop() {
-  //Play until finished/error
-  uint32_t time = millis();
-  while (PlaybackStatus == PLAYBACK_PLAYING) {
-    playVgmSongYM3812(); //Fetch and execute one command
-
-    if (waitSamples) { //Delay command found, delay n samples
-      const double samplesPrMs = (double)SAMPLES_PR_SECOND / 1000; //44.1
-      uint16_t waitMs = (uint16_t)((double)waitSamples / samplesPrMs);
-
-      //Reduce delay with time spent on IO
-      uint32_t ioTime = millis() - time;
-      if (ioTime < waitMs) {
-        delay(waitMs - ioTime);
-      }
-      time = millis();
+  // Send the register writes that are due, the player keeps track of the timing and returns right away.
+  if (PlaybackStatus == PLAYBACK_PLAYING) {
+    player.service();
+    if (!player.isPlaying()) {
+      PlaybackStatus = PLAYBACK_COMPLETE;
     }
-    waitSamples = 0;
-  }
-}
-
-void unsupportedCode(byte b) {
-  uint8_t buf[50];
-  sprintf(buf, "Unsupported code 0x%02X offset 0x%08lX", b, vgmFile.position() - 1);
-  printStringln(buf);
-  PlaybackStatus = PLAYBACK_ERROR_UNSUPPORTED_CODE;
-}
-
-void playVgmSongYM3812() {
-
-  //Simple stupid implementation, will stop if reading unsupported byte
-
-  uint8_t code = vgmFile.read();
-
-  switch (code) {
-    case CODE_CHIP_YM3812: //Single OPL2 chip
-      {
-        byte reg  = vgmFile.read();
-        byte data = vgmFile.read();
-        opl2.write(reg, data);
-      }
-      break;
-
-    case CODE_WAIT_N_SAMPLES: //Delay 0-65535 samples (1.49 second)
-      waitSamples  = readUint16FromFile();
-      break;
-
-    case CODE_WAIT_735_SAMPLES: //Delay 735 samples (1/60 second)
-      waitSamples  = 735;
-      break;
-
-    case CODE_WAIT_882_SAMPLES: //Delay 882 samples (1/50 second)
-      waitSamples  = 882;
-      break;
-
-    case CODE_END_OF_DATA: //End of data
-      if (relativeLoopOffset) {
-        vgmFile.seek(OFFSET_LOOP_OFFSET + relativeLoopOffset);
-      } else {
-        PlaybackStatus = PLAYBACK_COMPLETE;
-      }
-      break;
-
-    case CODE_WAIT_1_SAMPLE ... CODE_WAIT_16_SAMPLES: //0-15 sample delay
-      waitSamples = code - CODE_WAIT_1_SAMPLE + 1;
-      break;
-
-    default:
-      unsupportedCode(code);
-      break;
   }
 }
@@ -0,0 +1,199 @@
+/**
+ * This sketch benchmarks the library on your board, so changes to the write path can be checked for regressions. It
+ * measures how many raw register writes, setInstrument, setInstrument4OP, playNote and setFrequency calls can be done
+ * per second, how long a TuneParser tick takes and the worst case time the VoiceAllocator needs to find a voice.
+ *
+ * Every benchmark that writes to the chip first runs on the board and then once more against an OPLRecorder that keeps
+ * the register writes in memory. The board run shows the real throughput including the SPI bus and the chip's busy
+ * time, the recorder run shows the cost of the library itself and how many register writes each call needs. Open the
+ * serial monitor at 115200 baud to see the results. The board does not need to be connected for the recorder run.
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+
+#include <OPL3Duo.h>
+#include <midi_instruments_4op.h>
+#include <TuneParser.h>
+#include <VoiceAllocator.h>
+#include <OPLRecorder.h>
+
+#define BENCHMARK_ITERATIONS 500
+
+
+const char pattern1[] PROGMEM = "t150i0o4l16 cdefgab>c<bagfedc cdefgab>c<bagfedc";
+const char pattern2[] PROGMEM = "    i1o3l8  cegcegcegceg ceg";
+const char pattern3[] PROGMEM = "    i2o2l4  c.g.c.g.";
+
+const unsigned char piano[11] PROGMEM = { 0x00, 0x33, 0x5A, 0xB2, 0x50, 0x00, 0x31, 0x00, 0xB1, 0xF5, 0x11 };
+const unsigned char organ[11] PROGMEM = { 0x00, 0xE2, 0x07, 0xF4, 0x1B, 0x01, 0xE0, 0x00, 0xF4, 0x0D, 0x16 };
+
+OPL3Duo opl3;
+OPLRecorder recorder;
+TuneParser tuneParser(&opl3);
+Tune tune;
+VoiceAllocator voiceAllocator(OPL_MAX_VOICES);
+
+Instrument instruments[2];
+Instrument4OP instruments4OP[2];
+
+
+void setup() {
+	Serial.begin(115200);
+	while (!Serial);
+
+	// OPL3Duo is initialized by the TuneParser.
+	tuneParser.begin();
+	opl3.setOPL3Enabled(true);
+	opl3.setAll4OPChannelsEnabled(true);
+
+	instruments[0] = opl3.loadInstrument(piano);
+	instruments[1] = opl3.loadInstrument(organ);
+	instruments4OP[0] = opl3.loadInstrument4OP(midiInstruments[0]);
+	instruments4OP[1] = opl3.loadInstrument4OP(midiInstruments[16]);
+	tune = tuneParser.playBackground(pattern1, pattern2, pattern3);
+
+	Serial.println(F("OPL3 Duo benchmark"));
+	Serial.println(F("Board:"));
+	runChipBenchmarks(false);
+
+	// Silence the board before the writes go to the recorder.
+	opl3.reset();
+	opl3.setBackend(&recorder);
+	Serial.println(F("Recorder:"));
+	runChipBenchmarks(true);
+
+	Serial.println(F("Voice allocator:"));
+	runVoiceAllocatorBenchmark();
+}
+
+
+void loop() {
+}
+
+
+/**
+ * Run all benchmarks that write to the chip.
+ *
+ * @param recorded - True when the writes go to the recorder.
+ */
+void runChipBenchmarks(bool recorded) {
+	runBenchmark(F("write"),            benchmarkWrite,            recorded);
+	runBenchmark(F("setInstrument"),    benchmarkSetInstrument,    recorded);
+	runBenchmark(F("setInstrument4OP"), benchmarkSetInstrument4OP, recorded);
+	runBenchmark(F("playNote"),         benchmarkPlayNote,         recorded);
+	runBenchmark(F("setFrequency"),     benchmarkSetFrequency,     recorded);
+	runBenchmark(F("TuneParser tick"),  benchmarkTuneTick,         recorded);
+}
+
+
+/**
+ * Run a benchmark and print its results. The operation is run BENCHMARK_ITERATIONS times to measure the throughput
+ * and then again with each call timed on its own to find the slowest call.
+ *
+ * @param name - Name of the benchmark.
+ * @param operation - The operation to benchmark, it receives the index of the iteration.
+ * @param recorded - True when the writes go to the recorder, so the number of writes per call can be shown.
+ */
+void runBenchmark(const __FlashStringHelper* name, void (*operation)(unsigned int), bool recorded) {
+	unsigned long writes = recorder.getNumWrites();
+	unsigned long startTime = micros();
+	for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i ++) {
+		operation(i);
+	}
+	unsigned long totalTime = micros() - startTime;
+	writes = recorder.getNumWrites() - writes;
+
+	unsigned long maxTime = 0;
+	for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i ++) {
+		unsigned long callTime = micros();
+		operation(i);
+		callTime = micros() - callTime;
+		maxTime = max(maxTime, callTime);
+	}
+
+	Serial.print(F("  "));
+	Serial.print(name);
+	Serial.print(F(": "));
+	Serial.print(BENCHMARK_ITERATIONS * 1000000.0 / max(totalTime, 1UL), 0);
+	Serial.print(F(" calls/s, avg "));
+	Serial.print((float)totalTime / BENCHMARK_ITERATIONS, 2);
+	Serial.print(F(" us, max "));
+	Serial.print(maxTime);
+	Serial.print(F(" us"));
+	if (recorded) {
+		Serial.print(F(", "));
+		Serial.print((float)writes / BENCHMARK_ITERATIONS, 1);
+		Serial.print(F(" writes/call"));
+	}
+	Serial.println();
+}
+
+
+void benchmarkWrite(unsigned int i) {
+	opl3.write(0, 0xA0 + (i % 9), i);
+}
+
+
+/**
+ * Swap the instrument of every channel on each pass, so the whole instrument is written and not only the levels.
+ */
+void benchmarkSetInstrument(unsigned int i) {
+	opl3.setInstrument(i % opl3.getNumChannels(), instruments[(i / opl3.getNumChannels()) & 1]);
+}
+
+
+void benchmarkSetInstrument4OP(unsigned int i) {
+	opl3.setInstrument4OP(i % opl3.getNum4OPChannels(), instruments4OP[(i / opl3.getNum4OPChannels()) & 1]);
+}
+
+
+void benchmarkPlayNote(unsigned int i) {
+	opl3.playNote(i % opl3.getNumChannels(), 2 + (i % 5), i % 12);
+}
+
+
+void benchmarkSetFrequency(unsigned int i) {
+	opl3.setFrequency(i % opl3.getNumChannels(), 110.0 + (i % 880));
+}
+
+
+/**
+ * Force the TuneParser to process a tick right away and restart the tune when it ends.
+ */
+void benchmarkTuneTick(unsigned int i) {
+	if (tuneParser.tuneEnded(tune)) {
+		tuneParser.restartTune(tune);
+	}
+	tune.nextTick = millis();
+	tuneParser.update(tune);
+}
+
+
+/**
+ * Measure the worst case time the VoiceAllocator needs to find a voice. All voices are released with different programs
+ * that share one program list, so noteOn has to walk the whole list before it takes the oldest released voice.
+ */
+void runVoiceAllocatorBenchmark() {
+	unsigned long totalTime = 0;
+	unsigned long maxTime = 0;
+	for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i ++) {
+		voiceAllocator.reset();
+		for (byte voice = 0; voice < voiceAllocator.getNumVoices(); voice ++) {
+			voiceAllocator.noteOn(voice, (voice % 15) * OPL_VOICE_PROGRAM_LISTS);
+		}
+		voiceAllocator.releaseAll();
+
+		unsigned long callTime = micros();
+		voiceAllocator.noteOn(60, 15 * OPL_VOICE_PROGRAM_LISTS);
+		callTime = micros() - callTime;
+		totalTime += callTime;
+		maxTime = max(maxTime, callTime);
+	}
+
+	Serial.print(F("  noteOn worst case: avg "));
+	Serial.print((float)totalTime / BENCHMARK_ITERATIONS, 2);
+	Serial.print(F(" us, max "));
+	Serial.print(maxTime);
+	Serial.println(F(" us"));
+}
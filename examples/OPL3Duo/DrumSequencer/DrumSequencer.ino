@@ -75,16 +75,20 @@ void setup() {
 void loop() {
 	unsigned long t = millis();
 
+	// Collect the drums of this step and play them together.
+	OPLNote notes[OPL3DUO_NUM_4OP_CHANNELS];
+	byte numNotes = 0;
 	for (byte i = 0; i < OPL3DUO_NUM_4OP_CHANNELS; i ++) {
 		if (sequence[i].isPlaying && sequence[i].steps[step]) {
 			byte note = sequence[i].instrument.subInstrument[0].transpose;
-			byte octave = note / 12;
-			note = note % 12;
 
-			byte ch4op = opl3Duo.get4OPControlChannel(i);
-			opl3Duo.playNote(ch4op, octave, note);
+			notes[numNotes].channel = opl3Duo.get4OPControlChannel(i);
+			notes[numNotes].octave  = note / 12;
+			notes[numNotes].note    = note % 12;
+			numNotes ++;
 		}
 	}
+	opl3Duo.playNotes(notes, numNotes);
 
 	step = (step + 1) % 16;
 	delay(tTick - (millis() - t));
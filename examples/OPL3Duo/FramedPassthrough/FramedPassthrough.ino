@@ -0,0 +1,34 @@
+/**
+ * This demonstration sketch for the OPL3 Duo shows how the OPLPassthrough receives register writes from a host over
+ * serial at high baud rates. Unlike the SerialPassthrough sketch the host sends frames of many timed register writes
+ * and may only send as many bytes as the board has given it credits for, so no data is lost when the host sends
+ * faster than the chip can be written.
+ *
+ * Frames from the host:
+ *    0xA5 | number of writes n | delay low | delay high | n x (bank, register, value) | checksum
+ * The delay is the number of microseconds since the previous frame and the checksum is the sum of all bytes after
+ * 0xA5. The bank is defined as for the SerialPassthrough sketch, bit 0 selects the bank and bit 1 the chip.
+ *
+ * Messages to the host:
+ *    0xC5 | credits low | credits high    The host may send this many more bytes.
+ *    0xE5 | error code                    A frame was dropped.
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+#include <SPI.h>
+#include <OPL3Duo.h>
+#include <OPLPassthrough.h>
+
+OPL3Duo opl3Duo;
+OPLPassthrough passthrough(&opl3Duo, &Serial);
+
+void setup() {
+	Serial.begin(1000000);
+	opl3Duo.begin();
+	passthrough.begin();
+}
+
+void loop() {
+	passthrough.update();
+}
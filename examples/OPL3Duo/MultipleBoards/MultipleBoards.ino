@@ -0,0 +1,46 @@
+/**
+ * This is a demonstration sketch for the OPL3 Duo! It demonstrates how to combine several boards into a single chip
+ * array. Two OPL3 Duos share the SPI bus and the A0, A1, A2 and reset pins, but each board has its own latch pin. The
+ * array gives one flat range of 24 4-OP channels and random notes are played across all of them.
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+
+#include <OPL3Duo.h>
+#include <ChipArray.h>
+#include <midi_instruments_4op.h>
+
+
+OPL3Duo board1(6, 7, 8, 10, 9);		// A2, A1, A0, latch, reset
+OPL3Duo board2(6, 7, 8,  5, 9);		// Same pins as board 1, but latch on pin 5.
+ChipArray chips;
+
+byte ch4 = 0;		// 4-OP channel index of the array.
+
+
+void setup() {
+	chips.addChip(&board1);
+	chips.addChip(&board2);
+
+	// Initialize both boards and enable OPL3 features (requered to enable 4-OP channel support).
+	chips.begin();
+	chips.setOPL3Enabled(true);
+	chips.setAll4OPChannelsEnabled(true);
+
+	Instrument4OP instrument = board1.loadInstrument4OP(INSTRUMENT_XYLO);
+	for (byte i = 0; i < chips.getNum4OPChannels(); i ++) {
+		chips.setInstrument4OP(i, instrument);
+	}
+}
+
+
+void loop() {
+	byte noteIndex = random(0, 24);
+
+	// Consecutive 4-OP channels of the array alternate between the two boards.
+	chips.playNote(chips.get4OPControlChannel(ch4), 4 + (noteIndex / 12), noteIndex % 12);
+	ch4 = (ch4 + 1) % chips.getNum4OPChannels();
+
+	delay(100);
+}
@@ -0,0 +1,59 @@
+/**
+ * This is a demonstration sketch for the OPL3 Duo! It plays random notes with random instruments that are read from
+ * a bank file on SD card, so the sketch can use all 128 General MIDI instruments without storing them in flash. Use
+ * the InstrumentBank program of the Raspberry Pi examples to create GM4OP.OPB from midi_instruments_4op.h and copy it
+ * to the SD card.
+ *
+ * The InstrumentBank keeps the instruments that have been used most recently in memory, so only instruments that have
+ * not been used for a while need to be read from the card.
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+
+#include <SD.h>
+#include <OPL3Duo.h>
+#include <InstrumentBank.h>
+
+#define SD_CHIP_SELECT 4
+
+
+OPL3Duo opl3Duo;
+InstrumentBank bank(&opl3Duo);
+File bankFile;
+OPLSDFileStream<File> bankStream(bankFile);
+
+byte ch4 = 0;		// 4-OP channel index.
+
+
+void setup() {
+	Serial.begin(115200);
+
+	if (!SD.begin(SD_CHIP_SELECT)) {
+		Serial.println(F("Cannot access SD card"));
+		while (true);
+	}
+
+	bankFile = SD.open("GM4OP.OPB");
+	if (!bankFile || !bank.begin(&bankStream) || !bank.is4OP()) {
+		Serial.println(F("GM4OP.OPB is not a 4-OP instrument bank"));
+		while (true);
+	}
+
+	opl3Duo.begin();
+	opl3Duo.setOPL3Enabled(true);
+	opl3Duo.setAll4OPChannelsEnabled(true);
+}
+
+
+void loop() {
+	// Pick one of the first 16 instruments, so most of them are found in the cache.
+	CompiledInstrument4OP instrument;
+	if (bank.getInstrument4OP(random(0, 16), instrument)) {
+		opl3Duo.setInstrument4OP(ch4, instrument);
+		opl3Duo.playNote(opl3Duo.get4OPControlChannel(ch4), random(3, 6), random(0, 12));
+	}
+
+	ch4 = (ch4 + 1) % opl3Duo.getNum4OPChannels();
+	delay(200);
+}
@@ -10,7 +10,8 @@
  * The REGISTER sets the register of the selected chip and bank to write to.
  * The DATA defines the data to write to the selected register.
  *
- * You can change and improve the serial transfer to suit your application.
+ * You can change and improve the serial transfer to suit your application. For high baud rates have a look at the
+ * FramedPassthrough sketch, which batches writes and uses flow control.
  *
  * Code by Maarten Janssen, 2020-11-07
  * WWW.CHEERFUL.NL
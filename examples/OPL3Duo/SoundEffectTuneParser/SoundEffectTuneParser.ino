@@ -0,0 +1,55 @@
+/**
+ * This is a demonstration sketch for the OPL3 Duo! It demonstrates how the TuneParser can play several tunes at the same
+ * time. A piece of music is looped in the background while a sound effect is played on top of it every few seconds.
+ * The sound effect has a higher priority than the music, so when all channels are in use it takes over channels from
+ * the music.
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+
+#include <OPL3Duo.h>
+#include <midi_instruments_4op.h>
+#include <TuneParser.h>
+
+const char pattern1[] PROGMEM = "t120i44o3l16 frfrfrfrfrfrfrfr grgrgrgrgrgrgrgr  brbrbrbr arararar  grgrgrgrgrgrgrfr grgrgrgrgrgrgrgr";
+const char pattern2[] PROGMEM = "    i44o3l16 arararararararar brbrbrbrbrbrbrbr >drdrdrdr crcrcrcr <brbrbrbrbrbrbrar brbrbrbrbrbrbrbr";
+const char pattern3[] PROGMEM = "    i44o4l16 drdrdrdrdrdrdrdr drdrdrdrdrdrdrdr  grgrgrgr frfrfrfr  drdrdrdrdrdrdrdr drdrdrdrdrdrdrdr";
+const char effect1[]  PROGMEM = "t200i9o5l32 cegb>c";
+const char effect2[]  PROGMEM = "t200i9o5l32 egb>dg";
+
+OPL3Duo opl3;
+TuneParser tuneParser(&opl3);
+Tune music;
+Tune effect;
+Tune* tunes[] = { &effect, &music };
+unsigned long nextEffectTime = 4000;
+
+
+void setup() {
+	// Initialize the TuneParser and the tunes. OPL3Duo is initialized by the TuneParser.
+	tuneParser.begin();
+	music = tuneParser.playBackground(pattern1, pattern2, pattern3);
+	effect = tuneParser.playBackground(effect1, effect2);
+	effect.priority = 1;
+	tuneParser.stopTune(effect);
+}
+
+
+void loop() {
+	// When the music has reached its end restart it.
+	if (tuneParser.tuneEnded(music)) {
+		tuneParser.restartTune(music);
+	}
+
+	// Play the sound effect every 4 seconds.
+	if ((long)(millis() - nextEffectTime) >= 0) {
+		tuneParser.restartTune(effect);
+		nextEffectTime += 4000;
+	}
+
+	// Update both tunes. This returns the number of ms until the next tick of either tune is due, so we can sleep until
+	// then or do something else in the meantime.
+	unsigned long timeUntilNextTick = tuneParser.updateAll(tunes, 2);
+	delay(timeUntilNextTick);
+}
@@ -18,15 +18,10 @@ struct MidiChannel {
     float volume;                       // Channel volume.
     float modulation;                   // Channel modulation.
     float afterTouch;                   // Channel aftertouch.
-    unsigned long tAfterTouch;          // Aftertouch start.
 };
 
 
 struct OPLChannel {
-    unsigned long eventIndex;           // Midi event index to determine oldest channel to reuse.
-    byte midiChannel;                   // Midi channel associated with the event.
-    byte program;                       // Program number of the instrument loaded on the OPL channel.
-    byte note;                          // Note number playing on the channel (0xFF when channel is free).
     byte transpose;                     // Transpose notes on this OPL channel for drums.
     float noteVelocity;                 // Velocity of the note on event.
 };
@@ -49,8 +44,6 @@ const byte drumChannelsOPL[12] = {
 
 void setup();
 void loop();
-byte getFreeMelodicChannel();
-byte getFreeDrumChannel();
 void playDrum(byte note, byte velocity);
 void playMelodic(byte midiChannel, byte note, byte velocity);
 void setOplChannelVolume(byte channel4OP, byte midiChannel);
@@ -11,6 +11,8 @@
 
 #include <SPI.h>
 #include <OPL3Duo.h>
+#include <VoiceAllocator.h>
+#include <OPLModulator.h>
 #include <midi_instruments_4op.h>
 #include <midi_drums.h>
 #include "TeensyMidi.h"
@@ -21,16 +23,18 @@
 #define CONTROL_ALL_SOUND_OFF 120
 #define CONTROL_RESET_ALL     121
 #define CONTROL_ALL_NOTES_OFF 123
-#define PI2 6.28318
+#define VIBRATO_RATE           50		// Vibrato rate in steps of 0.1 Hz.
 
 
 
 OPL3Duo opl3;
+OPLModulator modulator(&opl3);
 
 MidiChannel midiChannels[NUM_MIDI_CHANNELS];
 OPLChannel melodicChannels[NUM_MELODIC_CHANNELS];
 OPLChannel drumChannels[NUM_DRUM_CHANNELS];
-unsigned long midiEventIndex = 0;
+VoiceAllocator melodicVoices(NUM_MELODIC_CHANNELS);
+VoiceAllocator drumVoices(drumChannelsOPL, NUM_DRUM_CHANNELS);
 
 
 /**
@@ -54,91 +58,34 @@ void setup() {
 void loop() {
 	usbMIDI.read();
 
+	// Apply the modulation wheel or aftertouch of each MIDI channel as vibrato to the notes it plays.
 	for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-		byte midiChannel = melodicChannels[i].midiChannel;
-		float modulation = max(
-			midiChannels[midiChannel].modulation,
-			midiChannels[midiChannel].afterTouch
-		);
-
-		if (modulation > 0.0) {
-			float tModulation  = (millis() - midiChannels[midiChannel].tAfterTouch) * (PI2 / 200);
-			byte controlChannel = opl3.get4OPControlChannel(i);
-			byte baseNote = (melodicChannels[i].note % 12) + 2;
-			float fModulation = (notePitches[baseNote + 1] - notePitches[baseNote]) * modulation;
-			float fDelta = (1.0 - ((cos(tModulation) * 0.5) + 0.5)) * fModulation;
-			opl3.setFNumber(controlChannel, notePitches[baseNote] + fDelta);
+		byte midiChannel = melodicVoices.getOwner(i);
+		byte depth = 0;
+		if (midiChannel != OPL_VOICE_NONE) {
+			depth = max(midiChannels[midiChannel].modulation, midiChannels[midiChannel].afterTouch) * 127.0;
 		}
+		modulator.setModulation(opl3.get4OPControlChannel(i), depth, VIBRATO_RATE);
 	}
+	modulator.update();
 }
 
 
 void playMelodic(byte midiChannel, byte note, byte velocity) {
 	midiChannel = midiChannel % NUM_MIDI_CHANNELS;
 
+	// Find the OPL channel to play the note on. Channels that have the same program loaded are preferred, otherwise the
+	// channel that is furthest in its release is used or the oldest note is stolen.
 	byte program = midiChannels[midiChannel].program;
-	byte oplChannelIndex = VALUE_UNDEFINED;
+	byte oplChannelIndex = melodicVoices.noteOn(note, program, midiChannel);
 
-	// Look for the oldest free melodic channel with the same program. There should be at least 2 free channels with the
-	// same program so we're not clubbering the release portion of an older note.
-	unsigned long oldest = -1;
-	byte sameProgramCount = 0;
-	for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-		if (melodicChannels[i].program == program && melodicChannels[i].note == VALUE_UNDEFINED) { 
-			sameProgramCount ++;
-			if (melodicChannels[i].eventIndex < oldest) {
-				oldest = melodicChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
-
-	// If there is no free channel or less than 2 with the smae program then look for any free channel.
-	if (oplChannelIndex == VALUE_UNDEFINED || sameProgramCount < 2) {
-		oldest = -1;
-		for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-			if (melodicChannels[i].note == VALUE_UNDEFINED && melodicChannels[i].eventIndex < oldest) {
-				oldest = melodicChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
-
-	// No free channels, recycle the oldest channel with the same program.
-	if (oplChannelIndex == VALUE_UNDEFINED) {
-		oldest = -1;
-		for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-			if (melodicChannels[i].program == program && melodicChannels[i].eventIndex < oldest) {
-				oldest = melodicChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
-
-	// Still no channel, simply recycle the oldest.
-	if (oplChannelIndex == VALUE_UNDEFINED) {
-		oldest = -1;
-		for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-			if (melodicChannels[i].eventIndex < oldest) {
-				oldest = melodicChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
-
-	if (oplChannelIndex != VALUE_UNDEFINED) {
+	if (oplChannelIndex != OPL_VOICE_NONE) {
 		opl3.setKeyOn(opl3.get4OPControlChannel(oplChannelIndex), false);
-
-		midiEventIndex ++;
-		melodicChannels[oplChannelIndex].eventIndex = midiEventIndex;
-		melodicChannels[oplChannelIndex].midiChannel = midiChannel;
-		melodicChannels[oplChannelIndex].note = note;
 		melodicChannels[oplChannelIndex].noteVelocity = log(min((float)velocity, 127.0)) / log(127.0);
 
 		// If the program loaded on the OPL channel is differs from the MIDI channel, then first send new instrument
 		// parameters to the OPL.
-		if (melodicChannels[oplChannelIndex].program != program) {
-			melodicChannels[oplChannelIndex].program = program;
+		if (melodicVoices.isProgramChanged(oplChannelIndex)) {
 			opl3.setFNumber(opl3.get4OPControlChannel(oplChannelIndex), 0);
 			opl3.setInstrument4OP(
 				oplChannelIndex,
@@ -168,73 +115,21 @@ void playDrum(byte note, byte velocity) {
 		return;
 	}
 
-	byte oplChannelIndex = VALUE_UNDEFINED;
-	unsigned long oldest = -1;
-
-	// Look for the oldest free drum channel with the same program.
-	oldest = -1;
-	for (byte i = 0; i < NUM_DRUM_CHANNELS; i ++) {
-		if (drumChannels[i].program == program && drumChannels[i].note == VALUE_UNDEFINED && drumChannels[i].eventIndex < oldest) {
-			oldest = drumChannels[i].eventIndex;
-			oplChannelIndex = i;
-		}
-	}
-
-	// Look for any free drum channel.
-	if (oplChannelIndex == VALUE_UNDEFINED) {
-		oldest = -1;
-		for (byte i = 0; i < NUM_DRUM_CHANNELS; i ++) {
-			if (drumChannels[i].note == VALUE_UNDEFINED && drumChannels[i].eventIndex < oldest) {
-				oldest = drumChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
+	byte oplChannelIndex = drumVoices.noteOn(note, program, MIDI_DRUM_CHANNEL);
 
-	// Look for the oldest drum channel with the same instrument.
-	if (oplChannelIndex == VALUE_UNDEFINED) {
-		oldest = -1;
-		for (byte i = 0; i < NUM_DRUM_CHANNELS; i ++) {
-			if (drumChannels[i].program == program && drumChannels[i].eventIndex < oldest) {
-				oldest = drumChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
-
-	// Recycle the oldest drum channel if still all channels are occupied.
-	if (oplChannelIndex == VALUE_UNDEFINED) {
-		oldest = -1;
-		for (byte i = 0; i < NUM_DRUM_CHANNELS; i ++) {
-			if (drumChannels[i].eventIndex < oldest) {
-				oldest = drumChannels[i].eventIndex;
-				oplChannelIndex = i;
-			}
-		}
-	}
-
-	if (oplChannelIndex != VALUE_UNDEFINED) {
+	if (oplChannelIndex != OPL_VOICE_NONE) {
 		opl3.setKeyOn(drumChannelsOPL[oplChannelIndex], false);
-
-		midiEventIndex ++;
-		drumChannels[oplChannelIndex].eventIndex = midiEventIndex;
-		drumChannels[oplChannelIndex].note = note;
 		drumChannels[oplChannelIndex].noteVelocity = log(min((float)velocity, 127.0)) / log(127.0);
 
-		// If the program loaded on the OPL channel is differs from the MIDI channel, then first send new instrument
-		// parameters to the OPL.
-		if (drumChannels[oplChannelIndex].program != program) {
-			Instrument drumInstrument = opl3.loadInstrument(midiDrums[program]);
-			drumChannels[oplChannelIndex].program = program;
-			drumChannels[oplChannelIndex].transpose = drumInstrument.transpose;
-			opl3.setInstrument(
-				drumChannelsOPL[oplChannelIndex],
-				drumInstrument,
-				log(min((float)velocity, 127.0)) / log(127.0)
-			);
-		} else {
-			// setOplChannelVolume(oplChannelIndex, MIDI_DRUM_CHANNEL);
-		}
+		// Set the drum instrument for every note, so its velocity is applied. When the OPL channel already holds the
+		// instrument only the output levels are sent.
+		Instrument drumInstrument = opl3.loadInstrument(midiDrums[program]);
+		drumChannels[oplChannelIndex].transpose = drumInstrument.transpose;
+		opl3.setInstrument(
+			drumChannelsOPL[oplChannelIndex],
+			drumInstrument,
+			drumChannels[oplChannelIndex].noteVelocity
+		);
 
 		opl3.playNote(
 			drumChannelsOPL[oplChannelIndex],
@@ -273,18 +168,14 @@ void onNoteOff(byte midiChannel, byte note, byte velocity) {
 	midiChannel = midiChannel % NUM_MIDI_CHANNELS;
 
 	if (midiChannel == MIDI_DRUM_CHANNEL) {
-		for (byte i = 0; i < NUM_DRUM_CHANNELS; i ++) {
-			if (drumChannels[i].note == note) {
-				opl3.setKeyOn(drumChannelsOPL[i], false);
-				drumChannels[i].note = VALUE_UNDEFINED;
-			}
+		byte i;
+		while ((i = drumVoices.noteOff(note, MIDI_DRUM_CHANNEL)) != OPL_VOICE_NONE) {
+			opl3.setKeyOn(drumChannelsOPL[i], false);
 		}
 	} else {
-		for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-			if (melodicChannels[i].midiChannel == midiChannel && melodicChannels[i].note == note) {
-				opl3.setKeyOn(opl3.get4OPControlChannel(i), false);
-				melodicChannels[i].note = VALUE_UNDEFINED;
-			}
+		byte i;
+		while ((i = melodicVoices.noteOff(note, midiChannel)) != OPL_VOICE_NONE) {
+			opl3.setKeyOn(opl3.get4OPControlChannel(i), false);
 		}
 	}
 }
@@ -346,7 +237,7 @@ void onControlChange(byte midiChannel, byte control, byte value) {
 		case CONTROL_VOLUME: {
 			midiChannels[midiChannel].volume = log(min((float)value, 127.0)) / log(127.0);
 			for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-				if (melodicChannels[i].midiChannel == midiChannel && melodicChannels[i].note != VALUE_UNDEFINED) {
+				if (melodicVoices.getOwner(i) == midiChannel && melodicVoices.isHeld(i)) {
 					setOplChannelVolume(i, midiChannel);
 				}
 			}
@@ -375,8 +266,8 @@ void onControlChange(byte midiChannel, byte control, byte value) {
 				// if (oplDrumChannel[i].midiNote != 0x00) {
 				// 	onNoteOff(MIDI_DRUM_CHANNEL, oplDrumChannel[i].midiNote, 0);
 				// }
-				if (melodicChannels[i].note != VALUE_UNDEFINED) {
-					onNoteOff(melodicChannels[i].midiChannel, melodicChannels[i].note, 0);
+				if (melodicVoices.isHeld(i)) {
+					onNoteOff(melodicVoices.getOwner(i), melodicVoices.getNote(i), 0);
 				}
 			}
 			break;
@@ -400,9 +291,9 @@ void onPitchChange(byte midiChannel, int pitch) {
 	float pitchBend = abs(pitch) / 8192.0;
 
 	for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-		if (melodicChannels[i].midiChannel == midiChannel) {
+		if (melodicVoices.getOwner(i) == midiChannel) {
 			byte controlChannel = opl3.get4OPControlChannel(i);
-			byte baseNote = (melodicChannels[i].note % 12) + 2;
+			byte baseNote = (melodicVoices.getNote(i) % 12) + 2;
 
 			if (pitch < 0) {
 				byte fDelta = (notePitches[baseNote] - notePitches[baseNote - 2]) * pitchBend;
@@ -419,9 +310,7 @@ void onPitchChange(byte midiChannel, int pitch) {
 
 
 void onAfterTouch(byte midiChannel, byte pressure) {
-	if (midiChannels[midiChannel].afterTouch == 0.0) {
-		midiChannels[midiChannel].tAfterTouch = millis();
-	}
+	midiChannel = midiChannel % NUM_MIDI_CHANNELS;
 	midiChannels[midiChannel].afterTouch = pressure / 127.0;
 }
 
@@ -431,6 +320,7 @@ void onAfterTouch(byte midiChannel, byte pressure) {
  */
 void onSystemReset() {
 	opl3.begin();
+	modulator.stopAll();
 	opl3.setDeepVibrato(true);
 	opl3.setDeepTremolo(true);
 	opl3.setOPL3Enabled(true);
@@ -445,28 +335,19 @@ void onSystemReset() {
 		midiChannels[i].volume = defaultVolume;
 		midiChannels[i].modulation = 0.0;
 		midiChannels[i].afterTouch = 0.0;
-		midiChannels[i].tAfterTouch = 0;
 	}
 
 	// Initialize melodic channels.
+	melodicVoices.reset();
 	for (byte i = 0; i < NUM_MELODIC_CHANNELS; i ++) {
-		melodicChannels[i].eventIndex = 0;
-		melodicChannels[i].midiChannel = 0;
-		melodicChannels[i].program = VALUE_UNDEFINED;
-		melodicChannels[i].note = VALUE_UNDEFINED;
 		melodicChannels[i].noteVelocity = 0.0;
 	}
 
 	// Initialize drum channels.
+	drumVoices.reset();
 	for (byte i = 0; i < NUM_DRUM_CHANNELS; i ++) {
-		drumChannels[i].eventIndex = 0;
-		drumChannels[i].midiChannel = MIDI_DRUM_CHANNEL;
-		drumChannels[i].program = VALUE_UNDEFINED;
-		drumChannels[i].note = VALUE_UNDEFINED;
 		drumChannels[i].noteVelocity = 0.0;
 	}
-
-	midiEventIndex = 0;
 }
 
 
@@ -0,0 +1,178 @@
+/**
+ * This program benchmarks the library on your Pi, so changes to the write path can be checked for regressions. It
+ * measures how many raw register writes, setInstrument, setInstrument4OP, playNote and setFrequency calls can be done
+ * per second and the worst case time the VoiceAllocator needs to find a voice. The TuneParser is only available on
+ * Arduino, so its tick is benchmarked by the Arduino version of this program.
+ *
+ * Every benchmark that writes to the chip first runs on the board and then once more against an OPLRecorder that keeps
+ * the register writes in memory. The board run shows the real throughput including the SPI bus and the chip's busy
+ * time, the recorder run shows the cost of the library itself and how many register writes each call needs. Pass
+ * --recorder to skip the board run when no board is connected.
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <wiringPi.h>
+#include <OPL3Duo.h>
+#include <VoiceAllocator.h>
+#include <OPLRecorder.h>
+
+#define BENCHMARK_ITERATIONS 10000
+
+
+const unsigned char piano[11] = { 0x00, 0x33, 0x5A, 0xB2, 0x50, 0x00, 0x31, 0x00, 0xB1, 0xF5, 0x11 };
+const unsigned char organ[11] = { 0x00, 0xE2, 0x07, 0xF4, 0x1B, 0x01, 0xE0, 0x00, 0xF4, 0x0D, 0x16 };
+const unsigned char piano4OP[21] = {
+	0x00, 0x31, 0x8F, 0xF1, 0xB2, 0x08, 0x11, 0x83, 0xF1, 0xAF, 0x00,
+	0x31, 0x19, 0xF1, 0xB2, 0x01, 0x31, 0x01, 0xC1, 0xD5, 0x00
+};
+const unsigned char organ4OP[21] = {
+	0x00, 0xA0, 0x85, 0xA2, 0x2A, 0x07, 0x22, 0x9E, 0xA5, 0x2A, 0x00,
+	0xA2, 0x83, 0xA5, 0x2A, 0x01, 0x28, 0x95, 0xA1, 0x2A, 0x00
+};
+
+OPL3Duo opl3;
+OPLRecorder recorder;
+VoiceAllocator voiceAllocator(OPL_MAX_VOICES);
+
+Instrument instruments[2];
+Instrument4OP instruments4OP[2];
+
+
+/**
+ * Run a benchmark and print its results. The operation is run BENCHMARK_ITERATIONS times to measure the throughput
+ * and then again with each call timed on its own to find the slowest call.
+ *
+ * @param name - Name of the benchmark.
+ * @param operation - The operation to benchmark, it receives the index of the iteration.
+ * @param recorded - True when the writes go to the recorder, so the number of writes per call can be shown.
+ */
+void runBenchmark(const char* name, void (*operation)(unsigned int), bool recorded) {
+	unsigned long writes = recorder.getNumWrites();
+	unsigned long startTime = micros();
+	for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i ++) {
+		operation(i);
+	}
+	unsigned long totalTime = micros() - startTime;
+	writes = recorder.getNumWrites() - writes;
+
+	unsigned long maxTime = 0;
+	for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i ++) {
+		unsigned long callTime = micros();
+		operation(i);
+		callTime = micros() - callTime;
+		if (callTime > maxTime) maxTime = callTime;
+	}
+
+	printf("  %-18s %10.0f calls/s, avg %8.3f us, max %5lu us", name,
+		BENCHMARK_ITERATIONS * 1000000.0 / (totalTime > 0 ? totalTime : 1),
+		(double)totalTime / BENCHMARK_ITERATIONS, maxTime);
+	if (recorded) {
+		printf(", %.1f writes/call", (double)writes / BENCHMARK_ITERATIONS);
+	}
+	printf("\n");
+}
+
+
+void benchmarkWrite(unsigned int i) {
+	opl3.write(0, 0xA0 + (i % 9), i);
+}
+
+
+/**
+ * Swap the instrument of every channel on each pass, so the whole instrument is written and not only the levels.
+ */
+void benchmarkSetInstrument(unsigned int i) {
+	opl3.setInstrument(i % opl3.getNumChannels(), instruments[(i / opl3.getNumChannels()) & 1]);
+}
+
+
+void benchmarkSetInstrument4OP(unsigned int i) {
+	opl3.setInstrument4OP(i % opl3.getNum4OPChannels(), instruments4OP[(i / opl3.getNum4OPChannels()) & 1]);
+}
+
+
+void benchmarkPlayNote(unsigned int i) {
+	opl3.playNote(i % opl3.getNumChannels(), 2 + (i % 5), i % 12);
+}
+
+
+void benchmarkSetFrequency(unsigned int i) {
+	opl3.setFrequency(i % opl3.getNumChannels(), 110.0 + (i % 880));
+}
+
+
+/**
+ * Run all benchmarks that write to the chip.
+ *
+ * @param recorded - True when the writes go to the recorder.
+ */
+void runChipBenchmarks(bool recorded) {
+	runBenchmark("write",            benchmarkWrite,            recorded);
+	runBenchmark("setInstrument",    benchmarkSetInstrument,    recorded);
+	runBenchmark("setInstrument4OP", benchmarkSetInstrument4OP, recorded);
+	runBenchmark("playNote",         benchmarkPlayNote,         recorded);
+	runBenchmark("setFrequency",     benchmarkSetFrequency,     recorded);
+}
+
+
+/**
+ * Measure the worst case time the VoiceAllocator needs to find a voice. All voices are released with different programs
+ * that share one program list, so noteOn has to walk the whole list before it takes the oldest released voice.
+ */
+void runVoiceAllocatorBenchmark() {
+	unsigned long totalTime = 0;
+	unsigned long maxTime = 0;
+	for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i ++) {
+		voiceAllocator.reset();
+		for (byte voice = 0; voice < voiceAllocator.getNumVoices(); voice ++) {
+			voiceAllocator.noteOn(voice, (voice % 15) * OPL_VOICE_PROGRAM_LISTS);
+		}
+		voiceAllocator.releaseAll();
+
+		unsigned long callTime = micros();
+		voiceAllocator.noteOn(60, 15 * OPL_VOICE_PROGRAM_LISTS);
+		callTime = micros() - callTime;
+		totalTime += callTime;
+		if (callTime > maxTime) maxTime = callTime;
+	}
+
+	printf("  %-18s avg %8.3f us, max %5lu us\n", "noteOn worst case", (double)totalTime / BENCHMARK_ITERATIONS, maxTime);
+}
+
+
+int main(int argc, char **argv) {
+	bool recorderOnly = argc > 1 && strcmp(argv[1], "--recorder") == 0;
+	if (recorderOnly) {
+		opl3.setBackend(&recorder);
+	}
+
+	opl3.begin();
+	opl3.setOPL3Enabled(true);
+	opl3.setAll4OPChannelsEnabled(true);
+
+	instruments[0] = opl3.loadInstrument(piano);
+	instruments[1] = opl3.loadInstrument(organ);
+	instruments4OP[0] = opl3.loadInstrument4OP(piano4OP);
+	instruments4OP[1] = opl3.loadInstrument4OP(organ4OP);
+
+	printf("OPL3 Duo benchmark\n");
+	if (!recorderOnly) {
+		printf("Board:\n");
+		runChipBenchmarks(false);
+
+		// Silence the board before the writes go to the recorder.
+		opl3.reset();
+		opl3.setBackend(&recorder);
+	}
+
+	printf("Recorder:\n");
+	runChipBenchmarks(true);
+
+	printf("Voice allocator:\n");
+	runVoiceAllocatorBenchmark();
+	return 0;
+}
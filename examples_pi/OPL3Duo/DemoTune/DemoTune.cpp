@@ -3,6 +3,9 @@
  * play music that is defined by simple strings of notes and other commands. The TuneParser can play up to 6 voices at
  * the same time.
  *
+ * Pass the name of a WAV file as argument to record the tune through the OPL3 Duo emulator instead of playing it on the
+ * board, for example `./DemoTune demotune.wav`.
+ *
  * Code by Maarten Janssen, 2020-12-04
  * WWW.CHEERFUL.NL
  * Most recent version of the library can be found at my GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
@@ -10,6 +13,8 @@
 
 #include "TuneParser.h"
 #include <OPL3Duo.h>
+#include <OPLEmulator.h>
+#include <stdio.h>
 #include "midi_instruments_4op.h"
 
 const char voice1[] = "i96t150o5l8egredgrdcerc<b>er<ba>a<a>agdefefedr4.regredgrdcerc<b>er<ba>a<a>agdedcr4.c<g>cea>cr<ag>cr<gfarfearedgrdcfrc<bagab>cdfegredgrdcerc<b>er<ba>a<a>agdedcr4.cro3c2r2";
@@ -17,13 +22,24 @@ const char voice2[] = "i96o4l8crer<br>dr<ar>cr<grbrfr>cr<grbr>crer<gb>dgcrer<br>
 const char voice3[] = "i2o3l8r4gr4.gr4.er4.err4fr4.gr4.gr4.grr4gr4.er4.er4.frr4gr4>ccr4ccr4<aarraar4ggr4ffr4.ro4gab>dr4.r<gr4.gr4.err4er4.fr4.g";
 
 OPL3Duo opl3;
+OPLEmulator emulator(OPL_EMULATOR_YMF262, 2);
 TuneParser tuneParser(&opl3);
 Tune tune;
 
 
 int main(int argc, char **argv) {
+	if (argc > 1) {
+		if (!emulator.openWav(argv[1])) {
+			printf("Cannot create %s\n", argv[1]);
+			return 1;
+		}
+		emulator.setRealTime(true);
+		opl3.setBackend(&emulator);
+	}
+
 	tuneParser.begin();
 	tuneParser.play(voice1, voice2, voice3);
+	emulator.closeWav();
 
 	return 0;
 }
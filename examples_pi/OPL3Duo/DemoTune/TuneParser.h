@@ -17,13 +17,23 @@
 #define TUNE_CMD_TEMPO 'T'
 #define TUNE_CMD_VOLUME 'V'
 
+#define TP_OP_END 0x00
+#define TP_OP_REST 0x01
+#define TP_OP_TEMPO 0x02
+#define TP_OP_INSTRUMENT 0x03
+#define TP_OP_VOLUME 0x04
+#define TP_OP_NOTE 0x80
+#define TP_MAX_OP_LENGTH 2
+
 
 #define TP_NUM_CHANNELS 12
+#define TP_NUM_VOICES 6
 #define TP_NAN 255
 
 
 struct Voice {
 	const char* pattern;			// String of commands to be played.
+	const byte* code;				// Compiled bytecode to be played instead of the pattern or NULL.
 	unsigned long position;			// Position within the pattern string.
 	byte ticks;						// Number of ticks left until the next command.
 	Instrument4OP instrument;		// Current instrument for this voice.
@@ -31,16 +41,22 @@ struct Voice {
 	byte octave;					// Current octave of this voice.
 	byte defaultNoteLength;			// Current default not length for this voice.
 	bool ended;						// Indicates that the voice has processed all commands.
-	byte channel;					// OPL channel used by this voice.
+	byte channel;					// OPL channel used by this voice or TP_NAN when it's not playing a note.
 };
 
 
+/**
+ * A tune of up to TP_NUM_VOICES voices. Several tunes can play at the same time and share the channels of the OPL3 Duo.
+ * When all channels are in use a note takes over the channel of a note from a tune with the same or a lower priority.
+ * Keep a tune at the same place in memory while it's playing.
+ */
 struct Tune {
 	byte numVoices;					// Number of voices in use.
 	byte numEnded;					// Number of voices that has ended.
+	byte priority;					// Priority of the tune when all channels are in use.
 	unsigned long tickDuration;		// Duration of each tick in ms (tempo)
 	unsigned long nextTick;			// Time in ms of the next tick.
-	Voice voice[6];					// Data of each voice.
+	Voice voice[TP_NUM_VOICES];		// Data of each voice.
 };
 
 
@@ -67,16 +83,21 @@ class TuneParser {
 		Tune playBackground(const char* voice0, const char* voice1, const char* voice2, const char* voice3);
 		Tune playBackground(const char* voice0, const char* voice1, const char* voice2, const char* voice3, const char* voice4);
 		Tune playBackground(const char* voice0, const char* voice1, const char* voice2, const char* voice3, const char* voice4, const char* voice5);
-		Tune createTune(const char* voices[6], int numVoices);
+		Tune createTune(const char* voices[TP_NUM_VOICES], int numVoices);
+		unsigned int compile(const char* pattern, byte* buffer, unsigned int size);
+		Tune createCompiledTune(const byte* voices[TP_NUM_VOICES], int numVoices);
 		void playTune(Tune& tune);
 		void restartTune(Tune& tune);
+		void stopTune(Tune& tune);
 		bool tuneEnded(Tune& tune);
 		unsigned long update(Tune& tune);
+		unsigned long updateAll(Tune* tunes[], byte numTunes);
 		bool parseTuneCommand(Tune& tune, byte voiceIndex);
-		void parseNote(Voice& voice);
-		void parseRest(Voice& voice);
-		byte parseNoteLength(Voice voice);
-		byte parseNumber(Voice voice, int nMin, int nMax);
+		byte compileCommand(Voice& voice, byte* op);
+		byte parseNote(Voice& voice);
+		byte parseRest(Voice& voice);
+		byte parseNoteLength(const Voice& voice);
+		byte parseNumber(const Voice& voice, int nMin, int nMax);
 
 	private:
 		OPL3Duo* opl3 = NULL;
@@ -85,4 +106,10 @@ class TuneParser {
 			false, false, false, false, false, false,
 			false, false, false, false, false, false
 		};
+		Voice* channelVoice[TP_NUM_CHANNELS];
+		byte channelPriority[TP_NUM_CHANNELS];
+
+		void playNote(Voice& voice, byte priority, byte octave, byte note);
+		byte allocateChannel(byte priority);
+		void releaseChannel(Voice& voice);
 };
@@ -0,0 +1,83 @@
+/**
+ * This program demonstrates how an InstrumentBank reads instruments from a bank file when they are needed instead of
+ * keeping all of them in memory. When the bank file does not exist yet it is created from the 4-OP General MIDI
+ * instruments of the library's midi_instruments_4op.h, so it can also be copied to an SD card for the SDInstrumentBank
+ * sketch. Each instrument of the bank then plays a short arpeggio.
+ *
+ * Usage: ./InstrumentBank gm4op.opb
+ *
+ * Most recent version of the library can be found on GitHub: https://github.com/DhrBaksteen/ArduinoOPL2
+ */
+
+#include <stdio.h>
+#include <wiringPi.h>
+#include <OPL3Duo.h>
+#include <InstrumentBank.h>
+#include <midi_instruments_4op.h>
+
+OPL3Duo opl3;
+InstrumentBank bank(&opl3);
+
+const byte arpeggio[4] = { NOTE_C, NOTE_E, NOTE_G, NOTE_B };
+
+
+/**
+ * Create a bank file from the 4-OP General MIDI instruments.
+ */
+bool createBank(const char* fileName) {
+	FILE* file = fopen(fileName, "wb");
+	if (file == NULL) {
+		return false;
+	}
+
+	OPLFileOutputStream output(file);
+	unsigned short numInstruments = sizeof(midiInstruments) / sizeof(midiInstruments[0]);
+	bool written = InstrumentBank::writeBank(&output, midiInstruments, numInstruments, OPL_BANK_4OP_SIZE);
+	fclose(file);
+	return written;
+}
+
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("Usage: %s <bank file>\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (file != NULL) {
+		fclose(file);
+	} else if (!createBank(argv[1])) {
+		printf("Cannot create %s\n", argv[1]);
+		return 1;
+	}
+
+	OPLMappedFileStream stream(argv[1]);
+	if (!stream.isOpen() || !bank.begin(&stream) || !bank.is4OP()) {
+		printf("%s is not a 4-OP instrument bank\n", argv[1]);
+		return 1;
+	}
+
+	opl3.begin();
+	opl3.setOPL3Enabled(true);
+	opl3.setAll4OPChannelsEnabled(true);
+
+	printf("Playing %d instruments from %s\n", bank.getNumInstruments(), argv[1]);
+	for (unsigned short i = 0; i < bank.getNumInstruments(); i ++) {
+		byte channel4OP = i % opl3.getNum4OPChannels();
+		CompiledInstrument4OP instrument;
+		if (!bank.getInstrument4OP(i, instrument)) {
+			continue;
+		}
+
+		opl3.setInstrument4OP(channel4OP, instrument);
+		for (byte j = 0; j < 4; j ++) {
+			opl3.playNote(opl3.get4OPControlChannel(channel4OP), 4, arpeggio[j]);
+			delay(60);
+		}
+		opl3.setKeyOn(opl3.get4OPControlChannel(channel4OP), false);
+	}
+
+	printf("Cache hits: %lu, misses: %lu\n", bank.getCacheHits(), bank.getCacheMisses());
+	return 0;
+}
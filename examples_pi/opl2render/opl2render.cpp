@@ -0,0 +1,318 @@
+#include <OPL2.h>
+#include <OPL3.h>
+#include <OPLPlayer.h>
+#include <OPLEmulator.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "opl2render.h"
+
+std::vector<RenderTask> tasks;
+std::vector<std::deque<unsigned int> > queues;			// Task queue of each worker.
+std::vector<std::mutex> queueLocks;
+std::mutex printLock;
+std::atomic<unsigned int> numRendered {0};
+std::atomic<unsigned int> numFailed {0};
+std::atomic<unsigned long long> renderedFrames {0};
+unsigned int numThreads = 0;
+int silent = FALSE;
+int useOPL3 = FALSE;
+char *outputDir = NULL;
+
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		showHelp();
+		return 0;
+	}
+
+	for (int i = 1; i < argc; i ++) {
+		if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i < argc - 1) {
+			numThreads = atoi(argv[++i]);
+		} else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && i < argc - 1) {
+			outputDir = argv[++i];
+		} else if (strcmp(argv[i], "-3") == 0 || strcmp(argv[i], "--opl3") == 0) {
+			useOPL3 = TRUE;
+		} else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--silent") == 0) {
+			silent = TRUE;
+		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			showHelp();
+			return 0;
+		} else if (argv[i][0] != '-') {
+			RenderTask task;
+			task.fileName = argv[i];
+			task.imfSpeed = OPL_PLAYER_IMF_SPEED;
+			if (i < argc - 1 && atoi(argv[i + 1])) task.imfSpeed = atoi(argv[++i]);
+
+			struct stat fileStat;
+			task.fileSize = stat(task.fileName, &fileStat) == 0 ? fileStat.st_size : 0;
+			tasks.push_back(task);
+		}
+	}
+
+	if (tasks.empty()) {
+		printf("Please provide one or more .DRO, .IMF, .VGM, .VGZ or .OPE files to render.\n\n");
+		return 1;
+	}
+
+	if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0) numThreads = 1;
+	if (numThreads > tasks.size()) numThreads = tasks.size();
+
+	printHeader();
+	queueTasks();
+
+	double startTime = getTime();
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < numThreads; i ++) {
+		workers.push_back(std::thread(renderWorker, i));
+	}
+	for (unsigned int i = 0; i < numThreads; i ++) {
+		workers[i].join();
+	}
+	double wallSeconds = getTime() - startTime;
+
+	double audioSeconds = (double)renderedFrames / OPL_EMULATOR_SAMPLE_RATE;
+	printf("Rendered %u songs", numRendered.load());
+	if (numFailed > 0) printf(", %u failed,", numFailed.load());
+	printf(" with %u threads in %.2f s\n", numThreads, wallSeconds);
+	printf("    %.2f songs/s\n", numRendered / wallSeconds);
+	printf("    %.1f s of audio, %.1f audio seconds per second\n\n", audioSeconds, audioSeconds / wallSeconds);
+	return numFailed > 0 ? 1 : 0;
+}
+
+
+/**
+ * Deal the songs over the queues of the workers, largest file first, so every worker starts on its longest songs and
+ * the short songs are left over to balance the load at the end.
+ */
+void queueTasks() {
+	std::vector<unsigned int> order;
+	for (unsigned int i = 0; i < tasks.size(); i ++) {
+		order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [](unsigned int a, unsigned int b) {
+		return tasks[a].fileSize > tasks[b].fileSize;
+	});
+
+	queues.resize(numThreads);
+	queueLocks = std::vector<std::mutex>(numThreads);
+	for (unsigned int i = 0; i < order.size(); i ++) {
+		queues[i % numThreads].push_back(order[i]);
+	}
+}
+
+
+/**
+ * Take the next song for a worker. A worker takes the largest song from the front of its own queue and when that is
+ * empty steals the smallest song from the back of the queue of another worker. No songs are added while rendering, so
+ * the work is done when all queues are empty.
+ *
+ * @param worker - Index of the worker.
+ * @param task - Receives the index of the song to render.
+ * @return True if a song was taken.
+ */
+bool takeTask(unsigned int worker, unsigned int &task) {
+	{
+		std::lock_guard<std::mutex> lock(queueLocks[worker]);
+		if (!queues[worker].empty()) {
+			task = queues[worker].front();
+			queues[worker].pop_front();
+			return true;
+		}
+	}
+
+	for (unsigned int i = 1; i < numThreads; i ++) {
+		unsigned int victim = (worker + i) % numThreads;
+		std::lock_guard<std::mutex> lock(queueLocks[victim]);
+		if (!queues[victim].empty()) {
+			task = queues[victim].back();
+			queues[victim].pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/**
+ * Render songs until there are none left.
+ */
+void renderWorker(unsigned int worker) {
+	unsigned int task;
+	while (takeTask(worker, task)) {
+		double startTime = getTime();
+		double seconds = 0.0;
+		bool rendered = renderSong(tasks[task], seconds);
+
+		if (rendered) {
+			numRendered ++;
+		} else {
+			numFailed ++;
+		}
+
+		if (!silent || !rendered) {
+			std::lock_guard<std::mutex> lock(printLock);
+			if (rendered) {
+				printf("Rendered %s, %.1f s of audio in %.2f s\n", tasks[task].fileName, seconds, getTime() - startTime);
+			} else {
+				printf("Cannot render %s\n", tasks[task].fileName);
+			}
+		}
+	}
+}
+
+
+/**
+ * Render a song to a WAV file. Every song gets its own emulated chip, board and player, so the workers share no state.
+ * The audio is streamed to the WAV file as the song is played.
+ *
+ * @param task - The song to render.
+ * @param seconds - Receives the length of the rendered audio in seconds.
+ * @return True if the song was rendered.
+ */
+bool renderSong(RenderTask &task, double &seconds) {
+	OPLMappedFileStream fileStream(task.fileName);
+	if (!fileStream.isOpen()) {
+		return false;
+	}
+
+	OPLEmulator emulator(useOPL3 ? OPL_EMULATOR_YMF262 : OPL_EMULATOR_YM3812);
+	std::unique_ptr<OPL2> opl2(useOPL3 ? NULL : new OPL2());
+	std::unique_ptr<OPL3> opl3(useOPL3 ? new OPL3() : NULL);
+	std::unique_ptr<OPLPlayer> player(useOPL3 ? new OPLPlayer(opl3.get()) : new OPLPlayer(opl2.get()));
+	OPL2 *board = useOPL3 ? opl3.get() : opl2.get();
+	board->setBackend(&emulator);
+	board->begin();
+
+	if (!loadSong(*player, &fileStream, task)) {
+		return false;
+	}
+
+	char wavFileName[4096];
+	getWavFileName(task, wavFileName, sizeof(wavFileName));
+	if (!emulator.openWav(wavFileName)) {
+		return false;
+	}
+
+	player->setLoop(false);
+	player->play();
+	while (player->isPlaying()) {
+		emulator.renderWav(player->step());
+	}
+
+	// Let the last notes ring out.
+	emulator.renderWav(1000000UL);
+	seconds = (double)emulator.getRenderedFrames() / emulator.getSampleRate();
+	renderedFrames += emulator.getRenderedFrames();
+	emulator.closeWav();
+	return true;
+}
+
+
+/**
+ * Load a song into the player by the extension of its file name.
+ */
+bool loadSong(OPLPlayer &player, OPLStream *stream, RenderTask &task) {
+	const char *ext = strrchr(task.fileName, '.');
+	if (ext == NULL) {
+		return false;
+	}
+
+	if (strcasecmp(ext, ".dro") == 0) {
+		return player.loadDRO(stream);
+	} else if (strcasecmp(ext, ".imf") == 0) {
+		return player.loadIMF(stream, task.imfSpeed);
+	} else if (strcasecmp(ext, ".vgm") == 0 || strcasecmp(ext, ".vgz") == 0 || strcasecmp(ext, ".gz") == 0) {
+		return player.loadVGM(stream);
+	} else if (strcasecmp(ext, ".ope") == 0) {
+		return player.loadOPE(stream);
+	}
+	return false;
+}
+
+
+/**
+ * Get the name of the WAV file of a song. The WAV file is written next to the song, or to the output directory when
+ * one was given, with the extension of the song replaced by .wav.
+ */
+void getWavFileName(RenderTask &task, char *wavFileName, unsigned int size) {
+	const char *baseName = task.fileName;
+	if (outputDir != NULL) {
+		const char *slash = strrchr(task.fileName, '/');
+		if (slash != NULL) baseName = slash + 1;
+		snprintf(wavFileName, size, "%s/%s", outputDir, baseName);
+	} else {
+		snprintf(wavFileName, size, "%s", baseName);
+	}
+
+	char *ext = strrchr(wavFileName, '.');
+	char *slash = strrchr(wavFileName, '/');
+	if (ext != NULL && (slash == NULL || ext > slash)) {
+		*ext = '\0';
+	}
+	strncat(wavFileName, ".wav", size - strlen(wavFileName) - 1);
+}
+
+
+/**
+ * Get the time of the monotonic system clock in seconds.
+ */
+double getTime() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1000000000.0;
+}
+
+
+void printHeader() {
+	if (!silent) {
+		printf("OPL2.render for the OPL2 Audio Board library\n");
+		printf("Rendering %u songs with %u threads through the %s emulator\n\n",
+			(unsigned int)tasks.size(), numThreads, useOPL3 ? "OPL3" : "OPL2");
+	}
+}
+
+
+void showHelp() {
+	printf("OPL2.render renders a library of songs to WAV files through the OPL2 or OPL3\n");
+	printf("emulator. No board needs to be attached. The songs are spread over a pool of\n");
+	printf("threads that each render whole songs. It supports the same formats as opl2play:\n");
+	printf("    *.DRO        - Raw Adlib register captures from DosBox\n");
+	printf("    *.IMF        - id Software music files\n");
+	printf("    *.VGM, *.VGZ - Video Game Music files\n");
+	printf("    *.OPE        - Pre-parsed OPL event streams created with opl2play --convert\n");
+	printf("\n");
+	printf("Usage: opl2render <file> [imf_speed] [<file_n> [imf_speed_n]]\n");
+	printf("                  [--help] [--silent] [--opl3] [--jobs <threads>]\n");
+	printf("                  [--output <directory>]\n");
+	printf("\n");
+	printf("file             A music file to render. It is written to a WAV file of the same\n");
+	printf("                 name with the extension replaced by .wav\n");
+	printf("\n");
+	printf("imf_speed        The playback speed in Hz for an IMF file. If this argument is\n");
+	printf("                 omitted then the default speed of 560 Hz will be used.\n");
+	printf("\n");
+	printf("--help, -h       Show this help screen and exit.\n");
+	printf("\n");
+	printf("--silent, -s     Only show errors and the throughput at the end.\n");
+	printf("\n");
+	printf("--opl3, -3       Render through the OPL3 emulator for OPL3 songs.\n");
+	printf("\n");
+	printf("--jobs, -j       Number of threads to render with. Defaults to the number of\n");
+	printf("                 CPU cores.\n");
+	printf("\n");
+	printf("--output, -o     Write the WAV files to the given directory instead of next to\n");
+	printf("                 the songs.\n");
+	printf("\n");
+}
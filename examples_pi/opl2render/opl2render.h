@@ -0,0 +1,24 @@
+#ifndef OPL2RENDER_H_
+	#define OPL2RENDER_H_
+
+	#include <stdio.h>
+
+
+	struct RenderTask {
+		char *fileName;
+		unsigned int imfSpeed;
+		unsigned long fileSize;
+	};
+
+
+	int main(int argc, char **argv);
+	void queueTasks();
+	bool takeTask(unsigned int worker, unsigned int &task);
+	void renderWorker(unsigned int worker);
+	bool renderSong(RenderTask &task, double &seconds);
+	bool loadSong(OPLPlayer &player, OPLStream *stream, RenderTask &task);
+	void getWavFileName(RenderTask &task, char *wavFileName, unsigned int size);
+	double getTime();
+	void printHeader();
+	void showHelp();
+#endif
@@ -0,0 +1,504 @@
+/**
+ * Chip array for the OPL2 Audio Board, OPL3 boards and OPL3 Duo. Puts several boards behind one flat channel space so
+ * polyphony and write throughput scale with the number of boards.
+ */
+
+#include "ChipArray.h"
+
+
+/**
+ * Create an empty chip array. Add the boards with addChip() before calling begin().
+ */
+ChipArray::ChipArray() {
+	for (byte i = 0; i < OPL_MAX_CHIPS; i ++) {
+		chips[i] = NULL;
+		chips4OP[i] = NULL;
+	}
+}
+
+
+/**
+ * Add an OPL2 Audio Board to the array. The board must have been created with its own latch pin.
+ *
+ * @param chip - The board to add.
+ * @return Index of the board in the array or OPL_CHIP_NONE if the array is full.
+ */
+byte ChipArray::addChip(OPL2* chip) {
+	if (numChips >= OPL_MAX_CHIPS || numChannels + chip->getNumChannels() > OPL_ARRAY_MAX_CHANNELS) {
+		return OPL_CHIP_NONE;
+	}
+
+	chips[numChips] = chip;
+	chips4OP[numChips] = NULL;
+	numChips ++;
+	mapChannels();
+	return numChips - 1;
+}
+
+
+/**
+ * Add an OPL3 board or OPL3 Duo to the array. Its 4-OP channels are added to the 4-OP channels of the array.
+ *
+ * @param chip - The board to add.
+ * @return Index of the board in the array or OPL_CHIP_NONE if the array is full.
+ */
+byte ChipArray::addChip(OPL3* chip) {
+	byte index = addChip((OPL2*)chip);
+	if (index != OPL_CHIP_NONE) {
+		chips4OP[index] = chip;
+		mapChannels();
+	}
+	return index;
+}
+
+
+/**
+ * Initialize all boards of the array.
+ */
+void ChipArray::begin() {
+	for (byte i = 0; i < numChips; i ++) {
+		chips[i]->begin();
+	}
+}
+
+
+/**
+ * Hard reset all boards of the array.
+ */
+void ChipArray::reset() {
+	for (byte i = 0; i < numChips; i ++) {
+		chips[i]->reset();
+	}
+}
+
+
+/**
+ * Number the channels of all boards round robin, so consecutive channels of the array are on different boards for as
+ * long as possible.
+ */
+void ChipArray::mapChannels() {
+	numChannels = 0;
+	num4OPChannels = 0;
+
+	for (byte channel = 0; numChannels < OPL_ARRAY_MAX_CHANNELS; channel ++) {
+		bool isMapped = false;
+		for (byte i = 0; i < numChips && numChannels < OPL_ARRAY_MAX_CHANNELS; i ++) {
+			if (channel < chips[i]->getNumChannels()) {
+				channels[numChannels].chip = i;
+				channels[numChannels].channel = channel;
+				numChannels ++;
+				isMapped = true;
+			}
+		}
+		if (!isMapped) {
+			break;
+		}
+	}
+
+	for (byte channel4OP = 0; num4OPChannels < OPL_ARRAY_MAX_4OP_CHANNELS; channel4OP ++) {
+		bool isMapped = false;
+		for (byte i = 0; i < numChips && num4OPChannels < OPL_ARRAY_MAX_4OP_CHANNELS; i ++) {
+			if (chips4OP[i] != NULL && channel4OP < chips4OP[i]->getNum4OPChannels()) {
+				channels4OP[num4OPChannels].chip = i;
+				channels4OP[num4OPChannels].channel = channel4OP;
+				num4OPChannels ++;
+				isMapped = true;
+			}
+		}
+		if (!isMapped) {
+			break;
+		}
+	}
+}
+
+
+/**
+ * Get the number of boards in the array.
+ */
+byte ChipArray::getNumChips() {
+	return numChips;
+}
+
+
+/**
+ * Get the board at the given index of the array.
+ */
+OPL2* ChipArray::getChip(byte index) {
+	return index < numChips ? chips[index] : NULL;
+}
+
+
+/**
+ * Get the total number of 2-OP channels of all boards.
+ */
+byte ChipArray::getNumChannels() {
+	return numChannels;
+}
+
+
+/**
+ * Get the total number of 4-OP channels of all OPL3 boards.
+ */
+byte ChipArray::getNum4OPChannels() {
+	return num4OPChannels;
+}
+
+
+/**
+ * Get the board that holds the given channel of the array, or NULL when the array has no channels.
+ */
+OPL2* ChipArray::getChannelChip(byte channel) {
+	if (numChannels == 0) {
+		return NULL;
+	}
+
+	return chips[channels[channel % numChannels].chip];
+}
+
+
+/**
+ * Get the channel number on its board of the given channel of the array, or OPL_CHIP_NONE when the array has no
+ * channels.
+ */
+byte ChipArray::getChipChannel(byte channel) {
+	if (numChannels == 0) {
+		return OPL_CHIP_NONE;
+	}
+
+	return channels[channel % numChannels].channel;
+}
+
+
+/**
+ * Get the OPL3 board that holds the given 4-OP channel of the array, or NULL when the array has no 4-OP channels.
+ */
+OPL3* ChipArray::getChannel4OPChip(byte channel4OP) {
+	if (num4OPChannels == 0) {
+		return NULL;
+	}
+
+	return chips4OP[channels4OP[channel4OP % num4OPChannels].chip];
+}
+
+
+/**
+ * Get the 4-OP channel number on its board of the given 4-OP channel of the array, or OPL_CHIP_NONE when the array
+ * has no 4-OP channels.
+ */
+byte ChipArray::getChipChannel4OP(byte channel4OP) {
+	if (num4OPChannels == 0) {
+		return OPL_CHIP_NONE;
+	}
+
+	return channels4OP[channel4OP % num4OPChannels].channel;
+}
+
+
+/**
+ * Get the 2-OP channel of the array that is associated with the given 4-OP channel of the array.
+ *
+ * @param channel4OP - The 4-OP channel of the array.
+ * @param index2OP - The 2-OP channel index [0, 1], defaults to 0 for the control channel.
+ * @return The 2-OP channel of the array or OPL_CHIP_NONE if there are no 4-OP channels.
+ */
+byte ChipArray::get4OPControlChannel(byte channel4OP, byte index2OP) {
+	if (num4OPChannels == 0) {
+		return OPL_CHIP_NONE;
+	}
+
+	OPLArrayChannel& channel = channels4OP[channel4OP % num4OPChannels];
+	byte chipChannel = chips4OP[channel.chip]->get4OPControlChannel(channel.channel, index2OP);
+	for (byte i = 0; i < numChannels; i ++) {
+		if (channels[i].chip == channel.chip && channels[i].channel == chipChannel) {
+			return i;
+		}
+	}
+	return OPL_CHIP_NONE;
+}
+
+
+/**
+ * Enable or disable write elimination on all boards.
+ */
+void ChipArray::setWriteEliminationEnabled(bool enable) {
+	for (byte i = 0; i < numChips; i ++) {
+		chips[i]->setWriteEliminationEnabled(enable);
+	}
+}
+
+
+/**
+ * Start a batch of register changes on all boards.
+ */
+void ChipArray::beginBatch() {
+	for (byte i = 0; i < numChips; i ++) {
+		chips[i]->beginBatch();
+	}
+}
+
+
+/**
+ * Commit the batch of all boards. The wait after the last write to a board overlaps with the writes to the next board.
+ */
+void ChipArray::commit() {
+	for (byte i = 0; i < numChips; i ++) {
+		chips[i]->commit();
+	}
+}
+
+
+/**
+ * Wait until all queued writes of all boards have been sent.
+ */
+void ChipArray::waitForWrites() {
+	for (byte i = 0; i < numChips; i ++) {
+		chips[i]->waitForWrites();
+	}
+}
+
+
+/**
+ * Get the value of a channel register of the given channel of the array.
+ */
+byte ChipArray::getChannelRegister(byte baseRegister, byte channel) {
+	if (numChannels == 0) {
+		return 0;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	return chips[mapped.chip]->getChannelRegister(baseRegister, mapped.channel);
+}
+
+
+/**
+ * Get the value of an operator register of the given channel of the array.
+ */
+byte ChipArray::getOperatorRegister(byte baseRegister, byte channel, byte op) {
+	if (numChannels == 0) {
+		return 0;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	return chips[mapped.chip]->getOperatorRegister(baseRegister, mapped.channel, op);
+}
+
+
+/**
+ * Set the value of a channel register of the given channel of the array.
+ */
+void ChipArray::setChannelRegister(byte baseRegister, byte channel, byte value) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setChannelRegister(baseRegister, mapped.channel, value);
+}
+
+
+/**
+ * Set the value of an operator register of the given channel of the array.
+ */
+void ChipArray::setOperatorRegister(byte baseRegister, byte channel, byte op, byte value) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setOperatorRegister(baseRegister, mapped.channel, op, value);
+}
+
+
+/**
+ * Set the given instrument to a channel of the array.
+ */
+void ChipArray::setInstrument(byte channel, Instrument instrument, float volume) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setInstrument(mapped.channel, instrument, volume);
+}
+
+
+/**
+ * Set the given compiled instrument to a channel of the array.
+ */
+void ChipArray::setInstrument(byte channel, CompiledInstrument instrument, byte volume) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setInstrument(mapped.channel, instrument, volume);
+}
+
+
+/**
+ * Set the given 4-OP instrument to a 4-OP channel of the array.
+ */
+void ChipArray::setInstrument4OP(byte channel4OP, Instrument4OP instrument, float volume) {
+	if (num4OPChannels > 0) {
+		OPLArrayChannel& mapped = channels4OP[channel4OP % num4OPChannels];
+		chips4OP[mapped.chip]->setInstrument4OP(mapped.channel, instrument, volume);
+	}
+}
+
+
+/**
+ * Set the given compiled 4-OP instrument to a 4-OP channel of the array.
+ */
+void ChipArray::setInstrument4OP(byte channel4OP, CompiledInstrument4OP instrument, byte volume) {
+	if (num4OPChannels > 0) {
+		OPLArrayChannel& mapped = channels4OP[channel4OP % num4OPChannels];
+		chips4OP[mapped.chip]->setInstrument4OP(mapped.channel, instrument, volume);
+	}
+}
+
+
+/**
+ * Enable or disable OPL3 mode on all OPL3 boards of the array.
+ */
+void ChipArray::setOPL3Enabled(bool enable) {
+	for (byte i = 0; i < numChips; i ++) {
+		if (chips4OP[i] != NULL) {
+			chips4OP[i]->setOPL3Enabled(enable);
+		}
+	}
+}
+
+
+/**
+ * Enable or disable all 4-OP channels on all OPL3 boards of the array.
+ */
+void ChipArray::setAll4OPChannelsEnabled(bool enable) {
+	for (byte i = 0; i < numChips; i ++) {
+		if (chips4OP[i] != NULL) {
+			chips4OP[i]->setAll4OPChannelsEnabled(enable);
+		}
+	}
+}
+
+
+/**
+ * Play a note of a certain octave on the given channel of the array.
+ */
+void ChipArray::playNote(byte channel, byte octave, byte note) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->playNote(mapped.channel, octave, note);
+}
+
+
+/**
+ * Play several notes at once on the channels of the array. All playing channels are keyed off before any new note is
+ * keyed on, see OPL2::playNotes.
+ */
+void ChipArray::playNotes(const OPLNote* notes, byte numNotes) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	stopNotes(notes, numNotes);
+
+	for (byte i = 0; i < numNotes; i ++) {
+		OPLArrayChannel& mapped = channels[notes[i].channel % numChannels];
+		OPLNote note = { mapped.channel, notes[i].octave, notes[i].note };
+		chips[mapped.chip]->playNotes(&note, 1);
+	}
+}
+
+
+/**
+ * Stop several notes at once by keying off their channels.
+ */
+void ChipArray::stopNotes(const OPLNote* notes, byte numNotes) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	for (byte i = 0; i < numNotes; i ++) {
+		OPLArrayChannel& mapped = channels[notes[i].channel % numChannels];
+		OPLNote note = { mapped.channel, notes[i].octave, notes[i].note };
+		chips[mapped.chip]->stopNotes(&note, 1);
+	}
+}
+
+
+/**
+ * Set the frequency of the given channel of the array to a MIDI note.
+ */
+void ChipArray::setNoteFrequency(byte channel, byte midiNote, short cents) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setNoteFrequency(mapped.channel, midiNote, cents);
+}
+
+
+/**
+ * Is the given channel of the array keyed on?
+ */
+bool ChipArray::getKeyOn(byte channel) {
+	if (numChannels == 0) {
+		return false;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	return chips[mapped.chip]->getKeyOn(mapped.channel);
+}
+
+
+/**
+ * Key the given channel of the array on or off.
+ */
+void ChipArray::setKeyOn(byte channel, bool keyOn) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setKeyOn(mapped.channel, keyOn);
+}
+
+
+/**
+ * Key off all channels of the array. Channels are released in array order, so the writes alternate between boards.
+ */
+void ChipArray::setAllKeysOff() {
+	for (byte i = 0; i < numChannels; i ++) {
+		chips[channels[i].chip]->setKeyOn(channels[i].channel, false);
+	}
+}
+
+
+/**
+ * Get the volume of the given channel of the array.
+ */
+byte ChipArray::getChannelVolume(byte channel) {
+	if (numChannels == 0) {
+		return 0;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	return chips[mapped.chip]->getChannelVolume(mapped.channel);
+}
+
+
+/**
+ * Set the volume of the given channel of the array.
+ */
+void ChipArray::setChannelVolume(byte channel, byte volume) {
+	if (numChannels == 0) {
+		return;
+	}
+
+	OPLArrayChannel& mapped = channels[channel % numChannels];
+	chips[mapped.chip]->setChannelVolume(mapped.channel, volume);
+}
@@ -0,0 +1,100 @@
+#include "OPL3.h"
+
+#ifndef CHIP_ARRAY_LIB_H_
+	#define CHIP_ARRAY_LIB_H_
+
+	// Maximum number of boards in a chip array.
+	#ifndef OPL_MAX_CHIPS
+		#define OPL_MAX_CHIPS 4
+	#endif
+
+	// Maximum number of 2-OP channels of a chip array. This must not exceed 255. The channel map takes 2 bytes for each
+	// 2-OP and 4-OP channel, so on AVR boards the default fits a single OPL3 Duo or 4 OPL2 boards.
+	#ifndef OPL_ARRAY_MAX_CHANNELS
+		#if defined(__AVR__)
+			#define OPL_ARRAY_MAX_CHANNELS 36
+		#else
+			#define OPL_ARRAY_MAX_CHANNELS 144
+		#endif
+	#endif
+	#define OPL_ARRAY_MAX_4OP_CHANNELS (OPL_ARRAY_MAX_CHANNELS / 3)
+
+	#define OPL_CHIP_NONE 0xFF
+
+
+	struct OPLArrayChannel {
+		byte chip;						// Index of the chip in the array.
+		byte channel;					// Channel on the chip.
+	};
+
+
+	/**
+	 * Puts several OPL2 Audio Boards, OPL3 boards and OPL3 Duos behind a single flat channel space. Every board is
+	 * created with its own pins, so each has its own latch (chip select) and the boards share the SPI bus.
+	 *
+	 * Channels are numbered round robin over the boards: channel 0 is the first channel of the first board, channel 1
+	 * the first channel of the second board and so on. Voices that are handed out in channel order, for example by a
+	 * VoiceAllocator, are therefore spread evenly over the boards. Each board keeps track of its own busy time, so a
+	 * write to one board does not wait for a write to another board to be processed. Walking over the flat channels
+	 * alternates between boards, which lets the chip timing of one board overlap with writes to the others.
+	 *
+	 * 4-OP channels are numbered the same way over the OPL3 and OPL3 Duo boards of the array.
+	 */
+	class ChipArray {
+		public:
+			ChipArray();
+			byte addChip(OPL2* chip);
+			byte addChip(OPL3* chip);
+			void begin();
+			void reset();
+
+			byte getNumChips();
+			OPL2* getChip(byte index);
+			byte getNumChannels();
+			byte getNum4OPChannels();
+			OPL2* getChannelChip(byte channel);
+			byte getChipChannel(byte channel);
+			OPL3* getChannel4OPChip(byte channel4OP);
+			byte getChipChannel4OP(byte channel4OP);
+			byte get4OPControlChannel(byte channel4OP, byte index2OP = 0);
+
+			void setWriteEliminationEnabled(bool enable);
+			void beginBatch();
+			void commit();
+			void waitForWrites();
+
+			byte getChannelRegister(byte baseRegister, byte channel);
+			byte getOperatorRegister(byte baseRegister, byte channel, byte op);
+			void setChannelRegister(byte baseRegister, byte channel, byte value);
+			void setOperatorRegister(byte baseRegister, byte channel, byte op, byte value);
+
+			void setInstrument(byte channel, Instrument instrument, float volume = 1.0);
+			void setInstrument(byte channel, CompiledInstrument instrument, byte volume = 255);
+			void setInstrument4OP(byte channel4OP, Instrument4OP instrument, float volume = 1.0);
+			void setInstrument4OP(byte channel4OP, CompiledInstrument4OP instrument, byte volume = 255);
+			void setOPL3Enabled(bool enable);
+			void setAll4OPChannelsEnabled(bool enable);
+
+			void playNote(byte channel, byte octave, byte note);
+			void playNotes(const OPLNote* notes, byte numNotes);
+			void stopNotes(const OPLNote* notes, byte numNotes);
+			void setNoteFrequency(byte channel, byte midiNote, short cents = 0);
+			bool getKeyOn(byte channel);
+			void setKeyOn(byte channel, bool keyOn);
+			void setAllKeysOff();
+			byte getChannelVolume(byte channel);
+			void setChannelVolume(byte channel, byte volume);
+
+		private:
+			void mapChannels();
+
+			OPL2* chips[OPL_MAX_CHIPS];
+			OPL3* chips4OP[OPL_MAX_CHIPS];
+			byte numChips = 0;
+
+			OPLArrayChannel channels[OPL_ARRAY_MAX_CHANNELS];
+			OPLArrayChannel channels4OP[OPL_ARRAY_MAX_4OP_CHANNELS];
+			byte numChannels = 0;
+			byte num4OPChannels = 0;
+	};
+#endif
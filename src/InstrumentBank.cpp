@@ -0,0 +1,250 @@
+/**
+ * Instrument bank for the OPL2 Audio Board library. Reads 2-OP and 4-OP instruments from a bank file on demand and
+ * keeps the most recently used instruments compiled in a small cache.
+ */
+
+#include "InstrumentBank.h"
+
+
+/**
+ * Create an instrument bank. The bank needs to be opened with begin before instruments can be read.
+ *
+ * @param opl2 - The OPL2, OPL3 or OPL3Duo that compiles the instruments.
+ */
+InstrumentBank::InstrumentBank(OPL2* opl2) {
+	this->opl2 = opl2;
+	clearCache();
+}
+
+
+/**
+ * Open a bank from the given stream. The header of the bank is read and checked, instruments are only read when they
+ * are requested. The stream must stay available until end is called.
+ *
+ * @param stream - The stream that holds the bank data.
+ * @return True if the stream holds a valid bank.
+ */
+bool InstrumentBank::begin(OPLStream* stream) {
+	end();
+
+	byte header[OPL_BANK_HEADER_SIZE];
+	if (stream == NULL || !stream->seek(0) || stream->read(header, OPL_BANK_HEADER_SIZE) != OPL_BANK_HEADER_SIZE) {
+		return false;
+	}
+	if (header[0] != 'O' || header[1] != 'P' || header[2] != 'L' || header[3] != 'B' ||
+		header[4] != OPL_BANK_VERSION ||
+		(header[5] != OPL_BANK_2OP_SIZE && header[5] != OPL_BANK_4OP_SIZE)) {
+		return false;
+	}
+
+	this->stream = stream;
+	instrumentSize = header[5];
+	numInstruments = header[6] + (header[7] << 8);
+
+	// Compile instruments straight from memory when all data is available.
+	unsigned long length;
+	data = stream->getData(length);
+	if (data != NULL && length < OPL_BANK_HEADER_SIZE + (unsigned long)numInstruments * instrumentSize) {
+		data = NULL;
+	}
+
+	return true;
+}
+
+
+/**
+ * Close the bank and clear the cache.
+ */
+void InstrumentBank::end() {
+	stream = NULL;
+	data = NULL;
+	instrumentSize = 0;
+	numInstruments = 0;
+	clearCache();
+}
+
+
+/**
+ * Is a valid bank opened?
+ */
+bool InstrumentBank::isOpen() {
+	return stream != NULL;
+}
+
+
+/**
+ * Does the bank hold 4-OP instruments?
+ */
+bool InstrumentBank::is4OP() {
+	return instrumentSize == OPL_BANK_4OP_SIZE;
+}
+
+
+/**
+ * Get the number of instruments in the bank.
+ */
+unsigned short InstrumentBank::getNumInstruments() {
+	return numInstruments;
+}
+
+
+/**
+ * Get a compiled 2-OP instrument from the bank.
+ *
+ * @param index - Index of the instrument in the bank.
+ * @param instrument - Receives the compiled instrument.
+ * @return True if the instrument was found, false if the index is out of range, the bank holds 4-OP instruments or
+ *         the instrument could not be read.
+ */
+bool InstrumentBank::getInstrument(unsigned short index, CompiledInstrument& instrument) {
+	if (instrumentSize != OPL_BANK_2OP_SIZE) {
+		return false;
+	}
+
+	OPLBankCacheEntry* entry = loadInstrument(index);
+	if (entry == NULL) {
+		return false;
+	}
+	instrument = entry->instrument.subInstrument[0];
+	return true;
+}
+
+
+/**
+ * Get a compiled 4-OP instrument from the bank.
+ *
+ * @param index - Index of the instrument in the bank.
+ * @param instrument - Receives the compiled instrument.
+ * @return True if the instrument was found, false if the index is out of range, the bank holds 2-OP instruments or
+ *         the instrument could not be read.
+ */
+bool InstrumentBank::getInstrument4OP(unsigned short index, CompiledInstrument4OP& instrument) {
+	if (instrumentSize != OPL_BANK_4OP_SIZE) {
+		return false;
+	}
+
+	OPLBankCacheEntry* entry = loadInstrument(index);
+	if (entry == NULL) {
+		return false;
+	}
+	instrument = entry->instrument;
+	return true;
+}
+
+
+/**
+ * Remove all instruments from the cache and reset the cache counters.
+ */
+void InstrumentBank::clearCache() {
+	for (byte i = 0; i < OPL_BANK_CACHE_SIZE; i ++) {
+		cache[i].index = OPL_BANK_NONE;
+		cache[i].lastUse = 0;
+	}
+	useCount = 0;
+	cacheHits = 0;
+	cacheMisses = 0;
+}
+
+
+/**
+ * Get the number of instrument requests that were served from the cache.
+ */
+unsigned long InstrumentBank::getCacheHits() {
+	return cacheHits;
+}
+
+
+/**
+ * Get the number of instrument requests that needed the instrument to be read from the bank.
+ */
+unsigned long InstrumentBank::getCacheMisses() {
+	return cacheMisses;
+}
+
+
+/**
+ * Find an instrument in the cache or read and compile it into the least recently used cache entry.
+ *
+ * @param index - Index of the instrument in the bank.
+ * @return The cache entry of the instrument or NULL if it could not be read.
+ */
+OPLBankCacheEntry* InstrumentBank::loadInstrument(unsigned short index) {
+	if (index >= numInstruments) {
+		return NULL;
+	}
+
+	OPLBankCacheEntry* oldest = &cache[0];
+	for (byte i = 0; i < OPL_BANK_CACHE_SIZE; i ++) {
+		if (cache[i].index == index) {
+			cache[i].lastUse = ++ useCount;
+			cacheHits ++;
+			return &cache[i];
+		}
+		if (cache[i].lastUse < oldest->lastUse) {
+			oldest = &cache[i];
+		}
+	}
+
+	unsigned long offset = OPL_BANK_HEADER_SIZE + (unsigned long)index * instrumentSize;
+	byte buffer[OPL_BANK_4OP_SIZE];
+	const byte* instrumentData = buffer;
+	if (data != NULL) {
+		instrumentData = data + offset;
+	} else if (!stream->seek(offset) || stream->read(buffer, instrumentSize) != instrumentSize) {
+		return NULL;
+	}
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		oldest->instrument.subInstrument[0] = opl2->loadCompiledInstrument(instrumentData, false);
+		if (instrumentSize == OPL_BANK_4OP_SIZE) {
+			oldest->instrument.subInstrument[1] = opl2->loadCompiledInstrument(instrumentData + 10, false);
+			oldest->instrument.subInstrument[1].transpose = 0;
+		}
+	#else
+		oldest->instrument.subInstrument[0] = opl2->loadCompiledInstrument(instrumentData);
+		if (instrumentSize == OPL_BANK_4OP_SIZE) {
+			oldest->instrument.subInstrument[1] = opl2->loadCompiledInstrument(instrumentData + 10);
+			oldest->instrument.subInstrument[1].transpose = 0;
+		}
+	#endif
+
+	oldest->index = index;
+	oldest->lastUse = ++ useCount;
+	cacheMisses ++;
+	return oldest;
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	/**
+	 * Write a bank file from the given instruments, for example to convert midiInstruments of midi_instruments_4op.h
+	 * into a bank that can be copied to SD card.
+	 *
+	 * @param output - The output to write the bank to.
+	 * @param instruments - Pointers to the data of each instrument.
+	 * @param numInstruments - The number of instruments.
+	 * @param instrumentSize - Size of each instrument, OPL_BANK_2OP_SIZE or OPL_BANK_4OP_SIZE.
+	 * @return True if the bank was written.
+	 */
+	bool InstrumentBank::writeBank(OPLOutputStream* output, const unsigned char* const* instruments,
+		unsigned short numInstruments, byte instrumentSize) {
+		if (instrumentSize != OPL_BANK_2OP_SIZE && instrumentSize != OPL_BANK_4OP_SIZE) {
+			return false;
+		}
+
+		byte header[OPL_BANK_HEADER_SIZE] = {
+			'O', 'P', 'L', 'B', OPL_BANK_VERSION, instrumentSize,
+			(byte)(numInstruments & 0xFF), (byte)(numInstruments >> 8)
+		};
+		if (!output->write(header, OPL_BANK_HEADER_SIZE)) {
+			return false;
+		}
+
+		for (unsigned short i = 0; i < numInstruments; i ++) {
+			if (!output->write(instruments[i], instrumentSize)) {
+				return false;
+			}
+		}
+		return true;
+	}
+#endif
@@ -0,0 +1,75 @@
+#include "OPLPlayer.h"
+
+#ifndef INSTRUMENT_BANK_LIB_H_
+	#define INSTRUMENT_BANK_LIB_H_
+
+	// Number of compiled instruments the bank keeps in memory. Each entry takes about 30 bytes.
+	#ifndef OPL_BANK_CACHE_SIZE
+		#if defined(__AVR__)
+			#define OPL_BANK_CACHE_SIZE 4
+		#else
+			#define OPL_BANK_CACHE_SIZE 16
+		#endif
+	#endif
+
+	// Layout of a bank file. The header holds the magic "OPLB", the version, the size of each instrument in bytes and
+	// the number of instruments as a 16 bit little endian number. The instruments follow the header and use the same
+	// 11 byte (2-OP) or 21 byte (4-OP) layout as the instruments in midi_instruments.h and midi_instruments_4op.h.
+	#define OPL_BANK_VERSION     1
+	#define OPL_BANK_HEADER_SIZE 8
+	#define OPL_BANK_2OP_SIZE    11
+	#define OPL_BANK_4OP_SIZE    21
+
+	// Index of an unused cache entry.
+	#define OPL_BANK_NONE 0xFFFF
+
+
+	struct OPLBankCacheEntry {
+		unsigned short index;					// Index of the instrument in the bank or OPL_BANK_NONE.
+		unsigned long lastUse;					// Value of the use counter when the instrument was last requested.
+		CompiledInstrument4OP instrument;		// The compiled instrument, 2-OP instruments use sub instrument 0.
+	};
+
+
+	/**
+	 * Bank of instruments that are read from an OPLStream when they are needed, so large sound sets can be kept on SD
+	 * card or in a file instead of in flash. Instruments are compiled as they are read and the most recently used ones
+	 * are kept in a small cache, so playing the same programs again costs no reads. When the stream holds all data in
+	 * memory, like a mapped file on the Pi, instruments are compiled straight from the data.
+	 */
+	class InstrumentBank {
+		public:
+			InstrumentBank(OPL2* opl2);
+			bool begin(OPLStream* stream);
+			void end();
+			bool isOpen();
+			bool is4OP();
+			unsigned short getNumInstruments();
+
+			bool getInstrument(unsigned short index, CompiledInstrument& instrument);
+			bool getInstrument4OP(unsigned short index, CompiledInstrument4OP& instrument);
+
+			void clearCache();
+			unsigned long getCacheHits();
+			unsigned long getCacheMisses();
+
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				static bool writeBank(OPLOutputStream* output, const unsigned char* const* instruments,
+					unsigned short numInstruments, byte instrumentSize);
+			#endif
+
+		private:
+			OPLBankCacheEntry* loadInstrument(unsigned short index);
+
+			OPL2* opl2;
+			OPLStream* stream = NULL;
+			const byte* data = NULL;
+			byte instrumentSize = 0;
+			unsigned short numInstruments = 0;
+
+			OPLBankCacheEntry cache[OPL_BANK_CACHE_SIZE];
+			unsigned long useCount = 0;
+			unsigned long cacheHits = 0;
+			unsigned long cacheMisses = 0;
+	};
+#endif
@@ -52,10 +52,56 @@
 	#include <SPI.h>
 	#include <Arduino.h>
 #else
+	#include <string.h>
 	#include <wiringPi.h>
 	#include <wiringPiSPI.h>
+	#if defined(OPL_FAST_IO)
+		#include <fcntl.h>
+		#include <sys/mman.h>
+		#include <unistd.h>
+
+		// BCM283x GPIO register offsets (in 32-bit words) for memory mapped fast IO.
+		#define GPIO_SET_OFFSET   7
+		#define GPIO_CLEAR_OFFSET 10
+
+		static volatile uint32_t* gpioRegisters = NULL;
+	#endif
 #endif
 
+#if defined(OPL_ASYNC_WRITES) && BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	OPL2* OPL2::writeTimerInstance = NULL;
+#endif
+
+// Sample rate of the chip in centi-Hz divided by 16 (3579545 / 72 * 100 / 16), used by the fixed point frequency
+// functions, and its reciprocal scaled by 2^36.
+#define OPL_SAMPLE_RATE_CENTI_HZ_16 310724UL
+#define OPL_SAMPLE_RATE_RECIPROCAL  13822UL
+
+// Highest frequency in centi-Hz that can be reached in each block (F-number 1023).
+const unsigned long blockCentiHz[8] PROGMEM = {
+	  4850,   9700,  19401,  38802,
+	 77605, 155210, 310420, 620841
+};
+
+// F-numbers of MIDI notes 60 to 71 in block 4 with A4 tuned to 440Hz in 12.4 fixed point.
+const unsigned int midiNoteFNumbers[12] PROGMEM = {
+	5518, 5846, 6194, 6562, 6952, 7366, 7804, 8268, 8759, 9280, 9832, 10417
+};
+
+// Frequency multiplier 2^(cents / 1200) for 0 to 99 cents in 1.15 fixed point.
+const unsigned int centMultipliers[100] PROGMEM = {
+	32768, 32787, 32806, 32825, 32844, 32863, 32882, 32901, 32920, 32939,
+	32958, 32977, 32996, 33015, 33034, 33053, 33072, 33091, 33110, 33130,
+	33149, 33168, 33187, 33206, 33225, 33245, 33264, 33283, 33302, 33322,
+	33341, 33360, 33379, 33399, 33418, 33437, 33457, 33476, 33495, 33515,
+	33534, 33553, 33573, 33592, 33611, 33631, 33650, 33670, 33689, 33709,
+	33728, 33748, 33767, 33787, 33806, 33826, 33845, 33865, 33884, 33904,
+	33924, 33943, 33963, 33982, 34002, 34022, 34041, 34061, 34081, 34100,
+	34120, 34140, 34160, 34179, 34199, 34219, 34239, 34258, 34278, 34298,
+	34318, 34338, 34357, 34377, 34397, 34417, 34437, 34457, 34477, 34497,
+	34517, 34536, 34556, 34576, 34596, 34616, 34636, 34656, 34676, 34696
+};
+
 
 /**
  * Instantiate the OPL2 library with default pin setup.
@@ -64,6 +110,8 @@ OPL2::OPL2() {
 	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
 		wiringPiSetup();
 	#endif
+
+	setClockFrequency(clockFrequency);
 }
 
 
@@ -82,6 +130,16 @@ OPL2::OPL2(byte reset, byte address, byte latch) : OPL2::OPL2() {
 }
 
 
+#if defined(OPL_ASYNC_WRITES)
+	/**
+	 * Send any writes that are still queued to the chip and stop the background write engine.
+	 */
+	OPL2::~OPL2() {
+		stopWriteEngine();
+	}
+#endif
+
+
 /**
  * Initialize the YM3812.
  */
@@ -92,20 +150,35 @@ void OPL2::begin() {
 		Serial.println("OPL serial debug enabled");
 	#endif
 
-	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
-		SPI.begin();
-		SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE0));
-	#else
-		wiringPiSPISetup(SPI_CHANNEL, SPI_SPEED);
-	#endif
+	if (backend == NULL) {
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			SPI.begin();
+		#else
+			wiringPiSPISetup(SPI_CHANNEL, SPI_SPEED);
+		#endif
 
-	pinMode(pinLatch,   OUTPUT);
-	pinMode(pinAddress, OUTPUT);
-	pinMode(pinReset,   OUTPUT);
+		pinMode(pinLatch,   OUTPUT);
+		pinMode(pinAddress, OUTPUT);
+		pinMode(pinReset,   OUTPUT);
 
-	digitalWrite(pinLatch,   HIGH);
-	digitalWrite(pinReset,   HIGH);
-	digitalWrite(pinAddress, LOW);
+		digitalWrite(pinLatch,   HIGH);
+		digitalWrite(pinReset,   HIGH);
+		digitalWrite(pinAddress, LOW);
+
+		resolveFastPin(fastLatch, pinLatch);
+		resolveFastPin(fastAddress, pinAddress);
+
+		#if defined(OPL_ASYNC_WRITES)
+			startWriteEngine();
+		#endif
+	}
+
+	#if defined(OPL_WRITE_STATS)
+		resetWriteStats();
+	#endif
+	#if defined(OPL_WRITE_TRACE)
+		clearTrace();
+	#endif
 
 	createShadowRegisters();
 	reset();
@@ -121,26 +194,42 @@ void OPL2::init() {
 
 
 /**
- * Create shadow registers to hold the values written to the OPL2 chip for later access. Only those registers that are
- * are valid on the YM3812 are created to be as memory friendly as possible for platforms with limited RAM such as the
- * Arduino Uno / Nano. Registers consume 120 bytes.
+ * Set up the shadow registers that hold the values written to the OPL2 chip for later access. Only those registers that
+ * are valid on the YM3812 are stored to be as memory friendly as possible for platforms with limited RAM such as the
+ * Arduino Uno / Nano. The storage is part of the OPL2 instance, so no memory is allocated. Registers consume 120 bytes
+ * and another 19 bytes are used to flag registers that are pending to be written by a batch (shadowRegisterFootprint).
  */
 void OPL2::createShadowRegisters() {
-	chipRegisters = new byte[3];					//  3
-	channelRegisters = new byte[3 * numChannels];	// 27
-	operatorRegisters = new byte[10 * numChannels];	// 90
+	useShadowStorage(shadowStorage);
 }
 
 
 /**
  * Hard reset the OPL2 chip and initialize all registers to 0x00. This should be called before sending any data to the
- * chip.
+ * chip. With fast reset enabled only the registers that are not 0x00 after a hard reset are written.
  */
 void OPL2::reset() {
 	// Hard reset the OPL2.
-	digitalWrite(pinReset, LOW);
-	delay(1);
-	digitalWrite(pinReset, HIGH);
+	waitForWrites();
+	if (backend != NULL) {
+		backend->reset();
+	} else {
+		digitalWrite(pinReset, LOW);
+		delay(1);
+		digitalWrite(pinReset, HIGH);
+	}
+
+	queuedDrums = 0;
+	queuedDrumChannels = 0;
+
+	// The hard reset cleared all registers. With fast reset the shadow registers are cleared to match and only registers
+	// that are initialized to another value are written. Otherwise all registers are written.
+	bool eliminateWrites = writeElimination;
+	unsigned long numSkippedWrites = skippedWrites;
+	writeElimination = fastReset;
+	if (fastReset) {
+		clearShadowRegisters();
+	}
 
 	// Initialize chip registers.
 	setChipRegister(0x00, 0x00);
@@ -161,6 +250,19 @@ void OPL2::reset() {
 			setOperatorRegister(0xE0, i, j, 0x00);
 		}
 	}
+
+	writeElimination = eliminateWrites;
+	skippedWrites = numSkippedWrites;
+}
+
+
+/**
+ * Set all shadow registers to 0x00, the value of every register after a hard reset.
+ */
+void OPL2::clearShadowRegisters() {
+	memset(chipRegisters, 0x00, getNumChipRegisters());
+	memset(channelRegisters, 0x00, 3 * getNumChannels());
+	memset(operatorRegisters, 0x00, 10 * getNumChannels());
 }
 
 
@@ -182,8 +284,10 @@ byte OPL2::getChipRegister(short reg) {
  * @param value - The value to write to the register.
  */
 void OPL2::setChipRegister(short reg, byte value) {
-	chipRegisters[getChipRegisterOffset(reg)] = value;
-	write(reg & 0xFF, value);
+	byte offset = getChipRegisterOffset(reg);
+	if (updateShadowRegister(chipRegisters, chipRegistersDirty, offset, value)) {
+		write(reg & 0xFF, value);
+	}
 }
 
 
@@ -206,6 +310,48 @@ byte OPL2::getChipRegisterOffset(short reg) {
 }
 
 
+/**
+ * Get the master clock frequency of the chip when no other clock frequency is set.
+ *
+ * @return The default clock frequency in Hz.
+ */
+unsigned long OPL2::getDefaultClockFrequency() {
+	return OPL2_CLOCK_FREQUENCY;
+}
+
+
+/**
+ * Get the number of chip wide registers that are held in the shadow registers.
+ *
+ * @return The number of chip wide shadow registers.
+ */
+byte OPL2::getNumChipRegisters() {
+	return 3;
+}
+
+
+/**
+ * Get the 9-bit register address of a chip wide register from its internal shadow register offset. This is the inverse
+ * of getChipRegisterOffset().
+ *
+ * @param offset - The internal offset of the chip wide register.
+ * @return The 9-bit address of the register.
+ */
+short OPL2::getChipRegisterAddress(byte offset) {
+	return chipRegisterAddresses[offset % 3];
+}
+
+
+/**
+ * Send the shadow value of the chip wide register at the given internal offset to the chip.
+ *
+ * @param offset - The internal offset of the chip wide register.
+ */
+void OPL2::commitChipRegister(byte offset) {
+	setChipRegister(getChipRegisterAddress(offset), chipRegisters[offset]);
+}
+
+
 /**
  * Get the value of a channel register.
  *
@@ -226,9 +372,11 @@ byte OPL2::getChannelRegister(byte baseRegister, byte channel) {
  * @param value - The value to write to the register.
  */
 void OPL2::setChannelRegister(byte baseRegister, byte channel, byte value) {
-	channelRegisters[getChannelRegisterOffset(baseRegister, channel)] = value;
-	byte reg = baseRegister + (channel % CHANNELS_PER_BANK);
-	write(reg, value);
+	byte offset = getChannelRegisterOffset(baseRegister, channel);
+	if (updateShadowRegister(channelRegisters, channelRegistersDirty, offset, value)) {
+		byte reg = baseRegister + (channel % CHANNELS_PER_BANK);
+		write(reg, value);
+	}
 }
 
 
@@ -277,9 +425,11 @@ byte OPL2::getOperatorRegister(byte baseRegister, byte channel, byte operatorNum
  * @param value - The value to write to the operator's register.
  */
 void OPL2::setOperatorRegister(byte baseRegister, byte channel, byte operatorNum, byte value) {
-	operatorRegisters[getOperatorRegisterOffset(baseRegister, channel, operatorNum)] = value;
-	byte reg = baseRegister + getRegisterOffset(channel, operatorNum);
-	write(reg, value);
+	short offset = getOperatorRegisterOffset(baseRegister, channel, operatorNum);
+	if (updateShadowRegister(operatorRegisters, operatorRegistersDirty, offset, value)) {
+		byte reg = baseRegister + getRegisterOffset(channel, operatorNum);
+		write(reg, value);
+	}
 }
 
 
@@ -313,65 +463,1022 @@ short OPL2::getOperatorRegisterOffset(byte baseRegister, byte channel, byte oper
 
 
 /**
- * Get the offset from a base register to a channel operator register.
+ * Get the offset from a base register to a channel operator register.
+ *
+ * @param channel - The channel for which to get the offset [0, 8].
+ * @param operatorNum - The operator for which to get the offset [0, 1].
+ * @return The offset from the base register to the operator register.
+ */
+byte OPL2::getRegisterOffset(byte channel, byte operatorNum) {
+	return registerOffsets[operatorNum % 2][channel % CHANNELS_PER_BANK];
+}
+
+
+/**
+ * Store a new value in the shadow registers and determine whether it needs to be sent to the chip. When write
+ * elimination is enabled and the shadow register already holds the given value then the write is counted as skipped.
+ * While a batch is active the register is flagged as dirty, so it will be written when the batch is committed.
+ *
+ * @param shadowRegisters - The shadow register array to update.
+ * @param dirtyRegisters - The flags that mark the registers of the shadow register array pending for a batch.
+ * @param offset - The internal offset of the register within the shadow register array.
+ * @param value - The new value of the register.
+ * @return True if the value must be written to the chip immediately.
+ */
+bool OPL2::updateShadowRegister(byte* shadowRegisters, byte* dirtyRegisters, short offset, byte value) {
+	if (writeElimination && shadowRegisters[offset] == value) {
+		skippedWrites ++;
+		return false;
+	}
+
+	shadowRegisters[offset] = value;
+
+	if (batchActive) {
+		setRegisterFlag(dirtyRegisters, offset, true);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Get the state of a register flag, such as the dirty flag of a shadow register.
+ *
+ * @param flags - The bit array holding the flags.
+ * @param offset - The internal offset of the register.
+ * @return True if the flag of the register is set.
+ */
+bool OPL2::getRegisterFlag(byte* flags, short offset) {
+	return flags[offset >> 3] & (0x01 << (offset & 0x07));
+}
+
+
+/**
+ * Set or clear a register flag, such as the dirty flag of a shadow register.
+ *
+ * @param flags - The bit array holding the flags.
+ * @param offset - The internal offset of the register.
+ * @param set - Sets the flag when true, otherwise clears it.
+ */
+void OPL2::setRegisterFlag(byte* flags, short offset, bool set) {
+	if (set) {
+		flags[offset >> 3] |= 0x01 << (offset & 0x07);
+	} else {
+		flags[offset >> 3] &= ~(0x01 << (offset & 0x07));
+	}
+}
+
+
+/**
+ * Start a batch of register changes. While a batch is active all register setters only update the shadow registers and
+ * nothing is sent to the chip until commit() is called. Only the final value of each register is written when the
+ * batch is committed.
+ */
+void OPL2::beginBatch() {
+	batchActive = true;
+}
+
+
+/**
+ * Write all registers that were changed since beginBatch() to the chip in a single pass and end the batch. Registers
+ * are written in an order that makes sure a patch is fully loaded before any note sounds: first the chip wide
+ * registers, then key-off of channels that were stopped during the batch, then all operator registers and channel
+ * registers 0xC0 and 0xA0 and finally key-on (0xB0) and the percussion register (0xBD).
+ */
+void OPL2::commit() {
+	if (!batchActive) {
+		return;
+	}
+
+	batchActive = false;
+	bool eliminateWrites = writeElimination;
+	writeElimination = false;
+
+	// Chip wide registers, except for the percussion register that may trigger drums.
+	for (byte i = 0; i < getNumChipRegisters(); i ++) {
+		if (getRegisterFlag(chipRegistersDirty, i) && (getChipRegisterAddress(i) & 0xFF) != 0xBD) {
+			setRegisterFlag(chipRegistersDirty, i, false);
+			commitChipRegister(i);
+		}
+	}
+
+	// Key-off all channels that were stopped during the batch, so their note is released before the patch changes.
+	// Channels that were restarted keep their key-on pending in 0xB0 so the note is retriggered at the end.
+	for (byte n = 0; n < getNumChannels(); n ++) {
+		byte i = getCommitChannel(n);
+		if (getRegisterFlag(channelsKeyedOff, i)) {
+			setRegisterFlag(channelsKeyedOff, i, false);
+
+			byte offset = getChannelRegisterOffset(0xB0, i);
+			byte value = channelRegisters[offset];
+			setChannelRegister(0xB0, i, value & 0xDF);
+			if (value & 0x20) {
+				channelRegisters[offset] = value;
+			} else {
+				setRegisterFlag(channelRegistersDirty, offset, false);
+			}
+		}
+	}
+
+	// Operator registers. Each register is written for all channels before moving on to the next register, so writes
+	// to chips that can be written in parallel are interleaved.
+	const byte operatorBaseRegisters[5] = { 0x20, 0x40, 0x60, 0x80, 0xE0 };
+	for (byte j = 0; j < 5; j ++) {
+		for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+			for (byte n = 0; n < getNumChannels(); n ++) {
+				byte i = getCommitChannel(n);
+				short offset = getOperatorRegisterOffset(operatorBaseRegisters[j], i, op);
+				if (getRegisterFlag(operatorRegistersDirty, offset)) {
+					setRegisterFlag(operatorRegistersDirty, offset, false);
+					setOperatorRegister(operatorBaseRegisters[j], i, op, operatorRegisters[offset]);
+				}
+			}
+		}
+	}
+
+	// Channel registers with 0xB0 last for key-on.
+	const byte channelBaseRegisters[3] = { 0xC0, 0xA0, 0xB0 };
+	for (byte j = 0; j < 3; j ++) {
+		for (byte n = 0; n < getNumChannels(); n ++) {
+			byte i = getCommitChannel(n);
+			byte offset = getChannelRegisterOffset(channelBaseRegisters[j], i);
+			if (getRegisterFlag(channelRegistersDirty, offset)) {
+				setRegisterFlag(channelRegistersDirty, offset, false);
+				setChannelRegister(channelBaseRegisters[j], i, channelRegisters[offset]);
+			}
+		}
+	}
+
+	// Percussion register.
+	for (byte i = 0; i < getNumChipRegisters(); i ++) {
+		if (getRegisterFlag(chipRegistersDirty, i)) {
+			setRegisterFlag(chipRegistersDirty, i, false);
+			commitChipRegister(i);
+		}
+	}
+
+	writeElimination = eliminateWrites;
+}
+
+
+/**
+ * Get the channel that is committed at the given position of a batch commit. The OPL2 commits its channels in order.
+ *
+ * @param index - Position in the commit order [0, getNumChannels() - 1].
+ * @return The channel to commit at this position.
+ */
+byte OPL2::getCommitChannel(byte index) {
+	return index;
+}
+
+
+/**
+ * Is a batch of register changes currently being collected?
+ *
+ * @return True if beginBatch() was called and the batch has not yet been committed.
+ */
+bool OPL2::isBatchActive() {
+	return batchActive;
+}
+
+
+/**
+ * Get the size in bytes of a snapshot of the registers of the chip. Use this or the snapshotSize of the chip class to
+ * size the buffer that holds a snapshot.
+ *
+ * @return The size of a snapshot in bytes.
+ */
+unsigned int OPL2::getSnapshotSize() {
+	return getNumChipRegisters() + 13 * getNumChannels();
+}
+
+
+/**
+ * Save the current state of all registers into the given buffer, for example to pause the music while a sound effect
+ * is played and resume it later with restore().
+ *
+ * @param buffer - Buffer of getSnapshotSize() bytes to receive the snapshot.
+ */
+void OPL2::snapshot(byte* buffer) {
+	byte numChipRegisters = getNumChipRegisters();
+	unsigned int numChannelRegisters = 3 * getNumChannels();
+	memcpy(buffer, chipRegisters, numChipRegisters);
+	memcpy(buffer + numChipRegisters, channelRegisters, numChannelRegisters);
+	memcpy(buffer + numChipRegisters + numChannelRegisters, operatorRegisters, 10 * getNumChannels());
+}
+
+
+/**
+ * Get the number of registers that differ between the given snapshot and the current state of the chip. This is the
+ * number of registers that restore() needs to write.
+ *
+ * @param buffer - A snapshot taken with snapshot().
+ * @return The number of registers that differ.
+ */
+unsigned int OPL2::diffSnapshot(const byte* buffer) {
+	byte numChipRegisters = getNumChipRegisters();
+	unsigned int numChannelRegisters = 3 * getNumChannels();
+	unsigned int numOperatorRegisters = 10 * getNumChannels();
+	unsigned int numDifferent = 0;
+
+	for (byte i = 0; i < numChipRegisters; i ++) {
+		numDifferent += chipRegisters[i] != buffer[i];
+	}
+	for (unsigned int i = 0; i < numChannelRegisters; i ++) {
+		numDifferent += channelRegisters[i] != buffer[numChipRegisters + i];
+	}
+	for (unsigned int i = 0; i < numOperatorRegisters; i ++) {
+		numDifferent += operatorRegisters[i] != buffer[numChipRegisters + numChannelRegisters + i];
+	}
+	return numDifferent;
+}
+
+
+/**
+ * Restore the state of all registers from the given snapshot. Only registers that differ from the current state are
+ * written. Channels that are playing a note and change are keyed off before anything else is written, then the changed
+ * registers are written in the same order as a batch commit, so no note sounds before its patch is fully restored.
+ * OPL3 mode is kept enabled until all other registers are restored, so the second register bank can be written. Any
+ * active batch is committed first.
+ *
+ * @param buffer - A snapshot taken with snapshot().
+ * @return The number of registers that differed from the snapshot.
+ */
+unsigned int OPL2::restore(const byte* buffer) {
+	commit();
+	unsigned int numDifferent = diffSnapshot(buffer);
+
+	byte numChipRegisters = getNumChipRegisters();
+	const byte* channelBuffer = buffer + numChipRegisters;
+	const byte* operatorBuffer = channelBuffer + 3 * getNumChannels();
+	bool eliminateWrites = writeElimination;
+	writeElimination = false;
+
+	// Key-off playing channels and drums that change.
+	for (byte n = 0; n < getNumChannels(); n ++) {
+		byte i = getCommitChannel(n);
+		byte value = getChannelRegister(0xB0, i);
+		if ((value & 0x20) && !isChannelInSnapshot(buffer, i)) {
+			setChannelRegister(0xB0, i, value & 0xDF);
+		}
+	}
+	for (byte i = 0; i < numChipRegisters; i ++) {
+		if ((getChipRegisterAddress(i) & 0xFF) == 0xBD && (chipRegisters[i] & 0x1F) && chipRegisters[i] != buffer[i]) {
+			chipRegisters[i] &= 0xE0;
+			commitChipRegister(i);
+		}
+	}
+
+	// Stage the differing registers as a batch.
+	bool registersChanged = false;
+	for (unsigned int i = 0; i < 3 * getNumChannels(); i ++) {
+		if (channelRegisters[i] != channelBuffer[i]) {
+			channelRegisters[i] = channelBuffer[i];
+			setRegisterFlag(channelRegistersDirty, i, true);
+			registersChanged = true;
+		}
+	}
+	for (unsigned int i = 0; i < 10 * getNumChannels(); i ++) {
+		if (operatorRegisters[i] != operatorBuffer[i]) {
+			operatorRegisters[i] = operatorBuffer[i];
+			setRegisterFlag(operatorRegistersDirty, i, true);
+			registersChanged = true;
+		}
+	}
+	for (byte i = 0; i < numChipRegisters; i ++) {
+		byte value = buffer[i];
+		if (registersChanged && getChipRegisterAddress(i) == 0x105) {
+			value |= 0x01;
+		}
+		if (chipRegisters[i] != value) {
+			chipRegisters[i] = value;
+			setRegisterFlag(chipRegistersDirty, i, true);
+		}
+	}
+
+	batchActive = true;
+	commit();
+
+	// Disable OPL3 mode again when it was enabled to restore the registers.
+	for (byte i = 0; i < numChipRegisters; i ++) {
+		if (chipRegisters[i] != buffer[i]) {
+			chipRegisters[i] = buffer[i];
+			commitChipRegister(i);
+		}
+	}
+
+	writeElimination = eliminateWrites;
+	return numDifferent;
+}
+
+
+/**
+ * Do all registers of a channel and its operators hold the same value as in the given snapshot?
+ *
+ * @param buffer - A snapshot taken with snapshot().
+ * @param channel - The channel to compare.
+ * @return True if the channel is unchanged.
+ */
+bool OPL2::isChannelInSnapshot(const byte* buffer, byte channel) {
+	const byte* channelBuffer = buffer + getNumChipRegisters();
+	const byte* operatorBuffer = channelBuffer + 3 * getNumChannels();
+	const byte channelBaseRegisters[3] = { 0xA0, 0xB0, 0xC0 };
+	for (byte j = 0; j < 3; j ++) {
+		byte offset = getChannelRegisterOffset(channelBaseRegisters[j], channel);
+		if (channelRegisters[offset] != channelBuffer[offset]) {
+			return false;
+		}
+	}
+	for (byte j = 0; j < 5; j ++) {
+		for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+			short offset = getOperatorRegisterOffset(instrumentRegisters[j], channel, op);
+			if (operatorRegisters[offset] != operatorBuffer[offset]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+/**
+ * Write the given value to an OPL2 register. This does not update the internal shadow register!
+ *
+ * @param reg - The register to change.
+ * @param value - The value to write to the register.
+ */
+void OPL2::write(byte reg, byte value) {
+	#ifdef OPL_SERIAL_DEBUG
+		Serial.print("reg: ");
+		Serial.print(reg, HEX);
+		Serial.print(", val: ");
+		Serial.println(value, HEX);
+	#endif
+
+	queueWrite(0, reg, value);
+}
+
+
+/**
+ * Send a register write to the chip. When a backend is set the write is passed on to the backend. When the background
+ * write engine is running the write is added to the write queue and this function returns immediately, unless the
+ * queue is full in which case it waits until a slot frees up. Otherwise the write is sent to the chip right away.
+ *
+ * @param bank - The bank of the register as passed to writeRegister.
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
+ */
+void OPL2::queueWrite(byte bank, byte reg, byte value) {
+	#if defined(OPL_WRITE_TRACE)
+		OPLTraceEntry& entry = trace[traceHead];
+		entry.time  = micros();
+		entry.bank  = bank;
+		entry.reg   = reg;
+		entry.value = value;
+		traceHead = (traceHead + 1) & (OPL_WRITE_TRACE_SIZE - 1);
+		if (traceLength < OPL_WRITE_TRACE_SIZE) traceLength ++;
+	#endif
+
+	#if defined(OPL_WRITE_STATS)
+		unsigned long startTime = micros();
+		sendWrite(bank, reg, value);
+		unsigned long latency = micros() - startTime;
+
+		writeStats.writes ++;
+		writeStats.classWrites[getWriteClass(reg)] ++;
+		writeStats.bankWrites[bank & (OPL_NUM_WRITE_BANKS - 1)] ++;
+		if (latency > writeStats.maxLatency) {
+			writeStats.maxLatency = latency;
+		}
+	#else
+		sendWrite(bank, reg, value);
+	#endif
+}
+
+
+/**
+ * Pass a register write on to the backend, the write queue or the chip.
+ *
+ * @param bank - The bank of the register as passed to writeRegister.
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
+ */
+void OPL2::sendWrite(byte bank, byte reg, byte value) {
+	if (backend != NULL) {
+		backend->write(bank, reg, value);
+		return;
+	}
+
+	#if defined(OPL_ASYNC_WRITES)
+		if (writeEngineRunning) {
+			unsigned int head = queueHead;
+			unsigned int nextHead = (head + 1) & (OPL_WRITE_QUEUE_SIZE - 1);
+			#if defined(OPL_WRITE_STATS)
+				unsigned long waitStart = micros();
+			#endif
+			while (nextHead == queueTail) {
+				#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+					std::this_thread::yield();
+				#endif
+			}
+			#if defined(OPL_WRITE_STATS)
+				writeStats.blockedMicros += micros() - waitStart;
+			#endif
+
+			writeQueue[head].bank  = bank;
+			writeQueue[head].reg   = reg;
+			writeQueue[head].value = value;
+
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				queueHead = nextHead;
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+				}
+				writesQueued.notify_one();
+			#else
+				__sync_synchronize();
+				queueHead = nextHead;
+			#endif
+			return;
+		}
+	#endif
+
+	writeRegister(bank, reg, value);
+}
+
+
+/**
+ * Write a value to a register of the chip and wait for the chip to process it. The OPL2 has only one bank of registers
+ * so the bank is ignored.
+ *
+ * @param bank - The bank of the register.
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
+ */
+void OPL2::writeRegister(byte bank, byte reg, byte value) {
+	// Hold the bus for the whole write, so another SPI device can not shift data into the board before it is latched.
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		SPI.beginTransaction(SPISettings(SPI_SPEED, MSBFIRST, SPI_MODE0));
+	#endif
+
+	// Write OPL2 address.
+	setPin(fastAddress, pinAddress, LOW);
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		SPI.transfer(reg);
+	#else
+		wiringPiSPIDataRW(SPI_CHANNEL, &reg, 1);
+	#endif
+	pulseLatch(addressWait);
+
+	// Write OPL2 data.
+	setPin(fastAddress, pinAddress, HIGH);
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		SPI.transfer(value);
+	#else
+		wiringPiSPIDataRW(SPI_CHANNEL, &value, 1);
+	#endif
+	pulseLatch(dataWait);
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		SPI.endTransaction();
+	#endif
+}
+
+
+/**
+ * Resolve the port registers and bit mask of the given pin so it can be driven without the overhead of digitalWrite.
+ * When OPL_FAST_IO is not defined or the port of the pin cannot be resolved the pin will be driven by digitalWrite.
+ *
+ * @param fastPin - The fast pin definition to fill.
+ * @param pin - The pin number as used by digitalWrite.
+ */
+void OPL2::resolveFastPin(OPLFastPin& fastPin, byte pin) {
+	fastPin.setRegister = NULL;
+	fastPin.clearRegister = NULL;
+	fastPin.mask = 0;
+
+	#if defined(OPL_FAST_IO) && BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		if (gpioRegisters == NULL) {
+			int memFd = open("/dev/gpiomem", O_RDWR | O_SYNC);
+			if (memFd < 0) {
+				return;
+			}
+
+			void* gpioMap = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+			close(memFd);
+			if (gpioMap == MAP_FAILED) {
+				return;
+			}
+			gpioRegisters = (volatile uint32_t*)gpioMap;
+		}
+
+		int gpio = wpiPinToGpio(pin);
+		if (gpio >= 0) {
+			fastPin.setRegister = gpioRegisters + GPIO_SET_OFFSET + (gpio / 32);
+			fastPin.clearRegister = gpioRegisters + GPIO_CLEAR_OFFSET + (gpio / 32);
+			fastPin.mask = 1UL << (gpio % 32);
+		}
+	#elif defined(OPL_FAST_IO) && defined(portSetRegister)
+		fastPin.setRegister = (OPLPortRegister)portSetRegister(pin);
+		fastPin.clearRegister = (OPLPortRegister)portClearRegister(pin);
+		fastPin.mask = digitalPinToBitMask(pin);
+	#elif defined(OPL_FAST_IO)
+		if (digitalPinToPort(pin) != NOT_A_PIN) {
+			fastPin.setRegister = (OPLPortRegister)portOutputRegister(digitalPinToPort(pin));
+			fastPin.clearRegister = fastPin.setRegister;
+			fastPin.mask = digitalPinToBitMask(pin);
+		}
+	#endif
+}
+
+
+/**
+ * Drive the given pin high or low. When the pin was resolved for fast IO it is set through its port registers,
+ * otherwise digitalWrite is used.
+ *
+ * @param fastPin - The fast pin definition of the pin.
+ * @param pin - The pin number as used by digitalWrite.
+ * @param high - Drive the pin high when true, otherwise drive it low.
+ */
+void OPL2::setPin(OPLFastPin& fastPin, byte pin, bool high) {
+	#if defined(OPL_FAST_IO) && (BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI || defined(portSetRegister))
+		if (fastPin.setRegister != NULL) {
+			if (high) {
+				*fastPin.setRegister = fastPin.mask;
+			} else {
+				*fastPin.clearRegister = fastPin.mask;
+			}
+			return;
+		}
+	#elif defined(OPL_FAST_IO)
+		if (fastPin.setRegister != NULL) {
+			#if defined(__AVR__)
+				byte oldSREG = SREG;
+				cli();
+			#endif
+			if (high) {
+				*fastPin.setRegister |= fastPin.mask;
+			} else {
+				*fastPin.clearRegister &= ~fastPin.mask;
+			}
+			#if defined(__AVR__)
+				SREG = oldSREG;
+			#endif
+			return;
+		}
+	#endif
+
+	digitalWrite(pin, high ? HIGH : LOW);
+}
+
+
+/**
+ * Wait until the chip has finished processing the previous write to its address or data register. Any time that has
+ * passed since the previous write is taken off the wait.
+ */
+void OPL2::waitForChip() {
+	unsigned long elapsed = micros() - lastWriteTime;
+	if (elapsed < writeWait) {
+		delayMicroseconds(writeWait - elapsed);
+
+		// Waits of the background write engine do not hold up the caller.
+		#if defined(OPL_WRITE_STATS) && defined(OPL_ASYNC_WRITES)
+			if (!writeEngineRunning) writeStats.blockedMicros += writeWait - elapsed;
+		#elif defined(OPL_WRITE_STATS)
+			writeStats.blockedMicros += writeWait - elapsed;
+		#endif
+	}
+}
+
+
+/**
+ * Pulse the latch to have the chip read the byte that was shifted out. When the chip is still busy with a previous
+ * write then this will first wait for it to finish.
+ *
+ * @param busyTime - Time in microseconds that the chip needs to process this write.
+ */
+void OPL2::pulseLatch(unsigned int busyTime) {
+	waitForChip();
+	setPin(fastLatch, pinLatch, LOW);
+	delayMicroseconds(1);
+	setPin(fastLatch, pinLatch, HIGH);
+
+	lastWriteTime = micros();
+	writeWait = busyTime;
+}
+
+
+/**
+ * Are there any register writes queued that have not yet been sent to the chip? Without OPL_ASYNC_WRITES writes are
+ * always sent right away and this will always return false.
+ *
+ * @return True if there are writes waiting in the write queue.
+ */
+bool OPL2::isWritePending() {
+	#if defined(OPL_ASYNC_WRITES)
+		return writeEngineRunning && queueTail != queueHead;
+	#else
+		return false;
+	#endif
+}
+
+
+/**
+ * Can a register write be made right away? This is the case when the chip has processed the previous write or, with
+ * OPL_ASYNC_WRITES, when there is room in the write queue. Use this to do other work, like receiving serial data,
+ * instead of waiting for the chip.
+ *
+ * @return True if the next write will not have to wait.
+ */
+bool OPL2::isWriteReady() {
+	if (backend != NULL) {
+		return true;
+	}
+
+	#if defined(OPL_ASYNC_WRITES)
+		if (writeEngineRunning) {
+			return ((queueHead + 1) & (OPL_WRITE_QUEUE_SIZE - 1)) != queueTail;
+		}
+	#endif
+
+	return micros() - lastWriteTime >= writeWait;
+}
+
+
+/**
+ * Wait until all queued register writes have been sent to the chip. Call this before timing critical code that needs
+ * the chip to be in sync with the shadow registers.
+ */
+void OPL2::waitForWrites() {
+	#if defined(OPL_ASYNC_WRITES) && BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		if (writeEngineRunning) {
+			std::unique_lock<std::mutex> lock(queueMutex);
+			writesDone.wait(lock, [this] { return queueTail == queueHead; });
+		}
+	#elif defined(OPL_ASYNC_WRITES)
+		while (isWritePending());
+	#endif
+}
+
+
+#if defined(OPL_ASYNC_WRITES)
+	/**
+	 * Start the background write engine. On Teensy the write queue is drained by an interval timer that sends one
+	 * write each time the chip is ready to accept it. Only one OPL instance can use the interval timer, any other
+	 * instance will write synchronously. The timer interrupt is registered with the SPI library, so it is held off
+	 * while another device, like an SD card, is in the middle of an SPI transaction. On the Raspberry Pi the queue is
+	 * drained by a dedicated write thread.
+	 */
+	void OPL2::startWriteEngine() {
+		if (writeEngineRunning) {
+			return;
+		}
+
+		queueHead = 0;
+		queueTail = 0;
+
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+			writeEngineRunning = true;
+			writeThread = std::thread(&OPL2::processWriteQueue, this);
+		#else
+			if (writeTimerInstance == NULL) {
+				writeTimerInstance = this;
+				writeEngineRunning = writeTimer.begin(onWriteTimer, addressWait + dataWait);
+				if (writeEngineRunning) {
+					SPI.usingInterrupt(writeTimer);
+				} else {
+					writeTimerInstance = NULL;
+				}
+			}
+		#endif
+	}
+
+
+	/**
+	 * Send all queued writes to the chip and stop the background write engine. Any writes after this are sent to the
+	 * chip synchronously.
+	 */
+	void OPL2::stopWriteEngine() {
+		if (!writeEngineRunning) {
+			return;
+		}
+
+		waitForWrites();
+
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				writeEngineRunning = false;
+			}
+			writesQueued.notify_one();
+			writeThread.join();
+		#else
+			writeTimer.end();
+			SPI.notUsingInterrupt(writeTimer);
+			writeEngineRunning = false;
+			writeTimerInstance = NULL;
+		#endif
+	}
+
+
+	/**
+	 * Send queued writes to the chip. On the Raspberry Pi this is the body of the write thread that keeps draining the
+	 * queue until the write engine is stopped. On Teensy this is called from the interval timer interrupt and sends at
+	 * most one write.
+	 */
+	void OPL2::processWriteQueue() {
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+			std::unique_lock<std::mutex> lock(queueMutex);
+			while (writeEngineRunning) {
+				if (queueTail == queueHead) {
+					writesDone.notify_all();
+					writesQueued.wait(lock);
+					continue;
+				}
+
+				lock.unlock();
+				while (queueTail != queueHead) {
+					OPLWrite& queued = writeQueue[queueTail];
+					writeRegister(queued.bank, queued.reg, queued.value);
+					queueTail = (queueTail + 1) & (OPL_WRITE_QUEUE_SIZE - 1);
+				}
+				lock.lock();
+			}
+			writesDone.notify_all();
+		#else
+			unsigned int tail = queueTail;
+			if (tail != queueHead) {
+				OPLWrite& queued = writeQueue[tail];
+				writeRegister(queued.bank, queued.reg, queued.value);
+				queueTail = (tail + 1) & (OPL_WRITE_QUEUE_SIZE - 1);
+			}
+		#endif
+	}
+
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		/**
+		 * Interval timer interrupt handler of the write engine.
+		 */
+		void OPL2::onWriteTimer() {
+			writeTimerInstance->processWriteQueue();
+		}
+	#endif
+#endif
+
+
+/**
+ * Return the number of channels for this OPL2.
+ */
+byte OPL2::getNumChannels() {
+	return numChannels;
+}
+
+
+/**
+ * Get the backend that receives the register writes instead of the board.
+ *
+ * @return The backend or NULL when registers are written to the board.
+ */
+OPLBackend* OPL2::getBackend() {
+	return backend;
+}
+
+
+/**
+ * Send all register writes to the given backend instead of the board, for example to an OPLEmulator to play or render
+ * offline without a board attached. The backend must be set before begin() is called, since begin() does not set up
+ * any pins or SPI when a backend is used.
+ *
+ * @param backend - The backend to use or NULL to write to the board.
+ */
+void OPL2::setBackend(OPLBackend* backend) {
+	waitForWrites();
+	this->backend = backend;
+}
+
+
+/**
+ * Get the master clock frequency of the chip that is used to calculate the write timing.
+ *
+ * @return The clock frequency in Hz.
+ */
+unsigned long OPL2::getClockFrequency() {
+	return clockFrequency;
+}
+
+
+/**
+ * Set the master clock frequency of the chip. From the clock frequency the minimum wait times between consecutive
+ * writes to the chip are derived. By default these are the 3.58 MHz of the YM3812 or the 14.32 MHz of the YMF262.
+ *
+ * @param frequency - The clock frequency in Hz, or 0 to restore the default clock of the chip.
+ */
+void OPL2::setClockFrequency(unsigned long frequency) {
+	clockFrequency = frequency > 0 ? frequency : getDefaultClockFrequency();
+	addressWait = (addressWaitCycles * 1000000UL + clockFrequency - 1) / clockFrequency + OPL_MICROS_RESOLUTION;
+	dataWait    = (dataWaitCycles    * 1000000UL + clockFrequency - 1) / clockFrequency + OPL_MICROS_RESOLUTION;
+}
+
+
+/**
+ * Is redundant write elimination enabled?
+ *
+ * @return True if register writes that don't change the value of the shadow register are skipped.
+ */
+bool OPL2::isWriteEliminationEnabled() {
+	return writeElimination;
+}
+
+
+/**
+ * Enable or disable redundant write elimination. When enabled a register write is only sent to the chip when the new
+ * value differs from the value held in the shadow registers. Note that this relies on the shadow registers being
+ * accurate, so registers should not be changed by calling write() directly while write elimination is enabled.
+ *
+ * @param enable - When true register writes that would not change the chip's state are skipped.
+ */
+void OPL2::setWriteEliminationEnabled(bool enable) {
+	writeElimination = enable;
+}
+
+
+/**
+ * Is fast reset enabled?
+ *
+ * @return True if reset() only writes the registers that are not 0x00 after a hard reset.
+ */
+bool OPL2::isFastResetEnabled() {
+	return fastReset;
+}
+
+
+/**
+ * Enable or disable fast reset. A hard reset clears all registers of the chip, so with fast reset enabled reset() sets
+ * the shadow registers to 0x00 and only writes the registers that are initialized to another value, like the output
+ * levels. This takes a fraction of the writes of a full reset. Only enable this when the reset pin of the chip is
+ * connected, since the chip is otherwise not cleared by the hard reset.
  *
- * @param channel - The channel for which to get the offset [0, 8].
- * @param operatorNum - The operator for which to get the offset [0, 1].
- * @return The offset from the base register to the operator register.
+ * @param enable - When true reset() skips the registers that the hard reset already cleared.
  */
-byte OPL2::getRegisterOffset(byte channel, byte operatorNum) {
-	return registerOffsets[operatorNum % 2][channel % CHANNELS_PER_BANK];
+void OPL2::setFastResetEnabled(bool enable) {
+	fastReset = enable;
 }
 
 
 /**
- * Write the given value to an OPL2 register. This does not update the internal shadow register!
+ * Get the number of register writes that were skipped by write elimination.
  *
- * @param reg - The register to change.
- * @param value - The value to write to the register.
+ * @return The number of skipped writes since the last call to resetSkippedWriteCount().
  */
-void OPL2::write(byte reg, byte value) {
-	#ifdef OPL_SERIAL_DEBUG
-		Serial.print("reg: ");
-		Serial.print(reg, HEX);
-		Serial.print(", val: ");
-		Serial.println(value, HEX);
-	#endif
-
-	// Write OPL2 address.
-	digitalWrite(pinAddress, LOW);
-	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
-		SPI.transfer(reg);
-	#else
-		wiringPiSPIDataRW(SPI_CHANNEL, &reg, 1);
-	#endif
-	digitalWrite(pinLatch, LOW);
-	delayMicroseconds(16);
-	digitalWrite(pinLatch, HIGH);
-	delayMicroseconds(16);
-
-	// Write OPL2 data.
-	digitalWrite(pinAddress, HIGH);
-	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
-		SPI.transfer(value);
-	#else
-		wiringPiSPIDataRW(SPI_CHANNEL, &value, 1);
-	#endif
-	digitalWrite(pinLatch, LOW);
-	delayMicroseconds(4);
-	digitalWrite(pinLatch, HIGH);
-	delayMicroseconds(92);
+unsigned long OPL2::getSkippedWriteCount() {
+	return skippedWrites;
 }
 
 
 /**
- * Return the number of channels for this OPL2.
+ * Reset the counter of register writes that were skipped by write elimination.
  */
-byte OPL2::getNumChannels() {
-	return numChannels;
+void OPL2::resetSkippedWriteCount() {
+	skippedWrites = 0;
 }
 
 
+#if defined(OPL_WRITE_STATS)
+	/**
+	 * Get the statistics of the register writes sent to the chip or backend since the last call to resetWriteStats().
+	 * Writes that were skipped by write elimination are not counted, see getSkippedWriteCount(). Blocked time only
+	 * counts waits that held up the caller, so with the background write engine running it is the time spent waiting
+	 * for a free slot in the write queue.
+	 *
+	 * @return A copy of the write statistics.
+	 */
+	OPLWriteStats OPL2::getWriteStats() {
+		return writeStats;
+	}
+
+
+	/**
+	 * Clear all write statistics and start measuring the write rate from now.
+	 */
+	void OPL2::resetWriteStats() {
+		writeStats = OPLWriteStats();
+		writeStats.startTime = millis();
+	}
+
+
+	/**
+	 * Get the average number of register writes per second since the last call to resetWriteStats().
+	 *
+	 * @return The number of writes per second.
+	 */
+	float OPL2::getWriteRate() {
+		unsigned long elapsed = millis() - writeStats.startTime;
+		return elapsed > 0 ? writeStats.writes * 1000.0 / elapsed : 0.0;
+	}
+
+
+	/**
+	 * Get the register class of the given register that it is counted by in the write statistics.
+	 *
+	 * @param reg - The register, registers of the second bank of an OPL3 are 0x100 - 0x1F5.
+	 * @return The register class of the register, OPL_WRITE_CLASS_CHIP - OPL_WRITE_CLASS_WAVEFORM.
+	 */
+	byte OPL2::getWriteClass(short reg) {
+		byte baseRegister = reg & 0xFF;
+		if (baseRegister < 0x20 || baseRegister == 0xBD) {
+			return OPL_WRITE_CLASS_CHIP;
+		}
+
+		switch (baseRegister & 0xE0) {
+			case 0x20: return OPL_WRITE_CLASS_MULTIPLE;
+			case 0x40: return OPL_WRITE_CLASS_LEVEL;
+			case 0x60: return OPL_WRITE_CLASS_ATTACK;
+			case 0x80: return OPL_WRITE_CLASS_SUSTAIN;
+			case 0xA0: return (baseRegister & 0x10) ? OPL_WRITE_CLASS_KEY_ON : OPL_WRITE_CLASS_FNUMBER;
+			case 0xC0: return OPL_WRITE_CLASS_FEEDBACK;
+			default:   return OPL_WRITE_CLASS_WAVEFORM;
+		}
+	}
+#endif
+
+
+#if defined(OPL_WRITE_TRACE)
+	/**
+	 * Get the number of register writes held in the trace. Once the trace is full the oldest writes are overwritten,
+	 * so the trace holds at most the last OPL_WRITE_TRACE_SIZE writes.
+	 *
+	 * @return The number of writes in the trace.
+	 */
+	unsigned int OPL2::getTraceLength() {
+		return traceLength;
+	}
+
+
+	/**
+	 * Get a register write from the trace.
+	 *
+	 * @param index - Index of the write in the trace, where 0 is the oldest write [0, getTraceLength() - 1].
+	 * @return The traced register write.
+	 */
+	OPLTraceEntry OPL2::getTraceEntry(unsigned int index) {
+		index = clampValue(index, (unsigned int)0, traceLength > 0 ? traceLength - 1 : 0);
+		return trace[(traceHead - traceLength + index) & (OPL_WRITE_TRACE_SIZE - 1)];
+	}
+
+
+	/**
+	 * Remove all register writes from the trace.
+	 */
+	void OPL2::clearTrace() {
+		traceHead = 0;
+		traceLength = 0;
+	}
+
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		/**
+		 * Write the trace to the given output in binary form, oldest write first. Every write takes 7 bytes: the
+		 * micros() timestamp of the write as a 32 bit little endian value followed by the bank, register and value.
+		 *
+		 * @param output - Where to write the trace, for example Serial.
+		 */
+		void OPL2::dumpTrace(Print& output) {
+			for (unsigned int i = 0; i < traceLength; i ++) {
+				OPLTraceEntry entry = getTraceEntry(i);
+				byte data[7] = {
+					(byte)entry.time, (byte)(entry.time >> 8), (byte)(entry.time >> 16), (byte)(entry.time >> 24),
+					entry.bank, entry.reg, entry.value
+				};
+				output.write(data, 7);
+			}
+		}
+	#else
+		/**
+		 * Write the trace to the given file in binary form, oldest write first. Every write takes 7 bytes: the
+		 * micros() timestamp of the write as a 32 bit little endian value followed by the bank, register and value.
+		 *
+		 * @param file - The file to write the trace to.
+		 * @return True if the whole trace was written.
+		 */
+		bool OPL2::dumpTrace(FILE* file) {
+			for (unsigned int i = 0; i < traceLength; i ++) {
+				OPLTraceEntry entry = getTraceEntry(i);
+				byte data[7] = {
+					(byte)entry.time, (byte)(entry.time >> 8), (byte)(entry.time >> 16), (byte)(entry.time >> 24),
+					entry.bank, entry.reg, entry.value
+				};
+				if (fwrite(data, 1, 7, file) != 7) {
+					return false;
+				}
+			}
+			return true;
+		}
+	#endif
+#endif
+
+
 /**
  * Get the F-number for the given frequency for a given channel. When the F-number is calculated the current frequency
  * block of the channel is taken into account.
@@ -410,6 +1517,113 @@ byte OPL2::getFrequencyBlock(float frequency) {
 }
 
 
+/**
+ * Get the frequency of the given channel in centi-Hz (1/100 Hz) using integer math only.
+ *
+ * @param channel - The channel to get the frequency of.
+ * @return The frequency of the channel in centi-Hz.
+ */
+unsigned long OPL2::getFrequencyCentiHz(byte channel) {
+	return ((unsigned long)getFNumber(channel) * OPL_SAMPLE_RATE_CENTI_HZ_16) >> (16 - getBlock(channel));
+}
+
+
+/**
+ * Set the frequency of the given channel in centi-Hz (1/100 Hz) and if needed switch to a different block. This is the
+ * integer equivalent of setFrequency.
+ *
+ * @param channel - The channel to set the frequency of.
+ * @param centiHz - The frequency in centi-Hz.
+ */
+void OPL2::setFrequencyCentiHz(byte channel, unsigned long centiHz) {
+	byte block = getFrequencyBlockCentiHz(centiHz);
+	if (getBlock(channel) != block) {
+		setBlock(channel, block);
+	}
+	setFNumber(channel, getFrequencyFNumberCentiHz(block, centiHz));
+}
+
+
+/**
+ * Get the optimal frequency block for the given frequency in centi-Hz.
+ *
+ * @param centiHz - The frequency in centi-Hz.
+ * @return The lowest block [0, 7] that can reach the frequency.
+ */
+byte OPL2::getFrequencyBlockCentiHz(unsigned long centiHz) {
+	for (byte i = 0; i < 8; i ++) {
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			if (centiHz < pgm_read_dword_near(blockCentiHz + i)) {
+		#else
+			if (centiHz < blockCentiHz[i]) {
+		#endif
+			return i;
+		}
+	}
+	return 7;
+}
+
+
+/**
+ * Get the F-number for a frequency in centi-Hz in the given block using integer math only.
+ *
+ * @param block - The frequency block [0, 7].
+ * @param centiHz - The frequency in centi-Hz.
+ * @return The F-number [0, 1023] closest to the frequency.
+ */
+short OPL2::getFrequencyFNumberCentiHz(byte block, unsigned long centiHz) {
+	block = clampValue(block, (byte)0, (byte)7);
+
+	// Frequencies above the top of the block give F-number 1023. Clamping first also keeps the product below 2^32.
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		centiHz = clampValue(centiHz, 0UL, (unsigned long)pgm_read_dword_near(blockCentiHz + block));
+	#else
+		centiHz = clampValue(centiHz, 0UL, blockCentiHz[block]);
+	#endif
+	unsigned long fNumber = (((centiHz << 2) >> block) * OPL_SAMPLE_RATE_RECIPROCAL + (1UL << 17)) >> 18;
+	return (short)clampValue(fNumber, 0UL, 1023UL);
+}
+
+
+/**
+ * Set the frequency of the given channel to a MIDI note with an optional detune in cents using lookup tables and
+ * integer math only. Unlike playNote this does not change the key on state of the channel, making it suitable for
+ * pitch bends and vibrato.
+ *
+ * @param channel - The channel to set the frequency of.
+ * @param midiNote - The MIDI note number [0, 127], where 69 is A4 at 440Hz.
+ * @param cents - Detune of the note in cents, may be negative.
+ */
+void OPL2::setNoteFrequency(byte channel, byte midiNote, short cents) {
+	long pitch = clampValue((long)midiNote * 100 + cents, 0L, 12799L);
+	unsigned int semitone = pitch / 100;
+	byte cent = pitch % 100;
+	short octave = semitone / 12 - 1;
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		unsigned long noteFNumber = pgm_read_word_near(midiNoteFNumbers + semitone % 12);
+		unsigned long multiplier = pgm_read_word_near(centMultipliers + cent);
+	#else
+		unsigned long noteFNumber = midiNoteFNumbers[semitone % 12];
+		unsigned long multiplier = centMultipliers[cent];
+	#endif
+	unsigned long fNumber = (noteFNumber * multiplier + (1UL << 18)) >> 19;
+
+	if (octave < 0) {
+		fNumber >>= -octave;
+		octave = 0;
+	} else if (octave > 7) {
+		fNumber <<= octave - 7;
+		octave = 7;
+	}
+
+	if (getBlock(channel) != octave) {
+		setBlock(channel, octave);
+	}
+	setFNumber(channel, (short)clampValue(fNumber, 0UL, 1023UL));
+}
+
+
 /**
  * Create and return a new empty instrument.
  */
@@ -517,11 +1731,21 @@ Instrument OPL2::getInstrument(byte channel) {
 
 /**
  * Set the given instrument to a channel. An optional volume may be provided to assign to proper output levels for the
- * operators.
+ * operators. When the channel already holds the instrument only the output levels are updated.
  */
 void OPL2::setInstrument(byte channel, Instrument instrument, float volume) {
 	volume = clampValue(volume, (float)0.0, (float)1.0);
 
+	if (hasInstrument(channel, compileInstrument(instrument))) {
+		for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+			byte outputLevel = 63 - (byte)((63.0 - (float)instrument.operators[op].outputLevel) * volume);
+			setOperatorRegister(0x40, channel, op,
+				((instrument.operators[op].keyScaleLevel & 0x03) << 6) +
+				(outputLevel & 0x3F));
+		}
+		return;
+	}
+
 	setWaveFormSelect(true);
 	for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
 		byte outputLevel = 63 - (byte)((63.0 - (float)instrument.operators[op].outputLevel) * volume);
@@ -601,6 +1825,162 @@ void OPL2::setDrumInstrument(Instrument instrument, byte drumType, float volume)
 }
 
 
+/**
+ * Compile the given instrument into the register values it will set on a channel so it can be assigned quickly and
+ * without any floating point math using setInstrument.
+ *
+ * @param instrument - The instrument to compile.
+ * @return The compiled instrument.
+ */
+CompiledInstrument OPL2::compileInstrument(Instrument instrument) {
+	CompiledInstrument compiled;
+
+	for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+		compiled.operatorRegisters[op][0] =
+			(instrument.operators[op].hasTremolo ? 0x80 : 0x00) +
+			(instrument.operators[op].hasVibrato ? 0x40 : 0x00) +
+			(instrument.operators[op].hasSustain ? 0x20 : 0x00) +
+			(instrument.operators[op].hasEnvelopeScaling ? 0x10 : 0x00) +
+			(instrument.operators[op].frequencyMultiplier & 0x0F);
+		compiled.operatorRegisters[op][1] =
+			((instrument.operators[op].keyScaleLevel & 0x03) << 6) +
+			(instrument.operators[op].outputLevel & 0x3F);
+		compiled.operatorRegisters[op][2] =
+			((instrument.operators[op].attack & 0x0F) << 4) +
+			(instrument.operators[op].decay & 0x0F);
+		compiled.operatorRegisters[op][3] =
+			((instrument.operators[op].sustain & 0x0F) << 4) +
+			(instrument.operators[op].release & 0x0F);
+		compiled.operatorRegisters[op][4] = instrument.operators[op].waveForm & 0x07;
+	}
+
+	compiled.channelRegister = ((instrument.feedback & 0x07) << 1) + (instrument.isAdditiveSynth ? 0x01 : 0x00);
+	compiled.transpose = instrument.transpose;
+
+	return compiled;
+}
+
+
+/**
+ * Load a compiled instrument directly from the given instrument data pointer. Since the instrument data already holds
+ * most register values this is much faster than loadInstrument followed by compileInstrument.
+ *
+ * @param instrumentData - Pointer to the offset of the 11 bytes of instrument data.
+ * @param fromProgmem - On Arduino defines to load instrument data from PROGMEM (when true (default)) or SRAM.
+ * @return The compiled instrument.
+ */
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	CompiledInstrument OPL2::loadCompiledInstrument(const unsigned char *instrumentData, bool fromProgmem) {
+#else
+	CompiledInstrument OPL2::loadCompiledInstrument(const unsigned char *instrumentData) {
+#endif
+	CompiledInstrument compiled;
+
+	byte data[11];
+	for (byte i = 0; i < 11; i ++) {
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			if (fromProgmem) {
+				data[i] = pgm_read_byte_near(instrumentData + i);
+			} else {
+				data[i] = instrumentData[i];
+			}
+		#else
+			data[i] = instrumentData[i];
+		#endif
+	}
+
+	for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+		for (byte i = 0; i < 4; i ++) {
+			compiled.operatorRegisters[op][i] = data[op * 5 + i + 1];
+		}
+	}
+	compiled.operatorRegisters[0][4] = data[10] & 0x07;
+	compiled.operatorRegisters[1][4] = (data[10] & 0x70) >> 4;
+
+	compiled.channelRegister = data[5] & 0x0F;
+	compiled.transpose = data[0];
+
+	return compiled;
+}
+
+
+/**
+ * Set the given compiled instrument to a channel. An optional volume may be provided to scale the output levels of the
+ * operators. Volume scaling is done with integer math only. When the channel already holds the instrument only the output
+ * levels are updated.
+ *
+ * @param channel - The channel to assign the instrument to.
+ * @param instrument - The compiled instrument to assign.
+ * @param volume - Optional volume [0, 255] that will be applied to the operators. If omitted defaults to 255.
+ */
+void OPL2::setInstrument(byte channel, CompiledInstrument instrument, byte volume) {
+	bool isLoaded = hasInstrument(channel, instrument);
+
+	if (!isLoaded) {
+		setWaveFormSelect(true);
+	}
+	for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+		byte* registers = instrument.operatorRegisters[op];
+		registers[1] = (registers[1] & 0xC0) + scaleOutputLevel(registers[1] & 0x3F, volume);
+
+		if (isLoaded) {
+			setOperatorRegister(0x40, channel, op, registers[1]);
+			continue;
+		}
+
+		for (byte i = 0; i < 5; i ++) {
+			setOperatorRegister(instrumentRegisters[i], channel, op, registers[i]);
+		}
+	}
+
+	if (!isLoaded) {
+		byte value = getChannelRegister(0xC0, channel) & 0xF0;
+		setChannelRegister(0xC0, channel, value + instrument.channelRegister);
+	}
+}
+
+
+/**
+ * Does the given channel already hold the given compiled instrument? The channel registers are compared with the
+ * instrument, except for the output levels of the operators, which depend on the volume that the instrument was set
+ * with. This lets setInstrument skip uploading a patch that is already loaded and only update the volume.
+ *
+ * @param channel - The channel to check.
+ * @param instrument - The compiled instrument to compare with.
+ * @return True if wave form selection is enabled and all instrument registers of the channel match.
+ */
+bool OPL2::hasInstrument(byte channel, CompiledInstrument instrument) {
+	if (!getWaveFormSelect()) {
+		return false;
+	}
+
+	for (byte op = OPERATOR1; op <= OPERATOR2; op ++) {
+		byte* registers = instrument.operatorRegisters[op];
+		for (byte i = 0; i < 5; i ++) {
+			byte mask = i == 1 ? 0xC0 : 0xFF;
+			if ((getOperatorRegister(instrumentRegisters[i], channel, op) & mask) != (registers[i] & mask)) {
+				return false;
+			}
+		}
+	}
+
+	return (getChannelRegister(0xC0, channel) & 0x0F) == instrument.channelRegister;
+}
+
+
+/**
+ * Scale the given operator output level by a volume. This is the fixed point equivalent of scaling the output level by
+ * a volume of [0.0, 1.0].
+ *
+ * @param outputLevel - The output level (attenuation) of the operator [0, 63].
+ * @param volume - The volume to scale by [0, 255].
+ * @return The scaled output level.
+ */
+byte OPL2::scaleOutputLevel(byte outputLevel, byte volume) {
+	return 63 - (byte)(((unsigned int)(63 - outputLevel) * (volume + 1)) >> 8);
+}
+
+
 /**
  * Play a note of a certain octave on the given channel.
  */
@@ -614,21 +1994,125 @@ void OPL2::playNote(byte channel, byte octave, byte note) {
 }
 
 
+/**
+ * Play several notes at once, for example a chord or the drums of a sequencer step. Instead of the read-modify-write
+ * cycles of playNote the final A0 and B0 values of every channel are computed once. First all channels that are still
+ * playing are keyed off, then the F-number low bits are written where they change and finally every channel gets its
+ * block, F-number high bits and key on in a single write. This takes at most 3 writes per note instead of 5.
+ *
+ * @param notes - The notes to play, each channel should be used only once.
+ * @param numNotes - The number of notes.
+ */
+void OPL2::playNotes(const OPLNote* notes, byte numNotes) {
+	stopNotes(notes, numNotes);
+
+	for (byte i = 0; i < numNotes; i ++) {
+		byte fNumberLow = noteFNumbers[notes[i].note % NUM_NOTES] & 0xFF;
+		if (getChannelRegister(0xA0, notes[i].channel) != fNumberLow) {
+			setChannelRegister(0xA0, notes[i].channel, fNumberLow);
+		}
+	}
+
+	for (byte i = 0; i < numNotes; i ++) {
+		byte block = clampValue(notes[i].octave, (byte)0, (byte)NUM_OCTAVES);
+		byte fNumberHigh = (noteFNumbers[notes[i].note % NUM_NOTES] & 0x0300) >> 8;
+		byte value = getChannelRegister(0xB0, notes[i].channel) & 0xC0;
+		setChannelRegister(0xB0, notes[i].channel, value + 0x20 + ((block & 0x07) << 2) + fNumberHigh);
+	}
+}
+
+
+/**
+ * Stop several notes at once by keying off their channels. Only channels that are playing are written to.
+ *
+ * @param notes - The notes to stop, only their channels are used.
+ * @param numNotes - The number of notes.
+ */
+void OPL2::stopNotes(const OPLNote* notes, byte numNotes) {
+	for (byte i = 0; i < numNotes; i ++) {
+		if (getKeyOn(notes[i].channel)) {
+			setKeyOn(notes[i].channel, false);
+		}
+	}
+}
+
+
 /**
  * Play a drum sound at a given note and frequency.
  * The OPL2 must be put into percusive mode first and the parameters of the drum sound must be set in the required
  * operator(s). Note that changing octave and note frequenct will influence both drum sounds if they occupy only a
- * single operator (Snare + Hi-hat and Tom + Cymbal).
+ * single operator (Snare + Hi-hat and Tom + Cymbal). Drums that were queued with queueDrum are triggered as well.
  */
 void OPL2::playDrum(byte drum, byte octave, byte note) {
+	queueDrum(drum, octave, note);
+	triggerDrums();
+}
+
+
+/**
+ * Queue a drum sound to be triggered by the next call to triggerDrums at the frequency that is currently set for its
+ * channel. Use this to collect all drums that are hit in the same tick of a pattern.
+ *
+ * @param drum - The drum sound to queue [DRUM_BASS, DRUM_HI_HAT].
+ */
+void OPL2::queueDrum(byte drum) {
+	queuedDrums |= drumBits[drum % NUM_DRUM_SOUNDS];
+}
+
+
+/**
+ * Queue a drum sound at a given note and octave to be triggered by the next call to triggerDrums. The snare and hi-hat
+ * share channel 7 and the tom tom and cymbal share channel 8, so when both drums of a channel are queued the note of
+ * the last one is used for both.
+ *
+ * @param drum - The drum sound to queue [DRUM_BASS, DRUM_HI_HAT].
+ * @param octave - The octave of the drum sound [0, 7].
+ * @param note - The note of the drum sound [NOTE_C, NOTE_B].
+ */
+void OPL2::queueDrum(byte drum, byte octave, byte note) {
 	drum = drum % NUM_DRUM_SOUNDS;
-	byte drumState = getDrums();
+	byte index = drumChannels[drum] - drumChannels[DRUM_BASS];
+
+	queuedDrums |= drumBits[drum];
+	queuedDrumChannels |= 1 << index;
+	queuedDrumFrequencies[index] = (clampValue(octave, (byte)0, (byte)NUM_OCTAVES) << 10) + noteFNumbers[note % NUM_NOTES];
+}
+
+
+/**
+ * Trigger all queued drum sounds at once. Queued drums that are still sounding are released with a single write to
+ * 0xBD, then the frequencies of the drum channels are written where they change and finally all queued drums are
+ * started with another single write to 0xBD. Drums that are not queued keep sounding. Don't call this during a batch,
+ * as the release and start are then combined into one write and the drums are not retriggered.
+ */
+void OPL2::triggerDrums() {
+	if (queuedDrums == 0x00) {
+		return;
+	}
+
+	byte value = getChipRegister(0xBD);
+	if (value & queuedDrums) {
+		setChipRegister(0xBD, value & ~queuedDrums);
+	}
 
-	setDrums(drumState & ~drumBits[drum]);
-	byte drumChannel = drumChannels[drum];
-	setBlock(drumChannel, clampValue(octave, (byte)0, (byte)NUM_OCTAVES));
-	setFNumber(drumChannel, noteFNumbers[note % NUM_NOTES]);
-	setDrums(drumState | drumBits[drum]);
+	for (byte i = 0; i < 3; i ++) {
+		if (queuedDrumChannels & (1 << i)) {
+			byte channel = drumChannels[DRUM_BASS] + i;
+			byte fNumberLow = queuedDrumFrequencies[i] & 0xFF;
+			byte blockFNumberHigh = (getChannelRegister(0xB0, channel) & 0xE0) + ((queuedDrumFrequencies[i] >> 8) & 0x1F);
+
+			if (getChannelRegister(0xA0, channel) != fNumberLow) {
+				setChannelRegister(0xA0, channel, fNumberLow);
+			}
+			if (getChannelRegister(0xB0, channel) != blockFNumberHigh) {
+				setChannelRegister(0xB0, channel, blockFNumberHigh);
+			}
+		}
+	}
+
+	setChipRegister(0xBD, value | queuedDrums);
+	queuedDrums = 0x00;
+	queuedDrumChannels = 0x00;
 }
 
 
@@ -964,6 +2448,11 @@ bool OPL2::getKeyOn(byte channel) {
  * Enable voice on channel.
  */
 void OPL2::setKeyOn(byte channel, bool keyOn) {
+	// Remember notes that are stopped during a batch, so they can be retriggered on commit.
+	if (batchActive && !keyOn && getKeyOn(channel)) {
+		setRegisterFlag(channelsKeyedOff, channel % getNumChannels(), true);
+	}
+
 	byte value = getChannelRegister(0xB0, channel) & 0xDF;
 	setChannelRegister(0xB0, channel, value + (keyOn ? 0x20 : 0x00));
 }
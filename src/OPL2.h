@@ -23,10 +23,40 @@
 	// In order to correctly compile the library for your platform be sure to set the correct BOARD_TYPE below.
 	#define BOARD_TYPE OPL2_BOARD_TYPE_ARDUINO
 
+	// Uncomment the line below to drive the latch, A0, A1 and A2 pins through direct port access (Arduino) or memory
+	// mapped GPIO (Raspberry Pi) instead of digitalWrite. Platforms without direct port access use digitalWrite.
+	// #define OPL_FAST_IO
+
+	// Uncomment the line below to have register writes queued and sent to the chip in the background by a timer
+	// interrupt (Teensy 3.x / 4.x) or a write thread (Raspberry Pi). Other platforms always write synchronously. The
+	// queue size must be a power of 2.
+	// #define OPL_ASYNC_WRITES
+	#ifndef OPL_WRITE_QUEUE_SIZE
+		#define OPL_WRITE_QUEUE_SIZE 256
+	#endif
+
+	// Uncomment the line below to count the register writes per register class and bank and time how long writes take
+	// and block the caller. See getWriteStats().
+	// #define OPL_WRITE_STATS
+
+	// Uncomment the line below to keep a trace of the most recent register writes that can be dumped after a run. The
+	// trace size must be a power of 2. See dumpTrace().
+	// #define OPL_WRITE_TRACE
+	#ifndef OPL_WRITE_TRACE_SIZE
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			#define OPL_WRITE_TRACE_SIZE 64
+		#else
+			#define OPL_WRITE_TRACE_SIZE 4096
+		#endif
+	#endif
+
 	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
 		#define PIN_LATCH 10
 		#define PIN_ADDR   9
 		#define PIN_RESET  8
+
+		// SPI setup of the bus transactions.
+		#define SPI_SPEED 4000000
 	#else
 		#define PIN_LATCH 3				// GPIO header pin 15
 		#define PIN_ADDR  4				// GPIO header pin 16
@@ -41,6 +71,21 @@
 	#define OPL2_NUM_CHANNELS 9
 	#define CHANNELS_PER_BANK 9
 
+	// Master clock of the YM3812 in Hz and the number of clock cycles the chip needs after a write to the address or
+	// data register before it can accept the next write.
+	#ifndef OPL2_CLOCK_FREQUENCY
+		#define OPL2_CLOCK_FREQUENCY 3579545
+	#endif
+	#define OPL2_ADDRESS_WAIT_CYCLES 12
+	#define OPL2_DATA_WAIT_CYCLES    84
+
+	// Resolution of micros() that must be added to any timed wait.
+	#if defined(__AVR__)
+		#define OPL_MICROS_RESOLUTION (64000000UL / F_CPU)
+	#else
+		#define OPL_MICROS_RESOLUTION 1
+	#endif
+
 	// Operator definitions.
 	#define OPERATOR1 0
 	#define OPERATOR2 1
@@ -94,11 +139,139 @@
 		#include <Arduino.h>
 	#else
 		#include <stdint.h>
+		#include <stdio.h>
 		#include <algorithm>
 		typedef uint8_t byte;
 		#define PROGMEM 
 	#endif
 
+	// Port register types for fast IO.
+	#if defined(OPL_FAST_IO) && defined(__AVR__)
+		typedef volatile uint8_t* OPLPortRegister;
+		typedef uint8_t OPLPortMask;
+	#elif defined(OPL_FAST_IO) && defined(KINETISK)
+		typedef volatile uint8_t* OPLPortRegister;		// Teensy 3.x bit band registers.
+		typedef uint8_t OPLPortMask;
+	#elif defined(OPL_FAST_IO) && (BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI || defined(portOutputRegister))
+		typedef volatile uint32_t* OPLPortRegister;
+		typedef uint32_t OPLPortMask;
+	#else
+		#undef OPL_FAST_IO
+		typedef volatile byte* OPLPortRegister;
+		typedef byte OPLPortMask;
+	#endif
+
+
+	// Background write engine.
+	#if defined(OPL_ASYNC_WRITES) && BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		#include <atomic>
+		#include <condition_variable>
+		#include <mutex>
+		#include <thread>
+		typedef std::atomic<unsigned int> OPLQueueIndex;
+		typedef std::atomic<unsigned long> OPLWriteTime;
+	#elif defined(OPL_ASYNC_WRITES) && defined(TEENSYDUINO) && !defined(__AVR__)
+		#include <IntervalTimer.h>
+		typedef volatile unsigned int OPLQueueIndex;
+		typedef volatile unsigned long OPLWriteTime;
+	#else
+		#undef OPL_ASYNC_WRITES
+		typedef unsigned long OPLWriteTime;
+	#endif
+
+
+	struct OPLWrite {
+		byte bank;
+		byte reg;
+		byte value;
+	};
+
+
+	// A note to play on a channel with playNotes or stop with stopNotes.
+	struct OPLNote {
+		byte channel;
+		byte octave;
+		byte note;
+	};
+
+
+	// Register classes counted by the write statistics.
+	#define OPL_WRITE_CLASS_CHIP      0		// 0x01 - 0x08, 0xBD and the OPL3 registers 0x104 and 0x105.
+	#define OPL_WRITE_CLASS_MULTIPLE  1		// 0x20 - 0x35 tremolo, vibrato, sustain, KSR and multiplier.
+	#define OPL_WRITE_CLASS_LEVEL     2		// 0x40 - 0x55 key scale level and output level.
+	#define OPL_WRITE_CLASS_ATTACK    3		// 0x60 - 0x75 attack and decay.
+	#define OPL_WRITE_CLASS_SUSTAIN   4		// 0x80 - 0x95 sustain and release.
+	#define OPL_WRITE_CLASS_FNUMBER   5		// 0xA0 - 0xA8 F-number low bits.
+	#define OPL_WRITE_CLASS_KEY_ON    6		// 0xB0 - 0xB8 key on, block and F-number high bits.
+	#define OPL_WRITE_CLASS_FEEDBACK  7		// 0xC0 - 0xC8 panning, feedback and synthesis mode.
+	#define OPL_WRITE_CLASS_WAVEFORM  8		// 0xE0 - 0xF5 waveform.
+	#define OPL_NUM_WRITE_CLASSES     9
+
+	// Number of banks counted by the write statistics. Bit 0 is the register bank (A1), bit 1 the synth unit (A2).
+	#define OPL_NUM_WRITE_BANKS 4
+
+	struct OPLWriteStats {
+		unsigned long writes;									// Register writes sent to the chip or backend.
+		unsigned long classWrites[OPL_NUM_WRITE_CLASSES];		// Writes per register class.
+		unsigned long bankWrites[OPL_NUM_WRITE_BANKS];			// Writes per bank and synth unit.
+		unsigned long blockedMicros;							// Time the caller waited for the chip or write queue.
+		unsigned long maxLatency;								// Longest time a single write took in microseconds.
+		unsigned long startTime;								// Value of millis() when the stats were reset.
+	};
+
+	struct OPLTraceEntry {
+		unsigned long time;				// Value of micros() when the write was sent.
+		byte bank;
+		byte reg;
+		byte value;
+	};
+
+
+	/**
+	 * Destination of the register writes of a chip other than the board itself, for example a software emulation of
+	 * the chip. When a backend is set on an OPL2, OPL3 or OPL3Duo all register writes go to the backend and no pins or
+	 * SPI are used, so everything built on top of the library runs without a board attached.
+	 */
+	class OPLBackend {
+		public:
+			virtual ~OPLBackend() {}
+
+			/**
+			 * Hard reset the chip. All registers are cleared to 0x00.
+			 */
+			virtual void reset() = 0;
+
+			/**
+			 * Write a value to a register of the chip.
+			 *
+			 * @param bank - The bank of the register as passed to writeRegister. Bit 0 is the register bank (A1) and
+			 *               bit 1 the synth unit (A2) of an OPL3 Duo.
+			 * @param reg - The register to be changed.
+			 * @param value - The value to write to the register.
+			 */
+			virtual void write(byte bank, byte reg, byte value) = 0;
+	};
+
+
+	// Storage of the shadow registers of a chip and the bit flags used by batches.
+	template <byte chipRegisterCount, byte channelCount>
+	struct OPLShadowRegisters {
+		byte chipRegisters[chipRegisterCount];
+		byte channelRegisters[3 * channelCount];
+		byte operatorRegisters[10 * channelCount];
+		byte chipRegistersDirty[(chipRegisterCount + 7) / 8];
+		byte channelRegistersDirty[(3 * channelCount + 7) / 8];
+		byte operatorRegistersDirty[(10 * channelCount + 7) / 8];
+		byte channelsKeyedOff[(channelCount + 7) / 8];
+	};
+
+
+	struct OPLFastPin {
+		OPLPortRegister setRegister;		// Register to set the pin high, NULL when the pin is driven by digitalWrite.
+		OPLPortRegister clearRegister;		// Register to set the pin low.
+		OPLPortMask mask;					// Bit mask of the pin within the registers.
+	};
+
 
 	struct Operator {
 		bool hasTremolo;
@@ -124,10 +297,25 @@
 	};
 
 
+	struct CompiledInstrument {
+		byte operatorRegisters[2][5];		// Values of registers 0x20, 0x40, 0x60, 0x80 and 0xE0 of both operators.
+		byte channelRegister;				// Feedback and synthesis mode bits of register 0xC0.
+		byte transpose;
+	};
+
+
 	class OPL2 {
 		public:
+			// Memory used by the shadow registers of this chip in bytes.
+			static const unsigned int shadowRegisterFootprint = sizeof(OPLShadowRegisters<3, OPL2_NUM_CHANNELS>);
+			// Size in bytes of a snapshot of the registers of this chip.
+			static const unsigned int snapshotSize = 3 + 13 * OPL2_NUM_CHANNELS;
+
 			OPL2();
 			OPL2(byte reset, byte address, byte latch);
+			#if defined(OPL_ASYNC_WRITES)
+				virtual ~OPL2();
+			#endif
 			virtual void begin();
 			virtual void reset();
 			virtual void createShadowRegisters();
@@ -147,14 +335,61 @@
 
 			virtual byte getNumChannels();
 
+			OPLBackend* getBackend();
+			void setBackend(OPLBackend* backend);
+			unsigned long getClockFrequency();
+			void setClockFrequency(unsigned long frequency);
+			bool isWriteEliminationEnabled();
+			void setWriteEliminationEnabled(bool enable);
+			bool isFastResetEnabled();
+			void setFastResetEnabled(bool enable);
+			unsigned long getSkippedWriteCount();
+			void resetSkippedWriteCount();
+			void beginBatch();
+			void commit();
+			bool isBatchActive();
+			bool isWritePending();
+			bool isWriteReady();
+			void waitForWrites();
+			unsigned int getSnapshotSize();
+			void snapshot(byte* buffer);
+			unsigned int diffSnapshot(const byte* buffer);
+			unsigned int restore(const byte* buffer);
+			#if defined(OPL_WRITE_STATS)
+				OPLWriteStats getWriteStats();
+				void resetWriteStats();
+				float getWriteRate();
+				static byte getWriteClass(short reg);
+			#endif
+			#if defined(OPL_WRITE_TRACE)
+				unsigned int getTraceLength();
+				OPLTraceEntry getTraceEntry(unsigned int index);
+				void clearTrace();
+				#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+					void dumpTrace(Print& output);
+				#else
+					bool dumpTrace(FILE* file);
+				#endif
+			#endif
+
 			float getFrequency(byte channel);
 			void setFrequency(byte channel, float frequency);
 			byte getFrequencyBlock(float frequency);
 			short getFrequencyFNumber(byte channel, float frequency);
 			short getNoteFNumber(byte note);
 			float getFrequencyStep(byte channel);
+			unsigned long getFrequencyCentiHz(byte channel);
+			void setFrequencyCentiHz(byte channel, unsigned long centiHz);
+			byte getFrequencyBlockCentiHz(unsigned long centiHz);
+			short getFrequencyFNumberCentiHz(byte block, unsigned long centiHz);
+			void setNoteFrequency(byte channel, byte midiNote, short cents = 0);
 			void playNote(byte channel, byte octave, byte note);
+			void playNotes(const OPLNote* notes, byte numNotes);
+			void stopNotes(const OPLNote* notes, byte numNotes);
 			void playDrum(byte drum, byte octave, byte note);
+			void queueDrum(byte drum);
+			void queueDrum(byte drum, byte octave, byte note);
+			void triggerDrums();
 
 			Instrument createInstrument();
 			#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
@@ -165,6 +400,14 @@
 			Instrument getInstrument(byte channel);
 			void setInstrument(byte channel, Instrument instrument, float volume = 1.0);
 			void setDrumInstrument(Instrument instrument, byte drumType, float volume = 1.0);
+			CompiledInstrument compileInstrument(Instrument instrument);
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+				CompiledInstrument loadCompiledInstrument(const unsigned char *instrument, bool fromProgmem = INSTRUMENT_DATA_PROGMEM);
+			#else
+				CompiledInstrument loadCompiledInstrument(const unsigned char *instrument);
+			#endif
+			void setInstrument(byte channel, CompiledInstrument instrument, byte volume = 255);
+			bool hasInstrument(byte channel, CompiledInstrument instrument);
 
 			virtual bool getWaveFormSelect();
 			bool getTremolo(byte channel, byte operatorNum);
@@ -220,17 +463,93 @@
 		protected:
 			template <typename T>
 			T clampValue(T value, T min, T max);
+			template <byte chipRegisterCount, byte channelCount>
+			void useShadowStorage(OPLShadowRegisters<chipRegisterCount, channelCount>& storage);
+			void clearShadowRegisters();
+			bool updateShadowRegister(byte* shadowRegisters, byte* dirtyRegisters, short offset, byte value);
+			byte scaleOutputLevel(byte outputLevel, byte volume);
+			bool getRegisterFlag(byte* flags, short offset);
+			void setRegisterFlag(byte* flags, short offset, bool set);
+			virtual unsigned long getDefaultClockFrequency();
+			virtual byte getNumChipRegisters();
+			virtual short getChipRegisterAddress(byte offset);
+			virtual void commitChipRegister(byte offset);
+			virtual byte getCommitChannel(byte index);
+			bool isChannelInSnapshot(const byte* buffer, byte channel);
+			void resolveFastPin(OPLFastPin& fastPin, byte pin);
+			void setPin(OPLFastPin& fastPin, byte pin, bool high);
+			void waitForChip();
+			void pulseLatch(unsigned int busyTime);
+			void queueWrite(byte bank, byte reg, byte value);
+			void sendWrite(byte bank, byte reg, byte value);
+			virtual void writeRegister(byte bank, byte reg, byte value);
+			#if defined(OPL_ASYNC_WRITES)
+				void startWriteEngine();
+				void stopWriteEngine();
+				void processWriteQueue();
+			#endif
 
 			byte pinReset   = PIN_RESET;
 			byte pinAddress = PIN_ADDR;
 			byte pinLatch   = PIN_LATCH;
+			OPLFastPin fastAddress = { NULL, NULL, 0 };
+			OPLFastPin fastLatch   = { NULL, NULL, 0 };
+			OPLBackend* backend = NULL;
 
 			byte* chipRegisters;
 			byte* channelRegisters;
 			byte* operatorRegisters;
+			byte* chipRegistersDirty;
+			byte* channelRegistersDirty;
+			byte* operatorRegistersDirty;
+			byte* channelsKeyedOff;
+			OPLShadowRegisters<3, OPL2_NUM_CHANNELS> shadowStorage;
 
 			byte numChannels = OPL2_NUM_CHANNELS;
 
+			unsigned long clockFrequency = OPL2_CLOCK_FREQUENCY;
+			byte addressWaitCycles = OPL2_ADDRESS_WAIT_CYCLES;
+			byte dataWaitCycles = OPL2_DATA_WAIT_CYCLES;
+			unsigned int addressWait;
+			unsigned int dataWait;
+			OPLWriteTime lastWriteTime { 0 };			// Timing of the last write, updated by the write engine.
+			OPLWriteTime writeWait { 0 };
+
+			bool writeElimination = false;
+			bool fastReset = false;
+			unsigned long skippedWrites = 0;
+			bool batchActive = false;
+
+			byte queuedDrums = 0;
+			byte queuedDrumChannels = 0;
+			unsigned short queuedDrumFrequencies[3];
+
+			#if defined(OPL_WRITE_STATS)
+				OPLWriteStats writeStats = OPLWriteStats();
+			#endif
+			#if defined(OPL_WRITE_TRACE)
+				OPLTraceEntry trace[OPL_WRITE_TRACE_SIZE];
+				unsigned int traceHead = 0;
+				unsigned int traceLength = 0;
+			#endif
+
+			#if defined(OPL_ASYNC_WRITES)
+				OPLWrite writeQueue[OPL_WRITE_QUEUE_SIZE];
+				OPLQueueIndex queueHead;
+				OPLQueueIndex queueTail;
+				bool writeEngineRunning = false;
+				#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+					std::thread writeThread;
+					std::mutex queueMutex;
+					std::condition_variable writesQueued;
+					std::condition_variable writesDone;
+				#else
+					IntervalTimer writeTimer;
+					static OPL2* writeTimerInstance;
+					static void onWriteTimer();
+				#endif
+			#endif
+
 			const float fIntervals[8] = {
 				0.048, 0.095, 0.190, 0.379, 0.759, 1.517, 3.034, 6.069
 			};
@@ -242,6 +561,12 @@
 				 48.503,   97.006,  194.013,  388.026,
 				776.053, 1552.107, 3104.215, 6208.431
 			};
+			const byte instrumentRegisters[5] = {
+				0x20, 0x40, 0x60, 0x80, 0xE0
+			};
+			const short chipRegisterAddresses[3] = {
+				0x01, 0x08, 0xBD
+			};
 			const byte registerOffsets[2][9] = {  
 				{ 0x00, 0x01, 0x02, 0x08, 0x09, 0x0A, 0x10, 0x11, 0x12 } ,   /*  initializers for operator 1 */
 				{ 0x03, 0x04, 0x05, 0x0B, 0x0C, 0x0D, 0x13, 0x14, 0x15 }     /*  initializers for operator 2 */
@@ -257,5 +582,26 @@
 				DRUM_BITS_BASS, DRUM_BITS_SNARE, DRUM_BITS_TOM, DRUM_BITS_CYMBAL, DRUM_BITS_HI_HAT
 			};
 	};
+
+
+	/**
+	 * Point the shadow registers to the given storage and clear all batch flags.
+	 *
+	 * @param storage - The shadow register storage sized for the chip.
+	 */
+	template <byte chipRegisterCount, byte channelCount>
+	void OPL2::useShadowStorage(OPLShadowRegisters<chipRegisterCount, channelCount>& storage) {
+		chipRegisters = storage.chipRegisters;
+		channelRegisters = storage.channelRegisters;
+		operatorRegisters = storage.operatorRegisters;
+		chipRegistersDirty = storage.chipRegistersDirty;
+		channelRegistersDirty = storage.channelRegistersDirty;
+		operatorRegistersDirty = storage.operatorRegistersDirty;
+		channelsKeyedOff = storage.channelsKeyedOff;
+
+		for (unsigned int i = 0; i < sizeof(storage); i ++) {
+			((byte*)&storage)[i] = 0x00;
+		}
+	}
 #endif
 
@@ -45,6 +45,10 @@
  * /WR = D10
  */
 OPL3::OPL3() : OPL2(PIN_RESET, PIN_ADDR, PIN_LATCH) {
+	numChannels = OPL3_NUM_2OP_CHANNELS;
+	addressWaitCycles = OPL3_ADDRESS_WAIT_CYCLES;
+	dataWaitCycles = OPL3_DATA_WAIT_CYCLES;
+	setClockFrequency(OPL3_CLOCK_FREQUENCY);
 }
 
 
@@ -58,6 +62,10 @@ OPL3::OPL3() : OPL2(PIN_RESET, PIN_ADDR, PIN_LATCH) {
  */
 OPL3::OPL3(byte a1, byte a0, byte latch, byte reset) : OPL2(reset, a0, latch) {
 	pinBank = a1;
+	numChannels = OPL3_NUM_2OP_CHANNELS;
+	addressWaitCycles = OPL3_ADDRESS_WAIT_CYCLES;
+	dataWaitCycles = OPL3_DATA_WAIT_CYCLES;
+	setClockFrequency(OPL3_CLOCK_FREQUENCY);
 }
 
 
@@ -65,32 +73,48 @@ OPL3::OPL3(byte a1, byte a0, byte latch, byte reset) : OPL2(reset, a0, latch) {
  * Initialize the OPL3 library and reset the chip.
  */
 void OPL3::begin() {
-	pinMode(pinBank, OUTPUT);
-	digitalWrite(pinBank, LOW);
+	if (backend == NULL) {
+		pinMode(pinBank, OUTPUT);
+		digitalWrite(pinBank, LOW);
+		resolveFastPin(fastBank, pinBank);
+	}
 	OPL2::begin();
 }
 
 
 /**
- * Create shadow registers to hold the values written to the OPL3 chip for later access. Only those registers that are
- * are valid on the YMF262 are created to be as memory friendly as possible for platforms with limited RAM such as the
- * Arduino Uno / Nano. Registers consume 239 bytes.
+ * Set up the shadow registers that hold the values written to the OPL3 chip for later access. Only those registers that
+ * are valid on the YMF262 are stored to be as memory friendly as possible for platforms with limited RAM such as the
+ * Arduino Uno / Nano. The storage is part of the OPL3 instance, so no memory is allocated. Registers consume 239 bytes
+ * and another 34 bytes are used to flag registers that are pending to be written by a batch. The storage inherited
+ * from OPL2 is left unused, shadowRegisterFootprint counts both.
  */
 void OPL3::createShadowRegisters() {
-	chipRegisters = new byte[5];					//   5
-	channelRegisters = new byte[3 * numChannels];	//  54
-	operatorRegisters = new byte[10 * numChannels];	// 180
+	useShadowStorage(shadowStorage);
 }
 
 
 /**
  * Hard reset the YMF262 chip and initialize all registers to 0x00. This should be called before sending any data to the
- * chip.
+ * chip. With fast reset enabled only the registers that are not 0x00 after a hard reset are written.
  */
 void OPL3::reset() {
-	digitalWrite(pinReset, LOW);
-	delay(1);
-	digitalWrite(pinReset, HIGH);
+	waitForWrites();
+	if (backend != NULL) {
+		backend->reset();
+	} else {
+		digitalWrite(pinReset, LOW);
+		delay(1);
+		digitalWrite(pinReset, HIGH);
+	}
+
+	// Fast reset works the same as in OPL2::reset().
+	bool eliminateWrites = writeElimination;
+	unsigned long numSkippedWrites = skippedWrites;
+	writeElimination = fastReset;
+	if (fastReset) {
+		clearShadowRegisters();
+	}
 
 	// Initialize chip registers and enable OPL3 mode temporarily.
 	setChipRegister(0x00, 0x00);
@@ -116,6 +140,9 @@ void OPL3::reset() {
 
 	// Disable OPL3 mode.
 	setChipRegister(0x105, 0x00);
+
+	writeElimination = eliminateWrites;
+	skippedWrites = numSkippedWrites;
 }
 
 
@@ -142,6 +169,38 @@ byte OPL3::getChipRegisterOffset(short reg) {
 }
 
 
+/**
+ * Get the master clock frequency of the chip when no other clock frequency is set.
+ *
+ * @return The default clock frequency in Hz.
+ */
+unsigned long OPL3::getDefaultClockFrequency() {
+	return OPL3_CLOCK_FREQUENCY;
+}
+
+
+/**
+ * Get the number of chip wide registers that are held in the shadow registers.
+ *
+ * @return The number of chip wide shadow registers.
+ */
+byte OPL3::getNumChipRegisters() {
+	return 5;
+}
+
+
+/**
+ * Get the 9-bit register address of a chip wide register from its internal shadow register offset. This is the inverse
+ * of getChipRegisterOffset().
+ *
+ * @param offset - The internal offset of the chip wide register.
+ * @return The 9-bit address of the register.
+ */
+short OPL3::getChipRegisterAddress(byte offset) {
+	return chipRegisterAddresses[offset % 5];
+}
+
+
 /**
  * Write a given value to a chip wide register.
  *
@@ -149,10 +208,11 @@ byte OPL3::getChipRegisterOffset(short reg) {
  * @param value - The value to write to the register.
  */
 void OPL3::setChipRegister(short baseRegister, byte value) {
-	chipRegisters[getChipRegisterOffset(baseRegister)] = value;
-
-	byte bank = (baseRegister >> 8) & 0x01;
-	write(bank, baseRegister & 0xFF, value);
+	byte offset = getChipRegisterOffset(baseRegister);
+	if (updateShadowRegister(chipRegisters, chipRegistersDirty, offset, value)) {
+		byte bank = (baseRegister >> 8) & 0x01;
+		write(bank, baseRegister & 0xFF, value);
+	}
 }
 
 
@@ -164,11 +224,12 @@ void OPL3::setChipRegister(short baseRegister, byte value) {
  * @param value - The value to write to the register.
  */
 void OPL3::setChannelRegister(byte baseRegister, byte channel, byte value) {
-	channelRegisters[getChannelRegisterOffset(baseRegister, channel)] = value;
-
-	byte bank = (channel / CHANNELS_PER_BANK) & 0x01;
-	byte reg = baseRegister + (channel % CHANNELS_PER_BANK);
-	write(bank, reg, value);
+	byte offset = getChannelRegisterOffset(baseRegister, channel);
+	if (updateShadowRegister(channelRegisters, channelRegistersDirty, offset, value)) {
+		byte bank = (channel / CHANNELS_PER_BANK) & 0x01;
+		byte reg = baseRegister + (channel % CHANNELS_PER_BANK);
+		write(bank, reg, value);
+	}
 }
 
 
@@ -181,11 +242,12 @@ void OPL3::setChannelRegister(byte baseRegister, byte channel, byte value) {
  * @param value - The value to write to the operator's register.
  */
 void OPL3::setOperatorRegister(byte baseRegister, byte channel, byte operatorNum, byte value) {
-	operatorRegisters[getOperatorRegisterOffset(baseRegister, channel, operatorNum)] = value;
-
-	byte bank = (channel / CHANNELS_PER_BANK) & 0x01;
-	byte reg = baseRegister + getRegisterOffset(channel % CHANNELS_PER_BANK, operatorNum);
-	write(bank, reg, value);
+	short offset = getOperatorRegisterOffset(baseRegister, channel, operatorNum);
+	if (updateShadowRegister(operatorRegisters, operatorRegistersDirty, offset, value)) {
+		byte bank = (channel / CHANNELS_PER_BANK) & 0x01;
+		byte reg = baseRegister + getRegisterOffset(channel % CHANNELS_PER_BANK, operatorNum);
+		write(bank, reg, value);
+	}
 }
 
 
@@ -206,39 +268,20 @@ void OPL3::write(byte bank, byte reg, byte value) {
 		Serial.println(value, HEX);
 	#endif
 
-	digitalWrite(pinAddress, LOW);
-	digitalWrite(pinBank, (bank & 0x01) ? HIGH : LOW);
-	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
-		SPI.transfer(reg);
-	#else
-		wiringPiSPIDataRW(SPI_CHANNEL, &reg, 1);
-	#endif
-	digitalWrite(pinLatch, LOW);
-	delayMicroseconds(8);
-
-	digitalWrite(pinLatch, HIGH);
-	delayMicroseconds(8);
-
-	digitalWrite(pinAddress, HIGH);
-	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
-		SPI.transfer(value);
-	#else
-		wiringPiSPIDataRW(SPI_CHANNEL, &value, 1);
-	#endif
-	digitalWrite(pinLatch, LOW);
-	delayMicroseconds(8);
-	digitalWrite(pinLatch, HIGH);
-	delayMicroseconds(8);
+	queueWrite(bank, reg, value);
 }
 
 
 /**
- * Get the number of 2OP channels for this implementation.
+ * Select the bank (A1) of the register and write the value to the chip.
  *
- * @return The number of 2OP channels.
+ * @param bank - The bank (A1) of the register [0, 1].
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
  */
-byte OPL3::getNumChannels() {
-	return numChannels;
+void OPL3::writeRegister(byte bank, byte reg, byte value) {
+	setPin(fastBank, pinBank, bank & 0x01);
+	OPL2::writeRegister(bank, reg, value);
 }
 
 
@@ -353,6 +396,68 @@ void OPL3::setInstrument4OP(byte channel4OP, Instrument4OP instrument, float vol
 }
 
 
+/**
+ * Compile the given 4-operator instrument so it can be assigned quickly using setInstrument4OP.
+ *
+ * @param instrument - The Instrument4OP to compile.
+ * @return The compiled 4-OP instrument.
+ */
+CompiledInstrument4OP OPL3::compileInstrument4OP(Instrument4OP instrument) {
+	CompiledInstrument4OP compiled;
+	compiled.subInstrument[0] = compileInstrument(instrument.subInstrument[0]);
+	compiled.subInstrument[1] = compileInstrument(instrument.subInstrument[1]);
+	return compiled;
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	/**
+	 * Load a compiled 4-OP instrument directly from the given data pointer. The data layout is the same as for
+	 * loadInstrument4OP.
+	 *
+	 * @param instrumentData - Pointer to the offset of instrument data.
+	 * @param fromProgmem - On Arduino defines to load instrument data from PROGMEM (when true (default)) or SRAM.
+	 * @return The compiled 4-OP instrument.
+	 */
+	CompiledInstrument4OP OPL3::loadCompiledInstrument4OP(const unsigned char *instrumentData, bool fromProgmem) {
+		CompiledInstrument4OP compiled;
+		compiled.subInstrument[0] = loadCompiledInstrument(instrumentData, fromProgmem);
+		compiled.subInstrument[1] = loadCompiledInstrument(instrumentData + 10, fromProgmem);
+		compiled.subInstrument[1].transpose = 0;
+		return compiled;
+	}
+#else
+	/**
+	 * Load a compiled 4-OP instrument directly from the given data pointer. The data layout is the same as for
+	 * loadInstrument4OP.
+	 *
+	 * @param instrumentData - Pointer to the offset of instrument data.
+	 * @return The compiled 4-OP instrument.
+	 */
+	CompiledInstrument4OP OPL3::loadCompiledInstrument4OP(const unsigned char *instrumentData) {
+		CompiledInstrument4OP compiled;
+		compiled.subInstrument[0] = loadCompiledInstrument(instrumentData);
+		compiled.subInstrument[1] = loadCompiledInstrument(instrumentData + 10);
+		compiled.subInstrument[1].transpose = 0;
+		return compiled;
+	}
+#endif
+
+
+/**
+ * Assign the given compiled 4-operator instrument to a 4-OP channel. An optional volume may be provided.
+ *
+ * @param channel4OP - The 4-op channel [0, 5] to assign the instrument to.
+ * @param instrument - The CompiledInstrument4OP to assign to the channel.
+ * @param volume - Optional volume [0, 255] that will be assigned to the operators. If omitted volume is set to 255.
+ */
+void OPL3::setInstrument4OP(byte channel4OP, CompiledInstrument4OP instrument, byte volume) {
+	channel4OP = channel4OP % getNum4OPChannels();
+	setInstrument(get4OPControlChannel(channel4OP, 0), instrument.subInstrument[0], volume);
+	setInstrument(get4OPControlChannel(channel4OP, 1), instrument.subInstrument[1], volume);
+}
+
+
 /**
  * Enable or disable OPL3 mode. This function must be called in order to use any of the OPL3 functions. It will also
  * set panning for all channels to enable both left and right speakers when OPL3 mode is enabled.
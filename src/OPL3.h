@@ -7,6 +7,14 @@
 	#define OPL3_NUM_4OP_CHANNELS 6
 	#define CHANNELS_PER_BANK 9
 
+	// Master clock of the YMF262 in Hz and the number of clock cycles the chip needs after a write to the address or
+	// data register before it can accept the next write.
+	#ifndef OPL3_CLOCK_FREQUENCY
+		#define OPL3_CLOCK_FREQUENCY 14318180
+	#endif
+	#define OPL3_ADDRESS_WAIT_CYCLES 32
+	#define OPL3_DATA_WAIT_CYCLES    32
+
 	#define SYNTH_MODE_FM_FM 0
 	#define SYNTH_MODE_FM_AM 1
 	#define SYNTH_MODE_AM_FM 2
@@ -30,8 +38,19 @@
 	};
 
 
+	struct CompiledInstrument4OP {
+		CompiledInstrument subInstrument[2];	// Compiled sub instruments for each 2-OP channel of the 4-OP channel.
+	};
+
+
 	class OPL3: public OPL2 {
 		public:
+			// Memory used by the shadow registers of this chip in bytes, including the OPL2 storage that is not used.
+			static const unsigned int shadowRegisterFootprint =
+				OPL2::shadowRegisterFootprint + sizeof(OPLShadowRegisters<5, OPL3_NUM_2OP_CHANNELS>);
+			// Size in bytes of a snapshot of the registers of this chip.
+			static const unsigned int snapshotSize = 5 + 13 * OPL3_NUM_2OP_CHANNELS;
+
 			OPL3();
 			OPL3(byte a1, byte a0, byte latch, byte reset);
 			virtual void begin();
@@ -44,7 +63,6 @@
 			virtual byte getChipRegisterOffset(short reg);
 			virtual void write(byte bank, byte reg, byte value);
 
-			virtual byte getNumChannels();
 			virtual byte getNum4OPChannels();
 			virtual byte get4OPControlChannel(byte channel4OP, byte index2OP = 0);
 
@@ -56,6 +74,13 @@
 			#endif
 			Instrument4OP getInstrument4OP(byte channel4OP);
 			void setInstrument4OP(byte channel4OP, Instrument4OP instrument, float volume = 1.0);
+			CompiledInstrument4OP compileInstrument4OP(Instrument4OP instrument);
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+				CompiledInstrument4OP loadCompiledInstrument4OP(const unsigned char *instrument, bool fromProgmem = INSTRUMENT_DATA_PROGMEM);
+			#else
+				CompiledInstrument4OP loadCompiledInstrument4OP(const unsigned char *instrument);
+			#endif
+			void setInstrument4OP(byte channel4OP, CompiledInstrument4OP instrument, byte volume = 255);
 
 			virtual bool getWaveFormSelect();
 			virtual void setWaveFormSelect(bool enable = false);
@@ -76,11 +101,20 @@
 
 
 		protected:
+			virtual unsigned long getDefaultClockFrequency();
+			virtual byte getNumChipRegisters();
+			virtual short getChipRegisterAddress(byte offset);
+			virtual void writeRegister(byte bank, byte reg, byte value);
+
 			byte pinBank = PIN_BANK;
+			OPLFastPin fastBank = { NULL, NULL, 0 };
+			OPLShadowRegisters<5, OPL3_NUM_2OP_CHANNELS> shadowStorage;
 
-			byte numChannels = OPL3_NUM_2OP_CHANNELS;
 			byte num4OPChannels = OPL3_NUM_4OP_CHANNELS;
 
+			const short chipRegisterAddresses[5] = {
+				0x01, 0x104, 0x105, 0x08, 0xBD
+			};
 			byte channelPairs4OP[6][2] = {
 				{ 0,  3 }, {  1,  4 }, {  2,  5 },
 				{ 9, 12 }, { 10, 13 }, { 11, 14 }
@@ -47,6 +47,8 @@
  * /WR = D10
  */
 OPL3Duo::OPL3Duo() : OPL3() {
+	numChannels = OPL3DUO_NUM_2OP_CHANNELS;
+	num4OPChannels = OPL3DUO_NUM_4OP_CHANNELS;
 }
 
 
@@ -61,6 +63,8 @@ OPL3Duo::OPL3Duo() : OPL3() {
  */
 OPL3Duo::OPL3Duo(byte a2, byte a1, byte a0, byte latch, byte reset) : OPL3(a1, a0, latch, reset) {
 	pinUnit = a2;
+	numChannels = OPL3DUO_NUM_2OP_CHANNELS;
+	num4OPChannels = OPL3DUO_NUM_4OP_CHANNELS;
 }
 
 
@@ -68,35 +72,51 @@ OPL3Duo::OPL3Duo(byte a2, byte a1, byte a0, byte latch, byte reset) : OPL3(a1, a
  * Initialize the OPL3Duo and reset the chips.
  */
 void OPL3Duo::begin() {
-	pinMode(pinUnit, OUTPUT);
-	digitalWrite(pinUnit, LOW);
+	if (backend == NULL) {
+		pinMode(pinUnit, OUTPUT);
+		digitalWrite(pinUnit, LOW);
+		resolveFastPin(fastUnit, pinUnit);
+	}
 	OPL3::begin();
 }
 
 
 /**
- * Create shadow registers to hold the values written to the OPL3 chips for later access. Only those registers that are
- * are valid on the YMF262 are created to be as memory friendly as possible for platforms with limited RAM such as the
- * Arduino Uno / Nano. Registers consume 478 bytes.
+ * Set up the shadow registers that hold the values written to the OPL3 chips for later access. Only those registers
+ * that are valid on the YMF262 are stored to be as memory friendly as possible for platforms with limited RAM such as
+ * the Arduino Uno / Nano. The storage is part of the OPL3Duo instance, so no memory is allocated. Registers consume 478
+ * bytes and another 66 bytes are used to flag registers that are pending to be written by a batch. The storage
+ * inherited from OPL2 and OPL3 is left unused, shadowRegisterFootprint counts all of it.
  */
 void OPL3Duo::createShadowRegisters() {
-	chipRegisters = new byte[5 * 2];					//  10
-	channelRegisters = new byte[3 * numChannels];		// 108
-	operatorRegisters = new byte[10 * numChannels];		// 360
+	useShadowStorage(shadowStorage);
 }
 
 
 /**
  * Hard reset the OPL3 chip. All registers will be reset to 0x00, This should be done before sending any register data
- * to the chip.
+ * to the chip. With fast reset enabled only the registers that are not 0x00 after a hard reset are written.
  */
 void OPL3Duo::reset() {
 	// Hard reset both OPL3 chips.
-	for (byte unit = 0; unit < 2; unit ++) {
-		digitalWrite(pinUnit, unit == 1);
-		digitalWrite(pinReset, LOW);
-		delay(1);
-		digitalWrite(pinReset, HIGH);
+	waitForWrites();
+	if (backend != NULL) {
+		backend->reset();
+	} else {
+		for (byte unit = 0; unit < 2; unit ++) {
+			digitalWrite(pinUnit, unit == 1);
+			digitalWrite(pinReset, LOW);
+			delay(1);
+			digitalWrite(pinReset, HIGH);
+		}
+	}
+
+	// Fast reset works the same as in OPL2::reset().
+	bool eliminateWrites = writeElimination;
+	unsigned long numSkippedWrites = skippedWrites;
+	writeElimination = fastReset;
+	if (fastReset) {
+		clearShadowRegisters();
 	}
 
 	// Initialize chip registers on both synth units.
@@ -111,8 +131,9 @@ void OPL3Duo::reset() {
 	setChipRegister(0, 0x105, 0x01);
 	setChipRegister(1, 0x105, 0x01);
 
-	// Initialize all channel and operator registers.
-	for (byte i = 0; i < getNumChannels(); i ++) {
+	// Initialize all channel and operator registers, alternating between both synth units.
+	for (byte n = 0; n < getNumChannels(); n ++) {
+		byte i = getCommitChannel(n);
 		setChannelRegister(0xA0, i, 0x00);
 		setChannelRegister(0xB0, i, 0x00);
 		setChannelRegister(0xC0, i, 0x00);
@@ -130,7 +151,11 @@ void OPL3Duo::reset() {
 	setChipRegister(0, 0x105, 0x00);
 	setChipRegister(1, 0x105, 0x00);
 
-	digitalWrite(pinUnit, LOW);
+	if (backend == NULL) {
+		digitalWrite(pinUnit, LOW);
+	}
+	writeElimination = eliminateWrites;
+	skippedWrites = numSkippedWrites;
 }
 
 
@@ -156,10 +181,43 @@ byte OPL3Duo::getChipRegister(byte synthUnit, short reg) {
  */
 void OPL3Duo::setChipRegister(byte synthUnit, short reg, byte value) {
 	synthUnit = synthUnit & 0x01;
-	chipRegisters[(synthUnit * 5) + getChipRegisterOffset(reg)] = value;
+	byte offset = (synthUnit * 5) + getChipRegisterOffset(reg);
+	if (updateShadowRegister(chipRegisters, chipRegistersDirty, offset, value)) {
+		byte bank = (synthUnit << 1) | ((reg >> 8) & 0x01);
+		write(bank, reg & 0xFF, value);
+	}
+}
+
+
+/**
+ * Get the number of chip wide registers of both synth units that are held in the shadow registers.
+ *
+ * @return The number of chip wide shadow registers.
+ */
+byte OPL3Duo::getNumChipRegisters() {
+	return 5 * 2;
+}
+
+
+/**
+ * Get the 9-bit register address of a chip wide register from its internal shadow register offset. The offset includes
+ * the synth unit.
+ *
+ * @param offset - The internal offset of the chip wide register [0, 9].
+ * @return The 9-bit address of the register.
+ */
+short OPL3Duo::getChipRegisterAddress(byte offset) {
+	return OPL3::getChipRegisterAddress(offset % 5);
+}
 
-	byte bank = (synthUnit << 1) | ((reg >> 8) & 0x01);
-	write(bank, reg & 0xFF, value);
+
+/**
+ * Send the shadow value of the chip wide register at the given internal offset to the synth unit it belongs to.
+ *
+ * @param offset - The internal offset of the chip wide register [0, 9].
+ */
+void OPL3Duo::commitChipRegister(byte offset) {
+	setChipRegister(offset / 5, getChipRegisterAddress(offset), chipRegisters[offset]);
 }
 
 
@@ -171,11 +229,12 @@ void OPL3Duo::setChipRegister(byte synthUnit, short reg, byte value) {
  * @param value - The value to write to the register.
  */
 void OPL3Duo::setChannelRegister(byte baseRegister, byte channel, byte value) {
-	channelRegisters[getChannelRegisterOffset(baseRegister, channel)] = value;
-
-	byte bank = (channel / CHANNELS_PER_BANK) & 0x03;
-	byte reg = baseRegister + (channel % CHANNELS_PER_BANK);
-	write(bank, reg, value);
+	byte offset = getChannelRegisterOffset(baseRegister, channel);
+	if (updateShadowRegister(channelRegisters, channelRegistersDirty, offset, value)) {
+		byte bank = (channel / CHANNELS_PER_BANK) & 0x03;
+		byte reg = baseRegister + (channel % CHANNELS_PER_BANK);
+		write(bank, reg, value);
+	}
 }
 
 
@@ -188,44 +247,46 @@ void OPL3Duo::setChannelRegister(byte baseRegister, byte channel, byte value) {
  * @param value - The value to write to the operator's register.
  */
 void OPL3Duo::setOperatorRegister(byte baseRegister, byte channel, byte operatorNum, byte value) {
-	operatorRegisters[getOperatorRegisterOffset(baseRegister, channel, operatorNum)] = value;
-
-	byte bank = (channel / CHANNELS_PER_BANK) & 0x03;
-	byte reg = baseRegister + getRegisterOffset(channel % CHANNELS_PER_BANK, operatorNum);
-	write(bank, reg, value);
+	short offset = getOperatorRegisterOffset(baseRegister, channel, operatorNum);
+	if (updateShadowRegister(operatorRegisters, operatorRegistersDirty, offset, value)) {
+		byte bank = (channel / CHANNELS_PER_BANK) & 0x03;
+		byte reg = baseRegister + getRegisterOffset(channel % CHANNELS_PER_BANK, operatorNum);
+		write(bank, reg, value);
+	}
 }
 
 
 /**
- * Write a given value to a register of the OPL3 chip.
+ * Select the synth unit (A2) and bank (A1) of the register and write the value to the chip. Both synth units keep track
+ * of their own busy time, so a write to one unit only waits for the previous write to that same unit to be processed.
+ * The time that one unit needs to process a write can be used to write to the other unit.
  *
  * @param bank - The bank + unit (A1 + A2) of the register [0, 3].
  * @param reg - The register to be changed.
  * @param value - The value to write to the register.
  */
-void OPL3Duo::write(byte bank, byte reg, byte value) {
-	digitalWrite(pinUnit, (bank & 0x02) ? HIGH : LOW);
-	OPL3::write(bank, reg, value);
-}
+void OPL3Duo::writeRegister(byte bank, byte reg, byte value) {
+	byte unit = (bank >> 1) & 0x01;
+	lastWriteTime = unitWriteTime[unit];
+	writeWait = unitWriteWait[unit];
 
+	setPin(fastUnit, pinUnit, unit);
+	OPL3::writeRegister(bank, reg, value);
 
-/**
- * Get the number of 2OP channels for this implementation.
- *
- * @return The number of 2OP channels.
- */
-byte OPL3Duo::getNumChannels() {
-	return numChannels;
+	unitWriteTime[unit] = lastWriteTime;
+	unitWriteWait[unit] = writeWait;
 }
 
 
 /**
- * Get the number of 4OP channels for this implementation.
+ * Get the channel that is committed at the given position of a batch commit. Channels of both synth units alternate, so
+ * while one unit processes a write the next write goes to the other unit.
  *
- * @return The number of 4OP channels.
+ * @param index - Position in the commit order [0, 35].
+ * @return The channel to commit at this position.
  */
-byte OPL3Duo::getNum4OPChannels() {
-	return num4OPChannels;
+byte OPL3Duo::getCommitChannel(byte index) {
+	return (index & 0x01) * OPL3_NUM_2OP_CHANNELS + (index >> 1);
 }
 
 
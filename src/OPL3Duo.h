@@ -15,6 +15,13 @@
 
 	class OPL3Duo: public OPL3 {
 		public:
+			// Memory used by the shadow registers of the two chips in bytes, including the OPL2 and OPL3 storage that is
+			// not used.
+			static const unsigned int shadowRegisterFootprint =
+				OPL3::shadowRegisterFootprint + sizeof(OPLShadowRegisters<5 * 2, OPL3DUO_NUM_2OP_CHANNELS>);
+			// Size in bytes of a snapshot of the registers of the two chips.
+			static const unsigned int snapshotSize = 5 * 2 + 13 * OPL3DUO_NUM_2OP_CHANNELS;
+
 			OPL3Duo();
 			OPL3Duo(byte a2, byte a1, byte a0, byte latch, byte reset);
 			virtual void begin();
@@ -25,10 +32,7 @@
 			virtual void setChipRegister(byte synthUnit, short reg, byte value);
 			virtual void setChannelRegister(byte baseRegister, byte channel, byte value);
 			virtual void setOperatorRegister(byte baseRegister, byte channel, byte op, byte value);
-			virtual void write(byte bank, byte reg, byte value);
 
-			virtual byte getNumChannels();
-			virtual byte getNum4OPChannels();
 			virtual byte get4OPControlChannel(byte channel4OP, byte index2OP = 0);
 
 			virtual bool isOPL3Enabled();
@@ -40,10 +44,17 @@
 			virtual void setAll4OPChannelsEnabled(bool enable);
 			void setAll4OPChannelsEnabled(byte synthUnit, bool enable);
 		protected:
-			byte pinUnit = PIN_UNIT;
+			virtual byte getNumChipRegisters();
+			virtual short getChipRegisterAddress(byte offset);
+			virtual void commitChipRegister(byte offset);
+			virtual void writeRegister(byte bank, byte reg, byte value);
+			virtual byte getCommitChannel(byte index);
 
-			byte numChannels = OPL3DUO_NUM_2OP_CHANNELS;
-			byte num4OPChannels = OPL3DUO_NUM_4OP_CHANNELS;
+			byte pinUnit = PIN_UNIT;
+			OPLFastPin fastUnit = { NULL, NULL, 0 };
+			unsigned long unitWriteTime[2] = { 0, 0 };
+			unsigned int unitWriteWait[2] = { 0, 0 };
+			OPLShadowRegisters<5 * 2, OPL3DUO_NUM_2OP_CHANNELS> shadowStorage;
 
 			byte channelPairs4OP[12][2] = {
 				{  0,  3 }, {  1,  4 }, {  2,  5 },
@@ -0,0 +1,259 @@
+#include "OPL3Duo.h"
+
+#ifndef OPL_CHIP_LIB_H_
+	#define OPL_CHIP_LIB_H_
+
+	/**
+	 * Compile time layout of the OPL2.
+	 */
+	struct OPL2Traits {
+		typedef OPL2 Chip;
+		static const byte numChannels = OPL2_NUM_CHANNELS;
+		static const byte bankMask = 0x00;			// Single register bank.
+
+		static void write(Chip* chip, byte bank, byte reg, byte value) {
+			chip->Chip::write(reg, value);
+		}
+	};
+
+
+	/**
+	 * Compile time layout of the OPL3.
+	 */
+	struct OPL3Traits {
+		typedef OPL3 Chip;
+		static const byte numChannels = OPL3_NUM_2OP_CHANNELS;
+		static const byte bankMask = 0x01;			// Bank is selected by A1.
+
+		static void write(Chip* chip, byte bank, byte reg, byte value) {
+			chip->Chip::write(bank, reg, value);
+		}
+	};
+
+
+	/**
+	 * Compile time layout of the OPL3 Duo.
+	 */
+	struct OPL3DuoTraits {
+		typedef OPL3Duo Chip;
+		static const byte numChannels = OPL3DUO_NUM_2OP_CHANNELS;
+		static const byte bankMask = 0x03;			// Bank is selected by A1 and synth unit by A2.
+
+		static void write(Chip* chip, byte bank, byte reg, byte value) {
+			chip->Chip::write(bank, reg, value);
+		}
+	};
+
+
+	/**
+	 * OPL chip whose channel count, bank layout and register offsets are resolved at compile time from its Traits. The
+	 * register access functions are inline and, since the class is final, calls made on an OPLChip are not dispatched
+	 * through the virtual function table. This allows the compiler to inline the hot paths down to the shadow register
+	 * update. Register writes still go through the write function of the chip class, called directly by Traits::write,
+	 * so debug output is the same. All other functionality is inherited unchanged from the chip class given by the
+	 * Traits, so an OPLChip can be used anywhere an OPL2, OPL3 or OPL3Duo is expected.
+	 *
+	 * Use the OPL2Chip, OPL3Chip and OPL3DuoChip types below.
+	 */
+	template <class Traits>
+	class OPLChip final : public Traits::Chip {
+		public:
+			using Traits::Chip::Chip;
+
+			/**
+			 * Get the number of 2-OP channels of the chip.
+			 */
+			virtual byte getNumChannels() {
+				return Traits::numChannels;
+			}
+
+
+			/**
+			 * Get the internal offset of a channel register.
+			 *
+			 * @param baseRegister - The base register where we want to know the offset of.
+			 * @param channel - The channel for which we want to know the offset.
+			 * @return The internal offset of the channel register.
+			 */
+			virtual byte getChannelRegisterOffset(byte baseRegister, byte channel) {
+				return (channel % Traits::numChannels) * 3 + getChannelRegisterIndex(baseRegister);
+			}
+
+
+			/**
+			 * Get the internal offset of an operator register.
+			 *
+			 * @param baseRegister - The base register where we want to know the offset of.
+			 * @param channel - The channel to get the offset to.
+			 * @param operatorNum - The operator [0, 1] to get the offset to.
+			 * @return The internal offset of the operator register.
+			 */
+			virtual short getOperatorRegisterOffset(byte baseRegister, byte channel, byte operatorNum) {
+				return (channel % Traits::numChannels) * 10 + (operatorNum & 0x01) * 5 +
+					getOperatorRegisterIndex(baseRegister);
+			}
+
+
+			/**
+			 * Get the value of a channel register from the shadow registers.
+			 *
+			 * @param baseRegister - The base address of the register.
+			 * @param channel - The channel for which to get the register value.
+			 * @return The current value of the from the shadow register.
+			 */
+			virtual byte getChannelRegister(byte baseRegister, byte channel) {
+				return this->channelRegisters[getChannelRegisterOffset(baseRegister, channel)];
+			}
+
+
+			/**
+			 * Get the value of an operator register of a channel from the shadow registers.
+			 *
+			 * @param baseRegister - The base address of the register.
+			 * @param channel - The channel of the operator.
+			 * @param operatorNum - The operator [0, 1].
+			 * @return The operator register value from shadow registers.
+			 */
+			virtual byte getOperatorRegister(byte baseRegister, byte channel, byte operatorNum) {
+				return this->operatorRegisters[getOperatorRegisterOffset(baseRegister, channel, operatorNum)];
+			}
+
+
+			/**
+			 * Write a given value to a channel based register.
+			 *
+			 * @param baseRegister - The base address of the register.
+			 * @param channel - The channel to address.
+			 * @param value - The value to write to the register.
+			 */
+			virtual void setChannelRegister(byte baseRegister, byte channel, byte value) {
+				byte offset = getChannelRegisterOffset(baseRegister, channel);
+				if (this->updateShadowRegister(this->channelRegisters, this->channelRegistersDirty, offset, value)) {
+					byte bank = (channel / CHANNELS_PER_BANK) & Traits::bankMask;
+					Traits::write(this, bank, baseRegister + (channel % CHANNELS_PER_BANK), value);
+				}
+			}
+
+
+			/**
+			 * Write a given value to an operator register for a channel.
+			 *
+			 * @param baseRegister - The base address of the register.
+			 * @param channel - The channel of the operator.
+			 * @param operatorNum - The operator to change [0, 1].
+			 * @param value - The value to write to the operator's register.
+			 */
+			virtual void setOperatorRegister(byte baseRegister, byte channel, byte operatorNum, byte value) {
+				short offset = getOperatorRegisterOffset(baseRegister, channel, operatorNum);
+				if (this->updateShadowRegister(this->operatorRegisters, this->operatorRegistersDirty, offset, value)) {
+					byte bank = (channel / CHANNELS_PER_BANK) & Traits::bankMask;
+					byte reg = baseRegister + this->registerOffsets[operatorNum & 0x01][channel % CHANNELS_PER_BANK];
+					Traits::write(this, bank, reg, value);
+				}
+			}
+
+
+			/**
+			 * Get the frequency F-number of the given channel.
+			 */
+			short getFNumber(byte channel) {
+				return ((getChannelRegister(0xB0, channel) & 0x03) << 8) + getChannelRegister(0xA0, channel);
+			}
+
+
+			/**
+			 * Set frequency F-number [0, 1023] for the given channel.
+			 */
+			void setFNumber(byte channel, short fNumber) {
+				byte value = getChannelRegister(0xB0, channel) & 0xFC;
+				setChannelRegister(0xB0, channel, value + ((fNumber & 0x0300) >> 8));
+				setChannelRegister(0xA0, channel, fNumber & 0xFF);
+			}
+
+
+			/**
+			 * Get the frequency block of the given channel.
+			 */
+			byte getBlock(byte channel) {
+				return (getChannelRegister(0xB0, channel) & 0x1C) >> 2;
+			}
+
+
+			/**
+			 * Set frequency block [0, 7] of the given channel.
+			 */
+			void setBlock(byte channel, byte block) {
+				byte value = getChannelRegister(0xB0, channel) & 0xE3;
+				setChannelRegister(0xB0, channel, value + ((block & 0x07) << 2));
+			}
+
+
+			/**
+			 * Is the voice of the given channel currently enabled?
+			 */
+			bool getKeyOn(byte channel) {
+				return getChannelRegister(0xB0, channel) & 0x20;
+			}
+
+
+			/**
+			 * Enable or disable the voice on the given channel.
+			 */
+			void setKeyOn(byte channel, bool keyOn) {
+				// Remember notes that are stopped during a batch, so they can be retriggered on commit.
+				if (this->batchActive && !keyOn && getKeyOn(channel)) {
+					this->setRegisterFlag(this->channelsKeyedOff, channel % Traits::numChannels, true);
+				}
+
+				byte value = getChannelRegister(0xB0, channel) & 0xDF;
+				setChannelRegister(0xB0, channel, value + (keyOn ? 0x20 : 0x00));
+			}
+
+
+			/**
+			 * Set the volume of the channel operator. Note that the scale is inverted! 0x00 for loudest, 0x3F for softest.
+			 */
+			void setVolume(byte channel, byte operatorNum, byte volume) {
+				byte value = getOperatorRegister(0x40, channel, operatorNum) & 0xC0;
+				setOperatorRegister(0x40, channel, operatorNum, value + (volume & 0x3F));
+			}
+
+
+			/**
+			 * Play a note of a certain octave on the given channel.
+			 */
+			void playNote(byte channel, byte octave, byte note) {
+				if (getKeyOn(channel)) {
+					setKeyOn(channel, false);
+				}
+				setBlock(channel, octave > NUM_OCTAVES ? NUM_OCTAVES : octave);
+				setFNumber(channel, this->noteFNumbers[note % NUM_NOTES]);
+				setKeyOn(channel, true);
+			}
+
+		private:
+			/**
+			 * Get the index of a channel register within the registers of a channel.
+			 */
+			static constexpr byte getChannelRegisterIndex(byte baseRegister) {
+				return baseRegister == 0xB0 ? 1 :
+					   baseRegister == 0xC0 ? 2 : 0;
+			}
+
+
+			/**
+			 * Get the index of an operator register within the registers of an operator.
+			 */
+			static constexpr byte getOperatorRegisterIndex(byte baseRegister) {
+				return baseRegister == 0x40 ? 1 :
+					   baseRegister == 0x60 ? 2 :
+					   baseRegister == 0x80 ? 3 :
+					   baseRegister == 0xE0 ? 4 : 0;
+			}
+	};
+
+
+	typedef OPLChip<OPL2Traits> OPL2Chip;
+	typedef OPLChip<OPL3Traits> OPL3Chip;
+	typedef OPLChip<OPL3DuoTraits> OPL3DuoChip;
+#endif
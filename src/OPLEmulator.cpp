@@ -0,0 +1,1301 @@
+/**
+ * Software emulation of the YM3812 and YMF262 for the OPL2 Audio Board library. Renders the register writes of an
+ * OPL2, OPL3 or OPL3Duo to PCM audio, so songs can be played or rendered offline without a board attached.
+ */
+
+#include "OPLEmulator.h"
+#include <math.h>
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	#include <time.h>
+	#include <mutex>
+#endif
+
+#if defined(OPL_EMULATOR_AVX2)
+	#include <immintrin.h>
+#elif defined(OPL_EMULATOR_SSE2)
+	#include <emmintrin.h>
+#elif defined(OPL_EMULATOR_NEON)
+	#include <arm_neon.h>
+#endif
+
+
+bool OPLEmulator::tablesReady = false;
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	// Emulators can be created from several threads at once, so the tables are calculated under a lock.
+	std::mutex emulatorTablesLock;
+#endif
+
+// Wave forms as the sign in bit 15 and the log-sine attenuation in bits 0 to 12 of each of the 1024 phases of all 8
+// wave forms. The extra entry lets the AVX2 kernel gather the 16 bit entries as 32 bit values.
+uint16_t emulatorWaveTable[8 * 1024 + 1];
+
+// Linear output of every 13 bit attenuation, the exponent table lookup and shift of the chip in one table.
+uint16_t emulatorExponentTable[0x2000 + 1];
+
+// Frequency multiplier of each MULT register value times 2.
+const byte emulatorMultipliers[16] = {
+	1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+// Key scale level attenuation in 0.75 dB steps for the upper 4 bits of the F-number in block 7.
+const byte emulatorKeyScaleLevels[16] = {
+	0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+// Right shift of the key scale level attenuation for KSL = 0 (off), 1 (1.5 dB), 2 (3 dB) and 3 (6 dB / octave).
+const byte emulatorKeyScaleShifts[4] = {
+	8, 1, 2, 0
+};
+
+// Envelope increments of the 8 steps of the rate counter. Rows 0 to 3 are used by rates 0 to 12, the rate index within
+// the row by the lower 2 bits of the rate. Rows 4 to 12 are used by rates 13 to 15.
+const byte emulatorEnvelopeSteps[13][8] = {
+	{ 0, 1, 0, 1, 0, 1, 0, 1 },
+	{ 0, 1, 0, 1, 1, 1, 0, 1 },
+	{ 0, 1, 1, 1, 0, 1, 1, 1 },
+	{ 0, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 1, 1, 2, 1, 1, 1, 2 },
+	{ 1, 2, 1, 2, 1, 2, 1, 2 },
+	{ 1, 2, 2, 2, 1, 2, 2, 2 },
+	{ 2, 2, 2, 2, 2, 2, 2, 2 },
+	{ 2, 2, 2, 4, 2, 2, 2, 4 },
+	{ 2, 4, 2, 4, 2, 4, 2, 4 },
+	{ 2, 4, 4, 4, 2, 4, 4, 4 },
+	{ 4, 4, 4, 4, 4, 4, 4, 4 }
+};
+
+// Channel within the bank and operator of the operator register offsets 0x00 to 0x15, 0xFF for unused offsets.
+const byte emulatorSlotChannels[22] = {
+	0, 1, 2, 0, 1, 2, 0xFF, 0xFF, 3, 4, 5, 3, 4, 5, 0xFF, 0xFF, 6, 7, 8, 6, 7, 8
+};
+const byte emulatorSlotOperators[22] = {
+	0, 0, 0, 1, 1, 1, 0xFF, 0xFF, 0, 0, 0, 1, 1, 1, 0xFF, 0xFF, 0, 0, 0, 1, 1, 1
+};
+
+
+#if defined(OPL_EMULATOR_AVX2)
+	/**
+	 * Calculate the output of 8 operators, see getOutput().
+	 */
+	static inline __m256i emulatorOutputAVX2(__m256i position, __m256i waveForm, __m256i attenuation) {
+		const __m256i mask16 = _mm256_set1_epi32(0xFFFF);
+		__m256i index = _mm256_add_epi32(waveForm, _mm256_and_si256(position, _mm256_set1_epi32(0x3FF)));
+		__m256i sample = _mm256_and_si256(_mm256_i32gather_epi32((const int*)emulatorWaveTable, index, 2), mask16);
+		__m256i exponent = _mm256_add_epi32(_mm256_and_si256(sample, _mm256_set1_epi32(0x7FFF)), _mm256_slli_epi32(attenuation, 3));
+		exponent = _mm256_min_epi32(exponent, _mm256_set1_epi32(0x1FFF));
+		__m256i value = _mm256_and_si256(_mm256_i32gather_epi32((const int*)emulatorExponentTable, exponent, 2), mask16);
+		return _mm256_xor_si256(value, _mm256_srai_epi32(_mm256_slli_epi32(sample, 16), 31));
+	}
+
+	static inline __m256i emulatorLoadAVX2(const void* values) {
+		return _mm256_loadu_si256((const __m256i*)values);
+	}
+
+	static inline void emulatorStoreAVX2(void* values, __m256i vector) {
+		_mm256_storeu_si256((__m256i*)values, vector);
+	}
+
+	// Select a where the mask is set and b elsewhere.
+	static inline __m256i emulatorSelectAVX2(__m256i mask, __m256i a, __m256i b) {
+		return _mm256_or_si256(_mm256_and_si256(mask, a), _mm256_andnot_si256(mask, b));
+	}
+#elif defined(OPL_EMULATOR_SSE2)
+	static inline __m128i emulatorLoadSSE2(const void* values) {
+		return _mm_loadu_si128((const __m128i*)values);
+	}
+
+	static inline void emulatorStoreSSE2(void* values, __m128i vector) {
+		_mm_storeu_si128((__m128i*)values, vector);
+	}
+
+	// Select a where the mask is set and b elsewhere.
+	static inline __m128i emulatorSelectSSE2(__m128i mask, __m128i a, __m128i b) {
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	}
+
+	static inline __m128i emulatorMinSSE2(__m128i a, __m128i b) {
+		return emulatorSelectSSE2(_mm_cmpgt_epi32(a, b), b, a);
+	}
+
+	/**
+	 * Shift each value right by its own shift in [2, 9]. SSE2 only shifts all values by the same amount, so the shift
+	 * is made of the fixed shift by 2 and shifts by 1, 2 and 4 that are selected by the bits of the rest.
+	 */
+	static inline __m128i emulatorShiftSSE2(__m128i value, __m128i shift) {
+		const __m128i one = _mm_set1_epi32(1);
+		__m128i steps = _mm_sub_epi32(shift, _mm_set1_epi32(2));
+		value = _mm_srai_epi32(value, 2);
+		value = emulatorSelectSSE2(_mm_cmpeq_epi32(_mm_and_si128(steps, one), one), _mm_srai_epi32(value, 1), value);
+		steps = _mm_srli_epi32(steps, 1);
+		value = emulatorSelectSSE2(_mm_cmpeq_epi32(_mm_and_si128(steps, one), one), _mm_srai_epi32(value, 2), value);
+		steps = _mm_srli_epi32(steps, 1);
+		return emulatorSelectSSE2(_mm_cmpeq_epi32(_mm_and_si128(steps, one), one), _mm_srai_epi32(value, 4), value);
+	}
+
+	/**
+	 * Calculate the output of 4 operators, see getOutput(). SSE2 has no gather, so only the table lookups are scalar.
+	 */
+	static inline __m128i emulatorOutputSSE2(__m128i position, __m128i waveForm, __m128i attenuation) {
+		int32_t index[4];
+		emulatorStoreSSE2(index, _mm_add_epi32(waveForm, _mm_and_si128(position, _mm_set1_epi32(0x3FF))));
+		__m128i sample = _mm_setr_epi32(
+			emulatorWaveTable[index[0]], emulatorWaveTable[index[1]],
+			emulatorWaveTable[index[2]], emulatorWaveTable[index[3]]);
+		__m128i exponent = _mm_add_epi32(_mm_and_si128(sample, _mm_set1_epi32(0x7FFF)), _mm_slli_epi32(attenuation, 3));
+		emulatorStoreSSE2(index, emulatorMinSSE2(exponent, _mm_set1_epi32(0x1FFF)));
+		__m128i value = _mm_setr_epi32(
+			emulatorExponentTable[index[0]], emulatorExponentTable[index[1]],
+			emulatorExponentTable[index[2]], emulatorExponentTable[index[3]]);
+		return _mm_xor_si128(value, _mm_srai_epi32(_mm_slli_epi32(sample, 16), 31));
+	}
+#elif defined(OPL_EMULATOR_NEON)
+	// Select a where the mask is set and b elsewhere.
+	static inline int32x4_t emulatorSelectNEON(int32x4_t mask, int32x4_t a, int32x4_t b) {
+		return vbslq_s32(vreinterpretq_u32_s32(mask), a, b);
+	}
+
+	/**
+	 * Calculate the output of 4 operators, see getOutput(). NEON has no gather, so only the table lookups are scalar.
+	 */
+	static inline int32x4_t emulatorOutputNEON(int32x4_t position, int32x4_t waveForm, int32x4_t attenuation) {
+		int32_t index[4];
+		int32_t values[4];
+		vst1q_s32(index, vaddq_s32(waveForm, vandq_s32(position, vdupq_n_s32(0x3FF))));
+		for (byte i = 0; i < 4; i ++) {
+			values[i] = emulatorWaveTable[index[i]];
+		}
+		int32x4_t sample = vld1q_s32(values);
+		int32x4_t exponent = vaddq_s32(vandq_s32(sample, vdupq_n_s32(0x7FFF)), vshlq_n_s32(attenuation, 3));
+		vst1q_s32(index, vminq_s32(exponent, vdupq_n_s32(0x1FFF)));
+		for (byte i = 0; i < 4; i ++) {
+			values[i] = emulatorExponentTable[index[i]];
+		}
+		return veorq_s32(vld1q_s32(values), vshrq_n_s32(vshlq_n_s32(sample, 16), 31));
+	}
+#endif
+
+
+/**
+ * Create an emulator of the given chips.
+ *
+ * @param chipType - The chip to emulate, OPL_EMULATOR_YM3812 for the OPL2 or OPL_EMULATOR_YMF262 for the OPL3.
+ * @param numUnits - The number of chips, 2 to emulate the OPL3 Duo. Writes to other synth units are ignored.
+ */
+OPLEmulator::OPLEmulator(byte chipType, byte numUnits) {
+	this->chipType = chipType;
+	this->numUnits = numUnits < 1 ? 1 : (numUnits > OPL_EMULATOR_MAX_UNITS ? OPL_EMULATOR_MAX_UNITS : numUnits);
+	numChannels = chipType == OPL_EMULATOR_YMF262 ? OPL_EMULATOR_NUM_CHANNELS : OPL2_NUM_CHANNELS;
+	numLanes = this->numUnits * numChannels;
+	numLanes = (numLanes + OPL_EMULATOR_LANE_VECTOR - 1) / OPL_EMULATOR_LANE_VECTOR * OPL_EMULATOR_LANE_VECTOR;
+	initTables();
+	reset();
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	/**
+	 * Finish the WAV file if one is still open.
+	 */
+	OPLEmulator::~OPLEmulator() {
+		closeWav();
+	}
+#endif
+
+
+/**
+ * Calculate the log-sine and exponent tables that the chips hold in ROM, with the wave forms and the exponent shift
+ * worked into them. The log-sine table holds -log2(sin(x)) of the first quarter of a sine wave and the exponent table
+ * 2^-x, both in 8 bit fixed point.
+ */
+void OPLEmulator::initTables() {
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		std::lock_guard<std::mutex> lock(emulatorTablesLock);
+	#endif
+
+	if (tablesReady) {
+		return;
+	}
+
+	uint16_t logSinTable[256];
+	uint16_t expTable[256];
+	for (unsigned int i = 0; i < 256; i ++) {
+		logSinTable[i] = (uint16_t)(-log(sin((i + 0.5) * 3.14159265358979 / 512.0)) / log(2.0) * 256.0 + 0.5);
+		expTable[i] = (uint16_t)(pow(2.0, -(i + 1.0) / 256.0) * 2048.0 + 0.5);
+	}
+
+	for (unsigned int i = 0; i < 8 * 1024; i ++) {
+		uint16_t phase = i & 0x3FF;
+		uint16_t negate = 0;
+		uint16_t level;
+		uint16_t quarter = (phase & 0x100) ? (phase & 0xFF) ^ 0xFF : phase & 0xFF;
+		switch (i >> 10) {
+			case 0:			// Sine.
+				negate = (phase & 0x200) ? 0x8000 : 0;
+				level = logSinTable[quarter];
+				break;
+			case 1:			// Half sine.
+				level = (phase & 0x200) ? 0x1000 : logSinTable[quarter];
+				break;
+			case 2:			// Absolute sine.
+				level = logSinTable[quarter];
+				break;
+			case 3:			// Quarter sine.
+				level = (phase & 0x100) ? 0x1000 : logSinTable[phase & 0xFF];
+				break;
+			case 4:			// Alternating sine at double frequency.
+				negate = ((phase & 0x300) == 0x100) ? 0x8000 : 0;
+				level = (phase & 0x200) ? 0x1000 : logSinTable[(phase & 0x80) ? ((phase ^ 0xFF) << 1) & 0xFF : (phase << 1) & 0xFF];
+				break;
+			case 5:			// Absolute alternating sine at double frequency.
+				level = (phase & 0x200) ? 0x1000 : logSinTable[(phase & 0x80) ? ((phase ^ 0xFF) << 1) & 0xFF : (phase << 1) & 0xFF];
+				break;
+			case 6:			// Square.
+				negate = (phase & 0x200) ? 0x8000 : 0;
+				level = 0;
+				break;
+			default:		// Derived square.
+				if (phase & 0x200) {
+					negate = 0x8000;
+					phase = (phase & 0x1FF) ^ 0x1FF;
+				}
+				level = phase << 3;
+				break;
+		}
+		emulatorWaveTable[i] = negate | level;
+	}
+	emulatorWaveTable[8 * 1024] = 0;
+
+	for (unsigned int i = 0; i < 0x2000; i ++) {
+		emulatorExponentTable[i] = (expTable[i & 0xFF] << 1) >> (i >> 8);
+	}
+	emulatorExponentTable[0x2000] = 0;
+	tablesReady = true;
+}
+
+
+/**
+ * Hard reset all emulated chips. All registers are cleared and all operators are silent.
+ */
+void OPLEmulator::reset() {
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		followClock();
+	#endif
+
+	for (unsigned int i = 0; i < sizeof(OPLEmulatorLanes); i ++) {
+		((byte*)&lanes)[i] = 0x00;
+	}
+	for (byte i = 0; i < OPL_EMULATOR_NUM_LANES; i ++) {
+		lanes.envelope[0][i] = 0x1FF;
+		lanes.envelope[1][i] = 0x1FF;
+	}
+
+	for (byte i = 0; i < numUnits; i ++) {
+		resetUnit(i);
+	}
+}
+
+
+/**
+ * Clear all registers and generator state of the given chip.
+ */
+void OPLEmulator::resetUnit(byte unit) {
+	OPLEmulatorChip& chip = chips[unit];
+	for (unsigned int i = 0; i < sizeof(OPLEmulatorChip); i ++) {
+		((byte*)&chip)[i] = 0x00;
+	}
+
+	for (byte i = 0; i < OPL_EMULATOR_NUM_SLOTS; i ++) {
+		chip.slots[i].envelopeState = OPL_ENVELOPE_RELEASE;
+	}
+	chip.noise = 1;
+
+	for (byte i = 0; i < numChannels; i ++) {
+		byte lane = unit * numChannels + i;
+		for (byte op = 0; op < 2; op ++) {
+			lanes.phase[op][lane] = 0;
+			lanes.envelope[op][lane] = 0x1FF;
+		}
+		lanes.tremolo[lane] = 0;
+		lanes.lastOutput[lane] = 0;
+		lanes.previousOutput[lane] = 0;
+	}
+	updateUnit(unit);
+}
+
+
+/**
+ * Write a value to a register of one of the emulated chips. On the YM3812 writes to the second register bank are
+ * ignored.
+ *
+ * @param bank - The bank (A1) of the register in bit 0 and the synth unit (A2) in bit 1.
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
+ */
+void OPLEmulator::write(byte bank, byte reg, byte value) {
+	byte unit = (bank >> 1) & 0x01;
+	bank &= 0x01;
+	if (unit >= numUnits || (bank == 1 && chipType == OPL_EMULATOR_YM3812)) {
+		return;
+	}
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		followClock();
+	#endif
+
+	OPLEmulatorChip& chip = chips[unit];
+	byte bankChannel = reg & 0x0F;
+	byte channel = bank * CHANNELS_PER_BANK + bankChannel;
+
+	switch (reg & 0xF0) {
+		case 0x00:
+			if (bank == 0 && reg == 0x01) {
+				chip.waveFormSelect = value & 0x20;
+			} else if (bank == 0 && reg == 0x08) {
+				chip.noteSelect = value & 0x40;
+			} else if (bank == 1 && reg == 0x04) {
+				chip.connections4OP = value & 0x3F;
+			} else if (bank == 1 && reg == 0x05) {
+				chip.opl3Mode = value & 0x01;
+			} else {
+				break;
+			}
+			updateUnit(unit);
+			break;
+
+		case 0x20: case 0x30:
+		case 0x40: case 0x50:
+		case 0x60: case 0x70:
+		case 0x80: case 0x90:
+		case 0xE0: case 0xF0:
+			writeSlotRegister(unit, bank, reg, value);
+			break;
+
+		case 0xA0:
+			if (bankChannel < CHANNELS_PER_BANK) {
+				chip.channels[channel].fNumber = (chip.channels[channel].fNumber & 0x300) | value;
+				updateChannel(unit, channel);
+				if (bankChannel < 3) {
+					updateChannel(unit, channel + 3);
+				}
+			}
+			break;
+
+		case 0xB0:
+			if (bank == 0 && reg == 0xBD) {
+				writePercussion(unit, value);
+			} else if (bankChannel < CHANNELS_PER_BANK) {
+				chip.channels[channel].fNumber = (chip.channels[channel].fNumber & 0xFF) | ((value & 0x03) << 8);
+				chip.channels[channel].block = (value >> 2) & 0x07;
+				setChannelKey(unit, channel, value & 0x20);
+				updateChannel(unit, channel);
+				if (bankChannel < 3) {
+					updateChannel(unit, channel + 3);
+				}
+			}
+			break;
+
+		case 0xC0:
+			if (bankChannel < CHANNELS_PER_BANK) {
+				chip.channels[channel].synthMode = value & 0x01;
+				chip.channels[channel].feedback = (value >> 1) & 0x07;
+				chip.channels[channel].outputs = value & 0xF0;
+				updateChannel(unit, channel);
+			}
+			break;
+	}
+}
+
+
+/**
+ * Write one of the operator registers 0x20, 0x40, 0x60, 0x80 or 0xE0.
+ */
+void OPLEmulator::writeSlotRegister(byte unit, byte bank, byte reg, byte value) {
+	byte offset = reg & 0x1F;
+	if (offset >= sizeof(emulatorSlotChannels) || emulatorSlotChannels[offset] == 0xFF) {
+		return;
+	}
+
+	byte channel = bank * CHANNELS_PER_BANK + emulatorSlotChannels[offset];
+	byte slotIndex = channel * 2 + emulatorSlotOperators[offset];
+	OPLEmulatorSlot& slot = chips[unit].slots[slotIndex];
+
+	switch (reg & 0xE0) {
+		case 0x20:
+			slot.hasTremolo = value & 0x80;
+			slot.hasVibrato = value & 0x40;
+			slot.hasSustain = value & 0x20;
+			slot.hasEnvelopeScaling = value & 0x10;
+			slot.multiplier = value & 0x0F;
+			break;
+		case 0x40:
+			slot.keyScaleLevel = value >> 6;
+			slot.totalLevel = value & 0x3F;
+			break;
+		case 0x60:
+			slot.attack = value >> 4;
+			slot.decay = value & 0x0F;
+			break;
+		case 0x80:
+			slot.sustain = value >> 4;
+			slot.release = value & 0x0F;
+			break;
+		case 0xE0:
+			slot.waveForm = value & 0x07;
+			break;
+	}
+	updateSlot(unit, slotIndex);
+}
+
+
+/**
+ * Write register 0xBD and key the percussion sounds on or off. The bass drum uses both operators of channel 6, the
+ * hi-hat and snare drum the operators of channel 7 and the tom tom and cymbal the operators of channel 8.
+ */
+void OPLEmulator::writePercussion(byte unit, byte value) {
+	chips[unit].percussion = value;
+
+	bool enabled = value & 0x20;
+	const byte drumBits[6] = { DRUM_BITS_BASS, DRUM_BITS_BASS, DRUM_BITS_HI_HAT, DRUM_BITS_SNARE, DRUM_BITS_TOM, DRUM_BITS_CYMBAL };
+	for (byte i = 0; i < 6; i ++) {
+		if (enabled && (value & drumBits[i])) {
+			keyOn(unit, 12 + i, OPL_KEY_DRUM);
+		} else {
+			keyOff(unit, 12 + i, OPL_KEY_DRUM);
+		}
+	}
+	updateUnit(unit);
+}
+
+
+/**
+ * Key the operators of the given channel on or off. On a 4-OP channel the first channel keys all four operators and the
+ * key of the second channel is ignored.
+ */
+void OPLEmulator::setChannelKey(byte unit, byte channel, bool isKeyOn) {
+	OPLEmulatorChip& chip = chips[unit];
+	chip.channels[channel].keyOn = isKeyOn;
+	if (is4OPSecondChannel(chip, channel)) {
+		return;
+	}
+
+	byte numSlots = is4OPChannel(chip, channel) ? 4 : 2;
+	for (byte i = 0; i < numSlots; i ++) {
+		// The operators of the second channel of a 4-OP pair follow those of the first channel, 3 channels further on.
+		byte slot = (channel + (i >> 1) * 3) * 2 + (i & 0x01);
+		if (isKeyOn) {
+			keyOn(unit, slot, OPL_KEY_CHANNEL);
+		} else {
+			keyOff(unit, slot, OPL_KEY_CHANNEL);
+		}
+	}
+}
+
+
+/**
+ * Key on an operator for the given source. The envelope restarts and the phase is reset when the operator was off.
+ */
+void OPLEmulator::keyOn(byte unit, byte slot, byte source) {
+	OPLEmulatorSlot& s = chips[unit].slots[slot];
+	if (s.key == 0) {
+		lanes.phase[slot & 0x01][unit * numChannels + (slot >> 1)] = 0;
+		s.envelopeState = OPL_ENVELOPE_ATTACK;
+		updateEnvelopeRate(unit, slot);
+	}
+	s.key |= source;
+}
+
+
+/**
+ * Key off an operator for the given source. The operator is released when no other source keeps it keyed on.
+ */
+void OPLEmulator::keyOff(byte unit, byte slot, byte source) {
+	OPLEmulatorSlot& s = chips[unit].slots[slot];
+	if (s.key != 0) {
+		s.key &= ~source;
+		if (s.key == 0) {
+			s.envelopeState = OPL_ENVELOPE_RELEASE;
+			updateEnvelopeRate(unit, slot);
+		}
+	}
+}
+
+
+/**
+ * Is the given channel the first channel of an enabled 4-OP channel pair?
+ */
+bool OPLEmulator::is4OPChannel(OPLEmulatorChip& chip, byte channel) {
+	if (chipType != OPL_EMULATOR_YMF262 || !chip.opl3Mode) {
+		return false;
+	}
+
+	if (channel < 3) {
+		return chip.connections4OP & (0x01 << channel);
+	} else if (channel >= 9 && channel < 12) {
+		return chip.connections4OP & (0x08 << (channel - 9));
+	}
+	return false;
+}
+
+
+/**
+ * Is the given channel the second channel of an enabled 4-OP channel pair?
+ */
+bool OPLEmulator::is4OPSecondChannel(OPLEmulatorChip& chip, byte channel) {
+	return (channel >= 3 && channel < 6) || (channel >= 12 && channel < 15) ? is4OPChannel(chip, channel - 3) : false;
+}
+
+
+/**
+ * Get the channel whose frequency the operators of the given channel use. This is the first channel of the pair for
+ * the second channel of a 4-OP pair.
+ */
+byte OPLEmulator::getFrequencyChannel(OPLEmulatorChip& chip, byte channel) {
+	return is4OPSecondChannel(chip, channel) ? channel - 3 : channel;
+}
+
+
+/**
+ * Get the outputs of the given channel, bit 0 for the left and bit 1 for the right speaker. The YM3812, and the YMF262
+ * when OPL3 mode is not enabled, output every channel on both speakers.
+ */
+byte OPLEmulator::getOutputMask(OPLEmulatorChip& chip, byte channel) {
+	if (chipType != OPL_EMULATOR_YMF262 || !chip.opl3Mode) {
+		return 0x03;
+	}
+	return (chip.channels[channel].outputs >> 4) & 0x03;
+}
+
+
+/**
+ * Get the wave form that the given operator uses. The YM3812 only uses the wave form registers when wave form select is
+ * enabled and the YMF262 only has wave forms 4 to 7 in OPL3 mode.
+ */
+byte OPLEmulator::getWaveForm(OPLEmulatorChip& chip, OPLEmulatorSlot& slot) {
+	if (chipType == OPL_EMULATOR_YM3812) {
+		return chip.waveFormSelect ? slot.waveForm & 0x03 : 0;
+	}
+	return chip.opl3Mode ? slot.waveForm : slot.waveForm & 0x03;
+}
+
+
+/**
+ * Update the lanes of all channels of the given chip after a write to a register that affects all of them.
+ */
+void OPLEmulator::updateUnit(byte unit) {
+	for (byte i = 0; i < numChannels; i ++) {
+		updateChannel(unit, i);
+	}
+}
+
+
+/**
+ * Update the lane of the given channel from its registers: the connection and output masks of the channel and the
+ * precalculated values of both operators.
+ */
+void OPLEmulator::updateChannel(byte unit, byte channel) {
+	OPLEmulatorChip& chip = chips[unit];
+	OPLEmulatorChannel& ch = chip.channels[channel];
+	byte lane = unit * numChannels + channel;
+
+	// The second channel of a 4-OP pair is output through the first channel and the hi-hat, snare drum, tom tom and
+	// cymbal do not use feedback, see render4OP() and renderPercussion().
+	bool isSecond4OP = is4OPSecondChannel(chip, channel);
+	bool isPercussion = (chip.percussion & 0x20) && channel >= 7 && channel < 9;
+	byte outputMask = isSecond4OP ? 0x00 : getOutputMask(chip, channel);
+
+	lanes.feedbackShift[lane] = 9 - ch.feedback;
+	lanes.feedbackMask[lane] = ch.feedback ? -1 : 0;
+	lanes.modulationMask[lane] = ch.synthMode == SYNTH_MODE_FM ? -1 : 0;
+	lanes.historyMask[lane] = isSecond4OP || isPercussion ? 0 : -1;
+	lanes.leftMask[lane] = (outputMask & 0x01) ? -1 : 0;
+	lanes.rightMask[lane] = (outputMask & 0x02) ? -1 : 0;
+
+	updateSlot(unit, channel * 2);
+	updateSlot(unit, channel * 2 + 1);
+}
+
+
+/**
+ * Precalculate the key scaled total level, tremolo mask, wave form, phase increment and envelope rate of an operator.
+ */
+void OPLEmulator::updateSlot(byte unit, byte slot) {
+	OPLEmulatorChip& chip = chips[unit];
+	OPLEmulatorSlot& s = chip.slots[slot];
+	OPLEmulatorChannel& channel = chip.channels[getFrequencyChannel(chip, slot >> 1)];
+	byte op = slot & 0x01;
+	byte lane = unit * numChannels + (slot >> 1);
+
+	int keyScale = (emulatorKeyScaleLevels[channel.fNumber >> 6] << 2) - ((8 - channel.block) << 5);
+	lanes.level[op][lane] = (s.totalLevel << 2) + (keyScale > 0 ? keyScale >> emulatorKeyScaleShifts[s.keyScaleLevel] : 0);
+	lanes.tremoloMask[op][lane] = s.hasTremolo ? -1 : 0;
+	lanes.waveForm[op][lane] = getWaveForm(chip, s) << 10;
+
+	updatePhaseStep(unit, slot);
+	updateEnvelopeRate(unit, slot);
+}
+
+
+/**
+ * Calculate the phase increment per sample of an operator from the frequency of its channel, its multiplier and the
+ * current vibrato.
+ */
+void OPLEmulator::updatePhaseStep(byte unit, byte slot) {
+	OPLEmulatorChip& chip = chips[unit];
+	OPLEmulatorSlot& s = chip.slots[slot];
+	OPLEmulatorChannel& channel = chip.channels[getFrequencyChannel(chip, slot >> 1)];
+
+	int fNumber = channel.fNumber;
+	if (s.hasVibrato) {
+		// Vibrato shifts the F-number by up to 1/128 (7 cents) or 1/256 (3.5 cents) of its value in 8 steps.
+		int range = (fNumber >> 7) & 0x07;
+		byte position = chip.vibratoPosition;
+		if (!(position & 0x03)) {
+			range = 0;
+		} else if (position & 0x01) {
+			range >>= 1;
+		}
+		range >>= (chip.percussion & 0x40) ? 0 : 1;
+		fNumber += (position & 0x04) ? -range : range;
+	}
+
+	lanes.phaseStep[slot & 0x01][unit * numChannels + (slot >> 1)] =
+		((((uint32_t)fNumber << channel.block) >> 1) * emulatorMultipliers[s.multiplier]) >> 1;
+}
+
+
+/**
+ * Calculate the effective rate of the current envelope state of an operator. The rate goes up with the octave and,
+ * with KSR set, also with the upper bits of the F-number.
+ */
+void OPLEmulator::updateEnvelopeRate(byte unit, byte slot) {
+	OPLEmulatorChip& chip = chips[unit];
+	OPLEmulatorSlot& s = chip.slots[slot];
+	OPLEmulatorChannel& channel = chip.channels[getFrequencyChannel(chip, slot >> 1)];
+
+	byte rate;
+	switch (s.envelopeState) {
+		case OPL_ENVELOPE_ATTACK:  rate = s.attack; break;
+		case OPL_ENVELOPE_DECAY:   rate = s.decay; break;
+		case OPL_ENVELOPE_SUSTAIN: rate = s.hasSustain ? 0 : s.release; break;
+		default:                   rate = s.release; break;
+	}
+	if (rate == 0) {
+		s.envelopeRate = 0;
+		return;
+	}
+
+	byte keyCode = (channel.block << 1) | ((channel.fNumber >> (chip.noteSelect ? 8 : 9)) & 0x01);
+	byte effectiveRate = rate * 4 + (s.hasEnvelopeScaling ? keyCode : keyCode >> 2);
+	s.envelopeRate = effectiveRate > 63 ? 63 : effectiveRate;
+}
+
+
+/**
+ * Render the given number of stereo frames at the sample rate of the chip. The output of all synth units is mixed.
+ *
+ * @param buffer - Buffer to receive the interleaved left and right 16 bit samples, 2 * numFrames values.
+ * @param numFrames - The number of frames to render.
+ */
+void OPLEmulator::render(int16_t* buffer, unsigned long numFrames) {
+	for (unsigned long i = 0; i < numFrames; i ++) {
+		int left = 0;
+		int right = 0;
+		generate(left, right);
+
+		buffer[i * 2]     = left  > 32767 ? 32767 : (left  < -32768 ? -32768 : left);
+		buffer[i * 2 + 1] = right > 32767 ? 32767 : (right < -32768 ? -32768 : right);
+	}
+}
+
+
+/**
+ * Get the emulated chip.
+ *
+ * @return OPL_EMULATOR_YM3812 or OPL_EMULATOR_YMF262.
+ */
+byte OPLEmulator::getChipType() {
+	return chipType;
+}
+
+
+/**
+ * Get the number of emulated chips.
+ */
+byte OPLEmulator::getNumUnits() {
+	return numUnits;
+}
+
+
+/**
+ * Get the sample rate of the rendered audio in Hz.
+ */
+unsigned long OPLEmulator::getSampleRate() {
+	return OPL_EMULATOR_SAMPLE_RATE;
+}
+
+
+/**
+ * Generate one sample of all chips and add it to the left and right outputs. The envelopes are stepped per operator,
+ * then all lanes go through the operator kernels together and the 4-OP channels and percussion sounds are completed
+ * from the operator outputs of their lanes.
+ */
+void OPLEmulator::generate(int& left, int& right) {
+	for (byte unit = 0; unit < numUnits; unit ++) {
+		stepLFOs(unit);
+		stepEnvelopes(unit);
+	}
+
+	stepOperators();
+	renderChannels();
+
+	for (byte unit = 0; unit < numUnits; unit ++) {
+		OPLEmulatorChip& chip = chips[unit];
+		render4OP(unit);
+		if (chip.percussion & 0x20) {
+			renderPercussion(unit);
+		}
+
+		uint32_t noiseBit = ((chip.noise >> 14) ^ chip.noise) & 0x01;
+		chip.noise = (chip.noise >> 1) | (noiseBit << 22);
+		chip.timer ++;
+	}
+
+	mixChannels(left, right);
+}
+
+
+/**
+ * Advance the tremolo and vibrato of the given chip. Tremolo is a triangle of 210 steps of 64 samples, vibrato has 8
+ * steps of 1024 samples.
+ */
+void OPLEmulator::stepLFOs(byte unit) {
+	OPLEmulatorChip& chip = chips[unit];
+
+	if ((chip.timer & 0x3F) == 0x3F) {
+		chip.tremoloPosition = (chip.tremoloPosition + 1) % 210;
+	}
+	byte tremoloShift = (chip.percussion & 0x80) ? 2 : 4;
+	byte tremolo = (chip.tremoloPosition < 105 ? chip.tremoloPosition : 210 - chip.tremoloPosition) >> tremoloShift;
+	if (tremolo != chip.tremolo) {
+		chip.tremolo = tremolo;
+		for (byte i = 0; i < numChannels; i ++) {
+			lanes.tremolo[unit * numChannels + i] = tremolo;
+		}
+	}
+
+	if ((chip.timer & 0x3FF) == 0x3FF) {
+		chip.vibratoPosition = (chip.vibratoPosition + 1) & 0x07;
+		for (byte i = 0; i < numChannels * 2; i ++) {
+			if (chip.slots[i].hasVibrato) {
+				updatePhaseStep(unit, i);
+			}
+		}
+	}
+}
+
+
+/**
+ * Advance the envelopes of all operators of the given chip by one sample. Each rate runs on a counter of 2^shift
+ * samples and adds the increment of the current step of that counter, so every increase of the rate by 4 doubles the
+ * speed of the envelope.
+ */
+void OPLEmulator::stepEnvelopes(byte unit) {
+	OPLEmulatorChip& chip = chips[unit];
+	for (byte i = 0; i < numChannels * 2; i ++) {
+		OPLEmulatorSlot& slot = chip.slots[i];
+		if (slot.envelopeRate == 0) {
+			continue;
+		}
+
+		byte rateHigh = slot.envelopeRate >> 2;
+		byte rateLow = slot.envelopeRate & 0x03;
+		byte shift = rateHigh < 12 ? 12 - rateHigh : 0;
+		if (chip.timer & ((1UL << shift) - 1)) {
+			continue;
+		}
+
+		byte row = rateHigh <= 12 ? rateLow : (rateHigh == 15 ? 12 : (rateHigh - 12) * 4 + rateLow);
+		int increment = emulatorEnvelopeSteps[row][(chip.timer >> shift) & 0x07];
+		int32_t& envelope = lanes.envelope[i & 0x01][unit * numChannels + (i >> 1)];
+
+		if (slot.envelopeState == OPL_ENVELOPE_ATTACK) {
+			// The attack curve is exponential. The highest attack rates reach full volume straight away.
+			envelope = rateHigh == 15 ? 0 : envelope + ((~envelope * increment) >> 3);
+			if (envelope <= 0) {
+				envelope = 0;
+				slot.envelopeState = OPL_ENVELOPE_DECAY;
+				updateEnvelopeRate(unit, i);
+			}
+		} else {
+			envelope += increment;
+			int sustainLevel = slot.sustain == 0x0F ? 0x1F0 : slot.sustain << 4;
+			if (slot.envelopeState == OPL_ENVELOPE_DECAY && envelope >= sustainLevel) {
+				slot.envelopeState = OPL_ENVELOPE_SUSTAIN;
+				updateEnvelopeRate(unit, i);
+			}
+			if (envelope > 0x1FF) {
+				envelope = 0x1FF;
+			}
+		}
+	}
+}
+
+
+/**
+ * Advance the phase of all operators of all lanes by one sample and calculate their attenuation from the envelope,
+ * level and tremolo. The phase before the increment is the phase of the current sample.
+ */
+void OPLEmulator::stepOperators() {
+	for (byte op = 0; op < 2; op ++) {
+		uint32_t* phase = lanes.phase[op];
+		const uint32_t* phaseStep = lanes.phaseStep[op];
+		const int32_t* envelope = lanes.envelope[op];
+		const int32_t* level = lanes.level[op];
+		const int32_t* tremoloMask = lanes.tremoloMask[op];
+		int32_t* position = lanes.position[op];
+		int32_t* attenuation = lanes.attenuation[op];
+		byte lane = 0;
+
+		#if defined(OPL_EMULATOR_AVX2)
+			for (; lane < numLanes; lane += 8) {
+				__m256i phases = emulatorLoadAVX2(&phase[lane]);
+				emulatorStoreAVX2(&position[lane], _mm256_and_si256(_mm256_srli_epi32(phases, 9), _mm256_set1_epi32(0x3FF)));
+				emulatorStoreAVX2(&phase[lane], _mm256_add_epi32(phases, emulatorLoadAVX2(&phaseStep[lane])));
+
+				__m256i tremolo = _mm256_and_si256(emulatorLoadAVX2(&tremoloMask[lane]), emulatorLoadAVX2(&lanes.tremolo[lane]));
+				__m256i total = _mm256_add_epi32(_mm256_add_epi32(emulatorLoadAVX2(&envelope[lane]), emulatorLoadAVX2(&level[lane])), tremolo);
+				emulatorStoreAVX2(&attenuation[lane], _mm256_min_epi32(total, _mm256_set1_epi32(0x1FF)));
+			}
+		#elif defined(OPL_EMULATOR_SSE2)
+			for (; lane < numLanes; lane += 4) {
+				__m128i phases = emulatorLoadSSE2(&phase[lane]);
+				emulatorStoreSSE2(&position[lane], _mm_and_si128(_mm_srli_epi32(phases, 9), _mm_set1_epi32(0x3FF)));
+				emulatorStoreSSE2(&phase[lane], _mm_add_epi32(phases, emulatorLoadSSE2(&phaseStep[lane])));
+
+				__m128i tremolo = _mm_and_si128(emulatorLoadSSE2(&tremoloMask[lane]), emulatorLoadSSE2(&lanes.tremolo[lane]));
+				__m128i total = _mm_add_epi32(_mm_add_epi32(emulatorLoadSSE2(&envelope[lane]), emulatorLoadSSE2(&level[lane])), tremolo);
+				emulatorStoreSSE2(&attenuation[lane], emulatorMinSSE2(total, _mm_set1_epi32(0x1FF)));
+			}
+		#elif defined(OPL_EMULATOR_NEON)
+			for (; lane < numLanes; lane += 4) {
+				uint32x4_t phases = vld1q_u32(&phase[lane]);
+				vst1q_s32(&position[lane], vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(phases, 9), vdupq_n_u32(0x3FF))));
+				vst1q_u32(&phase[lane], vaddq_u32(phases, vld1q_u32(&phaseStep[lane])));
+
+				int32x4_t tremolo = vandq_s32(vld1q_s32(&tremoloMask[lane]), vld1q_s32(&lanes.tremolo[lane]));
+				int32x4_t total = vaddq_s32(vaddq_s32(vld1q_s32(&envelope[lane]), vld1q_s32(&level[lane])), tremolo);
+				vst1q_s32(&attenuation[lane], vminq_s32(total, vdupq_n_s32(0x1FF)));
+			}
+		#endif
+
+		for (; lane < numLanes; lane ++) {
+			position[lane] = (phase[lane] >> 9) & 0x3FF;
+			phase[lane] += phaseStep[lane];
+
+			int32_t total = envelope[lane] + level[lane] + (tremoloMask[lane] & lanes.tremolo[lane]);
+			attenuation[lane] = total > 0x1FF ? 0x1FF : total;
+		}
+	}
+}
+
+
+/**
+ * Render all lanes as 2-OP channels. Operator 1 is modulated by its feedback and in FM mode modulates operator 2, in
+ * AM mode both operators are added.
+ */
+void OPLEmulator::renderChannels() {
+	byte lane = 0;
+
+	#if defined(OPL_EMULATOR_AVX2)
+		for (; lane < numLanes; lane += 8) {
+			__m256i last = emulatorLoadAVX2(&lanes.lastOutput[lane]);
+			__m256i previous = emulatorLoadAVX2(&lanes.previousOutput[lane]);
+			__m256i feedback = _mm256_srav_epi32(_mm256_add_epi32(previous, last), emulatorLoadAVX2(&lanes.feedbackShift[lane]));
+			feedback = _mm256_and_si256(feedback, emulatorLoadAVX2(&lanes.feedbackMask[lane]));
+			__m256i op1 = emulatorOutputAVX2(
+				_mm256_add_epi32(emulatorLoadAVX2(&lanes.position[0][lane]), feedback),
+				emulatorLoadAVX2(&lanes.waveForm[0][lane]), emulatorLoadAVX2(&lanes.attenuation[0][lane]));
+
+			__m256i history = emulatorLoadAVX2(&lanes.historyMask[lane]);
+			emulatorStoreAVX2(&lanes.previousOutput[lane], emulatorSelectAVX2(history, last, previous));
+			emulatorStoreAVX2(&lanes.lastOutput[lane], emulatorSelectAVX2(history, op1, last));
+
+			__m256i modulation = emulatorLoadAVX2(&lanes.modulationMask[lane]);
+			__m256i op2 = emulatorOutputAVX2(
+				_mm256_add_epi32(emulatorLoadAVX2(&lanes.position[1][lane]), _mm256_and_si256(modulation, op1)),
+				emulatorLoadAVX2(&lanes.waveForm[1][lane]), emulatorLoadAVX2(&lanes.attenuation[1][lane]));
+
+			emulatorStoreAVX2(&lanes.output[0][lane], op1);
+			emulatorStoreAVX2(&lanes.output[1][lane], op2);
+			emulatorStoreAVX2(&lanes.channelOutput[lane], _mm256_add_epi32(op2, _mm256_andnot_si256(modulation, op1)));
+		}
+	#elif defined(OPL_EMULATOR_SSE2)
+		for (; lane < numLanes; lane += 4) {
+			__m128i last = emulatorLoadSSE2(&lanes.lastOutput[lane]);
+			__m128i previous = emulatorLoadSSE2(&lanes.previousOutput[lane]);
+			__m128i feedback = emulatorShiftSSE2(_mm_add_epi32(previous, last), emulatorLoadSSE2(&lanes.feedbackShift[lane]));
+			feedback = _mm_and_si128(feedback, emulatorLoadSSE2(&lanes.feedbackMask[lane]));
+			__m128i op1 = emulatorOutputSSE2(
+				_mm_add_epi32(emulatorLoadSSE2(&lanes.position[0][lane]), feedback),
+				emulatorLoadSSE2(&lanes.waveForm[0][lane]), emulatorLoadSSE2(&lanes.attenuation[0][lane]));
+
+			__m128i history = emulatorLoadSSE2(&lanes.historyMask[lane]);
+			emulatorStoreSSE2(&lanes.previousOutput[lane], emulatorSelectSSE2(history, last, previous));
+			emulatorStoreSSE2(&lanes.lastOutput[lane], emulatorSelectSSE2(history, op1, last));
+
+			__m128i modulation = emulatorLoadSSE2(&lanes.modulationMask[lane]);
+			__m128i op2 = emulatorOutputSSE2(
+				_mm_add_epi32(emulatorLoadSSE2(&lanes.position[1][lane]), _mm_and_si128(modulation, op1)),
+				emulatorLoadSSE2(&lanes.waveForm[1][lane]), emulatorLoadSSE2(&lanes.attenuation[1][lane]));
+
+			emulatorStoreSSE2(&lanes.output[0][lane], op1);
+			emulatorStoreSSE2(&lanes.output[1][lane], op2);
+			emulatorStoreSSE2(&lanes.channelOutput[lane], _mm_add_epi32(op2, _mm_andnot_si128(modulation, op1)));
+		}
+	#elif defined(OPL_EMULATOR_NEON)
+		for (; lane < numLanes; lane += 4) {
+			int32x4_t last = vld1q_s32(&lanes.lastOutput[lane]);
+			int32x4_t previous = vld1q_s32(&lanes.previousOutput[lane]);
+			int32x4_t feedback = vshlq_s32(vaddq_s32(previous, last), vnegq_s32(vld1q_s32(&lanes.feedbackShift[lane])));
+			feedback = vandq_s32(feedback, vld1q_s32(&lanes.feedbackMask[lane]));
+			int32x4_t op1 = emulatorOutputNEON(
+				vaddq_s32(vld1q_s32(&lanes.position[0][lane]), feedback),
+				vld1q_s32(&lanes.waveForm[0][lane]), vld1q_s32(&lanes.attenuation[0][lane]));
+
+			int32x4_t history = vld1q_s32(&lanes.historyMask[lane]);
+			vst1q_s32(&lanes.previousOutput[lane], emulatorSelectNEON(history, last, previous));
+			vst1q_s32(&lanes.lastOutput[lane], emulatorSelectNEON(history, op1, last));
+
+			int32x4_t modulation = vld1q_s32(&lanes.modulationMask[lane]);
+			int32x4_t op2 = emulatorOutputNEON(
+				vaddq_s32(vld1q_s32(&lanes.position[1][lane]), vandq_s32(modulation, op1)),
+				vld1q_s32(&lanes.waveForm[1][lane]), vld1q_s32(&lanes.attenuation[1][lane]));
+
+			vst1q_s32(&lanes.output[0][lane], op1);
+			vst1q_s32(&lanes.output[1][lane], op2);
+			vst1q_s32(&lanes.channelOutput[lane], vaddq_s32(op2, vbicq_s32(op1, modulation)));
+		}
+	#endif
+
+	for (; lane < numLanes; lane ++) {
+		int32_t last = lanes.lastOutput[lane];
+		int32_t feedback = ((lanes.previousOutput[lane] + last) >> lanes.feedbackShift[lane]) & lanes.feedbackMask[lane];
+		int32_t op1 = getOutput(lanes.position[0][lane] + feedback, lanes.waveForm[0][lane], lanes.attenuation[0][lane]);
+		if (lanes.historyMask[lane]) {
+			lanes.previousOutput[lane] = last;
+			lanes.lastOutput[lane] = op1;
+		}
+
+		int32_t modulation = lanes.modulationMask[lane];
+		int32_t op2 = getOutput(lanes.position[1][lane] + (modulation & op1), lanes.waveForm[1][lane], lanes.attenuation[1][lane]);
+		lanes.output[0][lane] = op1;
+		lanes.output[1][lane] = op2;
+		lanes.channelOutput[lane] = op2 + (~modulation & op1);
+	}
+}
+
+
+/**
+ * Complete the enabled 4-OP channels of the given chip. Operators 1 and 2 were rendered in the lane of the first
+ * channel, operators 3 and 4 are the operators of the second channel. The connection is selected by the synth mode of
+ * both channels of the pair:
+ *   FM-FM: 1 > 2 > 3 > 4
+ *   AM-FM: 1 + (2 > 3 > 4)
+ *   FM-AM: (1 > 2) + (3 > 4)
+ *   AM-AM: 1 + (2 > 3) + 4
+ */
+void OPLEmulator::render4OP(byte unit) {
+	OPLEmulatorChip& chip = chips[unit];
+	if (chipType != OPL_EMULATOR_YMF262 || !chip.opl3Mode || !chip.connections4OP) {
+		return;
+	}
+
+	for (byte i = 0; i < 6; i ++) {
+		if (!(chip.connections4OP & (0x01 << i))) {
+			continue;
+		}
+
+		byte channel = i < 3 ? i : i + 6;
+		byte lane = unit * numChannels + channel;
+		byte lane34 = lane + 3;
+		byte connection = (chip.channels[channel].synthMode << 1) | chip.channels[channel + 3].synthMode;
+		int32_t op1 = lanes.output[0][lane];
+		int32_t op2 = lanes.output[1][lane];
+
+		int32_t op3 = getOutput(lanes.position[0][lane34] + (connection == 1 ? 0 : op2), lanes.waveForm[0][lane34], lanes.attenuation[0][lane34]);
+		lanes.previousOutput[lane34] = lanes.lastOutput[lane34];
+		lanes.lastOutput[lane34] = op3;
+		int32_t op4 = getOutput(lanes.position[1][lane34] + (connection == 3 ? 0 : op3), lanes.waveForm[1][lane34], lanes.attenuation[1][lane34]);
+
+		switch (connection) {
+			case 0:  lanes.channelOutput[lane] = op4; break;
+			case 1:  lanes.channelOutput[lane] = op2 + op4; break;
+			case 2:  lanes.channelOutput[lane] = op1 + op4; break;
+			default: lanes.channelOutput[lane] = op1 + op3 + op4; break;
+		}
+	}
+}
+
+
+/**
+ * Complete the percussion sounds of channels 6, 7 and 8 of the given chip. The bass drum is a normal channel that only
+ * outputs operator 2. The hi-hat, snare drum and cymbal take their phase from bits of the hi-hat and cymbal phase and
+ * the noise generator, the tom tom is a plain operator. All percussion sounds are output at double volume.
+ */
+void OPLEmulator::renderPercussion(byte unit) {
+	OPLEmulatorChip& chip = chips[unit];
+	byte bassLane = unit * numChannels + 6;
+	byte hiHatLane = bassLane + 1;
+	byte tomLane = bassLane + 2;
+
+	// Derive the phase of the noisy sounds from the hi-hat and cymbal phase.
+	int32_t hiHatPhase = lanes.position[0][hiHatLane];
+	int32_t snarePhase;
+	int32_t cymbalPhase = lanes.position[1][tomLane];
+	byte noise = chip.noise & 0x01;
+	byte hiHatBit2 = (hiHatPhase >> 2) & 0x01;
+	byte hiHatBit3 = (hiHatPhase >> 3) & 0x01;
+	byte hiHatBit7 = (hiHatPhase >> 7) & 0x01;
+	byte hiHatBit8 = (hiHatPhase >> 8) & 0x01;
+	byte cymbalBit3 = (cymbalPhase >> 3) & 0x01;
+	byte cymbalBit5 = (cymbalPhase >> 5) & 0x01;
+	byte phaseBit = (hiHatBit2 ^ hiHatBit7) | (hiHatBit3 ^ cymbalBit5) | (cymbalBit3 ^ cymbalBit5);
+
+	hiHatPhase = (phaseBit << 9) | ((phaseBit ^ noise) ? 0xD0 : 0x34);
+	snarePhase = (hiHatBit8 << 9) | ((hiHatBit8 ^ noise) << 8);
+	cymbalPhase = (phaseBit << 9) | 0x80;
+
+	int32_t hiHatSnare =
+		getOutput(hiHatPhase, lanes.waveForm[0][hiHatLane], lanes.attenuation[0][hiHatLane]) +
+		getOutput(snarePhase, lanes.waveForm[1][hiHatLane], lanes.attenuation[1][hiHatLane]);
+	int32_t tomCymbal =
+		getOutput(lanes.position[0][tomLane], lanes.waveForm[0][tomLane], lanes.attenuation[0][tomLane]) +
+		getOutput(cymbalPhase, lanes.waveForm[1][tomLane], lanes.attenuation[1][tomLane]);
+
+	lanes.channelOutput[bassLane] = lanes.output[1][bassLane] * 2;
+	lanes.channelOutput[hiHatLane] = hiHatSnare * 2;
+	lanes.channelOutput[tomLane] = tomCymbal * 2;
+}
+
+
+/**
+ * Add the output of all lanes to the speakers they are enabled on.
+ */
+void OPLEmulator::mixChannels(int& left, int& right) {
+	byte lane = 0;
+	int32_t sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	#if defined(OPL_EMULATOR_AVX2)
+		__m256i leftSum = _mm256_setzero_si256();
+		__m256i rightSum = _mm256_setzero_si256();
+		for (; lane < numLanes; lane += 8) {
+			__m256i output = emulatorLoadAVX2(&lanes.channelOutput[lane]);
+			leftSum = _mm256_add_epi32(leftSum, _mm256_and_si256(output, emulatorLoadAVX2(&lanes.leftMask[lane])));
+			rightSum = _mm256_add_epi32(rightSum, _mm256_and_si256(output, emulatorLoadAVX2(&lanes.rightMask[lane])));
+		}
+		__m128i leftHalf = _mm_add_epi32(_mm256_castsi256_si128(leftSum), _mm256_extracti128_si256(leftSum, 1));
+		__m128i rightHalf = _mm_add_epi32(_mm256_castsi256_si128(rightSum), _mm256_extracti128_si256(rightSum, 1));
+		_mm_storeu_si128((__m128i*)&sums[0], leftHalf);
+		_mm_storeu_si128((__m128i*)&sums[4], rightHalf);
+	#elif defined(OPL_EMULATOR_SSE2)
+		__m128i leftSum = _mm_setzero_si128();
+		__m128i rightSum = _mm_setzero_si128();
+		for (; lane < numLanes; lane += 4) {
+			__m128i output = emulatorLoadSSE2(&lanes.channelOutput[lane]);
+			leftSum = _mm_add_epi32(leftSum, _mm_and_si128(output, emulatorLoadSSE2(&lanes.leftMask[lane])));
+			rightSum = _mm_add_epi32(rightSum, _mm_and_si128(output, emulatorLoadSSE2(&lanes.rightMask[lane])));
+		}
+		emulatorStoreSSE2(&sums[0], leftSum);
+		emulatorStoreSSE2(&sums[4], rightSum);
+	#elif defined(OPL_EMULATOR_NEON)
+		int32x4_t leftSum = vdupq_n_s32(0);
+		int32x4_t rightSum = vdupq_n_s32(0);
+		for (; lane < numLanes; lane += 4) {
+			int32x4_t output = vld1q_s32(&lanes.channelOutput[lane]);
+			leftSum = vaddq_s32(leftSum, vandq_s32(output, vld1q_s32(&lanes.leftMask[lane])));
+			rightSum = vaddq_s32(rightSum, vandq_s32(output, vld1q_s32(&lanes.rightMask[lane])));
+		}
+		vst1q_s32(&sums[0], leftSum);
+		vst1q_s32(&sums[4], rightSum);
+	#endif
+
+	for (; lane < numLanes; lane ++) {
+		sums[0] += lanes.channelOutput[lane] & lanes.leftMask[lane];
+		sums[4] += lanes.channelOutput[lane] & lanes.rightMask[lane];
+	}
+
+	left += sums[0] + sums[1] + sums[2] + sums[3];
+	right += sums[4] + sums[5] + sums[6] + sums[7];
+}
+
+
+/**
+ * Calculate the output of an operator from its wave form, phase and attenuation. The wave form is looked up as an
+ * attenuation in the log-sine table, to which the attenuation of the envelope, total level, key scale level and tremolo
+ * is added, and is then converted back to a linear value through the exponent table.
+ *
+ * @param position - The modulated phase of the operator, only the lower 10 bits are used.
+ * @param waveForm - Offset of the wave form in the wave table.
+ * @param attenuation - The total attenuation of the operator [0, 511].
+ * @return The 13 bit signed output of the operator.
+ */
+int32_t OPLEmulator::getOutput(int32_t position, int32_t waveForm, int32_t attenuation) {
+	uint16_t sample = emulatorWaveTable[waveForm + (position & 0x3FF)];
+	int32_t exponent = (sample & 0x7FFF) + (attenuation << 3);
+	if (exponent > 0x1FFF) {
+		exponent = 0x1FFF;
+	}
+	return emulatorExponentTable[exponent] ^ -(int32_t)(sample >> 15);
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	/**
+	 * Start writing the rendered audio to a 16 bit stereo WAV file. Any WAV file that is still open is finished first.
+	 *
+	 * @param fileName - Name of the WAV file to create.
+	 * @return True if the file was created.
+	 */
+	bool OPLEmulator::openWav(const char* fileName) {
+		closeWav();
+
+		wavFile = fopen(fileName, "wb");
+		if (wavFile == NULL) {
+			return false;
+		}
+
+		// The RIFF and data chunk sizes are filled in by closeWav().
+		const uint32_t sampleRate = OPL_EMULATOR_SAMPLE_RATE;
+		const uint32_t byteRate = sampleRate * 4;
+		byte header[44] = {
+			'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+			'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 2, 0,
+			(byte)sampleRate, (byte)(sampleRate >> 8), (byte)(sampleRate >> 16), (byte)(sampleRate >> 24),
+			(byte)byteRate, (byte)(byteRate >> 8), (byte)(byteRate >> 16), (byte)(byteRate >> 24),
+			4, 0, 16, 0,
+			'd', 'a', 't', 'a', 0, 0, 0, 0
+		};
+		if (fwrite(header, 1, sizeof(header), wavFile) != sizeof(header)) {
+			fclose(wavFile);
+			wavFile = NULL;
+			return false;
+		}
+
+		wavFrames = 0;
+		wavFraction = 0;
+		clockTime = getTime();
+		return true;
+	}
+
+
+	/**
+	 * Finish the WAV file by writing the chunk sizes to its header and close it. In real time mode the audio up to now
+	 * is rendered first.
+	 */
+	void OPLEmulator::closeWav() {
+		if (wavFile == NULL) {
+			return;
+		}
+
+		followClock();
+
+		uint32_t dataSize = wavFrames * 4;
+		uint32_t riffSize = dataSize + 36;
+		byte riffSizeBytes[4] = { (byte)riffSize, (byte)(riffSize >> 8), (byte)(riffSize >> 16), (byte)(riffSize >> 24) };
+		byte dataSizeBytes[4] = { (byte)dataSize, (byte)(dataSize >> 8), (byte)(dataSize >> 16), (byte)(dataSize >> 24) };
+		fseek(wavFile, 4, SEEK_SET);
+		fwrite(riffSizeBytes, 1, 4, wavFile);
+		fseek(wavFile, 40, SEEK_SET);
+		fwrite(dataSizeBytes, 1, 4, wavFile);
+		fclose(wavFile);
+		wavFile = NULL;
+	}
+
+
+	/**
+	 * Is a WAV file being written?
+	 */
+	bool OPLEmulator::isWavOpen() {
+		return wavFile != NULL;
+	}
+
+
+	/**
+	 * Render the given amount of time to the WAV file. Time that does not make up a whole frame is carried over to the
+	 * next call, so the rendered audio does not drift from the song however short the delays are.
+	 *
+	 * @param micros - The time to render in microseconds.
+	 */
+	void OPLEmulator::renderWav(unsigned long micros) {
+		if (wavFile == NULL) {
+			return;
+		}
+
+		unsigned long long total = (unsigned long long)micros * OPL_EMULATOR_SAMPLE_RATE + wavFraction;
+		unsigned long numFrames = total / 1000000UL;
+		wavFraction = total % 1000000UL;
+
+		int16_t buffer[OPL_EMULATOR_WAV_FRAMES * 2];
+		while (numFrames > 0) {
+			unsigned long frames = numFrames < OPL_EMULATOR_WAV_FRAMES ? numFrames : OPL_EMULATOR_WAV_FRAMES;
+			render(buffer, frames);
+			fwrite(buffer, 4, frames, wavFile);
+			wavFrames += frames;
+			numFrames -= frames;
+		}
+	}
+
+
+	/**
+	 * Get the number of frames written to the WAV file.
+	 */
+	unsigned long OPLEmulator::getRenderedFrames() {
+		return wavFrames;
+	}
+
+
+	/**
+	 * Is the WAV file rendered in real time?
+	 */
+	bool OPLEmulator::isRealTime() {
+		return realTime;
+	}
+
+
+	/**
+	 * Render the WAV file in real time. Before each register write the time that passed on the system clock since the
+	 * previous write is rendered, so programs that time their notes with delay() or millis(), like the demo tunes and
+	 * the TuneParser, are recorded as they play.
+	 *
+	 * @param realTime - Set to true to follow the system clock.
+	 */
+	void OPLEmulator::setRealTime(bool realTime) {
+		this->realTime = realTime;
+		clockTime = getTime();
+	}
+
+
+	/**
+	 * In real time mode render the time that passed since the previous write to the WAV file.
+	 */
+	void OPLEmulator::followClock() {
+		if (realTime && wavFile != NULL) {
+			uint32_t now = getTime();
+			renderWav(now - clockTime);
+			clockTime = now;
+		}
+	}
+
+
+	/**
+	 * Get the time of the monotonic system clock in microseconds.
+	 */
+	uint32_t OPLEmulator::getTime() {
+		struct timespec time;
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		return time.tv_sec * 1000000UL + time.tv_nsec / 1000;
+	}
+#endif
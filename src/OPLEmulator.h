@@ -0,0 +1,229 @@
+#include "OPL2.h"
+
+#ifndef OPL_EMULATOR_LIB_H_
+	#define OPL_EMULATOR_LIB_H_
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		#include <stdio.h>
+	#endif
+
+	// Chips that can be emulated.
+	#define OPL_EMULATOR_YM3812 0
+	#define OPL_EMULATOR_YMF262 1
+
+	// Maximum number of chips behind a single emulator, two for the OPL3 Duo.
+	#define OPL_EMULATOR_MAX_UNITS 2
+	#define OPL_EMULATOR_NUM_CHANNELS 18
+	#define OPL_EMULATOR_NUM_SLOTS    36
+
+	// Sample rate of the YM3812 (3579545 Hz / 72) and the YMF262 (14318180 Hz / 288) in Hz.
+	#define OPL_EMULATOR_SAMPLE_RATE 49716UL
+
+	// Number of stereo frames rendered at once when writing to a WAV file.
+	#define OPL_EMULATOR_WAV_FRAMES 1024
+
+	// Envelope generator states.
+	#define OPL_ENVELOPE_ATTACK  0
+	#define OPL_ENVELOPE_DECAY   1
+	#define OPL_ENVELOPE_SUSTAIN 2
+	#define OPL_ENVELOPE_RELEASE 3
+
+	// Sources that can key on an operator.
+	#define OPL_KEY_CHANNEL 0x01
+	#define OPL_KEY_DRUM    0x02
+
+	// The channels of all synth units are rendered side by side, channel c of unit u in lane u * 9 + c on the YM3812 and
+	// u * 18 + c on the YMF262. The lanes in use are padded to a whole number of vectors of the SIMD kernel.
+	#define OPL_EMULATOR_NUM_LANES 40
+
+	// SIMD kernel of the renderer, picked from the instruction set the compiler targets. Build with -mavx2 (or
+	// -march=native) for AVX2 on x86 and with NEON enabled on ARM, SSE2 is the baseline of x86-64. All kernels give bit
+	// identical output to the scalar kernel, which is used when OPL_EMULATOR_SCALAR is defined or no SIMD is available.
+	#if !defined(OPL_EMULATOR_SCALAR)
+		#if defined(__AVX2__)
+			#define OPL_EMULATOR_AVX2
+			#define OPL_EMULATOR_LANE_VECTOR 8
+		#elif defined(__SSE2__)
+			#define OPL_EMULATOR_SSE2
+			#define OPL_EMULATOR_LANE_VECTOR 4
+		#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+			#define OPL_EMULATOR_NEON
+			#define OPL_EMULATOR_LANE_VECTOR 4
+		#endif
+	#endif
+	#ifndef OPL_EMULATOR_LANE_VECTOR
+		#define OPL_EMULATOR_LANE_VECTOR 1
+	#endif
+
+
+	struct OPLEmulatorSlot {
+		// Register values.
+		bool hasTremolo;
+		bool hasVibrato;
+		bool hasSustain;
+		bool hasEnvelopeScaling;
+		byte multiplier;
+		byte keyScaleLevel;
+		byte totalLevel;
+		byte attack;
+		byte decay;
+		byte sustain;
+		byte release;
+		byte waveForm;
+
+		// Envelope state, the attenuation of the envelope itself is kept in OPLEmulatorLanes.
+		byte envelopeState;
+		byte envelopeRate;					// Effective rate of the envelope state [4, 63], 0 when the envelope holds.
+		byte key;							// OPL_KEY_ flags of the sources that keep the operator keyed on.
+	};
+
+
+	struct OPLEmulatorChannel {
+		uint16_t fNumber;
+		byte block;
+		bool keyOn;
+		byte feedback;
+		byte synthMode;
+		byte outputs;						// Output bits 0xF0 of register 0xC0.
+	};
+
+
+	struct OPLEmulatorChip {
+		OPLEmulatorSlot slots[OPL_EMULATOR_NUM_SLOTS];
+		OPLEmulatorChannel channels[OPL_EMULATOR_NUM_CHANNELS];
+		bool waveFormSelect;
+		bool noteSelect;
+		byte percussion;					// Value of register 0xBD.
+		byte connections4OP;				// Value of register 0x104.
+		bool opl3Mode;
+		uint32_t timer;						// Number of samples generated since the reset.
+		uint32_t noise;						// 23 bit noise generator for the percussion sounds.
+		byte tremoloPosition;
+		byte tremolo;
+		byte vibratoPosition;
+	};
+
+
+	/**
+	 * Per sample state of all operators of all synth units in structure of arrays layout, one lane per channel. Row 0
+	 * of the operator arrays holds operator 1 and row 1 operator 2 of the channel of the lane, so the SIMD kernels run
+	 * the same step of the same operator of 4 or 8 channels at once. Everything that only changes with a register write
+	 * or the vibrato is kept here precalculated, and the connection of the operators is expressed as masks.
+	 */
+	struct OPLEmulatorLanes {
+		uint32_t phase[2][OPL_EMULATOR_NUM_LANES];			// Phase accumulator, bits 9 to 18 are the 10 bit phase.
+		uint32_t phaseStep[2][OPL_EMULATOR_NUM_LANES];		// Phase increment with multiplier and vibrato applied.
+		int32_t envelope[2][OPL_EMULATOR_NUM_LANES];		// Attenuation of the envelope in 0.1875 dB steps [0, 511].
+		int32_t level[2][OPL_EMULATOR_NUM_LANES];			// Attenuation of the total level and key scale level.
+		int32_t tremoloMask[2][OPL_EMULATOR_NUM_LANES];		// -1 when the operator has tremolo.
+		int32_t waveForm[2][OPL_EMULATOR_NUM_LANES];		// Offset of the wave form of the operator in the wave table.
+		int32_t position[2][OPL_EMULATOR_NUM_LANES];		// Unmodulated phase of the current sample.
+		int32_t attenuation[2][OPL_EMULATOR_NUM_LANES];		// Total attenuation of the current sample [0, 511].
+		int32_t output[2][OPL_EMULATOR_NUM_LANES];			// Output of the operators for the current sample.
+
+		int32_t tremolo[OPL_EMULATOR_NUM_LANES];			// Tremolo attenuation of the synth unit of the lane.
+		int32_t feedbackShift[OPL_EMULATOR_NUM_LANES];		// 9 - feedback.
+		int32_t feedbackMask[OPL_EMULATOR_NUM_LANES];		// -1 when operator 1 has feedback.
+		int32_t modulationMask[OPL_EMULATOR_NUM_LANES];		// -1 when operator 1 modulates operator 2, 0 when added.
+		int32_t historyMask[OPL_EMULATOR_NUM_LANES];		// -1 when the output of operator 1 is kept for feedback.
+		int32_t lastOutput[OPL_EMULATOR_NUM_LANES];			// Last two outputs of operator 1 for feedback.
+		int32_t previousOutput[OPL_EMULATOR_NUM_LANES];
+		int32_t leftMask[OPL_EMULATOR_NUM_LANES];			// -1 when the channel is output on the left speaker.
+		int32_t rightMask[OPL_EMULATOR_NUM_LANES];
+		int32_t channelOutput[OPL_EMULATOR_NUM_LANES];
+	};
+
+
+	/**
+	 * Software emulation of the YM3812 (OPL2) and YMF262 (OPL3) that renders the register writes of an OPL2, OPL3 or
+	 * OPL3Duo to 16 bit stereo PCM at the native sample rate of the chip. The emulator is a backend, so it is selected
+	 * through setBackend() of the chip and everything built on top of the library plays through it unchanged:
+	 *
+	 *     OPLEmulator emulator(OPL_EMULATOR_YMF262, 2);
+	 *     OPL3Duo opl3Duo;
+	 *     opl3Duo.setBackend(&emulator);
+	 *     opl3Duo.begin();
+	 *
+	 * The chip is emulated from its operator structure: a log-sine and exponent table lookup per operator, the
+	 * envelope generator with its rate counter and key scaling, tremolo, vibrato, the noise and phase logic of the
+	 * percussion sounds, and the 2-OP and 4-OP connections. The operators of all channels of all units are rendered
+	 * side by side by SIMD kernels on hosts that have them, see OPLEmulatorLanes. Audio is only generated when render()
+	 * is called, so rendering runs as fast as the host allows. On Linux the audio can be written to a WAV file, either by advancing
+	 * the emulated time with renderWav() for offline rendering faster than real time, or in real time by following the
+	 * system clock for programs that time their notes with delay().
+	 */
+	class OPLEmulator : public OPLBackend {
+		public:
+			OPLEmulator(byte chipType = OPL_EMULATOR_YM3812, byte numUnits = 1);
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				virtual ~OPLEmulator();
+			#endif
+
+			virtual void reset();
+			virtual void write(byte bank, byte reg, byte value);
+
+			void render(int16_t* buffer, unsigned long numFrames);
+			byte getChipType();
+			byte getNumUnits();
+			unsigned long getSampleRate();
+
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				bool openWav(const char* fileName);
+				void closeWav();
+				bool isWavOpen();
+				void renderWav(unsigned long micros);
+				unsigned long getRenderedFrames();
+				bool isRealTime();
+				void setRealTime(bool realTime);
+			#endif
+
+		private:
+			static void initTables();
+			void resetUnit(byte unit);
+			void writeSlotRegister(byte unit, byte bank, byte reg, byte value);
+			void writePercussion(byte unit, byte value);
+			void setChannelKey(byte unit, byte channel, bool keyOn);
+			void keyOn(byte unit, byte slot, byte source);
+			void keyOff(byte unit, byte slot, byte source);
+			bool is4OPChannel(OPLEmulatorChip& chip, byte channel);
+			bool is4OPSecondChannel(OPLEmulatorChip& chip, byte channel);
+			byte getFrequencyChannel(OPLEmulatorChip& chip, byte channel);
+			byte getOutputMask(OPLEmulatorChip& chip, byte channel);
+			byte getWaveForm(OPLEmulatorChip& chip, OPLEmulatorSlot& slot);
+			void updateUnit(byte unit);
+			void updateChannel(byte unit, byte channel);
+			void updateSlot(byte unit, byte slot);
+			void updatePhaseStep(byte unit, byte slot);
+			void updateEnvelopeRate(byte unit, byte slot);
+			void generate(int& left, int& right);
+			void stepLFOs(byte unit);
+			void stepEnvelopes(byte unit);
+			void stepOperators();
+			void renderChannels();
+			void render4OP(byte unit);
+			void renderPercussion(byte unit);
+			void mixChannels(int& left, int& right);
+			static int32_t getOutput(int32_t position, int32_t waveForm, int32_t attenuation);
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				void followClock();
+				uint32_t getTime();
+			#endif
+
+			byte chipType;
+			byte numUnits;
+			byte numChannels;						// Channels per synth unit.
+			byte numLanes;							// Lanes in use, rounded up to a whole number of vectors.
+			OPLEmulatorChip chips[OPL_EMULATOR_MAX_UNITS];
+			OPLEmulatorLanes lanes;
+
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				FILE* wavFile = NULL;
+				unsigned long wavFrames = 0;
+				unsigned long wavFraction = 0;			// Rendered time not yet covered by a whole frame, in frames * 10^6.
+				bool realTime = false;
+				uint32_t clockTime = 0;					// Time of the system clock up to which audio was rendered.
+			#endif
+
+			static bool tablesReady;
+	};
+#endif
@@ -0,0 +1,217 @@
+/**
+ * Software pitch modulation for the OPL2 Audio Board and OPL3 Duo. Adds vibrato of any depth and rate to each channel
+ * without floating point math and with as few register writes as possible.
+ */
+
+#include "OPLModulator.h"
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	#include <Arduino.h>
+#else
+	#include <wiringPi.h>
+#endif
+
+
+// First quarter of a sine wave scaled to [0, 255].
+static const byte modulatorSineTable[64] PROGMEM = {
+	  0,   6,  13,  19,  25,  31,  37,  44,  50,  56,  62,  68,  74,  80,  86,  92,
+	 98, 103, 109, 115, 120, 126, 131, 136, 142, 147, 152, 157, 162, 167, 171, 176,
+	180, 185, 189, 193, 197, 201, 205, 208, 212, 215, 219, 222, 225, 228, 231, 233,
+	236, 238, 240, 242, 244, 246, 247, 249, 250, 251, 252, 253, 254, 254, 255, 255
+};
+
+
+/**
+ * Create a modulator for the given chip. No channel is modulated until setModulation is called.
+ *
+ * @param opl2 - The OPL2, OPL3 or OPL3 Duo to modulate.
+ */
+OPLModulator::OPLModulator(OPL2* opl2) {
+	this->opl2 = opl2;
+	for (byte i = 0; i < OPL_MODULATOR_MAX_CHANNELS; i ++) {
+		modulations[i].baseFNumber = 0;
+		modulations[i].lastFNumber = -1;
+		modulations[i].phase = 0;
+		modulations[i].increment = 0;
+		modulations[i].depth = 0;
+		modulations[i].rate = 0;
+	}
+}
+
+
+/**
+ * Set the vibrato of a channel. For 4-OP channels use the control channel, as it holds the frequency. A depth of 0
+ * stops the modulation and restores the F-number of the note.
+ *
+ * @param channel - The channel to modulate.
+ * @param depth - Depth of the modulation [0, 255], where 255 bends the note up and down by a semitone.
+ * @param rate - Rate of the modulation [0, 255] in steps of 0.1 Hz.
+ */
+void OPLModulator::setModulation(byte channel, byte depth, byte rate) {
+	if (channel >= OPL_MODULATOR_MAX_CHANNELS) {
+		return;
+	}
+	if (depth == 0) {
+		stopModulation(channel);
+		return;
+	}
+
+	OPLModulation& modulation = modulations[channel];
+	if (modulation.depth == 0) {
+		modulation.phase = 0;
+		modulation.lastFNumber = -1;
+	}
+	modulation.depth = depth;
+	if (modulation.rate != rate || modulation.increment == 0) {
+		modulation.rate = rate;
+		modulation.increment = ((unsigned long)rate << 16) / (10UL * OPL_MODULATOR_CONTROL_RATE);
+	}
+}
+
+
+/**
+ * Stop the modulation of a channel and restore the F-number of its note.
+ *
+ * @param channel - The channel to stop modulating.
+ */
+void OPLModulator::stopModulation(byte channel) {
+	if (channel >= OPL_MODULATOR_MAX_CHANNELS || modulations[channel].depth == 0) {
+		return;
+	}
+
+	OPLModulation& modulation = modulations[channel];
+	if (modulation.lastFNumber >= 0 && opl2->getFNumber(channel) == modulation.lastFNumber) {
+		setFNumber(channel, modulation.baseFNumber);
+	}
+	modulation.depth = 0;
+	modulation.lastFNumber = -1;
+}
+
+
+/**
+ * Stop the modulation of all channels.
+ */
+void OPLModulator::stopAll() {
+	for (byte i = 0; i < OPL_MODULATOR_MAX_CHANNELS; i ++) {
+		stopModulation(i);
+	}
+}
+
+
+/**
+ * Get the modulation depth of a channel, 0 when the channel is not modulated.
+ */
+byte OPLModulator::getDepth(byte channel) {
+	return channel < OPL_MODULATOR_MAX_CHANNELS ? modulations[channel].depth : 0;
+}
+
+
+/**
+ * Get the modulation rate of a channel in steps of 0.1 Hz.
+ */
+byte OPLModulator::getRate(byte channel) {
+	return channel < OPL_MODULATOR_MAX_CHANNELS ? modulations[channel].rate : 0;
+}
+
+
+/**
+ * Update the modulation of all channels when a control tick is due. Call this as often as possible from the main loop.
+ * When the modulator falls behind the missed ticks are caught up with a single update.
+ *
+ * @return True if the modulation was updated.
+ */
+bool OPLModulator::update() {
+	unsigned long elapsed = micros() - lastTick;
+	if (elapsed < OPL_MODULATOR_TICK) {
+		return false;
+	}
+
+	unsigned int ticks;
+	if (elapsed < OPL_MODULATOR_TICK * OPL_MODULATOR_CONTROL_RATE) {
+		ticks = elapsed / OPL_MODULATOR_TICK;
+		lastTick += ticks * OPL_MODULATOR_TICK;
+	} else {
+		ticks = 1;
+		lastTick = micros();
+	}
+
+	byte numChannels = opl2->getNumChannels();
+	if (numChannels > OPL_MODULATOR_MAX_CHANNELS) {
+		numChannels = OPL_MODULATOR_MAX_CHANNELS;
+	}
+	for (byte i = 0; i < numChannels; i ++) {
+		if (modulations[i].depth > 0) {
+			modulate(i, ticks);
+		}
+	}
+	return true;
+}
+
+
+/**
+ * Advance the LFO of a channel and set the modulated F-number when it changes.
+ *
+ * @param channel - The channel to modulate.
+ * @param ticks - The number of control ticks that have passed.
+ */
+void OPLModulator::modulate(byte channel, unsigned int ticks) {
+	OPLModulation& modulation = modulations[channel];
+
+	// Anything else that changed the F-number played a new note, so it becomes the base of the modulation.
+	short fNumber = opl2->getFNumber(channel);
+	if (fNumber != modulation.lastFNumber) {
+		modulation.baseFNumber = fNumber;
+	}
+
+	// A semitone is close to 61 / 1024 of the F-number.
+	modulation.phase += modulation.increment * ticks;
+	long range = ((long)modulation.baseFNumber * 61 * modulation.depth) >> 10;
+	short target = modulation.baseFNumber + (short)((range * getSine(modulation.phase)) >> 16);
+	target = target < 0 ? 0 : (target > 1023 ? 1023 : target);
+
+	if (target != fNumber) {
+		setFNumber(channel, target);
+	}
+	modulation.lastFNumber = target;
+}
+
+
+/**
+ * Set the F-number of a channel, only writing the registers whose value changes.
+ *
+ * @param channel - The channel to set the F-number of.
+ * @param fNumber - The F-number [0, 1023].
+ */
+void OPLModulator::setFNumber(byte channel, short fNumber) {
+	byte fNumberLow = fNumber & 0xFF;
+	byte blockFNumberHigh = (opl2->getChannelRegister(0xB0, channel) & 0xFC) + ((fNumber & 0x0300) >> 8);
+
+	if (opl2->getChannelRegister(0xA0, channel) != fNumberLow) {
+		opl2->setChannelRegister(0xA0, channel, fNumberLow);
+	}
+	if (opl2->getChannelRegister(0xB0, channel) != blockFNumberHigh) {
+		opl2->setChannelRegister(0xB0, channel, blockFNumberHigh);
+	}
+}
+
+
+/**
+ * Get the sine of the given phase from the sine table.
+ *
+ * @param phase - The phase, where a full cycle is 65536.
+ * @return The sine scaled to [-255, 255].
+ */
+short OPLModulator::getSine(unsigned short phase) {
+	byte index = (phase >> 8) & 0x3F;
+	byte quarter = phase >> 14;
+	if (quarter & 0x01) {
+		index = 63 - index;
+	}
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		short sine = pgm_read_byte_near(modulatorSineTable + index);
+	#else
+		short sine = modulatorSineTable[index];
+	#endif
+	return quarter & 0x02 ? -sine : sine;
+}
@@ -0,0 +1,54 @@
+#include "OPL2.h"
+
+#ifndef OPL_MODULATOR_LIB_H_
+	#define OPL_MODULATOR_LIB_H_
+
+	// Maximum number of channels that can be modulated. Lower this to save memory on small boards.
+	#ifndef OPL_MODULATOR_MAX_CHANNELS
+		#define OPL_MODULATOR_MAX_CHANNELS 36
+	#endif
+
+	// Number of times per second the modulation is updated.
+	#ifndef OPL_MODULATOR_CONTROL_RATE
+		#define OPL_MODULATOR_CONTROL_RATE 200
+	#endif
+
+	#define OPL_MODULATOR_TICK (1000000UL / OPL_MODULATOR_CONTROL_RATE)
+
+
+	struct OPLModulation {
+		short baseFNumber;				// F-number of the note without modulation.
+		short lastFNumber;				// F-number that was last set by the modulator, -1 when the note has changed.
+		unsigned short phase;			// Phase of the LFO, a full cycle is 65536.
+		unsigned short increment;		// Phase increment per control tick.
+		byte depth;						// Depth [0, 255] where 255 bends the note up and down by a semitone.
+		byte rate;						// Rate of the LFO in steps of 0.1 Hz.
+	};
+
+
+	/**
+	 * Software LFO that adds vibrato to any channel of an OPL2, OPL3 or OPL3 Duo. The modulation is updated at a fixed
+	 * control rate with integer math and a sine table, and A0 and B0 are only written when the modulated F-number
+	 * changes. Notes can be played as usual: when the F-number of a channel is changed by anything other than the
+	 * modulator, the new F-number is used as the base of the modulation.
+	 */
+	class OPLModulator {
+		public:
+			OPLModulator(OPL2* opl2);
+			void setModulation(byte channel, byte depth, byte rate);
+			void stopModulation(byte channel);
+			void stopAll();
+			byte getDepth(byte channel);
+			byte getRate(byte channel);
+			bool update();
+
+		private:
+			void modulate(byte channel, unsigned int ticks);
+			void setFNumber(byte channel, short fNumber);
+			short getSine(unsigned short phase);
+
+			OPL2* opl2;
+			OPLModulation modulations[OPL_MODULATOR_MAX_CHANNELS];
+			unsigned long lastTick = 0;
+	};
+#endif
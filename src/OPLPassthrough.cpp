@@ -0,0 +1,203 @@
+/**
+ * Serial passthrough for the OPL2 Audio Board and OPL3 Duo. Receives frames of timed register writes from a host and
+ * uses credit based flow control, so the host never sends more data than fits in the receive buffer.
+ */
+
+#include "OPLPassthrough.h"
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+
+
+/**
+ * Create a passthrough to an OPL2. Writes to other banks than bank 0 are ignored.
+ *
+ * @param opl2 - The OPL2 to write to.
+ * @param serial - The serial port of the host.
+ */
+OPLPassthrough::OPLPassthrough(OPL2* opl2, Stream* serial) {
+	this->opl2 = opl2;
+	this->opl3 = NULL;
+	this->serial = serial;
+}
+
+
+/**
+ * Create a passthrough to an OPL3 or OPL3 Duo.
+ *
+ * @param opl3 - The OPL3 or OPL3 Duo to write to.
+ * @param serial - The serial port of the host.
+ */
+OPLPassthrough::OPLPassthrough(OPL3* opl3, Stream* serial) {
+	this->opl2 = opl3;
+	this->opl3 = opl3;
+	this->serial = serial;
+}
+
+
+/**
+ * Clear the receive buffer and give the host credits for the whole buffer. The serial port and the chip must be
+ * initialized first.
+ */
+void OPLPassthrough::begin() {
+	head = 0;
+	tail = 0;
+	credits = 0;
+	frameTime = micros();
+	numFrames = 0;
+	numErrors = 0;
+	grantCredits();
+}
+
+
+/**
+ * Receive data from the host and make the writes of all frames that are due. Call this as often as possible from the
+ * main loop.
+ */
+void OPLPassthrough::update() {
+	receive();
+	while (processFrame()) {
+		receive();
+	}
+	grantCredits();
+}
+
+
+/**
+ * Get the number of frames that have been played.
+ */
+unsigned long OPLPassthrough::getNumFrames() {
+	return numFrames;
+}
+
+
+/**
+ * Get the number of frames that were dropped because of a bad checksum or size.
+ */
+unsigned long OPLPassthrough::getNumErrors() {
+	return numErrors;
+}
+
+
+/**
+ * Move received bytes from the serial port into the receive buffer while there is room.
+ */
+void OPLPassthrough::receive() {
+	while (head - tail < OPL_PASSTHROUGH_BUFFER_SIZE && serial->available() > 0) {
+		buffer[head & (OPL_PASSTHROUGH_BUFFER_SIZE - 1)] = serial->read();
+		head ++;
+		if (credits > 0) {
+			credits --;
+		}
+	}
+}
+
+
+/**
+ * Give the host credits for the free space in the buffer that it has not been given credits for yet. Credits are sent
+ * once a quarter of the buffer is free, or right away when the host has no credits left.
+ */
+void OPLPassthrough::grantCredits() {
+	unsigned int freeSpace = OPL_PASSTHROUGH_BUFFER_SIZE - (head - tail) - credits;
+	if (freeSpace >= OPL_PASSTHROUGH_BUFFER_SIZE / 4 || (credits == 0 && freeSpace > 0)) {
+		serial->write(OPL_PASSTHROUGH_CREDIT);
+		serial->write(freeSpace & 0xFF);
+		serial->write(freeSpace >> 8);
+		credits += freeSpace;
+	}
+}
+
+
+/**
+ * Make the writes of the frame at the start of the buffer once the whole frame has been received and it is due. Any
+ * bytes before the frame's sync byte are skipped.
+ *
+ * @return True if a frame was played or dropped, false when the next frame is not complete or not yet due.
+ */
+bool OPLPassthrough::processFrame() {
+	while (head != tail && peek(0) != OPL_PASSTHROUGH_SYNC) {
+		tail ++;
+	}
+	if (head - tail < OPL_PASSTHROUGH_HEADER_SIZE) {
+		return false;
+	}
+
+	byte numWrites = peek(1);
+	unsigned int frameSize = OPL_PASSTHROUGH_HEADER_SIZE + numWrites * 3 + 1;
+	if (frameSize > OPL_PASSTHROUGH_BUFFER_SIZE) {
+		sendError(OPL_PASSTHROUGH_ERROR_SIZE);
+		tail ++;
+		return true;
+	}
+	if (head - tail < frameSize) {
+		return false;
+	}
+
+	byte checksum = 0;
+	for (unsigned int i = 1; i < frameSize - 1; i ++) {
+		checksum += peek(i);
+	}
+	if (checksum != peek(frameSize - 1)) {
+		sendError(OPL_PASSTHROUGH_ERROR_CHECKSUM);
+		tail ++;
+		return true;
+	}
+
+	unsigned long now = micros();
+	unsigned long due = frameTime + (peek(2) | ((unsigned int)peek(3) << 8));
+	if ((long)(now - due) < 0) {
+		return false;
+	}
+	frameTime = now - due > OPL_PASSTHROUGH_MAX_LATE ? now : due;
+
+	// Keep receiving while the chip is busy with the previous write.
+	for (unsigned int i = OPL_PASSTHROUGH_HEADER_SIZE; i < frameSize - 1; i += 3) {
+		while (!opl2->isWriteReady()) {
+			receive();
+		}
+		write(peek(i), peek(i + 1), peek(i + 2));
+	}
+
+	tail += frameSize;
+	numFrames ++;
+	return true;
+}
+
+
+/**
+ * Tell the host that a frame was dropped.
+ *
+ * @param error - The error code.
+ */
+void OPLPassthrough::sendError(byte error) {
+	serial->write(OPL_PASSTHROUGH_ERROR);
+	serial->write(error);
+	numErrors ++;
+}
+
+
+/**
+ * Write a register of the chip.
+ *
+ * @param bank - The bank (A1) of the register in bit 0 and the synth unit (A2) in bit 1.
+ * @param reg - The register to write.
+ * @param value - The value to write.
+ */
+void OPLPassthrough::write(byte bank, byte reg, byte value) {
+	if (opl3 != NULL) {
+		opl3->write(bank & 0x03, reg, value);
+	} else if ((bank & 0x03) == 0) {
+		opl2->write(reg, value);
+	}
+}
+
+
+/**
+ * Get a byte from the receive buffer.
+ *
+ * @param offset - Offset of the byte from the oldest byte in the buffer.
+ */
+byte OPLPassthrough::peek(unsigned int offset) {
+	return buffer[(tail + offset) & (OPL_PASSTHROUGH_BUFFER_SIZE - 1)];
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include "OPL3.h"
+
+#ifndef OPL_PASSTHROUGH_LIB_H_
+	#define OPL_PASSTHROUGH_LIB_H_
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		// Size of the receive buffer in bytes. The size must be a power of 2 and limits the size of a frame.
+		#ifndef OPL_PASSTHROUGH_BUFFER_SIZE
+			#if defined(__AVR__)
+				#define OPL_PASSTHROUGH_BUFFER_SIZE 256
+			#else
+				#define OPL_PASSTHROUGH_BUFFER_SIZE 2048
+			#endif
+		#endif
+
+		// A frame that is more than this many microseconds late restarts the timing instead of being caught up on.
+		#ifndef OPL_PASSTHROUGH_MAX_LATE
+			#define OPL_PASSTHROUGH_MAX_LATE 50000
+		#endif
+
+		// Frames from the host:
+		//     0xA5 | number of writes n | delay low | delay high | n x (bank, register, value) | checksum
+		// The delay is the number of microseconds between the previous frame and this one, so a frame without writes
+		// is a pause. The checksum is the sum of all bytes after the sync byte. Bit 0 of the bank selects the register
+		// bank and bit 1 the synth unit of an OPL3 Duo.
+		#define OPL_PASSTHROUGH_SYNC        0xA5
+		#define OPL_PASSTHROUGH_HEADER_SIZE 4
+
+		// Messages to the host:
+		//     0xC5 | credits low | credits high    The host may send this many more bytes.
+		//     0xE5 | error code                    A frame was dropped.
+		#define OPL_PASSTHROUGH_CREDIT         0xC5
+		#define OPL_PASSTHROUGH_ERROR          0xE5
+		#define OPL_PASSTHROUGH_ERROR_CHECKSUM 0x01
+		#define OPL_PASSTHROUGH_ERROR_SIZE     0x02
+
+
+		/**
+		 * Passthrough of register writes from a host over serial, for example from a tracker or DosBox. Writes arrive
+		 * in frames that carry any number of writes and the time at which they are to be made. Received data is kept
+		 * in a ring buffer that is also filled while the passthrough waits for the chip, and the host is given credits
+		 * for the free space in the buffer, so no bytes are lost at high baud rates. On begin the host receives credits
+		 * for the whole buffer, which is also the largest frame it can send.
+		 */
+		class OPLPassthrough {
+			public:
+				OPLPassthrough(OPL2* opl2, Stream* serial);
+				OPLPassthrough(OPL3* opl3, Stream* serial);
+				void begin();
+				void update();
+
+				unsigned long getNumFrames();
+				unsigned long getNumErrors();
+
+			private:
+				void receive();
+				void grantCredits();
+				bool processFrame();
+				void sendError(byte error);
+				void write(byte bank, byte reg, byte value);
+				byte peek(unsigned int offset);
+
+				OPL2* opl2;
+				OPL3* opl3;
+				Stream* serial;
+
+				byte buffer[OPL_PASSTHROUGH_BUFFER_SIZE];
+				unsigned int head = 0;
+				unsigned int tail = 0;
+				unsigned int credits = 0;
+				unsigned long frameTime = 0;
+
+				unsigned long numFrames = 0;
+				unsigned long numErrors = 0;
+		};
+	#endif
+#endif
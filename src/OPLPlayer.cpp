@@ -0,0 +1,1698 @@
+/**
+ * Streaming player for VGM, DRO, IMF and OPE songs. Song data is read from an OPLStream through a double buffered window,
+ * so songs of any size can be played in a fixed amount of memory on both Arduino and Raspberry Pi. On platforms with
+ * zlib compressed VGZ files are inflated while they are being played.
+ *
+ * VGM file format: https://vgmrips.net/wiki/VGM_Specification
+ * DRO file format: https://www.shikadi.net/moddingwiki/DRO_Format
+ * IMF file format: https://www.shikadi.net/moddingwiki/IMF_Format
+ */
+
+#include "OPLPlayer.h"
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	/**
+	 * Create a stream of song data that is held in memory.
+	 *
+	 * @param data - Pointer to the song data.
+	 * @param length - Length of the song data in bytes.
+	 * @param fromProgmem - Set to true when the song data is stored in PROGMEM.
+	 */
+	OPLMemoryStream::OPLMemoryStream(const byte* data, unsigned long length, bool fromProgmem) {
+		this->data = data;
+		this->length = length;
+		this->fromProgmem = fromProgmem;
+	}
+#else
+	/**
+	 * Create a stream of song data that is held in memory.
+	 *
+	 * @param data - Pointer to the song data.
+	 * @param length - Length of the song data in bytes.
+	 */
+	OPLMemoryStream::OPLMemoryStream(const byte* data, unsigned long length) {
+		this->data = data;
+		this->length = length;
+	}
+#endif
+
+
+/**
+ * Read up to length bytes from the current position into the given buffer.
+ */
+unsigned int OPLMemoryStream::read(byte* buffer, unsigned int length) {
+	unsigned long numAvailable = this->length - position;
+	unsigned int numRead = numAvailable < length ? numAvailable : length;
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		if (fromProgmem) {
+			for (unsigned int i = 0; i < numRead; i ++) {
+				buffer[i] = pgm_read_byte(data + position + i);
+			}
+		} else {
+			memcpy(buffer, data + position, numRead);
+		}
+	#else
+		memcpy(buffer, data + position, numRead);
+	#endif
+
+	position += numRead;
+	return numRead;
+}
+
+
+/**
+ * Move the read position to the given byte offset from the start of the data.
+ */
+bool OPLMemoryStream::seek(unsigned long position) {
+	if (position > length) {
+		return false;
+	}
+
+	this->position = position;
+	return true;
+}
+
+
+/**
+ * Get direct access to the song data. Data in PROGMEM can not be accessed directly.
+ */
+const byte* OPLMemoryStream::getData(unsigned long& length) {
+	length = this->length;
+	return fromProgmem ? NULL : data;
+}
+
+
+/**
+ * Create an output to a buffer in memory.
+ *
+ * @param buffer - Buffer to receive the data.
+ * @param size - Size of the buffer in bytes.
+ */
+OPLMemoryOutputStream::OPLMemoryOutputStream(byte* buffer, unsigned long size) {
+	this->buffer = buffer;
+	this->size = size;
+}
+
+
+/**
+ * Append the given data to the buffer.
+ */
+bool OPLMemoryOutputStream::write(const byte* data, unsigned int length) {
+	if (size - this->length < length) {
+		return false;
+	}
+
+	memcpy(buffer + this->length, data, length);
+	this->length += length;
+	return true;
+}
+
+
+/**
+ * Get the number of bytes written to the buffer.
+ */
+unsigned long OPLMemoryOutputStream::getLength() {
+	return length;
+}
+
+
+/**
+ * Create a writer of an OPE event stream.
+ *
+ * @param output - Destination of the OPE stream.
+ */
+OPLEventWriter::OPLEventWriter(OPLOutputStream* output) {
+	this->output = output;
+}
+
+
+/**
+ * Start the event stream by writing its header.
+ *
+ * @param tickRate - Number of ticks per second of the delays in the stream.
+ * @return True if the header was written.
+ */
+bool OPLEventWriter::begin(unsigned long tickRate) {
+	byte header[OPE_HEADER_SIZE] = { 'O', 'P', 'L', 'E', OPE_VERSION,
+		(byte)tickRate, (byte)(tickRate >> 8), (byte)(tickRate >> 16), (byte)(tickRate >> 24)
+	};
+	success = output->write(header, sizeof(header));
+	runLength = 0;
+	pendingDelay = 0;
+	return success;
+}
+
+
+/**
+ * An event stream has no chip to reset, so a hard reset of the chip is not recorded.
+ */
+void OPLEventWriter::reset() {
+}
+
+
+/**
+ * Add a register write to the event stream.
+ *
+ * @param bank - The bank of the register.
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
+ */
+void OPLEventWriter::write(byte bank, byte reg, byte value) {
+	writeDelay();
+	if (runLength == 16 || (runLength > 0 && bank != runBank)) {
+		writeRun();
+	}
+
+	runBank = bank;
+	run[1 + runLength * 2] = reg;
+	run[2 + runLength * 2] = value;
+	runLength ++;
+}
+
+
+/**
+ * Add a delay to the event stream. The delay is merged with any delay that directly precedes it.
+ *
+ * @param ticks - Length of the delay in ticks.
+ */
+void OPLEventWriter::delay(unsigned long ticks) {
+	pendingDelay += ticks;
+}
+
+
+/**
+ * Mark the current position of the event stream as the point where the song is repeated from.
+ */
+void OPLEventWriter::setLoopPoint() {
+	writeDelay();
+	writeRun();
+
+	byte command = OPE_CMD_LOOP;
+	success = success && output->write(&command, 1);
+}
+
+
+/**
+ * End the event stream. Any pending writes and delay are written first.
+ *
+ * @return True if the whole event stream was written.
+ */
+bool OPLEventWriter::end() {
+	writeDelay();
+	writeRun();
+
+	byte command = OPE_CMD_END;
+	success = success && output->write(&command, 1);
+	return success;
+}
+
+
+/**
+ * Did writing to the output fail?
+ */
+bool OPLEventWriter::hasError() {
+	return !success;
+}
+
+
+/**
+ * Write the writes that are grouped in the current run to the output.
+ */
+void OPLEventWriter::writeRun() {
+	if (runLength > 0) {
+		run[0] = OPE_CMD_WRITE | (runBank << 4) | (runLength - 1);
+		success = success && output->write(run, 1 + runLength * 2);
+		runLength = 0;
+	}
+}
+
+
+/**
+ * Write the pending delay to the output. Runs of writes go before the delay.
+ */
+void OPLEventWriter::writeDelay() {
+	if (pendingDelay == 0) {
+		return;
+	}
+
+	writeRun();
+	byte command[5];
+	byte length = 1;
+	unsigned long ticks = pendingDelay;
+	if (ticks <= 128) {
+		command[0] = OPE_CMD_DELAY | (ticks - 1);
+	} else {
+		command[0] = ticks <= 0xFFFF ? OPE_CMD_DELAY_16 : OPE_CMD_DELAY_32;
+		for (length = 1; length < (pendingDelay <= 0xFFFF ? 3 : 5); length ++) {
+			command[length] = ticks & 0xFF;
+			ticks >>= 8;
+		}
+	}
+	success = success && output->write(command, length);
+	pendingDelay = 0;
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	/**
+	 * Create a stream of song data from a file that was opened for reading in binary mode.
+	 *
+	 * @param file - The file to read from.
+	 */
+	OPLFileStream::OPLFileStream(FILE* file) {
+		this->file = file;
+	}
+
+
+	/**
+	 * Read up to length bytes from the current position of the file into the given buffer.
+	 */
+	unsigned int OPLFileStream::read(byte* buffer, unsigned int length) {
+		return fread(buffer, 1, length, file);
+	}
+
+
+	/**
+	 * Move the read position of the file to the given byte offset.
+	 */
+	bool OPLFileStream::seek(unsigned long position) {
+		return fseek(file, position, SEEK_SET) == 0;
+	}
+
+
+	/**
+	 * Map the given file into memory. VGZ and other gzip compressed files are inflated into an anonymous mapping, so
+	 * they can be played without a temporary file. Use isOpen to check whether the file could be mapped.
+	 *
+	 * @param fileName - Path of the file to map.
+	 */
+	OPLMappedFileStream::OPLMappedFileStream(const char* fileName) {
+		int file = open(fileName, O_RDONLY);
+		if (file < 0) {
+			return;
+		}
+
+		struct stat fileStat;
+		if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0) {
+			void* mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapping != MAP_FAILED) {
+				data = (byte*)mapping;
+				length = fileStat.st_size;
+				mappingSize = fileStat.st_size;
+				madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+			}
+		}
+		close(file);
+
+		#ifdef OPL_PLAYER_ZLIB
+			if (length >= 18 && data[0] == 0x1F && data[1] == 0x8B && !inflateMapping()) {
+				unmap();
+			}
+		#endif
+	}
+
+
+	/**
+	 * Unmap the file.
+	 */
+	OPLMappedFileStream::~OPLMappedFileStream() {
+		unmap();
+	}
+
+
+	/**
+	 * Was the file mapped successfully?
+	 */
+	bool OPLMappedFileStream::isOpen() {
+		return data != NULL;
+	}
+
+
+	/**
+	 * Copy up to length bytes from the current position into the given buffer.
+	 */
+	unsigned int OPLMappedFileStream::read(byte* buffer, unsigned int length) {
+		unsigned long numAvailable = this->length - position;
+		unsigned int numRead = numAvailable < length ? numAvailable : length;
+		memcpy(buffer, data + position, numRead);
+		position += numRead;
+		return numRead;
+	}
+
+
+	/**
+	 * Move the read position to the given byte offset.
+	 */
+	bool OPLMappedFileStream::seek(unsigned long position) {
+		if (position > length) {
+			return false;
+		}
+
+		this->position = position;
+		return true;
+	}
+
+
+	/**
+	 * Get direct access to the mapped song data.
+	 */
+	const byte* OPLMappedFileStream::getData(unsigned long& length) {
+		length = this->length;
+		return data;
+	}
+
+
+	/**
+	 * Release the mapping.
+	 */
+	void OPLMappedFileStream::unmap() {
+		if (data != NULL) {
+			munmap(data, mappingSize);
+		}
+		data = NULL;
+		length = 0;
+		mappingSize = 0;
+	}
+
+
+	#ifdef OPL_PLAYER_ZLIB
+		/**
+		 * Replace the mapping of compressed data by an anonymous mapping of the inflated data. The inflated size is
+		 * taken from the gzip trailer and the mapping is grown when the data turns out to be larger.
+		 *
+		 * @return True if the data was inflated.
+		 */
+		bool OPLMappedFileStream::inflateMapping() {
+			unsigned long sizeHint = data[length - 4] + (data[length - 3] << 8) + (data[length - 2] << 16) +
+				((unsigned long)data[length - 1] << 24);
+			size_t inflatedSize = sizeHint > 0 ? sizeHint : length * 4;
+			void* mapping = mmap(NULL, inflatedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mapping == MAP_FAILED) {
+				return false;
+			}
+
+			z_stream inflater;
+			memset(&inflater, 0, sizeof(z_stream));
+			if (inflateInit2(&inflater, 16 + MAX_WBITS) != Z_OK) {
+				munmap(mapping, inflatedSize);
+				return false;
+			}
+
+			inflater.next_in = data;
+			inflater.avail_in = length;
+			int result = Z_OK;
+			while (result == Z_OK) {
+				if (inflater.total_out == inflatedSize) {
+					void* grown = mremap(mapping, inflatedSize, inflatedSize * 2, MREMAP_MAYMOVE);
+					if (grown == MAP_FAILED) {
+						break;
+					}
+					mapping = grown;
+					inflatedSize *= 2;
+				}
+
+				inflater.next_out = (byte*)mapping + inflater.total_out;
+				inflater.avail_out = inflatedSize - inflater.total_out;
+				result = inflate(&inflater, Z_NO_FLUSH);
+			}
+
+			unsigned long inflatedLength = inflater.total_out;
+			inflateEnd(&inflater);
+			if (result != Z_STREAM_END) {
+				munmap(mapping, inflatedSize);
+				return false;
+			}
+
+			munmap(data, mappingSize);
+			data = (byte*)mapping;
+			length = inflatedLength;
+			mappingSize = inflatedSize;
+			mprotect(mapping, mappingSize, PROT_READ);
+			return true;
+		}
+	#endif
+
+
+	/**
+	 * Create an output to a file that was opened for writing in binary mode.
+	 *
+	 * @param file - The file to write to.
+	 */
+	OPLFileOutputStream::OPLFileOutputStream(FILE* file) {
+		this->file = file;
+	}
+
+
+	/**
+	 * Write the given data to the file.
+	 */
+	bool OPLFileOutputStream::write(const byte* data, unsigned int length) {
+		return fwrite(data, 1, length, file) == length;
+	}
+#endif
+
+
+#ifdef OPL_PLAYER_ZLIB
+	/**
+	 * Create a stream that inflates the gzip compressed data of the given source stream.
+	 *
+	 * @param source - Stream of compressed data.
+	 */
+	OPLGzipStream::OPLGzipStream(OPLStream* source) {
+		this->source = source;
+		restart();
+	}
+
+
+	/**
+	 * Release the zlib state.
+	 */
+	OPLGzipStream::~OPLGzipStream() {
+		if (inflaterReady) {
+			inflateEnd(&inflater);
+		}
+	}
+
+
+	/**
+	 * Inflate up to length bytes into the given buffer.
+	 */
+	unsigned int OPLGzipStream::read(byte* buffer, unsigned int length) {
+		if (!inflaterReady || streamEnded) {
+			return 0;
+		}
+
+		inflater.next_out = buffer;
+		inflater.avail_out = length;
+		while (inflater.avail_out > 0) {
+			if (inflater.avail_in == 0) {
+				inflater.next_in = input;
+				inflater.avail_in = source->read(input, sizeof(input));
+				if (inflater.avail_in == 0) {
+					break;
+				}
+			}
+
+			// Stop at the end of the compressed data or on a data error.
+			if (inflate(&inflater, Z_NO_FLUSH) != Z_OK) {
+				streamEnded = true;
+				break;
+			}
+		}
+
+		unsigned int numRead = length - inflater.avail_out;
+		position += numRead;
+		return numRead;
+	}
+
+
+	/**
+	 * Move to the given position in the inflated data. Seeking forward inflates and discards the data in between.
+	 * Seeking backwards restarts inflation from the start.
+	 */
+	bool OPLGzipStream::seek(unsigned long position) {
+		if (position < this->position && !restart()) {
+			return false;
+		}
+
+		byte discard[64];
+		while (this->position < position) {
+			unsigned long numSkip = position - this->position;
+			if (read(discard, numSkip < sizeof(discard) ? numSkip : sizeof(discard)) == 0) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+	/**
+	 * Does the given stream hold gzip compressed data? The read position of the stream is moved back to the start.
+	 *
+	 * @param source - The stream to test.
+	 * @return True if the stream starts with the gzip signature.
+	 */
+	bool OPLGzipStream::isCompressed(OPLStream* source) {
+		byte signature[2] = { 0x00, 0x00 };
+		source->seek(0);
+		source->read(signature, 2);
+		source->seek(0);
+		return signature[0] == 0x1F && signature[1] == 0x8B;
+	}
+
+
+	/**
+	 * Restart inflation from the start of the compressed data.
+	 */
+	bool OPLGzipStream::restart() {
+		if (inflaterReady) {
+			inflateEnd(&inflater);
+			inflaterReady = false;
+		}
+
+		position = 0;
+		streamEnded = false;
+		if (!source->seek(0)) {
+			return false;
+		}
+
+		memset(&inflater, 0, sizeof(z_stream));
+		inflaterReady = inflateInit2(&inflater, 16 + MAX_WBITS) == Z_OK;
+		return inflaterReady;
+	}
+#endif
+
+
+/**
+ * Service all given players that are playing.
+ *
+ * @param players - The players to service.
+ * @param numPlayers - The number of players.
+ * @return The time in microseconds until the first of the players needs to be serviced again, 0 when one of them has
+ *         more work due right away or none is playing.
+ */
+unsigned long OPLPlayable::serviceAll(OPLPlayable* players[], byte numPlayers) {
+	unsigned long wait = 0;
+	bool isPlaying = false;
+
+	for (byte i = 0; i < numPlayers; i ++) {
+		if (players[i]->isPlaying()) {
+			unsigned long playerWait = players[i]->service();
+			if (players[i]->isPlaying() && (!isPlaying || playerWait < wait)) {
+				wait = playerWait;
+				isPlaying = true;
+			}
+		}
+	}
+
+	return wait;
+}
+
+
+/**
+ * Create a player for songs on an OPL2.
+ *
+ * @param opl2Ref - The OPL2 to play on.
+ */
+OPLPlayer::OPLPlayer(OPL2* opl2Ref) {
+	opl2 = opl2Ref;
+	numBanks = 1;
+}
+
+
+/**
+ * Create a player for songs on an OPL3. Both register banks are available to the song.
+ *
+ * @param opl3Ref - The OPL3 to play on.
+ */
+OPLPlayer::OPLPlayer(OPL3* opl3Ref) {
+	opl2 = opl3Ref;
+	opl3 = opl3Ref;
+	numBanks = 2;
+}
+
+
+/**
+ * Create a player for songs on an OPL3 Duo. Writes for a second chip in dual chip songs are sent to synth unit 1.
+ *
+ * @param opl3DuoRef - The OPL3 Duo to play on.
+ */
+OPLPlayer::OPLPlayer(OPL3Duo* opl3DuoRef) {
+	opl2 = opl3DuoRef;
+	opl3 = opl3DuoRef;
+	numBanks = 4;
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	/**
+	 * Stop the real-time writer thread when the player is destroyed.
+	 */
+	OPLPlayer::~OPLPlayer() {
+		stopRealtimeWriter();
+	}
+
+
+	/**
+	 * Send all register writes from a dedicated real-time writer thread. From now on poll() only decodes the song and
+	 * queues its register writes ahead of time, together with the time at which each write is due. The writer thread
+	 * takes them from a lock free queue and sends them to the chip on time, so neither reading the song nor the process
+	 * calling poll() being descheduled can delay a register write.
+	 *
+	 * The writer thread is scheduled with SCHED_FIFO and all memory of the process is locked, so it is not delayed by
+	 * other processes or page faults. This requires root or CAP_SYS_NICE and CAP_IPC_LOCK. Without these the writer
+	 * thread is still used, but at normal priority.
+	 *
+	 * @param priority - SCHED_FIFO priority of the writer thread [1, 99].
+	 * @return True if the writer thread runs with real-time priority and locked memory.
+	 */
+	bool OPLPlayer::startRealtimeWriter(int priority) {
+		if (realtimeRunning) {
+			return true;
+		}
+
+		bool memoryLocked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+
+		realtimeHead = 0;
+		realtimeTail = 0;
+		realtimeFlush = false;
+		realtimeRunning = true;
+		realtimeThread = std::thread(&OPLPlayer::processRealtimeQueue, this);
+
+		struct sched_param parameters;
+		memset(&parameters, 0, sizeof(parameters));
+		parameters.sched_priority = priority;
+		bool scheduled = pthread_setschedparam(realtimeThread.native_handle(), SCHED_FIFO, &parameters) == 0;
+
+		return memoryLocked && scheduled;
+	}
+
+
+	/**
+	 * Stop the real-time writer thread. Register writes that are still queued are discarded and register writes are
+	 * sent from poll() again.
+	 */
+	void OPLPlayer::stopRealtimeWriter() {
+		if (!realtimeRunning) {
+			return;
+		}
+
+		realtimeRunning = false;
+		realtimeThread.join();
+		realtimeHead = 0;
+		realtimeTail = 0;
+		munlockall();
+	}
+#endif
+
+
+/**
+ * Load a song from the given stream and detect its format. VGM, DRO and OPE files are recognized by their signature,
+ * any other data is loaded as an IMF file at the default speed.
+ *
+ * @param stream - Stream of song data.
+ * @return True if the song was loaded.
+ */
+bool OPLPlayer::load(OPLStream* stream) {
+	byte signature[8];
+	open(stream);
+	unsigned int length = readHeader(signature, 8);
+
+	if (length >= 4 && memcmp(signature, "Vgm ", 4) == 0) {
+		return loadVGM(stream);
+	} else if (length == 8 && memcmp(signature, "DBRAWOPL", 8) == 0) {
+		return loadDRO(stream);
+	} else if (length >= 4 && memcmp(signature, "OPLE", 4) == 0) {
+		return loadOPE(stream);
+	}
+	return loadIMF(stream);
+}
+
+
+/**
+ * Load a VGM song for the YM3812, YM3526, Y8950 or YMF262 from the given stream.
+ *
+ * @param stream - Stream of VGM data. Use an OPLGzipStream to play VGZ files.
+ * @return True if the song was loaded.
+ */
+bool OPLPlayer::loadVGM(OPLStream* stream) {
+	byte header[0x60];
+	open(stream);
+	memset(header, 0, sizeof(header));
+	unsigned int length = readHeader(header, sizeof(header));
+	if (length < 0x40 || memcmp(header, "Vgm ", 4) != 0) {
+		return false;
+	}
+
+	// Data offset is only present since version 1.50, header fields past the data offset are song data.
+	unsigned long version = readValue(header + 0x08, 4);
+	unsigned long relativeDataOffset = version >= 0x150 ? readValue(header + 0x34, 4) : 0;
+	dataOffset = relativeDataOffset ? 0x34 + relativeDataOffset : 0x40;
+	if (dataOffset < sizeof(header)) {
+		memset(header + dataOffset, 0, sizeof(header) - dataOffset);
+	}
+
+	if (!readValue(header + 0x50, 4) && !readValue(header + 0x54, 4) && !readValue(header + 0x58, 4) &&
+		!readValue(header + 0x5C, 4)) {
+		return false;
+	}
+
+	dataEnd = 0x04 + readValue(header + 0x04, 4);
+	unsigned long relativeLoopOffset = readValue(header + 0x1C, 4);
+	hasLoop = relativeLoopOffset > 0;
+	loopOffset = 0x1C + relativeLoopOffset;
+
+	setTickRate(44100);
+	format = OPL_PLAYER_FORMAT_VGM;
+	return seek(dataOffset);
+}
+
+
+/**
+ * Load a DOSBox DRO version 2 song from the given stream.
+ *
+ * @param stream - Stream of DRO data.
+ * @return True if the song was loaded.
+ */
+bool OPLPlayer::loadDRO(OPLStream* stream) {
+	byte header[26];
+	open(stream);
+	if (readHeader(header, sizeof(header)) < sizeof(header) || memcmp(header, "DBRAWOPL", 8) != 0 ||
+		readValue(header + 8, 2) != 2) {
+		return false;
+	}
+
+	droShortDelay = header[23];
+	droLongDelay = header[24];
+	droHighBank = header[20] == OPL_DRO_HARDWARE_DUAL_OPL2 ? 2 : 1;
+	byte mapLength = header[25] < 128 ? header[25] : 128;
+	memset(droRegisterMap, 0, sizeof(droRegisterMap));
+	if (readHeader(droRegisterMap, mapLength) < mapLength) {
+		return false;
+	}
+
+	dataOffset = sizeof(header) + header[25];
+	dataEnd = dataOffset + readValue(header + 12, 4) * 2;
+	hasLoop = true;
+	loopOffset = dataOffset;
+
+	setTickRate(1000);
+	format = OPL_PLAYER_FORMAT_DRO;
+	return seek(dataOffset);
+}
+
+
+/**
+ * Load an id Software IMF song from the given stream. Type 1 files start with the length of the song data, type 0
+ * files are played until the end of the stream.
+ *
+ * @param stream - Stream of IMF data.
+ * @param speed - Playback speed of the song in Hz, usually 280, 560 or 700 depending on the game.
+ * @return True if the song was loaded.
+ */
+bool OPLPlayer::loadIMF(OPLStream* stream, unsigned int speed) {
+	byte header[2];
+	open(stream);
+	if (readHeader(header, sizeof(header)) < sizeof(header) || speed == 0) {
+		return false;
+	}
+
+	unsigned long songLength = readValue(header, 2);
+	dataOffset = songLength ? 2 : 0;
+	dataEnd = songLength ? 2 + songLength : 0;
+	hasLoop = true;
+	loopOffset = dataOffset;
+
+	setTickRate(speed);
+	format = OPL_PLAYER_FORMAT_IMF;
+	return seek(dataOffset);
+}
+
+
+/**
+ * Load an OPE event stream, as created by convert(), from the given stream.
+ *
+ * @param stream - Stream of OPE data.
+ * @return True if the song was loaded.
+ */
+bool OPLPlayer::loadOPE(OPLStream* stream) {
+	byte header[OPE_HEADER_SIZE];
+	open(stream);
+	if (readHeader(header, sizeof(header)) < sizeof(header) || memcmp(header, "OPLE", 4) != 0 ||
+		header[4] != OPE_VERSION || readValue(header + 5, 4) == 0) {
+		return false;
+	}
+
+	// The loop point is only known once the loop command has been played.
+	dataOffset = OPE_HEADER_SIZE;
+	dataEnd = 0;
+	hasLoop = false;
+	loopOffset = dataOffset;
+
+	setTickRate(readValue(header + 5, 4));
+	format = OPL_PLAYER_FORMAT_OPE;
+	return seek(dataOffset);
+}
+
+
+/**
+ * Convert the loaded song to an OPE event stream. The song is decoded once at full speed and its register writes and
+ * delays are written to the output, the loop point of the song is kept. Afterwards the song can still be played.
+ *
+ * @param output - Destination of the OPE stream.
+ * @return True if the song was converted.
+ */
+bool OPLPlayer::convert(OPLOutputStream* output) {
+	if (format == OPL_PLAYER_FORMAT_NONE || !seek(dataOffset)) {
+		return false;
+	}
+
+	OPLEventWriter writer(output);
+	writer.begin(tickRate);
+
+	playing = false;
+	converting = true;
+	songEnded = false;
+	opeWritesLeft = 0;
+	loopConverted = false;
+	while (!writer.hasError() && !songEnded) {
+		if (hasLoop && !loopConverted && getPosition() == loopOffset) {
+			writer.setLoopPoint();
+			loopConverted = true;
+		}
+
+		decodeBurst();
+		for (unsigned int i = 0; i < burstLength; i ++) {
+			writer.write(burst[i].bank, burst[i].reg, burst[i].value);
+		}
+		burstLength = 0;
+		writer.delay(burstDelay);
+	}
+	converting = false;
+
+	return writer.end();
+}
+
+
+/**
+ * Start playing the loaded song from the beginning. Call poll() to keep the song playing. Note that the chip is not
+ * reset, so call reset() on the chip first to start the song from a known state.
+ */
+void OPLPlayer::play() {
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		flushRealtimeQueue();
+	#endif
+
+	if (format != OPL_PLAYER_FORMAT_NONE && seek(dataOffset)) {
+		secondStartTime = getTime();
+		nextEventTime = secondStartTime;
+		tickCount = 0;
+		songEnded = false;
+		opeWritesLeft = 0;
+		playing = true;
+		decodeBurst();
+	}
+}
+
+
+/**
+ * Stop playing the song. Any notes that are playing are not silenced.
+ */
+void OPLPlayer::stop() {
+	playing = false;
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		flushRealtimeQueue();
+	#endif
+}
+
+
+/**
+ * Send all register writes that are due to the chip. As soon as a burst of writes is sent the next one is decoded, so
+ * it is ready to go when it is due. When the next burst lies in the future the idle half of the read window is
+ * refilled, so reading from the stream does not delay any register writes. When the real-time writer is running the
+ * decoded bursts are queued for the writer thread instead.
+ */
+void OPLPlayer::poll() {
+	if (!playing) {
+		return;
+	}
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		if (realtimeRunning) {
+			queueBursts();
+		} else
+	#endif
+
+	while (playing && (int32_t)(getTime() - nextEventTime) >= 0) {
+		sendBurst();
+		if (songEnded) {
+			playing = false;
+		} else {
+			addDelay(burstDelay);
+			decodeBurst();
+		}
+	}
+
+	byte idleWindow = activeWindow ^ 1;
+	if (playing && directData == NULL && !windowLoaded[idleWindow]) {
+		fillWindow(idleWindow);
+	}
+}
+
+
+/**
+ * Do a bounded amount of work to keep the song playing. When a burst of register writes is due only that burst is sent
+ * and the next one is decoded, otherwise the idle half of the read window is refilled. When the real-time writer is
+ * running the decoded bursts are queued for the writer thread instead.
+ *
+ * @return The time in microseconds until service() needs to be called again, 0 when the next burst is already due or
+ *         no song is playing.
+ */
+unsigned long OPLPlayer::service() {
+	if (!playing) {
+		return 0;
+	}
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		if (realtimeRunning) {
+			queueBursts();
+			return getTimeToNextEvent();
+		}
+	#endif
+
+	if ((int32_t)(getTime() - nextEventTime) >= 0) {
+		sendBurst();
+		if (songEnded) {
+			playing = false;
+			return 0;
+		}
+		addDelay(burstDelay);
+		decodeBurst();
+	} else {
+		byte idleWindow = activeWindow ^ 1;
+		if (directData == NULL && !windowLoaded[idleWindow]) {
+			fillWindow(idleWindow);
+		}
+	}
+
+	return getTimeToNextEvent();
+}
+
+
+/**
+ * Send the next burst of register writes right away, without waiting for it to be due. This plays the song as fast as
+ * the chip accepts writes, for example to render it offline through an OPLEmulator. Do not mix step() with poll() or
+ * the real-time writer.
+ *
+ * @return The time in microseconds from this burst to the next one, 0 when the song has ended.
+ */
+unsigned long OPLPlayer::step() {
+	if (!playing) {
+		return 0;
+	}
+
+	sendBurst();
+	if (songEnded) {
+		playing = false;
+		return 0;
+	}
+
+	uint32_t burstTime = nextEventTime;
+	addDelay(burstDelay);
+	decodeBurst();
+	return nextEventTime - burstTime;
+}
+
+
+/**
+ * Is a song currently playing? When the real-time writer is used the song is playing until its last register write
+ * is sent.
+ */
+bool OPLPlayer::isPlaying() {
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		if (realtimeRunning && realtimeHead != realtimeTail) {
+			return true;
+		}
+	#endif
+
+	return playing;
+}
+
+
+/**
+ * Get the time until the next burst of register writes is due. This can be used to sleep between calls to poll().
+ * When the real-time writer is used this is the time until half of the queued register writes are sent, so the queue
+ * is topped up well before it runs dry.
+ *
+ * @return The time until the next burst in microseconds, 0 when it is due or no song is playing.
+ */
+unsigned long OPLPlayer::getTimeToNextEvent() {
+	uint32_t now = getTime();
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		if (realtimeRunning) {
+			unsigned int head = realtimeHead.load(std::memory_order_acquire);
+			if (head == realtimeTail.load(std::memory_order_acquire)) {
+				return 0;
+			}
+
+			uint32_t lastTime = realtimeQueue[(head - 1) & (OPL_PLAYER_REALTIME_QUEUE_SIZE - 1)].time;
+			int32_t timeLeft = (int32_t)(lastTime - now) / 2;
+			return timeLeft > 0 ? timeLeft : 0;
+		}
+	#endif
+
+	int32_t timeLeft = nextEventTime - now;
+	return playing && timeLeft > 0 ? timeLeft : 0;
+}
+
+
+/**
+ * Get the format of the loaded song.
+ *
+ * @return One of the OPL_PLAYER_FORMAT_ definitions.
+ */
+byte OPLPlayer::getFormat() {
+	return format;
+}
+
+
+/**
+ * Is the song repeated when it ends?
+ */
+bool OPLPlayer::getLoop() {
+	return loop;
+}
+
+
+/**
+ * Set whether the song is repeated when it ends. VGM songs are repeated from their loop point and only when they have
+ * one, DRO and IMF songs are repeated from the start.
+ *
+ * @param loop - Set to true to repeat the song.
+ */
+void OPLPlayer::setLoop(bool loop) {
+	this->loop = loop;
+}
+
+
+/**
+ * Start reading a new song from the given stream. When all data of the stream is held in memory the song is read
+ * straight from there and the read window is not used.
+ */
+void OPLPlayer::open(OPLStream* stream) {
+	this->stream = stream;
+	directData = stream->getData(directLength);
+	directPosition = 0;
+	format = OPL_PLAYER_FORMAT_NONE;
+	playing = false;
+	windowLoaded[0] = false;
+	windowLoaded[1] = false;
+	windowLength[0] = 0;
+	windowLength[1] = 0;
+	seek(0);
+}
+
+
+/**
+ * Set the number of song ticks per second. The tick duration is kept as the fraction 1000000 / tickRate reduced to its
+ * lowest terms, so converting ticks to microseconds is exact for all common song rates.
+ */
+void OPLPlayer::setTickRate(unsigned long tickRate) {
+	unsigned long a = 1000000UL;
+	unsigned long b = tickRate;
+	while (b) {
+		unsigned long remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+
+	this->tickRate = tickRate;
+	tickMicros = 1000000UL / a;
+	tickDivisor = tickRate / a;
+
+	// Make sure tickCount * tickMicros can not overflow. This only loses precision for unusual tick rates.
+	while (tickMicros > 0xFFFFFFFFUL / tickRate) {
+		tickMicros >>= 1;
+		tickDivisor = (tickDivisor >> 1) ? tickDivisor >> 1 : 1;
+	}
+}
+
+
+/**
+ * Read the given number of header bytes from the current position.
+ *
+ * @return The number of bytes read.
+ */
+unsigned int OPLPlayer::readHeader(byte* header, unsigned int length) {
+	unsigned int numRead = 0;
+	while (numRead < length && readByte(header[numRead])) {
+		numRead ++;
+	}
+	return numRead;
+}
+
+
+/**
+ * Get the stream offset of the next byte to be read.
+ */
+unsigned long OPLPlayer::getPosition() {
+	if (directData != NULL) {
+		return directPosition;
+	}
+	return windowPosition[activeWindow] + readIndex;
+}
+
+
+/**
+ * Move the read position to the given stream offset. When the position lies within the read window no data is
+ * reloaded, so short loops play without accessing the stream.
+ */
+bool OPLPlayer::seek(unsigned long position) {
+	if (directData != NULL) {
+		if (position > directLength) {
+			return false;
+		}
+		directPosition = position;
+		return true;
+	}
+
+	for (byte i = 0; i < 2; i ++) {
+		byte index = activeWindow ^ i;
+		if (windowLoaded[index] && position >= windowPosition[index] &&
+			position < windowPosition[index] + windowLength[index]) {
+			if (index != activeWindow) {
+				windowLoaded[activeWindow] = false;
+				activeWindow = index;
+			}
+			readIndex = position - windowPosition[index];
+			return true;
+		}
+	}
+
+	windowLoaded[0] = false;
+	windowLoaded[1] = false;
+	activeWindow = 0;
+	readIndex = 0;
+	if (!stream->seek(position)) {
+		windowPosition[0] = position;
+		windowLength[0] = 0;
+		return false;
+	}
+
+	streamPosition = position;
+	return fillWindow(0);
+}
+
+
+/**
+ * Load the next block of the stream into the given half of the read window.
+ *
+ * @return True if any data was loaded.
+ */
+bool OPLPlayer::fillWindow(byte index) {
+	windowPosition[index] = streamPosition;
+	windowLength[index] = stream->read(window[index], OPL_PLAYER_WINDOW_SIZE);
+	windowLoaded[index] = true;
+	streamPosition += windowLength[index];
+	return windowLength[index] > 0;
+}
+
+
+/**
+ * Read the next byte of song data. When the active half of the read window is exhausted reading continues from the
+ * other half, which is loaded now if poll() did not already do so.
+ *
+ * @return False at the end of the stream.
+ */
+bool OPLPlayer::readByte(byte& value) {
+	if (directData != NULL) {
+		if (directPosition >= directLength) {
+			return false;
+		}
+		value = directData[directPosition ++];
+		return true;
+	}
+
+	if (readIndex >= windowLength[activeWindow]) {
+		if (windowLength[activeWindow] == 0) {
+			return false;
+		}
+
+		windowLoaded[activeWindow] = false;
+		activeWindow ^= 1;
+		readIndex = 0;
+		if (!windowLoaded[activeWindow] && !fillWindow(activeWindow)) {
+			return false;
+		}
+	}
+
+	value = window[activeWindow][readIndex ++];
+	return true;
+}
+
+
+/**
+ * Skip the given number of bytes of song data.
+ */
+bool OPLPlayer::skipBytes(unsigned long numBytes) {
+	return seek(getPosition() + numBytes);
+}
+
+
+/**
+ * Get a little endian value of the given number of bytes.
+ */
+unsigned long OPLPlayer::readValue(const byte* data, byte numBytes) {
+	unsigned long value = 0;
+	while (numBytes --) {
+		value = (value << 8) + data[numBytes];
+	}
+	return value;
+}
+
+
+/**
+ * Process song events up to the next delay.
+ *
+ * @return The delay until the next event in song ticks.
+ */
+unsigned long OPLPlayer::nextEvent() {
+	switch (format) {
+		case OPL_PLAYER_FORMAT_VGM: return nextVGMEvent();
+		case OPL_PLAYER_FORMAT_DRO: return nextDROEvent();
+		case OPL_PLAYER_FORMAT_IMF: return nextIMFEvent();
+		case OPL_PLAYER_FORMAT_OPE: return nextOPEEvent();
+	}
+
+	songEnded = true;
+	return 0;
+}
+
+
+/**
+ * Process VGM commands up to the next wait command. Commands for chips other than the OPL family are skipped.
+ */
+unsigned long OPLPlayer::nextVGMEvent() {
+	byte command;
+	byte data[2];
+
+	while (!songEnded && burstLength < OPL_PLAYER_BURST_SIZE && !isLoopPoint()) {
+		if ((dataEnd && getPosition() >= dataEnd) || !readByte(command)) {
+			command = 0x66;
+		}
+
+		switch (command) {
+			// YM3812, YM3526, Y8950 and YMF262 port 0 and 1 writes.
+			case 0x5A:
+			case 0x5B:
+			case 0x5C:
+			case 0x5E:
+			case 0x5F:
+				if (readByte(data[0]) && readByte(data[1])) {
+					writeRegister(command == 0x5F ? 1 : 0, data[0], data[1]);
+				}
+				break;
+
+			// Writes to the second chip of a dual chip song.
+			case 0xAA:
+			case 0xAB:
+			case 0xAC:
+			case 0xAE:
+			case 0xAF:
+				if (readByte(data[0]) && readByte(data[1])) {
+					writeRegister(command == 0xAF ? 3 : 2, data[0], data[1]);
+				}
+				break;
+
+			// Wait n samples.
+			case 0x61:
+				if (readByte(data[0]) && readByte(data[1]) && readValue(data, 2)) {
+					return readValue(data, 2);
+				}
+				break;
+
+			// Wait 1/60 and 1/50 of a second.
+			case 0x62:
+				return 735;
+			case 0x63:
+				return 882;
+
+			// End of song data.
+			case 0x66:
+				if (!restartSong()) {
+					songEnded = true;
+				}
+				break;
+
+			// Data block, skip its contents.
+			case 0x67: {
+				byte blockHeader[6];
+				if (readHeader(blockHeader, 6) == 6) {
+					skipBytes(readValue(blockHeader + 2, 4) & 0x7FFFFFFF);
+				}
+				break;
+			}
+
+			// PCM RAM write.
+			case 0x68:
+				skipBytes(11);
+				break;
+
+			// Wait 1 to 16 samples.
+			case 0x70 ... 0x7F:
+				return (command & 0x0F) + 1;
+
+			// YM2612 DAC write and wait 0 to 15 samples.
+			case 0x80 ... 0x8F:
+				if (command & 0x0F) {
+					return command & 0x0F;
+				}
+				break;
+
+			// DAC stream control.
+			case 0x90:
+			case 0x91:
+			case 0x95:
+				skipBytes(4);
+				break;
+			case 0x92:
+				skipBytes(5);
+				break;
+			case 0x93:
+				skipBytes(10);
+				break;
+			case 0x94:
+				skipBytes(1);
+				break;
+
+			// Commands for other chips, skip their operands.
+			case 0x30 ... 0x3F:
+			case 0x4F:
+			case 0x50:
+				skipBytes(1);
+				break;
+			case 0x40 ... 0x4E:
+			case 0x51 ... 0x59:
+			case 0x5D:
+			case 0xA0 ... 0xA9:
+			case 0xAD:
+			case 0xB0 ... 0xBF:
+				skipBytes(2);
+				break;
+			case 0xC0 ... 0xDF:
+				skipBytes(3);
+				break;
+			case 0xE0 ... 0xFF:
+				skipBytes(4);
+				break;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Process DRO register writes up to the next delay. Register codes with the high bit set address the second bank of
+ * an OPL3 song or, in a dual OPL2 song, the second chip. The second chip is played on synth unit 1 of an OPL3 Duo.
+ */
+unsigned long OPLPlayer::nextDROEvent() {
+	byte code;
+	byte value;
+
+	while (!songEnded && burstLength < OPL_PLAYER_BURST_SIZE && !isLoopPoint()) {
+		if (getPosition() >= dataEnd || !readByte(code) || !readByte(value)) {
+			if (!restartSong()) {
+				songEnded = true;
+			}
+		} else if (code == droShortDelay) {
+			return value + 1;
+		} else if (code == droLongDelay) {
+			return (value + 1) << 8;
+		} else {
+			writeRegister(code & 0x80 ? droHighBank : 0, droRegisterMap[code & 0x7F], value);
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Process IMF register writes up to the next delay.
+ */
+unsigned long OPLPlayer::nextIMFEvent() {
+	byte event[4];
+
+	while (!songEnded && burstLength < OPL_PLAYER_BURST_SIZE && !isLoopPoint()) {
+		if ((dataEnd && getPosition() >= dataEnd) || readHeader(event, 4) < 4) {
+			if (!restartSong()) {
+				songEnded = true;
+			}
+		} else {
+			writeRegister(0, event[0], event[1]);
+			if (readValue(event + 2, 2)) {
+				return readValue(event + 2, 2);
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Process the commands of an OPE event stream up to the next delay.
+ */
+unsigned long OPLPlayer::nextOPEEvent() {
+	byte command;
+	byte data[4];
+
+	while (!songEnded && burstLength < OPL_PLAYER_BURST_SIZE) {
+		if (opeWritesLeft) {
+			if (readByte(data[0]) && readByte(data[1])) {
+				writeRegister(opeBank, data[0], data[1]);
+				opeWritesLeft --;
+			} else {
+				songEnded = true;
+			}
+		} else if (!readByte(command) || command == OPE_CMD_END) {
+			if (!restartSong()) {
+				songEnded = true;
+			}
+		} else if (command & OPE_CMD_DELAY) {
+			return (command & 0x7F) + 1;
+		} else if (command & OPE_CMD_WRITE) {
+			opeBank = (command >> 4) & 0x03;
+			opeWritesLeft = (command & 0x0F) + 1;
+		} else if (command == OPE_CMD_DELAY_16 || command == OPE_CMD_DELAY_32) {
+			byte numBytes = command == OPE_CMD_DELAY_16 ? 2 : 4;
+			if (readHeader(data, numBytes) == numBytes && readValue(data, numBytes)) {
+				return readValue(data, numBytes);
+			}
+		} else if (command == OPE_CMD_LOOP) {
+			hasLoop = true;
+			loopOffset = getPosition();
+
+			// The loop point of an OPE song is only known here, so end the burst to have convert() write the loop.
+			if (converting) {
+				return 0;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Is the song being converted and has decoding reached the loop point? A burst ends at the loop point, so the loop
+ * command can be put in the right place of the converted song.
+ */
+bool OPLPlayer::isLoopPoint() {
+	return converting && hasLoop && !loopConverted && getPosition() == loopOffset;
+}
+
+
+/**
+ * Continue playing from the loop point when the song is to be repeated. Songs are never repeated while converting.
+ *
+ * @return True if the song continues.
+ */
+bool OPLPlayer::restartSong() {
+	opeWritesLeft = 0;
+	return loop && !converting && hasLoop && seek(loopOffset);
+}
+
+
+/**
+ * Add a register write of the given bank to the next burst. Writes to banks that the chip does not have are ignored.
+ */
+void OPLPlayer::writeRegister(byte bank, byte reg, byte value) {
+	if (bank < numBanks) {
+		burst[burstLength].bank = bank;
+		burst[burstLength].reg = reg;
+		burst[burstLength].value = value;
+		burstLength ++;
+	}
+}
+
+
+/**
+ * Decode all register writes up to the next delay into the burst. When the burst is full the remaining writes of the
+ * same tick are sent as a next burst without delay.
+ */
+void OPLPlayer::decodeBurst() {
+	burstLength = 0;
+	burstDelay = nextEvent();
+}
+
+
+/**
+ * Send the register writes of the burst to the chip.
+ */
+void OPLPlayer::sendBurst() {
+	for (unsigned int i = 0; i < burstLength; i ++) {
+		if (opl3 != NULL) {
+			opl3->write(burst[i].bank, burst[i].reg, burst[i].value);
+		} else {
+			opl2->write(burst[i].reg, burst[i].value);
+		}
+	}
+	burstLength = 0;
+}
+
+
+/**
+ * Advance the time of the next burst by the given number of song ticks. The time is calculated from the total number
+ * of ticks since the song started rather than from when the previous burst was sent, so neither rounding nor the time
+ * spent writing registers accumulates.
+ */
+void OPLPlayer::addDelay(unsigned long ticks) {
+	tickCount += ticks;
+	while (tickCount >= tickRate) {
+		tickCount -= tickRate;
+		secondStartTime += 1000000UL;
+	}
+	nextEventTime = secondStartTime + tickCount * tickMicros / tickDivisor;
+}
+
+
+/**
+ * Get the time of the monotonic clock that is used for playback in microseconds.
+ */
+uint32_t OPLPlayer::getTime() {
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		return micros();
+	#else
+		struct timespec time;
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		return time.tv_sec * 1000000UL + time.tv_nsec / 1000;
+	#endif
+}
+
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+	/**
+	 * Move decoded bursts into the queue of the real-time writer thread until the queue is full or the song ends. Each
+	 * register write is stamped with the time at which its burst is due.
+	 */
+	void OPLPlayer::queueBursts() {
+		const unsigned int mask = OPL_PLAYER_REALTIME_QUEUE_SIZE - 1;
+
+		while (playing) {
+			unsigned int head = realtimeHead.load(std::memory_order_relaxed);
+			unsigned int numQueued = (head - realtimeTail.load(std::memory_order_acquire)) & mask;
+			if (numQueued + burstLength >= OPL_PLAYER_REALTIME_QUEUE_SIZE) {
+				return;
+			}
+
+			for (unsigned int i = 0; i < burstLength; i ++) {
+				OPLTimedWrite& write = realtimeQueue[(head + i) & mask];
+				write.time = nextEventTime;
+				write.bank = burst[i].bank;
+				write.reg = burst[i].reg;
+				write.value = burst[i].value;
+			}
+			realtimeHead.store((head + burstLength) & mask, std::memory_order_release);
+			burstLength = 0;
+
+			if (songEnded) {
+				playing = false;
+			} else {
+				addDelay(burstDelay);
+				decodeBurst();
+			}
+		}
+	}
+
+
+	/**
+	 * Discard all register writes that are queued for the real-time writer thread and wait until the thread has let go
+	 * of them.
+	 */
+	void OPLPlayer::flushRealtimeQueue() {
+		if (!realtimeRunning || realtimeHead == realtimeTail) {
+			return;
+		}
+
+		realtimeFlush = true;
+		while (realtimeFlush && realtimeRunning) {
+			std::this_thread::yield();
+		}
+	}
+
+
+	/**
+	 * Main loop of the real-time writer thread. Waits until the register write at the tail of the queue is due and sends
+	 * it to the chip. This is the only place where the tail of the queue is moved.
+	 */
+	void OPLPlayer::processRealtimeQueue() {
+		const unsigned int mask = OPL_PLAYER_REALTIME_QUEUE_SIZE - 1;
+
+		while (realtimeRunning) {
+			if (realtimeFlush) {
+				realtimeTail.store(realtimeHead.load(std::memory_order_acquire), std::memory_order_release);
+				realtimeFlush = false;
+				continue;
+			}
+
+			unsigned int tail = realtimeTail.load(std::memory_order_relaxed);
+			if (tail == realtimeHead.load(std::memory_order_acquire)) {
+				sleepUntil(getTime() + 500);
+				continue;
+			}
+
+			const OPLTimedWrite& write = realtimeQueue[tail];
+			if (!sleepUntil(write.time)) {
+				continue;
+			}
+
+			if (opl3 != NULL) {
+				opl3->write(write.bank, write.reg, write.value);
+			} else {
+				opl2->write(write.reg, write.value);
+			}
+			realtimeTail.store((tail + 1) & mask, std::memory_order_release);
+		}
+	}
+
+
+	/**
+	 * Sleep on the monotonic clock until the given time. Sleeps are split into slices of at most 1ms, so the writer
+	 * thread still responds quickly when it needs to flush its queue or stop.
+	 *
+	 * @param time - The time to sleep until in microseconds.
+	 * @return True if the given time was reached.
+	 */
+	bool OPLPlayer::sleepUntil(uint32_t time) {
+		uint32_t now = getTime();
+		int32_t timeLeft = time - now;
+		if (timeLeft <= 0) {
+			return true;
+		}
+
+		bool reached = timeLeft <= 1000;
+		struct timespec wakeTime;
+		clock_gettime(CLOCK_MONOTONIC, &wakeTime);
+		long nanoseconds = wakeTime.tv_nsec + (reached ? timeLeft : 1000) * 1000L;
+		wakeTime.tv_sec += nanoseconds / 1000000000L;
+		wakeTime.tv_nsec = nanoseconds % 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL);
+		return reached;
+	}
+#endif
@@ -0,0 +1,485 @@
+#include "OPL3Duo.h"
+
+#ifndef OPL_PLAYER_LIB_H_
+	#define OPL_PLAYER_LIB_H_
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		#include <stdio.h>
+		#include <string.h>
+		#include <time.h>
+		#include <atomic>
+		#include <thread>
+
+		// VGZ files are inflated on the fly with zlib. Comment the line below to build the player without zlib.
+		#define OPL_PLAYER_ZLIB
+	#endif
+
+	#ifdef OPL_PLAYER_ZLIB
+		#include <zlib.h>
+	#endif
+
+	// Size in bytes of each of the two halves of the read window of the player.
+	#ifndef OPL_PLAYER_WINDOW_SIZE
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			#define OPL_PLAYER_WINDOW_SIZE 64
+		#else
+			#define OPL_PLAYER_WINDOW_SIZE 4096
+		#endif
+	#endif
+
+	// Maximum number of register writes that are sent to the chip as a single burst.
+	#ifndef OPL_PLAYER_BURST_SIZE
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			#define OPL_PLAYER_BURST_SIZE 16
+		#else
+			#define OPL_PLAYER_BURST_SIZE 256
+		#endif
+	#endif
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+		// Number of register writes the real-time writer thread can hold. The size must be a power of 2.
+		#ifndef OPL_PLAYER_REALTIME_QUEUE_SIZE
+			#define OPL_PLAYER_REALTIME_QUEUE_SIZE 4096
+		#endif
+
+		// SCHED_FIFO priority of the real-time writer thread.
+		#ifndef OPL_PLAYER_REALTIME_PRIORITY
+			#define OPL_PLAYER_REALTIME_PRIORITY 80
+		#endif
+
+		struct OPLTimedWrite {
+			uint32_t time;							// Time at which the write is due.
+			byte bank;
+			byte reg;
+			byte value;
+		};
+	#endif
+
+	// Song formats supported by the player.
+	#define OPL_PLAYER_FORMAT_NONE 0
+	#define OPL_PLAYER_FORMAT_VGM  1
+	#define OPL_PLAYER_FORMAT_DRO  2
+	#define OPL_PLAYER_FORMAT_IMF  3
+	#define OPL_PLAYER_FORMAT_OPE  4
+
+	// Hardware type of a DRO song.
+	#define OPL_DRO_HARDWARE_OPL2      0
+	#define OPL_DRO_HARDWARE_DUAL_OPL2 1
+	#define OPL_DRO_HARDWARE_OPL3      2
+
+	// Commands of the compact OPE event stream. Register writes are grouped per bank in runs of 1 to 16 writes and
+	// delays of 1 to 128 ticks take a single byte.
+	#define OPE_VERSION        1
+	#define OPE_HEADER_SIZE    9
+	#define OPE_CMD_END        0x00			// End of the song.
+	#define OPE_CMD_DELAY_16   0x01			// Delay of a 16 bit number of ticks.
+	#define OPE_CMD_DELAY_32   0x02			// Delay of a 32 bit number of ticks.
+	#define OPE_CMD_LOOP       0x03			// The song is repeated from here.
+	#define OPE_CMD_WRITE      0x40			// 0x40 | bank << 4 | (count - 1), followed by count reg, value pairs.
+	#define OPE_CMD_DELAY      0x80			// 0x80 | (ticks - 1).
+
+	#define OPL_PLAYER_IMF_SPEED 560
+
+
+	/**
+	 * Source of song data for the OPLPlayer. Implementations only need to supply data in blocks and be able to jump to
+	 * a given position in the data.
+	 */
+	class OPLStream {
+		public:
+			virtual ~OPLStream() {}
+
+			/**
+			 * Read up to length bytes from the current position into the given buffer.
+			 *
+			 * @param buffer - Buffer to receive the data.
+			 * @param length - Maximum number of bytes to read.
+			 * @return The number of bytes read, 0 at the end of the data.
+			 */
+			virtual unsigned int read(byte* buffer, unsigned int length) = 0;
+
+			/**
+			 * Move the read position to the given byte offset from the start of the data.
+			 *
+			 * @param position - The new read position.
+			 * @return True if the position could be reached.
+			 */
+			virtual bool seek(unsigned long position) = 0;
+
+			/**
+			 * Get direct access to the data when all of it is held in memory. The player then reads straight from the
+			 * data instead of copying it into its read window.
+			 *
+			 * @param length - Receives the length of the data in bytes.
+			 * @return Pointer to the data or NULL when the data can only be read through read().
+			 */
+			virtual const byte* getData(unsigned long& length) {
+				return NULL;
+			}
+	};
+
+
+	/**
+	 * Destination of a song that is converted to an OPE event stream.
+	 */
+	class OPLOutputStream {
+		public:
+			virtual ~OPLOutputStream() {}
+
+			/**
+			 * Write the given data at the end of the output.
+			 *
+			 * @param data - The data to write.
+			 * @param length - Number of bytes to write.
+			 * @return True if all data was written.
+			 */
+			virtual bool write(const byte* data, unsigned int length) = 0;
+	};
+
+
+	/**
+	 * Stream of song data held in memory. On Arduino the data can be kept in PROGMEM.
+	 */
+	class OPLMemoryStream : public OPLStream {
+		public:
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+				OPLMemoryStream(const byte* data, unsigned long length, bool fromProgmem = false);
+			#else
+				OPLMemoryStream(const byte* data, unsigned long length);
+			#endif
+			virtual unsigned int read(byte* buffer, unsigned int length);
+			virtual bool seek(unsigned long position);
+			virtual const byte* getData(unsigned long& length);
+
+		private:
+			const byte* data;
+			unsigned long length;
+			unsigned long position = 0;
+			bool fromProgmem = false;
+	};
+
+
+	/**
+	 * Output of a converted song to a buffer in memory.
+	 */
+	class OPLMemoryOutputStream : public OPLOutputStream {
+		public:
+			OPLMemoryOutputStream(byte* buffer, unsigned long size);
+			virtual bool write(const byte* data, unsigned int length);
+			unsigned long getLength();
+
+		private:
+			byte* buffer;
+			unsigned long size;
+			unsigned long length = 0;
+	};
+
+
+	/**
+	 * Writer of an OPE event stream. The writer is an OPLBackend, so a chip can hand its register writes straight to the
+	 * writer while a song is converted. Writes to the same bank are grouped into runs and consecutive delays are merged
+	 * until the next write, loop point or the end of the stream.
+	 */
+	class OPLEventWriter : public OPLBackend {
+		public:
+			OPLEventWriter(OPLOutputStream* output);
+			bool begin(unsigned long tickRate);
+			virtual void reset();
+			virtual void write(byte bank, byte reg, byte value);
+			void delay(unsigned long ticks);
+			void setLoopPoint();
+			bool end();
+			bool hasError();
+
+		private:
+			void writeRun();
+			void writeDelay();
+
+			OPLOutputStream* output;
+			bool success = true;
+			byte run[1 + 2 * 16];
+			byte runLength = 0;
+			byte runBank = 0;
+			unsigned long pendingDelay = 0;
+	};
+
+
+	#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+		/**
+		 * Stream of song data from a file on SD card. Any file class that provides read(buffer, length) and
+		 * seek(position), like the File class of the SD and SdFat libraries, can be used.
+		 */
+		template <class FileType>
+		class OPLSDFileStream : public OPLStream {
+			public:
+				OPLSDFileStream(FileType& file) : file(file) {
+				}
+
+				virtual unsigned int read(byte* buffer, unsigned int length) {
+					int numRead = file.read(buffer, length);
+					return numRead > 0 ? numRead : 0;
+				}
+
+				virtual bool seek(unsigned long position) {
+					return file.seek(position);
+				}
+
+			private:
+				FileType& file;
+		};
+	#else
+		/**
+		 * Stream of song data from a file.
+		 */
+		class OPLFileStream : public OPLStream {
+			public:
+				OPLFileStream(FILE* file);
+				virtual unsigned int read(byte* buffer, unsigned int length);
+				virtual bool seek(unsigned long position);
+
+			private:
+				FILE* file;
+		};
+
+
+		/**
+		 * Stream of song data from a file that is mapped into memory, so the player parses the song straight from the
+		 * mapping. Gzip compressed files are inflated into an anonymous mapping when zlib is available.
+		 */
+		class OPLMappedFileStream : public OPLStream {
+			public:
+				OPLMappedFileStream(const char* fileName);
+				virtual ~OPLMappedFileStream();
+				bool isOpen();
+				virtual unsigned int read(byte* buffer, unsigned int length);
+				virtual bool seek(unsigned long position);
+				virtual const byte* getData(unsigned long& length);
+
+			private:
+				void unmap();
+				#ifdef OPL_PLAYER_ZLIB
+					bool inflateMapping();
+				#endif
+
+				byte* data = NULL;
+				unsigned long length = 0;
+				unsigned long mappingSize = 0;
+				unsigned long position = 0;
+		};
+
+
+		/**
+		 * Output of a converted song to a file.
+		 */
+		class OPLFileOutputStream : public OPLOutputStream {
+			public:
+				OPLFileOutputStream(FILE* file);
+				virtual bool write(const byte* data, unsigned int length);
+
+			private:
+				FILE* file;
+		};
+	#endif
+
+
+	#ifdef OPL_PLAYER_ZLIB
+		/**
+		 * Stream that inflates gzip compressed data, like a VGZ file, from another stream while it is being read. Only
+		 * the zlib state and a small input buffer are kept in memory. Seeking backwards restarts inflation from the
+		 * start of the compressed data.
+		 */
+		class OPLGzipStream : public OPLStream {
+			public:
+				OPLGzipStream(OPLStream* source);
+				virtual ~OPLGzipStream();
+				virtual unsigned int read(byte* buffer, unsigned int length);
+				virtual bool seek(unsigned long position);
+				static bool isCompressed(OPLStream* source);
+
+			private:
+				bool restart();
+
+				OPLStream* source;
+				z_stream inflater;
+				bool inflaterReady = false;
+				bool streamEnded = false;
+				unsigned long position = 0;
+				byte input[512];
+		};
+	#endif
+
+
+	/**
+	 * Interface of a player that is driven cooperatively from the main loop. Each call to service() does a bounded amount
+	 * of work, like sending one burst of register writes or reading one block of song data, and returns right away. The
+	 * returned time tells when the player needs to be serviced again, so several players and other tasks like reading
+	 * MIDI or buttons can share a single core without any of them blocking the others.
+	 */
+	class OPLPlayable {
+		public:
+			virtual ~OPLPlayable() {}
+
+			/**
+			 * Start playing from the beginning.
+			 */
+			virtual void play() = 0;
+
+			/**
+			 * Stop playing.
+			 */
+			virtual void stop() = 0;
+
+			/**
+			 * Is the player currently playing?
+			 */
+			virtual bool isPlaying() = 0;
+
+			/**
+			 * Do the work that is due and return. Call this again when the returned time has passed, or earlier.
+			 *
+			 * @return The time in microseconds until the player needs to be serviced again, 0 when more work is due
+			 *         right away or nothing is playing.
+			 */
+			virtual unsigned long service() = 0;
+
+			static unsigned long serviceAll(OPLPlayable* players[], byte numPlayers);
+	};
+
+
+	/**
+	 * Player for VGM, DRO, IMF and OPE songs that are streamed from an OPLStream. The song data is read through a window of
+	 * two buffers. While events are taken from one buffer the other one is refilled by poll() when no events are due,
+	 * so the size of a song is not limited by the available memory.
+	 *
+	 * Call poll() as often as possible while a song is playing. It sends all register writes that are due to the chip
+	 * and returns as soon as the next event lies in the future. To share the main loop with other work call service()
+	 * instead, which sends at most one burst per call.
+	 *
+	 * Event times are kept as an absolute number of song ticks (44.1 kHz samples for VGM) since the song started and
+	 * are converted to microseconds of a monotonic clock without rounding errors, so the song does not drift no matter
+	 * how long it plays or how long register writes take. All writes that fall on the same tick are decoded ahead of
+	 * time and sent to the chip back to back as one burst.
+	 *
+	 * On Linux the register writes can be sent by a real-time writer thread instead, see startRealtimeWriter().
+	 *
+	 * Any song can be converted to the compact OPE event stream with convert(). An OPE stream holds nothing but delta
+	 * timed register writes, so it is the cheapest format to play and it can be kept in PROGMEM.
+	 */
+	class OPLPlayer : public OPLPlayable {
+		public:
+			OPLPlayer(OPL2* opl2Ref);
+			OPLPlayer(OPL3* opl3Ref);
+			OPLPlayer(OPL3Duo* opl3DuoRef);
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				~OPLPlayer();
+				bool startRealtimeWriter(int priority = OPL_PLAYER_REALTIME_PRIORITY);
+				void stopRealtimeWriter();
+			#endif
+
+			bool load(OPLStream* stream);
+			bool loadVGM(OPLStream* stream);
+			bool loadDRO(OPLStream* stream);
+			bool loadIMF(OPLStream* stream, unsigned int speed = OPL_PLAYER_IMF_SPEED);
+			bool loadOPE(OPLStream* stream);
+			bool convert(OPLOutputStream* output);
+
+			virtual void play();
+			virtual void stop();
+			virtual bool isPlaying();
+			virtual unsigned long service();
+			void poll();
+			unsigned long step();
+			unsigned long getTimeToNextEvent();
+			byte getFormat();
+			bool getLoop();
+			void setLoop(bool loop);
+
+		private:
+			void open(OPLStream* stream);
+			void setTickRate(unsigned long tickRate);
+			unsigned int readHeader(byte* header, unsigned int length);
+			unsigned long getPosition();
+			bool seek(unsigned long position);
+			bool fillWindow(byte window);
+			bool readByte(byte& value);
+			bool skipBytes(unsigned long numBytes);
+			unsigned long readValue(const byte* data, byte numBytes);
+			unsigned long nextEvent();
+			unsigned long nextVGMEvent();
+			unsigned long nextDROEvent();
+			unsigned long nextIMFEvent();
+			unsigned long nextOPEEvent();
+			bool isLoopPoint();
+			bool restartSong();
+			void writeRegister(byte bank, byte reg, byte value);
+			void decodeBurst();
+			void sendBurst();
+			void addDelay(unsigned long ticks);
+			uint32_t getTime();
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				void queueBursts();
+				void flushRealtimeQueue();
+				void processRealtimeQueue();
+				bool sleepUntil(uint32_t time);
+			#endif
+
+			OPL2* opl2 = NULL;
+			OPL3* opl3 = NULL;
+			byte numBanks = 1;
+
+			OPLStream* stream = NULL;
+			byte format = OPL_PLAYER_FORMAT_NONE;
+			bool playing = false;
+			bool converting = false;
+			bool loopConverted = false;					// Has the loop point been written to the converted song?
+			bool songEnded = false;
+			bool loop = false;
+
+			byte window[2][OPL_PLAYER_WINDOW_SIZE];
+			unsigned int windowLength[2] = { 0, 0 };
+			unsigned long windowPosition[2] = { 0, 0 };	// Stream offset of the start of each window.
+			bool windowLoaded[2] = { false, false };
+			byte activeWindow = 0;
+			unsigned int readIndex = 0;
+			unsigned long streamPosition = 0;			// Offset in the stream of the next block to load.
+
+			const byte* directData = NULL;				// Song data when the stream is held in memory.
+			unsigned long directLength = 0;
+			unsigned long directPosition = 0;
+
+			unsigned long dataOffset = 0;				// Offset of the first event.
+			unsigned long dataEnd = 0;					// Offset after the last event, or 0 when not known.
+			unsigned long loopOffset = 0;				// Offset of the event to loop to.
+			bool hasLoop = false;						// Can the song be looped?
+			unsigned long tickRate = 0;					// Number of song ticks per second.
+			unsigned long tickMicros = 0;				// Tick duration in microseconds is tickMicros / tickDivisor.
+			unsigned long tickDivisor = 1;
+			unsigned long tickCount = 0;				// Song ticks since secondStartTime.
+			uint32_t secondStartTime = 0;				// Time of the last whole second of the song.
+			uint32_t nextEventTime = 0;					// Time when the next burst is due.
+
+			OPLWrite burst[OPL_PLAYER_BURST_SIZE];		// Register writes of the next burst.
+			unsigned int burstLength = 0;
+			unsigned long burstDelay = 0;				// Song ticks from the next burst to the one after.
+
+			// DRO specific data.
+			byte droShortDelay = 0;
+			byte droLongDelay = 0;
+			byte droHighBank = 1;						// Bank of register codes with the high bit set.
+			byte droRegisterMap[128];
+
+			#if BOARD_TYPE == OPL2_BOARD_TYPE_RASPBERRY_PI
+				// Lock free single producer, single consumer queue between poll() and the real-time writer thread.
+				OPLTimedWrite realtimeQueue[OPL_PLAYER_REALTIME_QUEUE_SIZE];
+				std::atomic<unsigned int> realtimeHead {0};
+				std::atomic<unsigned int> realtimeTail {0};
+				std::atomic<bool> realtimeRunning {false};
+				std::atomic<bool> realtimeFlush {false};
+				std::thread realtimeThread;
+			#endif
+
+			// OPE specific data.
+			byte opeBank = 0;
+			byte opeWritesLeft = 0;					// Writes left in the current run of register writes.
+	};
+#endif
@@ -0,0 +1,171 @@
+/**
+ * In-memory recording backend for the OPL2 Audio Board library. Captures the register writes of an OPL2, OPL3 or
+ * OPL3Duo without any delays, so tests and benchmarks can run without a board attached.
+ */
+
+#include "OPLRecorder.h"
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	#include <Arduino.h>
+#else
+	#include <wiringPi.h>
+	#include <string.h>
+#endif
+
+
+/**
+ * Create a recorder that only keeps the register values and counts the writes.
+ */
+OPLRecorder::OPLRecorder() {
+	memset(registers, 0, sizeof(registers));
+}
+
+
+/**
+ * Create a recorder that also logs every write to the given buffer. Once the log is full further writes still update
+ * the registers, but are no longer logged.
+ *
+ * @param log - Buffer to log the writes to.
+ * @param logSize - The number of writes that fit in the buffer.
+ */
+OPLRecorder::OPLRecorder(OPLTraceEntry* log, unsigned int logSize) : OPLRecorder() {
+	this->log = log;
+	this->logSize = log != NULL ? logSize : 0;
+}
+
+
+/**
+ * Hard reset the recorded chip. All registers are cleared to 0x00, the log and write count are kept.
+ */
+void OPLRecorder::reset() {
+	memset(registers, 0, sizeof(registers));
+	numResets ++;
+}
+
+
+/**
+ * Record a register write. Writes to banks beyond OPL_RECORDER_NUM_BANKS are logged and counted, but their values are
+ * not kept.
+ *
+ * @param bank - The bank (A1) of the register in bit 0 and the synth unit (A2) in bit 1.
+ * @param reg - The register to be changed.
+ * @param value - The value to write to the register.
+ */
+void OPLRecorder::write(byte bank, byte reg, byte value) {
+	if (bank < OPL_RECORDER_NUM_BANKS) {
+		registers[bank][reg] = value;
+	}
+	numWrites ++;
+
+	if (logLength < logSize) {
+		log[logLength].time  = micros();
+		log[logLength].bank  = bank;
+		log[logLength].reg   = reg;
+		log[logLength].value = value;
+		logLength ++;
+	} else if (logSize > 0) {
+		logOverflow = true;
+	}
+}
+
+
+/**
+ * Clear the log and the write and reset counters. The register values are kept.
+ */
+void OPLRecorder::clear() {
+	logLength = 0;
+	logOverflow = false;
+	numWrites = 0;
+	numResets = 0;
+}
+
+
+/**
+ * Get the value that was last written to a register.
+ *
+ * @param bank - The bank (A1) of the register in bit 0 and the synth unit (A2) in bit 1.
+ * @param reg - The register to read.
+ * @return The value of the register or 0x00 if the bank is not recorded.
+ */
+byte OPLRecorder::getRegister(byte bank, byte reg) {
+	return bank < OPL_RECORDER_NUM_BANKS ? registers[bank][reg] : 0x00;
+}
+
+
+/**
+ * Get the number of register writes that were recorded since the recorder was created or cleared.
+ */
+unsigned long OPLRecorder::getNumWrites() {
+	return numWrites;
+}
+
+
+/**
+ * Get the number of hard resets that were recorded since the recorder was created or cleared.
+ */
+unsigned int OPLRecorder::getNumResets() {
+	return numResets;
+}
+
+
+/**
+ * Get the number of writes in the log.
+ */
+unsigned int OPLRecorder::getLogLength() {
+	return logLength;
+}
+
+
+/**
+ * Has the log run out of space? When true, writes have been made that are not in the log.
+ */
+bool OPLRecorder::isLogFull() {
+	return logOverflow;
+}
+
+
+/**
+ * Get a write from the log.
+ *
+ * @param index - Index of the write, where 0 is the first write [0, getLogLength() - 1].
+ * @return The logged write or an empty entry if the index is out of range.
+ */
+OPLTraceEntry OPLRecorder::getLogEntry(unsigned int index) {
+	if (index < logLength) {
+		return log[index];
+	}
+
+	OPLTraceEntry entry = { 0, 0, 0, 0 };
+	return entry;
+}
+
+
+/**
+ * Find the first register that has a different value in another recorder. Use this to verify that an optimization
+ * such as write elimination or batching leaves the chip in the same state as writing every register.
+ *
+ * @param other - The recorder to compare with.
+ * @return The bank in bits 8 - 9 and the register in bits 0 - 7 of the first different register, or
+ *         OPL_RECORDER_NO_DIFFERENCE when all registers are the same.
+ */
+short OPLRecorder::findDifference(OPLRecorder& other) {
+	for (byte bank = 0; bank < OPL_RECORDER_NUM_BANKS; bank ++) {
+		for (short reg = 0; reg < 256; reg ++) {
+			if (registers[bank][reg] != other.registers[bank][reg]) {
+				return (bank << 8) | reg;
+			}
+		}
+	}
+	return OPL_RECORDER_NO_DIFFERENCE;
+}
+
+
+/**
+ * Do all registers have the same value in another recorder?
+ *
+ * @param other - The recorder to compare with.
+ * @return True if all registers are the same.
+ */
+bool OPLRecorder::hasSameRegisters(OPLRecorder& other) {
+	return findDifference(other) == OPL_RECORDER_NO_DIFFERENCE;
+}
@@ -0,0 +1,52 @@
+#include "OPL2.h"
+
+#ifndef OPL_RECORDER_LIB_H_
+	#define OPL_RECORDER_LIB_H_
+
+	// Number of register banks of which the recorder holds the values, each bank takes 256 bytes. Bit 0 of the bank is
+	// the register bank (A1) and bit 1 the synth unit (A2), so 1 bank covers the OPL2, 2 the OPL3 and 4 the OPL3 Duo.
+	// Only the OPL2 is covered on AVR to save memory.
+	#ifndef OPL_RECORDER_NUM_BANKS
+		#if defined(__AVR__)
+			#define OPL_RECORDER_NUM_BANKS 1
+		#else
+			#define OPL_RECORDER_NUM_BANKS 4
+		#endif
+	#endif
+
+	// Returned by findDifference when the registers of two recorders are the same.
+	#define OPL_RECORDER_NO_DIFFERENCE -1
+
+
+	/**
+	 * Backend that records the register writes of an OPL2, OPL3 or OPL3Duo in memory instead of sending them to a board.
+	 * Writes take no time, so tests and benchmarks run at full speed without a board attached. The recorder keeps the
+	 * value that was last written to every register and can keep a log of the writes with their time stamp.
+	 */
+	class OPLRecorder : public OPLBackend {
+		public:
+			OPLRecorder();
+			OPLRecorder(OPLTraceEntry* log, unsigned int logSize);
+			virtual void reset();
+			virtual void write(byte bank, byte reg, byte value);
+			void clear();
+
+			byte getRegister(byte bank, byte reg);
+			unsigned long getNumWrites();
+			unsigned int getNumResets();
+			unsigned int getLogLength();
+			bool isLogFull();
+			OPLTraceEntry getLogEntry(unsigned int index);
+			short findDifference(OPLRecorder& other);
+			bool hasSameRegisters(OPLRecorder& other);
+
+		private:
+			byte registers[OPL_RECORDER_NUM_BANKS][256];
+			OPLTraceEntry* log = NULL;
+			unsigned int logSize = 0;
+			unsigned int logLength = 0;
+			bool logOverflow = false;
+			unsigned long numWrites = 0;
+			unsigned int numResets = 0;
+	};
+#endif
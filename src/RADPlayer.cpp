@@ -0,0 +1,813 @@
+/**
+ * Reality Adlib Tracker (RAD) player for the OPL2 Audio Board and OPL3 Duo. Songs are streamed from an OPLStream, such
+ * as a file on SD card, through a small read ahead buffer.
+ *
+ * For more information about the RAD file format download the Reality Adlib Tracker from
+ * http://www.pouet.net/prod.php?which=48994
+ */
+
+#include "RADPlayer.h"
+
+#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+	#include <Arduino.h>
+#else
+	#include <wiringPi.h>
+#endif
+
+
+/**
+ * Create a RAD player that plays songs on the given chip. The chip must be initialized with begin() before a song is
+ * played.
+ *
+ * @param opl2Ref - The OPL2, OPL3 or OPL3 Duo to play on. RAD songs only use the 9 OPL2 channels.
+ */
+RADPlayer::RADPlayer(OPL2* opl2Ref) {
+	opl2 = opl2Ref;
+}
+
+
+/**
+ * Load a RAD song from the given stream and index its order list and patterns. The header, instruments, order list
+ * and pattern offsets are kept in memory. Pattern data is read from the stream while the song plays.
+ *
+ * @param songStream - Stream with the song data. The stream must remain available while the song plays.
+ * @return True if the song is a valid RAD version 1 song.
+ */
+bool RADPlayer::load(OPLStream* songStream) {
+	stop();
+	stream = NULL;
+	numOrders = 0;
+
+	// Check the signature and version.
+	byte header[18];
+	const char signature[16] = { 'R', 'A', 'D', ' ', 'b', 'y', ' ', 'R', 'E', 'A', 'L', 'i', 'T', 'Y', '!', '!' };
+	if (!songStream->seek(0) || songStream->read(header, 18) != 18) {
+		return false;
+	}
+	for (byte i = 0; i < 16; i ++) {
+		if (header[i] != signature[i]) {
+			return false;
+		}
+	}
+	if (header[16] != 0x10) {
+		return false;
+	}
+
+	byte songProps = header[17];
+	hasSlowTimer = (songProps & 0x40) != 0x00;
+	initialSpeed = songProps & 0x1F;
+
+	// Skip song description block if available.
+	byte value;
+	if ((songProps & 0x80) != 0x00) {
+		do {
+			if (songStream->read(&value, 1) != 1) {
+				return false;
+			}
+		} while (value != 0x00);
+	}
+
+	// Read instruments.
+	byte instrumentNum;
+	for (byte i = 0; i < RAD_NUM_INSTRUMENTS; i ++) {
+		for (byte j = 0; j < 10; j ++) {
+			instruments[i][j] = 0x00;
+		}
+	}
+	while (songStream->read(&instrumentNum, 1) == 1 && instrumentNum != 0x00) {
+		byte data[11];
+		if (instrumentNum > RAD_NUM_INSTRUMENTS || songStream->read(data, 11) != 11) {
+			return false;
+		}
+		for (byte i = 0; i < 9; i ++) {
+			instruments[instrumentNum - 1][i] = data[i];
+		}
+		instruments[instrumentNum - 1][9] = (data[9] & 0x07) + ((data[10] & 0x07) << 4);
+	}
+
+	// Read order list.
+	byte songLength;
+	if (songStream->read(&songLength, 1) != 1 || songLength > RAD_MAX_ORDERS) {
+		return false;
+	}
+	if (songStream->read(orders, songLength) != songLength) {
+		return false;
+	}
+
+	// Read pattern offsets.
+	byte offsets[RAD_NUM_PATTERNS * 2];
+	if (songStream->read(offsets, RAD_NUM_PATTERNS * 2) != RAD_NUM_PATTERNS * 2) {
+		return false;
+	}
+
+	// Index the length of each pattern by walking over its lines.
+	for (byte i = 0; i < RAD_NUM_PATTERNS; i ++) {
+		patternOffsets[i] = offsets[i * 2] + (offsets[i * 2 + 1] << 8);
+		patternLengths[i] = 0;
+		if (patternOffsets[i] == 0x0000 || !songStream->seek(patternOffsets[i])) {
+			continue;
+		}
+
+		unsigned int length = 0;
+		byte lineNumber;
+		do {
+			if (songStream->read(&lineNumber, 1) != 1) {
+				break;
+			}
+			length ++;
+
+			byte channel[3];
+			do {
+				if (songStream->read(channel, 3) != 3) {
+					return false;
+				}
+				length += 3;
+				if (channel[2] & 0x0F) {
+					if (songStream->read(&value, 1) != 1) {
+						return false;
+					}
+					length ++;
+				}
+			} while (!(channel[0] & 0x80));
+		} while (!(lineNumber & 0x80));
+		patternLengths[i] = length;
+	}
+
+	stream = songStream;
+	numOrders = songLength;
+	return true;
+}
+
+
+/**
+ * Start playing the loaded song from the first order.
+ */
+void RADPlayer::play() {
+	stop();
+	if (stream == NULL || numOrders == 0) {
+		return;
+	}
+
+	opl2->setWaveFormSelect(true);
+	opl2->setPercussion(false);
+
+	for (byte i = 0; i < RAD_NUM_CHANNELS; i ++) {
+		channelNote[i] = 0x0000;
+		effectParameter[i] = 0x00;
+		channelPitch[i] = (opl2->getBlock(i) << 12) + opl2->getFNumber(i);
+		pitchSlideDest[i] = 0x0000;
+		pitchSlideSpeed[i] = 0x00;
+	}
+
+	speed = initialSpeed > 0 ? initialSpeed : 1;
+	line = 0;
+	tickIndex = 0;
+	patternBreak = 0xFF;
+	endOfPattern = false;
+
+	// Start reading ahead from the first order.
+	bufferHead = 0;
+	bufferTail = 0;
+	fillOrder = resolveOrder(0);
+	fillRemaining = 0;
+	if (fillOrder != RAD_ORDER_NONE && stream->seek(patternOffsets[getPattern(fillOrder)])) {
+		fillRemaining = patternLengths[getPattern(fillOrder)];
+	}
+	order = fillOrder;
+	patternRemaining = order != RAD_ORDER_NONE ? patternLengths[getPattern(order)] : 0;
+
+	fillBuffer();
+	readLine();
+	playing = order != RAD_ORDER_NONE;
+	nextTickTime = micros();
+}
+
+
+/**
+ * Convert the loaded song to an OPE event stream. The song is played once at full speed from the first order up to
+ * where it starts to repeat itself and that order is marked as the loop point of the OPE stream. While converting, the
+ * register writes of the chip go to the OPE stream instead of the chip. The chip is reset before and after the
+ * conversion, because afterwards its shadow registers no longer match the chip.
+ *
+ * @param output - Destination of the OPE stream.
+ * @return True if the song was converted.
+ */
+bool RADPlayer::convert(OPLOutputStream* output) {
+	stop();
+	if (stream == NULL || numOrders == 0 || resolveOrder(0) == RAD_ORDER_NONE) {
+		return false;
+	}
+
+	// Follow the order list with looping enabled until an order comes up a second time. That is where the song loops
+	// and the order played just before it is the last order of the converted song.
+	bool loopSong = loop;
+	loop = true;
+	byte visited[(RAD_MAX_ORDERS + 7) / 8] = { 0 };
+	byte lastOrder = RAD_ORDER_NONE;
+	byte loopOrder = resolveOrder(0);
+	while (loopOrder != RAD_ORDER_NONE && !(visited[loopOrder >> 3] & (1 << (loopOrder & 0x07)))) {
+		visited[loopOrder >> 3] |= 1 << (loopOrder & 0x07);
+		lastOrder = loopOrder;
+		loopOrder = getNextOrder(loopOrder);
+	}
+
+	// Use one OPE tick per RAD tick when the tick duration divides a second, otherwise delays are in microseconds.
+	unsigned long tickRate = 1000000UL / getTickDuration();
+	unsigned long tickLength = 1;
+	if (tickRate * getTickDuration() != 1000000UL) {
+		tickRate = 1000000UL;
+		tickLength = getTickDuration();
+	}
+
+	OPLEventWriter writer(output);
+	OPLBackend* chipBackend = opl2->getBackend();
+	bool eliminateWrites = opl2->isWriteEliminationEnabled();
+	opl2->reset();
+	opl2->setBackend(&writer);
+	opl2->setWriteEliminationEnabled(false);
+
+	writer.begin(tickRate);
+	endOrder = lastOrder;
+	play();
+	bool loopConverted = false;
+	while (playing && !writer.hasError()) {
+		if (!loopConverted && order == loopOrder) {
+			writer.setLoopPoint();
+			loopConverted = true;
+		}
+
+		tick();
+		fillBuffer();
+		writer.delay(tickLength);
+	}
+	playing = false;
+	endOrder = RAD_ORDER_NONE;
+	loop = loopSong;
+	bool success = writer.end();
+
+	opl2->setBackend(chipBackend);
+	opl2->setWriteEliminationEnabled(eliminateWrites);
+	opl2->reset();
+	return success;
+}
+
+
+/**
+ * Stop playing and silence all channels.
+ */
+void RADPlayer::stop() {
+	if (playing) {
+		for (byte i = 0; i < RAD_NUM_CHANNELS; i ++) {
+			opl2->setKeyOn(i, false);
+		}
+	}
+	playing = false;
+}
+
+
+/**
+ * Play the ticks of the song that are due and read ahead pattern data. Call this as often as possible while a song
+ * is playing. When the player falls behind by more than a tick, for example because the sketch was busy, the missed
+ * ticks are dropped instead of played back to back.
+ */
+void RADPlayer::poll() {
+	if (!playing) {
+		return;
+	}
+
+	if ((long)(micros() - nextTickTime) >= 0) {
+		tick();
+		nextTickTime += getTickDuration();
+		if ((long)(micros() - nextTickTime) >= 0) {
+			nextTickTime = micros() + getTickDuration();
+		}
+	}
+
+	fillBuffer();
+}
+
+
+/**
+ * Play the tick of the song that is due and read ahead pattern data.
+ *
+ * @return The time in microseconds until service() needs to be called again, 0 if no song is playing.
+ */
+unsigned long RADPlayer::service() {
+	poll();
+	return getTimeToNextTick();
+}
+
+
+/**
+ * Process one tick of the current line and advance the song if needed. poll() calls this at the tick rate of the song,
+ * it only needs to be called directly to drive the player from another timer.
+ */
+void RADPlayer::tick() {
+	if (!playing) {
+		return;
+	}
+
+	unsigned long startTime = micros();
+
+	for (byte channel = 0; channel < RAD_NUM_CHANNELS; channel ++) {
+		unsigned int channelData = channelNote[channel];
+		byte effect = channelData & 0x000F;
+
+		if (tickIndex == 0) {
+			byte instrument = ((channelData & 0x8000) >> 11) + ((channelData & 0x00F0) >> 4);
+			byte octave     = (channelData & 0x7000) >> 12;
+			byte note       = (channelData & 0x0F00) >> 8;
+
+			// Set instrument.
+			if (instrument > 0) {
+				setInstrument(channel, instrument - 1);
+			}
+
+			// Stop note.
+			if (note == 0x0F) {
+				opl2->setKeyOn(channel, false);
+			}
+
+			// Trigger note.
+			else if (note && effect != RAD_EFFECT_NOTE_SLIDE_TO) {
+				playNote(channel, octave, note);
+			}
+
+			// Process line effects.
+			switch (effect) {
+				case RAD_EFFECT_NOTE_SLIDE_TO: {
+					if (note > 0x00 && note < 0x0F) {
+						pitchSlideDest[channel] = getNotePitch(octave, note);
+						pitchSlideSpeed[channel] = effectParameter[channel];
+					}
+					break;
+				}
+
+				case RAD_EFFECT_SET_VOLUME: {
+					byte parameter = effectParameter[channel];
+					opl2->setVolume(channel, CARRIER, parameter > 63 ? 0 : (parameter > 0 ? 64 - parameter : 63));
+					break;
+				}
+
+				case RAD_EFFECT_PATTERN_BREAK: {
+					patternBreak = effectParameter[channel];
+					break;
+				}
+
+				case RAD_EFFECT_SET_SPEED: {
+					speed = effectParameter[channel] > 0 ? effectParameter[channel] : 1;
+					break;
+				}
+			}
+		}
+
+		// Process tick effects.
+		switch (effect) {
+			case RAD_EFFECT_NOTE_SLIDE_UP: {
+				pitchAdjust(channel, effectParameter[channel]);
+				break;
+			}
+
+			case RAD_EFFECT_NOTE_SLIDE_DOWN: {
+				pitchAdjust(channel, -effectParameter[channel]);
+				break;
+			}
+
+			case RAD_EFFECT_NOTE_SLIDE_VOLUME: {
+				pitchAdjustToNote(channel);
+				volumeAdjust(channel, effectParameter[channel]);
+				break;
+			}
+
+			case RAD_EFFECT_NOTE_SLIDE_TO: {
+				pitchAdjustToNote(channel);
+				break;
+			}
+
+			case RAD_EFFECT_VOLUME_SLIDE: {
+				volumeAdjust(channel, effectParameter[channel]);
+				break;
+			}
+		}
+	}
+
+	// Advance song.
+	tickIndex = (tickIndex + 1) % speed;
+	if (tickIndex == 0) {
+		if (patternBreak == 0xFF) {
+			line = (line + 1) % RAD_NUM_LINES;
+			if (line == 0) {
+				nextOrder();
+			}
+		} else {
+			line = patternBreak % RAD_NUM_LINES;
+			patternBreak = 0xFF;
+			nextOrder(line);
+		}
+
+		readLine();
+	}
+
+	unsigned long tickTime = micros() - startTime;
+	if (tickTime > maxTickTime) {
+		maxTickTime = tickTime;
+	}
+}
+
+
+/**
+ * Is a song playing? When looping is disabled this becomes false once the last order has been played.
+ */
+bool RADPlayer::isPlaying() {
+	return playing;
+}
+
+
+/**
+ * Get the time until the next tick is due.
+ *
+ * @return The time in microseconds until poll() needs to be called again, 0 if no song is playing.
+ */
+unsigned long RADPlayer::getTimeToNextTick() {
+	if (!playing) {
+		return 0;
+	}
+
+	long timeLeft = (long)(nextTickTime - micros());
+	return timeLeft > 0 ? timeLeft : 0;
+}
+
+
+/**
+ * Get the duration of a tick of the loaded song in microseconds.
+ */
+unsigned long RADPlayer::getTickDuration() {
+	return hasSlowTimer ? RAD_SLOW_TICK_MICROS : RAD_TICK_MICROS;
+}
+
+
+/**
+ * Get the longest time in microseconds that a single tick took to process since the song started or since
+ * resetMaxTickTime() was called.
+ */
+unsigned long RADPlayer::getMaxTickTime() {
+	return maxTickTime;
+}
+
+
+/**
+ * Reset the longest tick time.
+ */
+void RADPlayer::resetMaxTickTime() {
+	maxTickTime = 0;
+}
+
+
+/**
+ * Does the song restart after the last order has been played?
+ */
+bool RADPlayer::getLoop() {
+	return loop;
+}
+
+
+/**
+ * Set whether the song restarts after the last order has been played. This is enabled by default.
+ */
+void RADPlayer::setLoop(bool loopSong) {
+	loop = loopSong;
+}
+
+
+/**
+ * Get the index in the order list that is currently playing.
+ */
+byte RADPlayer::getOrder() {
+	return order;
+}
+
+
+/**
+ * Get the line of the current pattern that is currently playing.
+ */
+byte RADPlayer::getLine() {
+	return line;
+}
+
+
+/**
+ * Follow the order jump at the given order if there is one.
+ *
+ * @param order - Index in the order list.
+ * @return The index of the order that plays a pattern or RAD_ORDER_NONE if the order is outside of the order list.
+ */
+byte RADPlayer::resolveOrder(byte orderIndex) {
+	if (orderIndex >= numOrders) {
+		return RAD_ORDER_NONE;
+	}
+
+	// If bit 7 is set then we're looking at an order jump.
+	if (orders[orderIndex] & 0x80) {
+		orderIndex = orders[orderIndex] & 0x7F;
+		if (orderIndex >= numOrders) {
+			return RAD_ORDER_NONE;
+		}
+	}
+	return orderIndex;
+}
+
+
+/**
+ * Get the order that is played after the given order. The song may loop back to the beginning if looping is enabled.
+ *
+ * @param order - Index in the order list.
+ * @return The next order or RAD_ORDER_NONE at the end of the song. While converting the song ends after the last order
+ *         before it loops.
+ */
+byte RADPlayer::getNextOrder(byte orderIndex) {
+	if (orderIndex == RAD_ORDER_NONE || orderIndex == endOrder) {
+		return RAD_ORDER_NONE;
+	}
+	if (orderIndex + 1 >= numOrders) {
+		return loop ? resolveOrder(0) : RAD_ORDER_NONE;
+	}
+	return resolveOrder(orderIndex + 1);
+}
+
+
+/**
+ * Get the pattern that is played by the given order.
+ */
+byte RADPlayer::getPattern(byte orderIndex) {
+	return orders[orderIndex] % RAD_NUM_PATTERNS;
+}
+
+
+/**
+ * Read pattern data ahead into the ring buffer. Patterns are read in the order they are played, so the stream only
+ * seeks when the read position moves on to the pattern of the next order.
+ *
+ * @return True if any data was added to the buffer.
+ */
+bool RADPlayer::fillBuffer() {
+	bool hasRead = false;
+	byte numSkipped = 0;
+
+	while (fillOrder != RAD_ORDER_NONE) {
+		unsigned int bufferFree = RAD_PLAYER_BUFFER_SIZE - 1 - ((bufferHead - bufferTail) & (RAD_PLAYER_BUFFER_SIZE - 1));
+		if (bufferFree == 0) {
+			break;
+		}
+
+		// Move on to the pattern of the next order. Stop when a whole loop of the song holds no pattern data.
+		if (fillRemaining == 0) {
+			if (numSkipped ++ > numOrders) {
+				break;
+			}
+
+			fillOrder = getNextOrder(fillOrder);
+			if (fillOrder != RAD_ORDER_NONE && stream->seek(patternOffsets[getPattern(fillOrder)])) {
+				fillRemaining = patternLengths[getPattern(fillOrder)];
+			}
+			continue;
+		}
+
+		unsigned int length = RAD_PLAYER_BUFFER_SIZE - bufferHead;
+		length = length < bufferFree ? length : bufferFree;
+		length = length < fillRemaining ? length : fillRemaining;
+		unsigned int numRead = stream->read(buffer + bufferHead, length);
+		if (numRead == 0) {
+			fillOrder = RAD_ORDER_NONE;
+			break;
+		}
+
+		bufferHead = (bufferHead + numRead) & (RAD_PLAYER_BUFFER_SIZE - 1);
+		fillRemaining -= numRead;
+		numSkipped = 0;
+		hasRead = true;
+	}
+
+	return hasRead;
+}
+
+
+/**
+ * Read the next byte of the current pattern. When the read ahead buffer has run dry it is refilled first.
+ *
+ * @param value - Receives the byte.
+ * @return True if a byte was read, false at the end of the pattern.
+ */
+bool RADPlayer::readByte(byte& value) {
+	if (!peekByte(value)) {
+		return false;
+	}
+
+	bufferTail = (bufferTail + 1) & (RAD_PLAYER_BUFFER_SIZE - 1);
+	patternRemaining --;
+	return true;
+}
+
+
+/**
+ * Get the next byte of the current pattern without consuming it.
+ *
+ * @param value - Receives the byte.
+ * @return True if there is a byte, false at the end of the pattern.
+ */
+bool RADPlayer::peekByte(byte& value) {
+	if (patternRemaining == 0 || (bufferTail == bufferHead && !fillBuffer())) {
+		return false;
+	}
+
+	value = buffer[bufferTail];
+	return true;
+}
+
+
+/**
+ * Read the next line of the current pattern when it holds data for the current line number.
+ */
+void RADPlayer::readLine() {
+	// Reset note data on each channel.
+	for (byte i = 0; i < RAD_NUM_CHANNELS; i ++) {
+		channelNote[i] = 0x0000;
+	}
+
+	// If the previous line was the last line of the pattern then we're done.
+	if (endOfPattern) {
+		return;
+	}
+
+	// If the next line number does not match our current line then it's empty so there's nothing to do for us here.
+	byte lineNumber;
+	if (!peekByte(lineNumber) || (lineNumber & 0x3F) != line) {
+		return;
+	}
+	readByte(lineNumber);
+
+	// Set end of pattern marker if this is the last line in the pattern.
+	endOfPattern = lineNumber & 0x80;
+
+	// Read note and effect data for each channel.
+	byte channelNumber;
+	do {
+		byte noteHigh, noteLow;
+		byte parameter = 0x00;
+		if (!readByte(channelNumber) || !readByte(noteHigh) || !readByte(noteLow)) {
+			return;
+		}
+		if ((noteLow & 0x0F) && !readByte(parameter)) {
+			return;
+		}
+
+		byte channel = channelNumber & 0x0F;
+		if (channel < RAD_NUM_CHANNELS) {
+			channelNote[channel] = (noteHigh << 8) + noteLow;
+			effectParameter[channel] = parameter;
+		}
+	} while (!(channelNumber & 0x80));
+}
+
+
+/**
+ * Move on to the next order. A startLine may be given since the pattern break effect can start the next order on any
+ * particular line. Any data left of the current pattern is skipped in the read ahead buffer.
+ */
+void RADPlayer::nextOrder(byte startLine) {
+	byte value;
+	while (readByte(value));
+
+	order = getNextOrder(order);
+	if (order == RAD_ORDER_NONE) {
+		patternRemaining = 0;
+		playing = false;
+		return;
+	}
+
+	patternRemaining = patternLengths[getPattern(order)];
+	endOfPattern = false;
+	for (line = 0; line < startLine; line ++) {
+		readLine();
+	}
+}
+
+
+/**
+ * Load instrument data for the given channel.
+ */
+void RADPlayer::setInstrument(byte channel, byte instrumentIndex) {
+	byte* instrument = instruments[instrumentIndex];
+
+	opl2->setOperatorRegister(0x20, channel, CARRIER, instrument[0]);
+	opl2->setOperatorRegister(0x40, channel, CARRIER, instrument[2]);
+	opl2->setOperatorRegister(0x60, channel, CARRIER, instrument[4]);
+	opl2->setOperatorRegister(0x80, channel, CARRIER, instrument[6]);
+	opl2->setOperatorRegister(0xE0, channel, CARRIER, instrument[9] & 0x0F);
+
+	opl2->setOperatorRegister(0x20, channel, MODULATOR, instrument[1]);
+	opl2->setOperatorRegister(0x40, channel, MODULATOR, instrument[3]);
+	opl2->setOperatorRegister(0x60, channel, MODULATOR, instrument[5]);
+	opl2->setOperatorRegister(0x80, channel, MODULATOR, instrument[7]);
+	opl2->setOperatorRegister(0xE0, channel, MODULATOR, (instrument[9] & 0xF0) >> 4);
+
+	opl2->setChannelRegister(0xC0, channel, instrument[8]);
+}
+
+
+/**
+ * Play a note on the given channel.
+ */
+void RADPlayer::playNote(byte channel, byte octave, byte note) {
+	opl2->setKeyOn(channel, false);
+	setPitch(channel, getNotePitch(octave, note));
+	opl2->setKeyOn(channel, true);
+}
+
+
+/**
+ * Set the block and F-number of the given channel from a pitch of block << 12 + F-number.
+ */
+void RADPlayer::setPitch(byte channel, unsigned int pitch) {
+	channelPitch[channel] = pitch;
+	opl2->setBlock(channel, pitch >> 12);
+	opl2->setFNumber(channel, pitch & 0x0FFF);
+}
+
+
+/**
+ * Get the pitch as block << 12 + F-number of a note [1, 12] in the given octave.
+ */
+unsigned int RADPlayer::getNotePitch(byte octave, byte note) {
+	return ((octave + (note / 12)) << 12) + noteFNumbers[note % 12];
+}
+
+
+/**
+ * Slide the pitch of a channel by a given F-number amount. The block is moved up or down an octave when the F-number
+ * leaves the range of an octave.
+ */
+void RADPlayer::pitchAdjust(byte channel, short amount) {
+	byte block = channelPitch[channel] >> 12;
+	short fNumber = (channelPitch[channel] & 0x0FFF) + amount;
+	fNumber = fNumber < 0x000 ? 0x000 : (fNumber > 0x3FF ? 0x3FF : fNumber);
+
+	// Drop one octave (if possible) when the F-number drops below octave minimum.
+	if (fNumber < RAD_FNUMBER_MIN) {
+		if (block > 0) {
+			block --;
+			fNumber = RAD_FNUMBER_MAX - (RAD_FNUMBER_MIN - fNumber);
+		}
+
+	// Increase one octave (if possible) when the F-number reaches above octave maximum.
+	} else if (fNumber > RAD_FNUMBER_MAX) {
+		if (block < 7) {
+			block ++;
+			fNumber = RAD_FNUMBER_MIN + (fNumber - RAD_FNUMBER_MAX);
+		}
+	}
+
+	setPitch(channel, (block << 12) + fNumber);
+}
+
+
+/**
+ * Adjust the pitch of the note on the given channel toward pitchSlideDest for the channel and stop sliding once the
+ * destination pitch is reached.
+ */
+void RADPlayer::pitchAdjustToNote(byte channel) {
+	unsigned int destination = pitchSlideDest[channel];
+	if (destination == 0x0000) {
+		return;
+	}
+
+	// Slide pitch up or down and compensate any overshoot.
+	if (channelPitch[channel] < destination) {
+		pitchAdjust(channel, pitchSlideSpeed[channel]);
+		if (channelPitch[channel] >= destination) {
+			setPitch(channel, destination);
+			pitchSlideDest[channel] = 0x0000;
+		}
+	} else if (channelPitch[channel] > destination) {
+		pitchAdjust(channel, -pitchSlideSpeed[channel]);
+		if (channelPitch[channel] <= destination) {
+			setPitch(channel, destination);
+			pitchSlideDest[channel] = 0x0000;
+		}
+	}
+}
+
+
+/**
+ * Adjust the volume of a channel by the given amount. Amounts of 1 to 49 lower the volume and 51 to 99 raise it.
+ */
+void RADPlayer::volumeAdjust(byte channel, byte amount) {
+	byte volume = opl2->getVolume(channel, CARRIER);
+
+	if (amount > 0 && amount < 50) {
+		volume = volume + amount < 63 ? volume + amount : 63;
+	} else if (amount > 50 && amount < 100) {
+		volume = volume > amount - 50 ? volume - (amount - 50) : 0;
+	}
+
+	opl2->setVolume(channel, CARRIER, volume);
+}
@@ -0,0 +1,139 @@
+#include "OPLPlayer.h"
+
+#ifndef RAD_PLAYER_LIB_H_
+	#define RAD_PLAYER_LIB_H_
+
+	// Size in bytes of the ring buffer that pattern data is read ahead into. The size must be a power of 2.
+	#ifndef RAD_PLAYER_BUFFER_SIZE
+		#if BOARD_TYPE == OPL2_BOARD_TYPE_ARDUINO
+			#define RAD_PLAYER_BUFFER_SIZE 64
+		#else
+			#define RAD_PLAYER_BUFFER_SIZE 1024
+		#endif
+	#endif
+
+	// Maximum length of the order list. Lower this to save memory on small boards.
+	#ifndef RAD_MAX_ORDERS
+		#define RAD_MAX_ORDERS 128
+	#endif
+
+	#define RAD_NUM_CHANNELS    9
+	#define RAD_NUM_PATTERNS    32
+	#define RAD_NUM_INSTRUMENTS 31
+	#define RAD_NUM_LINES       64
+	#define RAD_ORDER_NONE      0xFF
+
+	// Tick durations in microseconds of the normal 50Hz timer and the slow 18.2Hz timer.
+	#define RAD_TICK_MICROS      20000UL
+	#define RAD_SLOW_TICK_MICROS 54945UL
+
+	// Minimum and maximum F-numbers in each octave.
+	#define RAD_FNUMBER_MIN 0x156
+	#define RAD_FNUMBER_MAX 0x2AE
+
+	// RAD effect codes.
+	#define RAD_EFFECT_NONE              0x00
+	#define RAD_EFFECT_NOTE_SLIDE_UP     0x01
+	#define RAD_EFFECT_NOTE_SLIDE_DOWN   0x02
+	#define RAD_EFFECT_NOTE_SLIDE_TO     0x03
+	#define RAD_EFFECT_NOTE_SLIDE_VOLUME 0x05
+	#define RAD_EFFECT_VOLUME_SLIDE      0x0A
+	#define RAD_EFFECT_SET_VOLUME        0x0C
+	#define RAD_EFFECT_PATTERN_BREAK     0x0D
+	#define RAD_EFFECT_SET_SPEED         0x0F
+
+
+	/**
+	 * Player for Reality Adlib Tracker (RAD) version 1 songs that are streamed from an OPLStream. The order list and
+	 * the offset and length of every pattern are indexed when the song is loaded. While the song plays the pattern
+	 * data is read ahead, in the order it will be played, into a small ring buffer that poll() refills after each
+	 * tick. The stream only needs to seek once per pattern and this happens between ticks, so slow seeks on SD card
+	 * do not hold up a tick. Since poll() does no more than one tick and one buffer refill per call, service() simply
+	 * polls the player and returns the time until the next tick.
+	 *
+	 * Pitch is kept per channel as block << 12 + F-number and all effects use integer math only, so the cost of a
+	 * tick is bounded. The duration of the slowest tick is available through getMaxTickTime().
+	 */
+	class RADPlayer : public OPLPlayable {
+		public:
+			RADPlayer(OPL2* opl2Ref);
+
+			bool load(OPLStream* stream);
+			bool convert(OPLOutputStream* output);
+			virtual void play();
+			virtual void stop();
+			virtual bool isPlaying();
+			virtual unsigned long service();
+			void poll();
+			void tick();
+			unsigned long getTimeToNextTick();
+			unsigned long getTickDuration();
+			unsigned long getMaxTickTime();
+			void resetMaxTickTime();
+			bool getLoop();
+			void setLoop(bool loop);
+			byte getOrder();
+			byte getLine();
+
+		private:
+			byte resolveOrder(byte order);
+			byte getNextOrder(byte order);
+			byte getPattern(byte order);
+			bool fillBuffer();
+			bool readByte(byte& value);
+			bool peekByte(byte& value);
+			void readLine();
+			void nextOrder(byte startLine = 0);
+			void setInstrument(byte channel, byte instrumentIndex);
+			void playNote(byte channel, byte octave, byte note);
+			void setPitch(byte channel, unsigned int pitch);
+			unsigned int getNotePitch(byte octave, byte note);
+			void pitchAdjust(byte channel, short amount);
+			void pitchAdjustToNote(byte channel);
+			void volumeAdjust(byte channel, byte amount);
+
+			OPL2* opl2;
+			OPLStream* stream = NULL;
+			bool playing = false;
+			bool loop = true;
+			byte endOrder = RAD_ORDER_NONE;				// Last order of the song while it is converted.
+
+			// Song data.
+			byte instruments[RAD_NUM_INSTRUMENTS][10];
+			byte orders[RAD_MAX_ORDERS];
+			byte numOrders = 0;
+			unsigned int patternOffsets[RAD_NUM_PATTERNS];
+			unsigned int patternLengths[RAD_NUM_PATTERNS];
+			byte initialSpeed = 6;
+			bool hasSlowTimer = false;
+
+			// Read ahead buffer, filled with the pattern data of fillOrder.
+			byte buffer[RAD_PLAYER_BUFFER_SIZE];
+			unsigned int bufferHead = 0;
+			unsigned int bufferTail = 0;
+			byte fillOrder = RAD_ORDER_NONE;
+			unsigned int fillRemaining = 0;				// Bytes of the pattern of fillOrder not yet buffered.
+
+			// Player state.
+			byte order = RAD_ORDER_NONE;
+			byte line = 0;
+			byte tickIndex = 0;
+			byte speed = 6;
+			bool endOfPattern = false;
+			unsigned int patternRemaining = 0;			// Bytes of the current pattern not yet parsed.
+			byte patternBreak = 0xFF;
+			unsigned int channelNote[RAD_NUM_CHANNELS];
+			byte effectParameter[RAD_NUM_CHANNELS];
+			unsigned int channelPitch[RAD_NUM_CHANNELS];
+			unsigned int pitchSlideDest[RAD_NUM_CHANNELS];
+			byte pitchSlideSpeed[RAD_NUM_CHANNELS];
+
+			unsigned long nextTickTime = 0;
+			unsigned long maxTickTime = 0;
+
+			const unsigned int noteFNumbers[12] = {
+				0x16B, 0x181, 0x198, 0x1B0, 0x1CA, 0x1E5,
+				0x202, 0x220, 0x241, 0x263, 0x287, 0x2AE
+			};
+	};
+#endif
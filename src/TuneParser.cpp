@@ -27,7 +27,7 @@ void TuneParser::begin() {
  * @param voice0 - Command string for voice 0.
  */
 void TuneParser::play(const char* voice0) {
-	const char* voices[6] = { voice0, NULL, NULL, NULL, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, NULL, NULL, NULL, NULL, NULL };
 	Tune tune = createTune(voices, 1);
 	playTune(tune);
 }
@@ -40,7 +40,7 @@ void TuneParser::play(const char* voice0) {
  * @param voice1 - Command string for voice 1.
  */
 void TuneParser::play(const char* voice0, const char* voice1) {
-	const char* voices[6] = { voice0, voice1, NULL, NULL, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, NULL, NULL, NULL, NULL };
 	Tune tune = createTune(voices, 2);
 	playTune(tune);
 }
@@ -54,7 +54,7 @@ void TuneParser::play(const char* voice0, const char* voice1) {
  * @param voice2 - Command string for voice 2.
  */
 void TuneParser::play(const char* voice0, const char* voice1, const char* voice2) {
-	const char* voices[6] = { voice0, voice1, voice2, NULL, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, NULL, NULL, NULL };
 	Tune tune = createTune(voices, 3);
 	playTune(tune);
 }
@@ -69,7 +69,7 @@ void TuneParser::play(const char* voice0, const char* voice1, const char* voice2
  * @param voice3 - Command string for voice 3.
  */
 void TuneParser::play(const char* voice0, const char* voice1, const char* voice2, const char* voice3) {
-	const char* voices[6] = { voice0, voice1, voice2, voice3, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, voice3, NULL, NULL };
 	Tune tune = createTune(voices, 4);
 	playTune(tune);
 }
@@ -85,7 +85,7 @@ void TuneParser::play(const char* voice0, const char* voice1, const char* voice2
  * @param voice4 - Command string for voice 4.
  */
 void TuneParser::play(const char* voice0, const char* voice1, const char* voice2, const char* voice3, const char* voice4) {
-	const char* voices[6] = { voice0, voice1, voice2, voice3, voice4, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, voice3, voice4, NULL };
 	Tune tune = createTune(voices, 5);
 	playTune(tune);
 }
@@ -102,7 +102,7 @@ void TuneParser::play(const char* voice0, const char* voice1, const char* voice2
  * @param voice5 - Command string for voice 5.
  */
 void TuneParser::play(const char* voice0, const char* voice1, const char* voice2, const char* voice3, const char* voice4, const char* voice5) {
-	const char* voices[6] = { voice0, voice1, voice2, voice3, voice4, voice5 };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, voice3, voice4, voice5 };
 	Tune tune = createTune(voices, 6);
 	playTune(tune);
 }
@@ -115,7 +115,7 @@ void TuneParser::play(const char* voice0, const char* voice1, const char* voice2
  * @return The tune ready to be played by calling update.
  */
 Tune TuneParser::playBackground(const char* voice0) {
-	const char* voices[6] = { voice0, NULL, NULL, NULL, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, NULL, NULL, NULL, NULL, NULL };
 	return createTune(voices, 1);
 }
 
@@ -128,7 +128,7 @@ Tune TuneParser::playBackground(const char* voice0) {
  * @return The tune ready to be played by calling update.
  */
 Tune TuneParser::playBackground(const char* voice0, const char* voice1) {
-	const char* voices[6] = { voice0, voice1, NULL, NULL, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, NULL, NULL, NULL, NULL };
 	return createTune(voices, 2);
 }
 
@@ -142,7 +142,7 @@ Tune TuneParser::playBackground(const char* voice0, const char* voice1) {
  * @return The tune ready to be played by calling update.
  */
 Tune TuneParser::playBackground(const char* voice0, const char* voice1, const char* voice2) {
-	const char* voices[6] = { voice0, voice1, voice2, NULL, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, NULL, NULL, NULL };
 	return createTune(voices, 3);
 }
 
@@ -157,7 +157,7 @@ Tune TuneParser::playBackground(const char* voice0, const char* voice1, const ch
  * @return The tune ready to be played by calling update.
  */
 Tune TuneParser::playBackground(const char* voice0, const char* voice1, const char* voice2, const char* voice3) {
-	const char* voices[6] = { voice0, voice1, voice2, voice3, NULL, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, voice3, NULL, NULL };
 	return createTune(voices, 4);
 }
 
@@ -173,7 +173,7 @@ Tune TuneParser::playBackground(const char* voice0, const char* voice1, const ch
  * @return The tune ready to be played by calling update.
  */
 Tune TuneParser::playBackground(const char* voice0, const char* voice1, const char* voice2, const char* voice3, const char* voice4) {
-	const char* voices[6] = { voice0, voice1, voice2, voice3, voice4, NULL };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, voice3, voice4, NULL };
 	return createTune(voices, 5);
 }
 
@@ -190,7 +190,7 @@ Tune TuneParser::playBackground(const char* voice0, const char* voice1, const ch
  * @return The tune ready to be played by calling update.
  */
 Tune TuneParser::playBackground(const char* voice0, const char* voice1, const char* voice2, const char* voice3, const char* voice4, const char* voice5) {
-	const char* voices[6] = { voice0, voice1, voice2, voice3, voice4, voice5 };
+	const char* voices[TP_NUM_VOICES] = { voice0, voice1, voice2, voice3, voice4, voice5 };
 	return createTune(voices, 6);
 }
 
@@ -201,12 +201,15 @@ Tune TuneParser::playBackground(const char* voice0, const char* voice1, const ch
  * @param voices - Array of command strings for each voice.
  * @param numVoices - The number of voices that is in use.
  */
-Tune TuneParser::createTune(const char* voices[6], int numVoices) {
+Tune TuneParser::createTune(const char* voices[TP_NUM_VOICES], int numVoices) {
 	Tune tune;
 
-	tune.numVoices = min(numVoices, 6);
+	tune.numVoices = min(numVoices, TP_NUM_VOICES);
+	tune.priority = 0;
 	for (byte i = 0; i < tune.numVoices; i ++) {
 		tune.voice[i].pattern = voices[i];
+		tune.voice[i].code = NULL;
+		tune.voice[i].channel = TP_NAN;
 	}
 
 	restartTune(tune);
@@ -216,7 +219,7 @@ Tune TuneParser::createTune(const char* voices[6], int numVoices) {
 
 
 /**
- * Restart the given background tune.
+ * Restart the given background tune. Any notes of the tune that are still playing are stopped.
  *
  * @param tune - The tune to restart.
  */
@@ -226,6 +229,7 @@ void TuneParser::restartTune(Tune& tune) {
 	tune.nextTick = millis();
 
 	for (byte i = 0; i < tune.numVoices; i ++) {
+		releaseChannel(tune.voice[i]);
 		tune.voice[i].ended = false;
 		tune.voice[i].position = 0;
 		tune.voice[i].ticks = 1;
@@ -233,11 +237,24 @@ void TuneParser::restartTune(Tune& tune) {
 		tune.voice[i].volume = 0.8;
 		tune.voice[i].instrument = opl3->loadInstrument4OP(midiInstruments[0]);
 		tune.voice[i].defaultNoteLength = 16;
-		tune.voice[i].channel = tune.numVoices;
 	}
 }
 
 
+/**
+ * Stop playing the given background tune and free the channels of its notes for other tunes.
+ *
+ * @param tune - The tune to stop.
+ */
+void TuneParser::stopTune(Tune& tune) {
+	for (byte i = 0; i < tune.numVoices; i ++) {
+		releaseChannel(tune.voice[i]);
+		tune.voice[i].ended = true;
+	}
+	tune.numEnded = tune.numVoices;
+}
+
+
 /**
  * Has the given tune finished playing?
  *
@@ -266,25 +283,26 @@ void TuneParser::playTune(Tune& tune) {
  * to process the next tick. If it not yet time to process the next tick then this function will exit immediately and
  * return the number of milliseconds remaining until the next tick can be processed.
  *
+ * Ticks are scheduled from the time the previous tick was due rather than from when update was called, so the tempo
+ * does not drift. When the tune has fallen behind by more than a tick it continues from the current time.
+ *
  * @param tune - The tune to update.
  * @return The number of ms to wait until the next tick.
  */
 unsigned long TuneParser::update(Tune& tune) {
 	// Return immediately if it's not yet time to process the next tick.
-	if (millis() < tune.nextTick) {
-		return tune.nextTick - millis();
+	unsigned long now = millis();
+	long timeLeft = tune.nextTick - now;
+	if (timeLeft > 0) {
+		return timeLeft;
 	}
 
-	tune.nextTick = millis();
-	unsigned long t = millis();
-
 	for (byte i = 0; i < tune.numVoices; i ++) {
 		if (!tune.voice[i].ended) {
 			tune.voice[i].ticks --;
 
 			if (tune.voice[i].ticks == 0) {
-				opl3->setKeyOn(opl3->get4OPControlChannel(tune.voice[i].channel), false);
-				channelInUse[tune.voice[i].channel] = false;
+				releaseChannel(tune.voice[i]);
 
 				// Parse commands until we find a note, a rest or the end of the tune for this voice.
 				bool playingNote = false;
@@ -300,23 +318,182 @@ unsigned long TuneParser::update(Tune& tune) {
 	}
 
 	// Calculate time of next tick.
-	unsigned long wait = tune.tickDuration - (millis() - t);
-	tune.nextTick += wait;
+	tune.nextTick += tune.tickDuration;
+	if ((long)(tune.nextTick - now) < 0) {
+		tune.nextTick = now;
+	}
+
+	timeLeft = tune.nextTick - millis();
+	return timeLeft > 0 ? timeLeft : 0;
+}
+
+
+/**
+ * Update all given tunes in the background. Tunes that have ended are skipped. When notes of several tunes need a
+ * channel at the same time, the tunes are served in the order of the array. This function never blocks, it returns
+ * the time until the earliest next tick of all tunes, so the caller can sleep exactly that long before calling it
+ * again.
+ *
+ * @param tunes - Array of pointers to the tunes to update.
+ * @param numTunes - The number of tunes in the array.
+ * @return The number of ms until the next tick of any tune, or 0 when all tunes have ended.
+ */
+unsigned long TuneParser::updateAll(Tune* tunes[], byte numTunes) {
+	unsigned long wait = 0;
+	bool isPlaying = false;
+
+	for (byte i = 0; i < numTunes; i ++) {
+		if (!tuneEnded(*tunes[i])) {
+			unsigned long tuneWait = update(*tunes[i]);
+			if (!tuneEnded(*tunes[i]) && (!isPlaying || tuneWait < wait)) {
+				wait = tuneWait;
+				isPlaying = true;
+			}
+		}
+	}
 
 	return wait;
 }
 
 
 /**
- * Parse the next command in the command string of the given tune and voice index and leave the data pointer at the next
- * command.
+ * Compile the command string of a voice into bytecode. Compiled voices are played without parsing any text during
+ * playback, every note, rest or change of instrument, volume or tempo is a single op that is executed in constant time.
+ * Use createCompiledTune to play the compiled voices.
+ *
+ * The bytecode consists of 2 byte ops, an opcode followed by its operand, and ends with a single TP_OP_END byte. Notes
+ * are encoded in the opcode as TP_OP_NOTE + octave * 16 + note and their operand is the duration in ticks.
+ *
+ * @param pattern - Command string of the voice.
+ * @param buffer - Buffer to receive the bytecode.
+ * @param size - Size of the buffer in bytes.
+ * @return The length of the bytecode in bytes or 0 if the buffer is too small.
+ */
+unsigned int TuneParser::compile(const char* pattern, byte* buffer, unsigned int size) {
+	Voice voice;
+	voice.pattern = pattern;
+	voice.position = 0;
+	voice.octave = 4;
+	voice.defaultNoteLength = 16;
+
+	byte op[TP_MAX_OP_LENGTH];
+	unsigned int length = 0;
+	while (true) {
+		byte opLength = compileCommand(voice, op);
+		if (length + opLength > size) {
+			return 0;
+		}
+
+		for (byte i = 0; i < opLength; i ++) {
+			buffer[length ++] = op[i];
+		}
+
+		if (opLength > 0 && op[0] == TP_OP_END) {
+			return length;
+		}
+	}
+}
+
+
+/**
+ * Create a Tune structure from the given array of voices that were compiled to bytecode with compile.
+ *
+ * @param voices - Array of bytecode for each voice.
+ * @param numVoices - The number of voices that is in use.
+ */
+Tune TuneParser::createCompiledTune(const byte* voices[TP_NUM_VOICES], int numVoices) {
+	Tune tune;
+
+	tune.numVoices = min(numVoices, TP_NUM_VOICES);
+	tune.priority = 0;
+	for (byte i = 0; i < tune.numVoices; i ++) {
+		tune.voice[i].pattern = NULL;
+		tune.voice[i].code = voices[i];
+		tune.voice[i].channel = TP_NAN;
+	}
+
+	restartTune(tune);
+
+	return tune;
+}
+
+
+/**
+ * Execute the next command of the given tune and voice index and leave the data pointer at the next command. Command
+ * strings are compiled one command at a time, compiled voices run their bytecode directly.
  *
  * @param tune - The tune that's being played.
  * @param voiceIndex - The index of the voice that is being parsed/
+ * @return True if the voice is playing a note or rest or has ended.
  */
 bool TuneParser::parseTuneCommand(Tune& tune, byte voiceIndex) {
-	bool isPlaying = false;
 	Voice& voice = tune.voice[voiceIndex];
+	byte op[TP_MAX_OP_LENGTH];
+	const byte* code = op;
+
+	if (voice.code != NULL) {
+		code = voice.code + voice.position;
+		voice.position += code[0] == TP_OP_END ? 1 : 2;
+	} else if (compileCommand(voice, op) == 0) {
+		return false;
+	}
+
+	if (code[0] >= TP_OP_NOTE) {
+		playNote(voice, tune.priority, (code[0] >> 4) & 0x07, code[0] & 0x0F);
+		voice.ticks = code[1];
+		return true;
+	}
+
+	switch (code[0]) {
+		// Handle end of tune for this voice.
+		case TP_OP_END: {
+			voice.ended = true;
+			return true;
+		}
+
+		// Handle a rest or pause in the tune.
+		case TP_OP_REST: {
+			voice.ticks = code[1];
+			return true;
+		}
+
+		// Change the tempo of the tune.
+		case TP_OP_TEMPO: {
+			tune.tickDuration = code[1];
+			break;
+		}
+
+		// Change the current instrument.
+		case TP_OP_INSTRUMENT: {
+			voice.instrument = opl3->loadInstrument4OP(midiInstruments[code[1]]);
+			break;
+		}
+
+		// Change the volume.
+		case TP_OP_VOLUME: {
+			voice.volume = (float)code[1] / 15.0;
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	return false;
+}
+
+
+/**
+ * Compile the command at the current command string position of the given voice into a bytecode op and move the data
+ * pointer to the next command. Commands that only change the state of the parser, like octave changes or the default
+ * note length, do not result in an op.
+ *
+ * @param voice - The voice from which to compile the next command.
+ * @param op - Buffer of TP_MAX_OP_LENGTH bytes to receive the op.
+ * @return The length of the op in bytes, 0 if the command did not result in an op.
+ */
+byte TuneParser::compileCommand(Voice& voice, byte* op) {
+	byte opLength = 0;
 
 	// Get command character and convert to upper case.
 	char command = pgm_read_byte_near(voice.pattern + voice.position);
@@ -327,21 +504,25 @@ bool TuneParser::parseTuneCommand(Tune& tune, byte voiceIndex) {
 	switch (command) {
 		// Handle end of tune for this voice.
 		case TUNE_CMD_END: {
-			voice.ended = true;
-			isPlaying = true;
+			op[0] = TP_OP_END;
+			opLength = 1;
 			break;
 		}
 
-		// Parse note and cascade into handling rest for note delay.
+		// Handle a note and its duration.
 		case TUNE_CMD_NOTE_A ... TUNE_CMD_NOTE_G: {
-			parseNote(voice);
+			op[0] = parseNote(voice);
+			op[1] = parseRest(voice);
+			opLength = 2;
+			break;
 		}
 
 		// Handle a rest or pause in the tune.
 		case TUNE_CMD_REST:
 		case TUNE_CMD_PAUSE: {
-			parseRest(voice);
-			isPlaying = true;
+			op[0] = TP_OP_REST;
+			op[1] = parseRest(voice);
+			opLength = 2;
 			break;
 		}
 
@@ -374,7 +555,9 @@ bool TuneParser::parseTuneCommand(Tune& tune, byte voiceIndex) {
 		case TUNE_CMD_TEMPO: {
 			byte tempo = parseNumber(voice, 40, 250);
 			if (tempo != TP_NAN) {
-				tune.tickDuration = 60000 / (tempo * 16);
+				op[0] = TP_OP_TEMPO;
+				op[1] = 60000 / (tempo * 16);
+				opLength = 2;
 			}
 			break;
 		}
@@ -389,7 +572,9 @@ bool TuneParser::parseTuneCommand(Tune& tune, byte voiceIndex) {
 		case TUNE_CMD_INSTRUMENT: {
 			byte instrumentIndex = parseNumber(voice, 0, 127);
 			if (instrumentIndex != TP_NAN) {
-				voice.instrument = opl3->loadInstrument4OP(midiInstruments[instrumentIndex]);
+				op[0] = TP_OP_INSTRUMENT;
+				op[1] = instrumentIndex;
+				opLength = 2;
 			}
 			break;
 		}
@@ -398,7 +583,9 @@ bool TuneParser::parseTuneCommand(Tune& tune, byte voiceIndex) {
 		case TUNE_CMD_VOLUME: {
 			byte volume = parseNumber(voice, 0, 15);
 			if (volume != TP_NAN) {
-				voice.volume = (float)volume / 15.0;
+				op[0] = TP_OP_VOLUME;
+				op[1] = volume;
+				opLength = 2;
 			}
 			break;
 		}
@@ -409,24 +596,23 @@ bool TuneParser::parseTuneCommand(Tune& tune, byte voiceIndex) {
 	}
 
 	voice.position ++;
-	return isPlaying;
+	return opLength;
 }
 
 
 /**
- * Parse the note found at the current command string position of the given voice and play the note. The duration of the
- * note will be stored with the voice.
+ * Parse the note found at the current command string position of the given voice, including any sharp or flat that
+ * follows it.
  *
  * @param voice - The voice from which to extract the note.
+ * @return The note op holding the octave and note.
  */
-void TuneParser::parseNote(Voice& voice) {
+byte TuneParser::parseNote(Voice& voice) {
 	byte noteIndex = pgm_read_byte_near(voice.pattern + voice.position);
 	if (noteIndex >= 'a' && noteIndex <= 'g') {
 		noteIndex = noteIndex - 'a';
-	} else if (noteIndex >= 'A' && noteIndex <= 'G') {
-		noteIndex = noteIndex - 'A';
 	} else {
-		return;
+		noteIndex = noteIndex - 'A';
 	}
 
 	byte octave = voice.octave;
@@ -448,30 +634,50 @@ void TuneParser::parseNote(Voice& voice) {
 		}
 	}
 
-	// Find the next free channel to play the note on.
-	for (byte i = 1; i <= TP_NUM_CHANNELS; i ++) {
-		oplChannel4OP = (oplChannel4OP + i) % TP_NUM_CHANNELS;
-		if (!channelInUse[oplChannel4OP]) {
-			break;
-		}
+	return TP_OP_NOTE + (octave << 4) + note;
+}
+
+
+/**
+ * Play a note on the given voice. When no channel is available to the note, because all channels are taken by notes of
+ * tunes with a higher priority, the note is not played.
+ *
+ * @param voice - The voice that plays the note.
+ * @param priority - Priority of the tune that the voice belongs to.
+ * @param octave - Octave of the note.
+ * @param note - The note to play.
+ */
+void TuneParser::playNote(Voice& voice, byte priority, byte octave, byte note) {
+	// Find a channel to play the note on.
+	byte channel = allocateChannel(priority);
+	if (channel == TP_NAN) {
+		return;
+	}
+
+	// Take over the channel if it is used by a note of another voice.
+	if (channelInUse[channel]) {
+		channelVoice[channel]->channel = TP_NAN;
 	}
 
 	// Do some administartion and play the note!
-	channelInUse[oplChannel4OP] = true;
-	voice.channel = oplChannel4OP;
-	opl3->setInstrument4OP(oplChannel4OP, voice.instrument);
-	opl3->set4OPChannelVolume(oplChannel4OP, (1.0 - voice.volume) * 63);
-	opl3->playNote(opl3->get4OPControlChannel(oplChannel4OP), octave, note);
+	channelInUse[channel] = true;
+	channelVoice[channel] = &voice;
+	channelPriority[channel] = priority;
+	voice.channel = channel;
+	opl3->setInstrument4OP(channel, voice.instrument);
+	opl3->set4OPChannelVolume(channel, (1.0 - voice.volume) * 63);
+	opl3->playNote(opl3->get4OPControlChannel(channel), octave, note);
 }
 
 
 /**
  * Determine the number of ticks until the next command should be parsed. This is uesed for both rests and notes to
- * determine their length. The number of ticks to wait is sotred with the given voice.
+ * determine their length.
  *
  * @param voice - The voice for which we want to know the duration of the note or rest.
+ * @return The duration of the note or rest in ticks.
  */
-void TuneParser::parseRest(Voice& voice) {
+byte TuneParser::parseRest(Voice& voice) {
 	byte ticks = parseNoteLength(voice);
 
 	// Step through pattern data until we no longer find a digit.
@@ -489,8 +695,7 @@ void TuneParser::parseRest(Voice& voice) {
 	// Move position back one byte to not skip next command.
 	voice.position --;
 
-	// Set the number of ticks to hold the note.
-	voice.ticks = ticks;
+	return ticks;
 }
 
 
@@ -502,7 +707,7 @@ void TuneParser::parseRest(Voice& voice) {
  * @param voice - the voice from which to extract the note length.
  * @return The length of the note in ticks.
  */
-byte TuneParser::parseNoteLength(Voice voice) {
+byte TuneParser::parseNoteLength(const Voice& voice) {
 	byte length = parseNumber(voice, 1, 64);
 
 	if (length == TP_NAN) {
@@ -529,8 +734,9 @@ byte TuneParser::parseNoteLength(Voice voice) {
  * @param nMax - Maximum value of the number.
  * @return The number at the current command position in the voice or TP_NAN.
  */
-byte TuneParser::parseNumber(Voice voice, int nMin, int nMax) {
-	char nextDigit = pgm_read_byte_near(voice.pattern + voice.position + 1);
+byte TuneParser::parseNumber(const Voice& voice, int nMin, int nMax) {
+	unsigned long position = voice.position;
+	char nextDigit = pgm_read_byte_near(voice.pattern + position + 1);
 	if (nextDigit < '0' || nextDigit > '9') {
 		return TP_NAN;
 	}
@@ -538,10 +744,108 @@ byte TuneParser::parseNumber(Voice voice, int nMin, int nMax) {
 	int number = 0;
 	while(nextDigit >= '0' && nextDigit <= '9') {
 		number *= 10;
-		voice.position ++;
-		number = number + pgm_read_byte_near(voice.pattern + voice.position) - '0';
-		nextDigit = pgm_read_byte_near(voice.pattern + voice.position + 1);
+		position ++;
+		number = number + pgm_read_byte_near(voice.pattern + position) - '0';
+		nextDigit = pgm_read_byte_near(voice.pattern + position + 1);
 	}
 
 	return (byte)max(nMin, min(number, nMax));
 }
+
+
+/**
+ * Find a channel to play a note of the given priority on. Free channels are handed out round robin, so the release of
+ * the previous note on a channel can ring out. When all channels are in use the channel of the note with the lowest
+ * priority is taken, provided that its priority is not higher than the given priority.
+ *
+ * @param priority - Priority of the tune that wants to play a note.
+ * @return The 4-OP channel to play the note on or TP_NAN if no channel is available.
+ */
+byte TuneParser::allocateChannel(byte priority) {
+	byte lowestChannel = TP_NAN;
+
+	for (byte i = 1; i <= TP_NUM_CHANNELS; i ++) {
+		byte channel = (oplChannel4OP + i) % TP_NUM_CHANNELS;
+		if (!channelInUse[channel]) {
+			oplChannel4OP = channel;
+			return channel;
+		}
+
+		if (channelPriority[channel] <= priority &&
+			(lowestChannel == TP_NAN || channelPriority[channel] < channelPriority[lowestChannel])) {
+			lowestChannel = channel;
+		}
+	}
+
+	if (lowestChannel != TP_NAN) {
+		oplChannel4OP = lowestChannel;
+	}
+	return lowestChannel;
+}
+
+
+/**
+ * Stop the note that the given voice is playing and free its channel.
+ *
+ * @param voice - The voice that releases its channel.
+ */
+void TuneParser::releaseChannel(Voice& voice) {
+	if (voice.channel == TP_NAN) {
+		return;
+	}
+
+	opl3->setKeyOn(opl3->get4OPControlChannel(voice.channel), false);
+	channelInUse[voice.channel] = false;
+	voice.channel = TP_NAN;
+}
+
+
+/**
+ * Create a player for a background tune.
+ *
+ * @param parser - The tune parser that plays the tune.
+ * @param tune - The tune to play, for example as returned by createTune or createCompiledTune.
+ */
+TunePlayer::TunePlayer(TuneParser* parser, Tune* tune) {
+	this->parser = parser;
+	this->tune = tune;
+}
+
+
+/**
+ * Play the tune from the beginning.
+ */
+void TunePlayer::play() {
+	parser->restartTune(*tune);
+}
+
+
+/**
+ * Stop playing the tune and free its channels.
+ */
+void TunePlayer::stop() {
+	parser->stopTune(*tune);
+}
+
+
+/**
+ * Is the tune still playing?
+ */
+bool TunePlayer::isPlaying() {
+	return !parser->tuneEnded(*tune);
+}
+
+
+/**
+ * Process the tick of the tune that is due.
+ *
+ * @return The time in microseconds until service() needs to be called again, 0 if the tune has ended.
+ */
+unsigned long TunePlayer::service() {
+	if (parser->tuneEnded(*tune)) {
+		return 0;
+	}
+
+	unsigned long wait = parser->update(*tune);
+	return parser->tuneEnded(*tune) ? 0 : wait * 1000;
+}
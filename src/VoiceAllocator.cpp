@@ -0,0 +1,301 @@
+/**
+ * Polyphonic voice allocator for the OPL2 Audio Board and OPL3 Duo. Keeps track of which OPL channel plays which note
+ * and program, so MIDI sketches and players don't need to scan their channels for every note.
+ */
+
+#include "VoiceAllocator.h"
+
+
+/**
+ * Create an allocator for OPL channels 0 to numChannels - 1.
+ *
+ * @param numChannels - The number of channels to allocate. For 4-OP channels use the 4-OP channel index.
+ */
+VoiceAllocator::VoiceAllocator(byte numChannels) {
+	numVoices = numChannels < OPL_MAX_VOICES ? numChannels : OPL_MAX_VOICES;
+	for (byte i = 0; i < numVoices; i ++) {
+		voices[i].channel = i;
+	}
+	reset();
+}
+
+
+/**
+ * Create an allocator for the given OPL channels.
+ *
+ * @param channels - Array of the OPL channels to allocate.
+ * @param numChannels - The number of channels in the array.
+ */
+VoiceAllocator::VoiceAllocator(const byte* channels, byte numChannels) {
+	numVoices = numChannels < OPL_MAX_VOICES ? numChannels : OPL_MAX_VOICES;
+	for (byte i = 0; i < numVoices; i ++) {
+		voices[i].channel = channels[i];
+	}
+	reset();
+}
+
+
+/**
+ * Release all voices and forget the programs that are loaded on their channels. Call this after the chip is reset.
+ */
+void VoiceAllocator::reset() {
+	oldestHeld = OPL_VOICE_NONE;
+	newestHeld = OPL_VOICE_NONE;
+	oldestReleased = OPL_VOICE_NONE;
+	newestReleased = OPL_VOICE_NONE;
+	for (byte i = 0; i < OPL_VOICE_PROGRAM_LISTS; i ++) {
+		oldestOfProgram[i] = OPL_VOICE_NONE;
+		newestOfProgram[i] = OPL_VOICE_NONE;
+	}
+
+	for (byte i = 0; i < numVoices; i ++) {
+		voices[i].program = OPL_VOICE_NONE;
+		voices[i].note = OPL_VOICE_NONE;
+		voices[i].owner = OPL_VOICE_NONE;
+		voices[i].held = false;
+		voices[i].programChanged = false;
+		append(i, oldestReleased, newestReleased);
+	}
+}
+
+
+/**
+ * Allocate a voice to play the given note. The caller is responsible for stopping whatever note was playing on the
+ * channel of the voice and for loading the instrument when isProgramChanged() is true.
+ *
+ * @param note - The note to be played.
+ * @param program - The program, or instrument, that the note is played with.
+ * @param owner - Owner of the note, for example its MIDI channel.
+ * @return The voice to play the note on or OPL_VOICE_NONE if the allocator has no voices.
+ */
+byte VoiceAllocator::noteOn(byte note, byte program, byte owner) {
+	byte voice = oldestOfProgram[program & (OPL_VOICE_PROGRAM_LISTS - 1)];
+	while (voice != OPL_VOICE_NONE && voices[voice].program != program) {
+		voice = voices[voice].nextOfProgram;
+	}
+
+	if (voice == OPL_VOICE_NONE) {
+		voice = oldestReleased != OPL_VOICE_NONE ? oldestReleased : oldestHeld;
+		if (voice == OPL_VOICE_NONE) {
+			return OPL_VOICE_NONE;
+		}
+	}
+
+	unlink(voice);
+	voices[voice].programChanged = voices[voice].program != program;
+	voices[voice].program = program;
+	voices[voice].note = note;
+	voices[voice].owner = owner;
+	voices[voice].held = true;
+	append(voice, oldestHeld, newestHeld);
+	return voice;
+}
+
+
+/**
+ * Release the oldest voice that holds the given note of the given owner.
+ *
+ * @param note - The note to release.
+ * @param owner - Owner of the note.
+ * @return The voice that was released or OPL_VOICE_NONE if the note is not held.
+ */
+byte VoiceAllocator::noteOff(byte note, byte owner) {
+	byte voice = findVoice(note, owner);
+	if (voice != OPL_VOICE_NONE) {
+		release(voice);
+	}
+	return voice;
+}
+
+
+/**
+ * Release the given voice. The voice keeps its note and program, but it becomes available to new notes.
+ *
+ * @param voice - The voice to release.
+ */
+void VoiceAllocator::release(byte voice) {
+	if (voice >= numVoices || !voices[voice].held) {
+		return;
+	}
+
+	unlink(voice);
+	voices[voice].held = false;
+	append(voice, oldestReleased, newestReleased);
+}
+
+
+/**
+ * Release all held voices from oldest to newest.
+ */
+void VoiceAllocator::releaseAll() {
+	while (oldestHeld != OPL_VOICE_NONE) {
+		release(oldestHeld);
+	}
+}
+
+
+/**
+ * Find the oldest voice that holds the given note of the given owner.
+ *
+ * @param note - The note to look for.
+ * @param owner - Owner of the note.
+ * @return The voice that holds the note or OPL_VOICE_NONE.
+ */
+byte VoiceAllocator::findVoice(byte note, byte owner) {
+	for (byte voice = oldestHeld; voice != OPL_VOICE_NONE; voice = voices[voice].next) {
+		if (voices[voice].note == note && voices[voice].owner == owner) {
+			return voice;
+		}
+	}
+	return OPL_VOICE_NONE;
+}
+
+
+/**
+ * Get the number of voices of the allocator.
+ */
+byte VoiceAllocator::getNumVoices() {
+	return numVoices;
+}
+
+
+/**
+ * Get the OPL channel of the given voice.
+ */
+byte VoiceAllocator::getChannel(byte voice) {
+	return voices[voice].channel;
+}
+
+
+/**
+ * Get the note that the given voice plays or played last.
+ */
+byte VoiceAllocator::getNote(byte voice) {
+	return voices[voice].note;
+}
+
+
+/**
+ * Get the program that is loaded on the channel of the given voice.
+ */
+byte VoiceAllocator::getProgram(byte voice) {
+	return voices[voice].program;
+}
+
+
+/**
+ * Get the owner of the note of the given voice.
+ */
+byte VoiceAllocator::getOwner(byte voice) {
+	return voices[voice].owner;
+}
+
+
+/**
+ * Is the note of the given voice held?
+ */
+bool VoiceAllocator::isHeld(byte voice) {
+	return voices[voice].held;
+}
+
+
+/**
+ * Did the last note on of the given voice change its program? If so then the instrument needs to be loaded on the
+ * channel of the voice.
+ */
+bool VoiceAllocator::isProgramChanged(byte voice) {
+	return voices[voice].programChanged;
+}
+
+
+/**
+ * Remove the given voice from the held or released list and from its program list.
+ */
+void VoiceAllocator::unlink(byte voice) {
+	OPLVoice& v = voices[voice];
+	byte& oldest = v.held ? oldestHeld : oldestReleased;
+	byte& newest = v.held ? newestHeld : newestReleased;
+
+	if (v.previous != OPL_VOICE_NONE) {
+		voices[v.previous].next = v.next;
+	} else {
+		oldest = v.next;
+	}
+
+	if (v.next != OPL_VOICE_NONE) {
+		voices[v.next].previous = v.previous;
+	} else {
+		newest = v.previous;
+	}
+
+	if (!v.held) {
+		unlinkProgram(voice);
+	}
+}
+
+
+/**
+ * Add the given voice as the newest voice of the list given by oldest and newest. Released voices are also added to
+ * their program list.
+ */
+void VoiceAllocator::append(byte voice, byte& oldest, byte& newest) {
+	voices[voice].previous = newest;
+	voices[voice].next = OPL_VOICE_NONE;
+	if (newest != OPL_VOICE_NONE) {
+		voices[newest].next = voice;
+	} else {
+		oldest = voice;
+	}
+	newest = voice;
+
+	if (!voices[voice].held) {
+		appendProgram(voice);
+	}
+}
+
+
+/**
+ * Remove the given released voice from its program list.
+ */
+void VoiceAllocator::unlinkProgram(byte voice) {
+	OPLVoice& v = voices[voice];
+	if (v.program == OPL_VOICE_NONE) {
+		return;
+	}
+
+	byte list = v.program & (OPL_VOICE_PROGRAM_LISTS - 1);
+
+	if (v.previousOfProgram != OPL_VOICE_NONE) {
+		voices[v.previousOfProgram].nextOfProgram = v.nextOfProgram;
+	} else {
+		oldestOfProgram[list] = v.nextOfProgram;
+	}
+
+	if (v.nextOfProgram != OPL_VOICE_NONE) {
+		voices[v.nextOfProgram].previousOfProgram = v.previousOfProgram;
+	} else {
+		newestOfProgram[list] = v.previousOfProgram;
+	}
+}
+
+
+/**
+ * Add the given released voice as the newest voice of its program list. Voices without a program are not kept in a
+ * program list.
+ */
+void VoiceAllocator::appendProgram(byte voice) {
+	if (voices[voice].program == OPL_VOICE_NONE) {
+		return;
+	}
+
+	byte list = voices[voice].program & (OPL_VOICE_PROGRAM_LISTS - 1);
+
+	voices[voice].previousOfProgram = newestOfProgram[list];
+	voices[voice].nextOfProgram = OPL_VOICE_NONE;
+	if (newestOfProgram[list] != OPL_VOICE_NONE) {
+		voices[newestOfProgram[list]].nextOfProgram = voice;
+	} else {
+		oldestOfProgram[list] = voice;
+	}
+	newestOfProgram[list] = voice;
+}
@@ -0,0 +1,80 @@
+#include "OPL2.h"
+
+#ifndef VOICE_ALLOCATOR_LIB_H_
+	#define VOICE_ALLOCATOR_LIB_H_
+
+	// Maximum number of voices of an allocator. Lower this to save memory on small boards.
+	#ifndef OPL_MAX_VOICES
+		#define OPL_MAX_VOICES 36
+	#endif
+
+	// Number of lists that released voices are sorted into by program. The number must be a power of 2.
+	#ifndef OPL_VOICE_PROGRAM_LISTS
+		#define OPL_VOICE_PROGRAM_LISTS 16
+	#endif
+
+	#define OPL_VOICE_NONE 0xFF
+
+
+	struct OPLVoice {
+		byte channel;					// OPL channel of the voice.
+		byte program;					// Program loaded on the channel or OPL_VOICE_NONE.
+		byte note;						// Note that the voice plays or played last or OPL_VOICE_NONE.
+		byte owner;						// Owner of the note, for example its MIDI channel.
+		bool held;						// Is the note held or is it released?
+		bool programChanged;			// Did the last note on change the program of the voice?
+		byte previous;					// Previous voice in the held or released list.
+		byte next;						// Next voice in the held or released list.
+		byte previousOfProgram;			// Previous released voice in the program list.
+		byte nextOfProgram;				// Next released voice in the program list.
+	};
+
+
+	/**
+	 * Polyphonic voice allocator that hands out OPL channels to notes. The allocator only does the bookkeeping, so it
+	 * works with 2-OP and 4-OP channels of any chip. Voices are kept in a list of held voices and a list of released
+	 * voices, both ordered from oldest to newest, and released voices are also sorted into lists by program. This
+	 * makes every note on O(1):
+	 *
+	 * 1. The oldest released voice that already has the program loaded is used, so no instrument needs uploading.
+	 * 2. Otherwise the oldest released voice is used, as it is the furthest into its release.
+	 * 3. When no voice is released the oldest held note is stolen.
+	 *
+	 * After noteOn() call isProgramChanged() to find out whether the instrument has to be sent to the channel.
+	 */
+	class VoiceAllocator {
+		public:
+			VoiceAllocator(byte numChannels);
+			VoiceAllocator(const byte* channels, byte numChannels);
+			void reset();
+
+			byte noteOn(byte note, byte program, byte owner = 0);
+			byte noteOff(byte note, byte owner = 0);
+			void release(byte voice);
+			void releaseAll();
+			byte findVoice(byte note, byte owner = 0);
+
+			byte getNumVoices();
+			byte getChannel(byte voice);
+			byte getNote(byte voice);
+			byte getProgram(byte voice);
+			byte getOwner(byte voice);
+			bool isHeld(byte voice);
+			bool isProgramChanged(byte voice);
+
+		private:
+			OPLVoice voices[OPL_MAX_VOICES];
+			byte numVoices = 0;
+			byte oldestHeld = OPL_VOICE_NONE;
+			byte newestHeld = OPL_VOICE_NONE;
+			byte oldestReleased = OPL_VOICE_NONE;
+			byte newestReleased = OPL_VOICE_NONE;
+			byte oldestOfProgram[OPL_VOICE_PROGRAM_LISTS];
+			byte newestOfProgram[OPL_VOICE_PROGRAM_LISTS];
+
+			void unlink(byte voice);
+			void append(byte voice, byte& oldest, byte& newest);
+			void unlinkProgram(byte voice);
+			void appendProgram(byte voice);
+	};
+#endif
@@ -1,8 +1,38 @@
 #include <Arduino.h>
 #include <OPL2.h>
+#include <instruments.h>
+#include <OPLPlayer.h>
+#include <VoiceAllocator.h>
+#include <RADPlayer.h>
+#include <InstrumentBank.h>
+#include <OPLPassthrough.h>
+#include <OPLModulator.h>
+#include <OPLRecorder.h>
 #include <unity.h>
 
 OPL2 opl2;
+OPLRecorder recorder;
+
+
+/**
+ * Serial port that is fed from a buffer and keeps what is sent to it.
+ */
+class TestSerial : public Stream {
+    public:
+        byte input[32];
+        int inputLength = 0;
+        int inputPosition = 0;
+        byte output[16];
+        int outputLength = 0;
+
+        virtual int available() { return inputLength - inputPosition; }
+        virtual int read() { return inputPosition < inputLength ? input[inputPosition ++] : -1; }
+        virtual int peek() { return inputPosition < inputLength ? input[inputPosition] : -1; }
+        virtual size_t write(uint8_t value) {
+            if (outputLength < 16) output[outputLength ++] = value;
+            return 1;
+        }
+};
 
 
 /**
@@ -348,10 +378,477 @@ void test_register0xE0() {
 }
 
 
+/**
+ * Test that a compiled instrument sets the same registers as the instrument it was compiled from.
+ */
+void test_compiledInstrument() {
+    Instrument instrument = opl2.loadInstrument(INSTRUMENT_BAGPIPE1);
+    CompiledInstrument compiled = opl2.loadCompiledInstrument(INSTRUMENT_BAGPIPE1);
+    CompiledInstrument recompiled = opl2.compileInstrument(instrument);
+    TEST_ASSERT_EQUAL_MEMORY(&compiled, &recompiled, sizeof(CompiledInstrument));
+
+    opl2.setInstrument(0, instrument, 0.5);
+    opl2.setInstrument(1, compiled, 127);
+    for (int op = 0; op < 2; op ++) {
+        TEST_ASSERT_EQUAL_INT8(opl2.getOperatorRegister(0x20, 0, op), opl2.getOperatorRegister(0x20, 1, op));
+        TEST_ASSERT_EQUAL_INT8(opl2.getOperatorRegister(0x40, 0, op), opl2.getOperatorRegister(0x40, 1, op));
+        TEST_ASSERT_EQUAL_INT8(opl2.getOperatorRegister(0x60, 0, op), opl2.getOperatorRegister(0x60, 1, op));
+        TEST_ASSERT_EQUAL_INT8(opl2.getOperatorRegister(0x80, 0, op), opl2.getOperatorRegister(0x80, 1, op));
+        TEST_ASSERT_EQUAL_INT8(opl2.getOperatorRegister(0xE0, 0, op), opl2.getOperatorRegister(0xE0, 1, op));
+    }
+    TEST_ASSERT_EQUAL_INT8(opl2.getChannelRegister(0xC0, 0), opl2.getChannelRegister(0xC0, 1));
+}
+
+
+/**
+ * Test that setting an instrument that a channel already holds only changes its output levels.
+ */
+void test_instrumentAlreadyLoaded() {
+    CompiledInstrument compiled = opl2.loadCompiledInstrument(INSTRUMENT_BAGPIPE1);
+    CompiledInstrument other = opl2.loadCompiledInstrument(INSTRUMENT_BANJO1);
+
+    opl2.setInstrument(2, other);
+    TEST_ASSERT_FALSE(opl2.hasInstrument(2, compiled));
+    opl2.setInstrument(2, compiled, 255);
+    TEST_ASSERT_TRUE(opl2.hasInstrument(2, compiled));
+
+    opl2.setInstrument(2, compiled, 0);
+    TEST_ASSERT_TRUE(opl2.hasInstrument(2, compiled));
+    TEST_ASSERT_EQUAL_INT8(63, opl2.getVolume(2, OPERATOR1));
+    TEST_ASSERT_EQUAL_INT8(63, opl2.getVolume(2, OPERATOR2));
+
+    opl2.setAttack(2, OPERATOR1, (opl2.getAttack(2, OPERATOR1) + 1) & 0x0F);
+    TEST_ASSERT_FALSE(opl2.hasInstrument(2, compiled));
+}
+
+
+/**
+ * Test setting the channel frequency with the fixed point frequency functions.
+ */
+void test_fixedPointFrequency() {
+    opl2.setNoteFrequency(0, 69);
+    TEST_ASSERT_EQUAL_INT8(4, opl2.getBlock(0));
+    TEST_ASSERT_EQUAL_INT16(580, opl2.getFNumber(0));
+    TEST_ASSERT_UINT32_WITHIN(10, 44000, opl2.getFrequencyCentiHz(0));
+
+    opl2.setFrequencyCentiHz(0, 22000);
+    TEST_ASSERT_EQUAL_INT8(3, opl2.getBlock(0));
+    TEST_ASSERT_EQUAL_INT16(580, opl2.getFNumber(0));
+
+    TEST_ASSERT_EQUAL_INT8(0, opl2.getFrequencyBlockCentiHz(4849));
+    TEST_ASSERT_EQUAL_INT8(1, opl2.getFrequencyBlockCentiHz(4850));
+    TEST_ASSERT_EQUAL_INT8(7, opl2.getFrequencyBlockCentiHz(1000000));
+    TEST_ASSERT_EQUAL_INT16(1023, opl2.getFrequencyFNumberCentiHz(7, 1000000));
+    TEST_ASSERT_EQUAL_INT16(1023, opl2.getFrequencyFNumberCentiHz(0, 620841));
+}
+
+
+/**
+ * Create a VGM song of 17 samples with 2 register writes.
+ */
+void createTestSong(byte* song) {
+    const byte header[] = { 'V', 'g', 'm', ' ', 0x69, 0x00, 0x00, 0x00, 0x51, 0x01, 0x00, 0x00 };
+    const byte events[] = { 0x5A, 0x20, 0x01, 0x61, 0x10, 0x00, 0x4F, 0x00, 0x70, 0x5A, 0x20, 0x00, 0x66 };
+    memset(song, 0, 0x60);
+    memcpy(song, header, sizeof(header));
+    memcpy(song + 0x60, events, sizeof(events));
+    song[0x1C] = 0x44;
+    song[0x34] = 0x2C;
+}
+
+
+/**
+ * Test streaming a short VGM song from memory with the player.
+ */
+void test_streamingPlayer() {
+    byte song[0x6D];
+    createTestSong(song);
+
+    OPLMemoryStream stream(song, sizeof(song));
+    OPLPlayer player(&opl2);
+    TEST_ASSERT_FALSE(player.loadVGM(&stream));
+    song[0x52] = 0x01;
+    TEST_ASSERT_TRUE(player.load(&stream));
+    TEST_ASSERT_EQUAL_INT8(OPL_PLAYER_FORMAT_VGM, player.getFormat());
+
+    unsigned long songTime = 0;
+    player.play();
+    while (player.isPlaying()) {
+        songTime += player.step();
+    }
+    TEST_ASSERT_EQUAL_UINT32(385, songTime);
+
+    player.setLoop(true);
+    player.play();
+    delay(5);
+    player.poll();
+    TEST_ASSERT_TRUE(player.isPlaying());
+    player.stop();
+    TEST_ASSERT_FALSE(player.isPlaying());
+}
+
+
+/**
+ * Test that the second chip of a dual OPL2 DRO song is played on synth unit 1 of an OPL3 Duo.
+ */
+void test_droDualOPL2() {
+    byte song[32] = { 'D', 'B', 'R', 'A', 'W', 'O', 'P', 'L', 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00 };
+    song[20] = OPL_DRO_HARDWARE_DUAL_OPL2;
+    song[23] = 0x7E;
+    song[24] = 0x7F;
+    song[25] = 0x01;
+    const byte events[] = { 0x20, 0x00, 0x22, 0x80, 0x11 };
+    memcpy(song + 26, events, sizeof(events));
+
+    OPLTraceEntry log[2];
+    OPLRecorder chips(log, 2);
+    OPL3Duo opl3Duo;
+    opl3Duo.setBackend(&chips);
+    opl3Duo.begin();
+    chips.clear();
+
+    OPLMemoryStream stream(song, 31);
+    OPLPlayer player(&opl3Duo);
+    TEST_ASSERT_TRUE(player.load(&stream));
+    TEST_ASSERT_EQUAL_INT8(OPL_PLAYER_FORMAT_DRO, player.getFormat());
+    player.play();
+    player.service();
+
+    TEST_ASSERT_EQUAL_UINT32(2, chips.getLogLength());
+    TEST_ASSERT_EQUAL_INT8(0, chips.getLogEntry(0).bank);
+    TEST_ASSERT_EQUAL_INT8(0x22, chips.getLogEntry(0).value);
+    TEST_ASSERT_EQUAL_INT8(2, chips.getLogEntry(1).bank);
+    TEST_ASSERT_EQUAL_INT8(0x20, chips.getLogEntry(1).reg);
+    TEST_ASSERT_EQUAL_INT8(0x11, chips.getLogEntry(1).value);
+}
+
+
+/**
+ * Test that service() sends a single burst of register writes per call and returns the time until the next burst.
+ */
+void test_playerService() {
+    byte song[0x6D];
+    createTestSong(song);
+    song[0x52] = 0x01;
+
+    OPLMemoryStream stream(song, sizeof(song));
+    OPLPlayer player(&opl2);
+    OPLPlayable* players[] = { &player };
+    TEST_ASSERT_TRUE(player.load(&stream));
+
+    recorder.clear();
+    player.play();
+    unsigned long wait = player.service();
+    TEST_ASSERT_EQUAL_UINT32(1, recorder.getNumWrites());
+    TEST_ASSERT_UINT32_WITHIN(50, 363, wait);
+
+    while (player.isPlaying()) {
+        TEST_ASSERT_TRUE(OPLPlayable::serviceAll(players, 1) <= 363);
+    }
+    TEST_ASSERT_EQUAL_UINT32(2, recorder.getNumWrites());
+    TEST_ASSERT_EQUAL_UINT32(0, player.service());
+    TEST_ASSERT_EQUAL_UINT32(0, OPLPlayable::serviceAll(players, 1));
+}
+
+
+/**
+ * Test converting a VGM song to an OPE event stream and playing it.
+ */
+void test_eventStreamConversion() {
+    byte song[0x6D];
+    createTestSong(song);
+    song[0x52] = 0x01;
+
+    const byte expected[] = {
+        'O', 'P', 'L', 'E', OPE_VERSION, 0x44, 0xAC, 0x00, 0x00,
+        OPE_CMD_LOOP, OPE_CMD_WRITE, 0x20, 0x01, OPE_CMD_DELAY | 16, OPE_CMD_WRITE, 0x20, 0x00,
+        OPE_CMD_END
+    };
+    byte events[32];
+    OPLMemoryStream stream(song, sizeof(song));
+    OPLMemoryOutputStream output(events, sizeof(events));
+    OPLPlayer player(&opl2);
+    TEST_ASSERT_TRUE(player.loadVGM(&stream));
+    TEST_ASSERT_TRUE(player.convert(&output));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected), output.getLength());
+    TEST_ASSERT_EQUAL_MEMORY(expected, events, sizeof(expected));
+
+    OPLMemoryStream eventStream(events, output.getLength());
+    TEST_ASSERT_TRUE(player.load(&eventStream));
+    TEST_ASSERT_EQUAL_INT8(OPL_PLAYER_FORMAT_OPE, player.getFormat());
+
+    unsigned long songTime = 0;
+    player.play();
+    while (player.isPlaying()) {
+        songTime += player.step();
+    }
+    TEST_ASSERT_EQUAL_UINT32(385, songTime);
+}
+
+
+/**
+ * Test that converting an OPE song keeps its loop point where it is.
+ */
+void test_eventStreamLoopConversion() {
+    const byte song[] = {
+        'O', 'P', 'L', 'E', OPE_VERSION, 0x44, 0xAC, 0x00, 0x00,
+        OPE_CMD_WRITE, 0x20, 0x01, OPE_CMD_DELAY | 3, OPE_CMD_LOOP, OPE_CMD_WRITE, 0x20, 0x02, OPE_CMD_DELAY | 7,
+        OPE_CMD_END
+    };
+    byte events[32];
+    OPLMemoryStream stream(song, sizeof(song));
+    OPLMemoryOutputStream output(events, sizeof(events));
+    OPLPlayer player(&opl2);
+    TEST_ASSERT_TRUE(player.loadOPE(&stream));
+    TEST_ASSERT_TRUE(player.convert(&output));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(song), output.getLength());
+    TEST_ASSERT_EQUAL_MEMORY(song, events, sizeof(song));
+}
+
+
+/**
+ * Test that the voice allocator prefers voices with the same program, then the oldest released voice and only steals
+ * held notes when all voices are held.
+ */
+void test_voiceAllocator() {
+    VoiceAllocator allocator(3);
+    TEST_ASSERT_EQUAL_UINT8(0, allocator.noteOn(60, 1));
+    TEST_ASSERT_TRUE(allocator.isProgramChanged(0));
+    TEST_ASSERT_EQUAL_UINT8(1, allocator.noteOn(62, 2));
+    TEST_ASSERT_EQUAL_UINT8(2, allocator.noteOn(64, 3));
+
+    // All voices are held, so the oldest note is stolen.
+    TEST_ASSERT_EQUAL_UINT8(0, allocator.noteOn(65, 4));
+
+    // Voice 2 still has program 3 loaded, so it is preferred over voice 1 that was released first.
+    TEST_ASSERT_EQUAL_UINT8(1, allocator.noteOff(62));
+    TEST_ASSERT_EQUAL_UINT8(2, allocator.noteOff(64));
+    TEST_ASSERT_EQUAL_UINT8(OPL_VOICE_NONE, allocator.noteOff(64));
+    TEST_ASSERT_EQUAL_UINT8(2, allocator.noteOn(67, 3));
+    TEST_ASSERT_FALSE(allocator.isProgramChanged(2));
+
+    // Otherwise the oldest released voice is used.
+    TEST_ASSERT_EQUAL_UINT8(1, allocator.noteOn(69, 5));
+    TEST_ASSERT_TRUE(allocator.isProgramChanged(1));
+    TEST_ASSERT_EQUAL_UINT8(5, allocator.getProgram(1));
+    TEST_ASSERT_TRUE(allocator.isHeld(1));
+
+    allocator.releaseAll();
+    TEST_ASSERT_FALSE(allocator.isHeld(0));
+    TEST_ASSERT_FALSE(allocator.isHeld(1));
+    TEST_ASSERT_FALSE(allocator.isHeld(2));
+}
+
+
+/**
+ * Create a RAD song of a single pattern that plays a note on channel 0 at the first line.
+ */
+void createRADSong(byte* song) {
+    const char signature[] = "RAD by REALiTY!!";
+    const byte instrument[] = { 0x01, 0x21, 0x02, 0x12, 0x3F, 0xF1, 0xF2, 0x53, 0x74, 0x0A, 0x00, 0x01 };
+    memset(song, 0, 101);
+    memcpy(song, signature, 16);
+    song[16] = 0x10;                                    // Version 1.0
+    song[17] = 0x03;                                    // Speed 3, no description.
+    memcpy(song + 18, instrument, sizeof(instrument));  // Instrument 1, terminated by 0x00 at 30.
+    song[31] = 0x01;                                    // Order list of 1 order playing pattern 0.
+    song[33] = 97;                                      // Offset of pattern 0.
+    const byte pattern[] = { 0x80, 0x80, 0x41, 0x10 };  // Line 0: channel 0 plays C# in octave 4 with instrument 1.
+    memcpy(song + 97, pattern, sizeof(pattern));
+}
+
+
+/**
+ * Test that the RAD player plays a note from a song of a single pattern and stops at the end when not looping.
+ */
+void test_radPlayer() {
+    byte song[101];
+    createRADSong(song);
+
+    OPLMemoryStream stream(song, sizeof(song));
+    RADPlayer player(&opl2);
+    TEST_ASSERT_TRUE(player.load(&stream));
+
+    player.setLoop(false);
+    player.play();
+    player.tick();
+    TEST_ASSERT_EQUAL_INT8(0x21, opl2.getOperatorRegister(0x20, 0, CARRIER));
+    TEST_ASSERT_EQUAL_INT8(4, opl2.getBlock(0));
+    TEST_ASSERT_EQUAL_INT16(0x181, opl2.getFNumber(0));
+    TEST_ASSERT_TRUE(opl2.getKeyOn(0));
+
+    for (int i = 1; i < 64 * 3; i ++) {
+        TEST_ASSERT_TRUE(player.isPlaying());
+        player.tick();
+    }
+    TEST_ASSERT_FALSE(player.isPlaying());
+}
+
+
+/**
+ * Test converting a RAD song to an OPE event stream. The song loops at its first order, so the loop point follows the
+ * writes that set up the chip, and the 64 lines of 3 ticks at 50Hz follow the writes of the note.
+ */
+void test_radConversion() {
+    byte song[101];
+    createRADSong(song);
+
+    byte events[128];
+    OPLMemoryStream stream(song, sizeof(song));
+    OPLMemoryOutputStream output(events, sizeof(events));
+    RADPlayer player(&opl2);
+    TEST_ASSERT_TRUE(player.load(&stream));
+    TEST_ASSERT_TRUE(player.convert(&output));
+    TEST_ASSERT_TRUE(player.getLoop());
+    TEST_ASSERT_EQUAL_PTR(&recorder, opl2.getBackend());
+
+    const byte header[] = { 'O', 'P', 'L', 'E', OPE_VERSION, 50, 0x00, 0x00, 0x00 };
+    const byte ending[] = { OPE_CMD_DELAY_16, 64 * 3, 0x00, OPE_CMD_END };
+    unsigned long length = output.getLength();
+    TEST_ASSERT_EQUAL_MEMORY(header, events, OPE_HEADER_SIZE);
+    TEST_ASSERT_EQUAL_INT8(OPE_CMD_WRITE, events[OPE_HEADER_SIZE] & 0xF0);
+    TEST_ASSERT_EQUAL_INT8(OPE_CMD_LOOP, events[OPE_HEADER_SIZE + 1 + 2 * ((events[OPE_HEADER_SIZE] & 0x0F) + 1)]);
+    TEST_ASSERT_EQUAL_MEMORY(ending, events + length - sizeof(ending), sizeof(ending));
+
+    OPLMemoryStream eventStream(events, length);
+    OPLPlayer eventPlayer(&opl2);
+    TEST_ASSERT_TRUE(eventPlayer.load(&eventStream));
+    TEST_ASSERT_EQUAL_INT8(OPL_PLAYER_FORMAT_OPE, eventPlayer.getFormat());
+}
+
+
+/**
+ * Test that the instrument bank compiles the instruments it reads from a stream and keeps the most recently
+ * used instruments in its cache.
+ */
+void test_instrumentBank() {
+    const byte numInstruments = OPL_BANK_CACHE_SIZE + 1;
+    const byte header[] = { 'O', 'P', 'L', 'B', OPL_BANK_VERSION, OPL_BANK_2OP_SIZE, numInstruments, 0x00 };
+    const byte instrument[] = { 0x00, 0x21, 0x02, 0x12, 0x3F, 0x0A, 0x01, 0x53, 0x74, 0x0A, 0x21 };
+    byte bankData[OPL_BANK_HEADER_SIZE + numInstruments * OPL_BANK_2OP_SIZE];
+    memcpy(bankData, header, OPL_BANK_HEADER_SIZE);
+    for (byte i = 0; i < numInstruments; i ++) {
+        memcpy(bankData + OPL_BANK_HEADER_SIZE + i * OPL_BANK_2OP_SIZE, instrument, OPL_BANK_2OP_SIZE);
+        bankData[OPL_BANK_HEADER_SIZE + i * OPL_BANK_2OP_SIZE] = i;
+    }
+
+    OPLMemoryStream stream(bankData, sizeof(bankData));
+    InstrumentBank bank(&opl2);
+    TEST_ASSERT_TRUE(bank.begin(&stream));
+    TEST_ASSERT_FALSE(bank.is4OP());
+    TEST_ASSERT_EQUAL_UINT16(numInstruments, bank.getNumInstruments());
+
+    CompiledInstrument compiled;
+    CompiledInstrument4OP compiled4OP;
+    const byte modulator[] = { 0x21, 0x02, 0x12, 0x3F, 0x01 };
+    const byte carrier[] = { 0x01, 0x53, 0x74, 0x0A, 0x02 };
+    TEST_ASSERT_TRUE(bank.getInstrument(0, compiled));
+    TEST_ASSERT_EQUAL_MEMORY(modulator, compiled.operatorRegisters[MODULATOR], 5);
+    TEST_ASSERT_EQUAL_MEMORY(carrier, compiled.operatorRegisters[CARRIER], 5);
+    TEST_ASSERT_EQUAL_INT8(0x0A, compiled.channelRegister);
+    TEST_ASSERT_FALSE(bank.getInstrument(numInstruments, compiled));
+    TEST_ASSERT_FALSE(bank.getInstrument4OP(0, compiled4OP));
+
+    // Fill the cache, then instrument 1 is the least recently used and is replaced by the last instrument.
+    for (byte i = 1; i < OPL_BANK_CACHE_SIZE; i ++) {
+        TEST_ASSERT_TRUE(bank.getInstrument(i, compiled));
+        TEST_ASSERT_EQUAL_UINT8(i, compiled.transpose);
+    }
+    TEST_ASSERT_TRUE(bank.getInstrument(0, compiled));
+    TEST_ASSERT_EQUAL_UINT32(1, bank.getCacheHits());
+    TEST_ASSERT_TRUE(bank.getInstrument(numInstruments - 1, compiled));
+    TEST_ASSERT_TRUE(bank.getInstrument(0, compiled));
+    TEST_ASSERT_EQUAL_UINT32(2, bank.getCacheHits());
+    TEST_ASSERT_TRUE(bank.getInstrument(1, compiled));
+    TEST_ASSERT_EQUAL_UINT32(2, bank.getCacheHits());
+    TEST_ASSERT_EQUAL_UINT32(OPL_BANK_CACHE_SIZE + 2, bank.getCacheMisses());
+
+    bankData[0] = 'X';
+    TEST_ASSERT_FALSE(bank.begin(&stream));
+    TEST_ASSERT_FALSE(bank.isOpen());
+}
+
+
+/**
+ * Test that the passthrough gives the host credits for its buffer, makes the writes of a valid frame and drops a frame
+ * with a bad checksum. The passthrough writes the registers directly, so the writes are checked with the recorder.
+ */
+void test_passthrough() {
+    TestSerial serial;
+    OPLPassthrough passthrough(&opl2, &serial);
+    passthrough.begin();
+    TEST_ASSERT_EQUAL_INT(3, serial.outputLength);
+    TEST_ASSERT_EQUAL_UINT8(OPL_PASSTHROUGH_CREDIT, serial.output[0]);
+    TEST_ASSERT_EQUAL_UINT16(OPL_PASSTHROUGH_BUFFER_SIZE, serial.output[1] + (serial.output[2] << 8));
+
+    const byte frames[] = {
+        OPL_PASSTHROUGH_SYNC, 0x02, 0x00, 0x00, 0x00, 0xA3, 0x44, 0x00, 0xB3, 0x31, 0xCD,
+        OPL_PASSTHROUGH_SYNC, 0x01, 0x00, 0x00, 0x00, 0xA3, 0x55, 0x00
+    };
+    memcpy(serial.input, frames, sizeof(frames));
+    serial.inputLength = sizeof(frames);
+    passthrough.update();
+
+    TEST_ASSERT_EQUAL_INT8(0x44, recorder.getRegister(0, 0xA3));
+    TEST_ASSERT_EQUAL_INT8(0x31, recorder.getRegister(0, 0xB3));
+    TEST_ASSERT_EQUAL_UINT32(1, passthrough.getNumFrames());
+    TEST_ASSERT_EQUAL_UINT32(1, passthrough.getNumErrors());
+    TEST_ASSERT_EQUAL_UINT8(OPL_PASSTHROUGH_ERROR, serial.output[3]);
+    TEST_ASSERT_EQUAL_UINT8(OPL_PASSTHROUGH_ERROR_CHECKSUM, serial.output[4]);
+
+    opl2.write(0xA3, 0x00);
+    opl2.write(0xB3, 0x00);
+}
+
+
+
+/**
+ * Test that the modulator bends the note by no more than a semitone, makes no writes when the modulation is too small
+ * to change the F-number and restores the F-number of the note when it is stopped.
+ */
+void test_modulator() {
+    OPLModulator modulator(&opl2);
+    opl2.playNote(4, 4, NOTE_A);
+    short baseFNumber = opl2.getFNumber(4);
+
+    modulator.setModulation(4, 255, 255);
+    TEST_ASSERT_EQUAL_UINT8(255, modulator.getDepth(4));
+    TEST_ASSERT_EQUAL_UINT8(255, modulator.getRate(4));
+    bool changed = false;
+    for (byte updates = 0; updates < 8; ) {
+        delay(1);
+        if (modulator.update()) {
+            short fNumber = opl2.getFNumber(4);
+            TEST_ASSERT_INT16_WITHIN(baseFNumber * 61 / 1024, baseFNumber, fNumber);
+            changed = changed || fNumber != baseFNumber;
+            updates ++;
+        }
+    }
+    TEST_ASSERT_TRUE(changed);
+    modulator.stopModulation(4);
+    TEST_ASSERT_EQUAL_INT16(baseFNumber, opl2.getFNumber(4));
+    TEST_ASSERT_EQUAL_UINT8(0, modulator.getDepth(4));
+
+    modulator.setModulation(4, 1, 50);
+    recorder.clear();
+    for (byte updates = 0; updates < 4; ) {
+        delay(1);
+        updates += modulator.update() ? 1 : 0;
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.getNumWrites());
+    modulator.stopAll();
+
+    opl2.setKeyOn(4, false);
+}
+
+
+
 void setup() {
     delay(2000);
     UNITY_BEGIN();
 
+    // Record the register writes in memory, so the tests don't need a board.
+    opl2.setBackend(&recorder);
     opl2.begin();
     RUN_TEST(test_register0x01);
     RUN_TEST(test_register0x20);
@@ -363,6 +860,20 @@ void setup() {
     RUN_TEST(test_register0xBD);
     RUN_TEST(test_register0xC0);
     RUN_TEST(test_register0xE0);
+    RUN_TEST(test_compiledInstrument);
+    RUN_TEST(test_instrumentAlreadyLoaded);
+    RUN_TEST(test_fixedPointFrequency);
+    RUN_TEST(test_streamingPlayer);
+    RUN_TEST(test_playerService);
+    RUN_TEST(test_droDualOPL2);
+    RUN_TEST(test_eventStreamConversion);
+    RUN_TEST(test_eventStreamLoopConversion);
+    RUN_TEST(test_voiceAllocator);
+    RUN_TEST(test_radPlayer);
+    RUN_TEST(test_radConversion);
+    RUN_TEST(test_instrumentBank);
+    RUN_TEST(test_passthrough);
+    RUN_TEST(test_modulator);
 
     UNITY_END();
 }
@@ -1,8 +1,12 @@
 #include <Arduino.h>
 #include <OPL2.h>
+#include <OPLChip.h>
+#include <OPLRecorder.h>
 #include <unity.h>
 
 OPL2 opl2;
+OPL2Chip opl2Chip;
+OPLRecorder recorder;
 
 
 /**
@@ -72,6 +76,67 @@ void test_getOperatorRegisterOffset() {
 }
 
 
+/**
+ * Shadow registers of the OPL2 should take 120 bytes plus 19 bytes of batch flags.
+ */
+void test_shadowRegisterFootprint() {
+    TEST_ASSERT_EQUAL_UINT16(139, OPL2::shadowRegisterFootprint);
+}
+
+
+/**
+ * An OPL3Duo can be used as an OPL3 and an OPL2, and reports its channel counts through either of them.
+ */
+void test_numChannels() {
+    OPL3Duo opl3Duo;
+    OPL3* opl3 = &opl3Duo;
+    OPL2& opl2Ref = opl3Duo;
+    TEST_ASSERT_EQUAL_UINT8(OPL3DUO_NUM_2OP_CHANNELS, opl2Ref.getNumChannels());
+    TEST_ASSERT_EQUAL_UINT8(OPL3DUO_NUM_4OP_CHANNELS, opl3->getNum4OPChannels());
+    TEST_ASSERT_EQUAL_UINT8(OPL2_NUM_CHANNELS, opl2.getNumChannels());
+}
+
+
+/**
+ * Setting a clock frequency of 0 should restore the default clock of the chip type.
+ */
+void test_defaultClockFrequency() {
+    OPL3 opl3;
+    opl3.setClockFrequency(1000000);
+    TEST_ASSERT_EQUAL_UINT32(1000000, opl3.getClockFrequency());
+    opl3.setClockFrequency(0);
+    TEST_ASSERT_EQUAL_UINT32(OPL3_CLOCK_FREQUENCY, opl3.getClockFrequency());
+
+    opl2.setClockFrequency(0);
+    TEST_ASSERT_EQUAL_UINT32(OPL2_CLOCK_FREQUENCY, opl2.getClockFrequency());
+}
+
+
+/**
+ * Test that the compile time register offsets of OPL2Chip match those of OPL2.
+ */
+void test_oplChipRegisterOffsets() {
+    const byte channelRegisters[4] = { 0xA0, 0xB0, 0xC0, 0xFF };
+    const byte operatorRegisters[6] = { 0x20, 0x40, 0x60, 0x80, 0xE0, 0xFF };
+
+    TEST_ASSERT_EQUAL_INT8(opl2.getNumChannels(), opl2Chip.getNumChannels());
+    for (int i = 0; i < 20; i ++) {
+        for (int reg = 0; reg < 4; reg ++) {
+            TEST_ASSERT_EQUAL_INT8(
+                opl2.getChannelRegisterOffset(channelRegisters[reg], i),
+                opl2Chip.getChannelRegisterOffset(channelRegisters[reg], i));
+        }
+        for (int j = 0; j < 4; j ++) {
+            for (int reg = 0; reg < 6; reg ++) {
+                TEST_ASSERT_EQUAL_INT16(
+                    opl2.getOperatorRegisterOffset(operatorRegisters[reg], i, j),
+                    opl2Chip.getOperatorRegisterOffset(operatorRegisters[reg], i, j));
+            }
+        }
+    }
+}
+
+
 /**
  * Test write / read operations on chip wide registers.
  */
@@ -126,6 +191,291 @@ void test_operatorRegisterRW() {
 }
 
 
+/**
+ * Test that writes of unchanged values are skipped and counted when write elimination is enabled.
+ */
+void test_writeElimination() {
+    opl2.setWriteEliminationEnabled(true);
+    opl2.resetSkippedWriteCount();
+
+    opl2.setChannelRegister(0xA0, 0, 0x55);
+    opl2.setChannelRegister(0xA0, 0, 0x55);
+    opl2.setOperatorRegister(0x20, 0, 0, 0x55);
+    opl2.setOperatorRegister(0x20, 0, 0, 0x55);
+    opl2.setChipRegister(0x08, 0x40);
+    opl2.setChipRegister(0x08, 0x40);
+    TEST_ASSERT_EQUAL_UINT32(3, opl2.getSkippedWriteCount());
+    TEST_ASSERT_EQUAL_INT8(0x55, opl2.getChannelRegister(0xA0, 0));
+    TEST_ASSERT_EQUAL_INT8(0x55, opl2.getOperatorRegister(0x20, 0, 0));
+
+    opl2.setChannelRegister(0xA0, 0, 0xAA);
+    TEST_ASSERT_EQUAL_UINT32(3, opl2.getSkippedWriteCount());
+    TEST_ASSERT_EQUAL_INT8(0xAA, opl2.getChannelRegister(0xA0, 0));
+
+    opl2.resetSkippedWriteCount();
+    TEST_ASSERT_EQUAL_UINT32(0, opl2.getSkippedWriteCount());
+    opl2.setWriteEliminationEnabled(false);
+}
+
+
+/**
+ * Test that shadow registers are updated immediately while a batch is active and the batch ends on commit.
+ */
+void test_batch() {
+    TEST_ASSERT_FALSE(opl2.isBatchActive());
+
+    opl2.beginBatch();
+    TEST_ASSERT_TRUE(opl2.isBatchActive());
+    opl2.setChannelRegister(0xB0, 1, 0x55);
+    opl2.setOperatorRegister(0x60, 1, 1, 0xAA);
+    TEST_ASSERT_EQUAL_INT8(0x55, opl2.getChannelRegister(0xB0, 1));
+    TEST_ASSERT_EQUAL_INT8(0xAA, opl2.getOperatorRegister(0x60, 1, 1));
+
+    opl2.commit();
+    TEST_ASSERT_FALSE(opl2.isBatchActive());
+    TEST_ASSERT_EQUAL_INT8(0x55, opl2.getChannelRegister(0xB0, 1));
+    TEST_ASSERT_EQUAL_INT8(0xAA, opl2.getOperatorRegister(0x60, 1, 1));
+}
+
+
+/**
+ * Test that a note that is stopped in a batch is keyed off before its patch is changed and is not keyed on again.
+ */
+void test_batchKeyOff() {
+    OPLTraceEntry log[8];
+    OPLRecorder ordered(log, 8);
+    opl2.setBackend(&ordered);
+    opl2.reset();
+    opl2.playNote(2, 4, NOTE_A);
+    ordered.clear();
+
+    opl2.beginBatch();
+    opl2.setKeyOn(2, false);
+    opl2.setOperatorRegister(0x20, 2, CARRIER, 0x21);
+    opl2.setOperatorRegister(0x40, 2, CARRIER, 0x10);
+    opl2.commit();
+
+    TEST_ASSERT_EQUAL_UINT32(3, ordered.getLogLength());
+    TEST_ASSERT_EQUAL_INT8(0xB2, ordered.getLogEntry(0).reg);
+    TEST_ASSERT_EQUAL_INT8(0x00, ordered.getLogEntry(0).value & 0x20);
+    TEST_ASSERT_EQUAL_INT8(0x25, ordered.getLogEntry(1).reg);
+    TEST_ASSERT_EQUAL_INT8(0x45, ordered.getLogEntry(2).reg);
+    TEST_ASSERT_FALSE(opl2.getKeyOn(2));
+
+    opl2.setBackend(&recorder);
+    opl2.reset();
+}
+
+
+/**
+ * Change some registers, repeating several writes, and play a note.
+ */
+void writeTestSequence() {
+    for (int i = 0; i < 2; i ++) {
+        opl2.setOperatorRegister(0x20, 0, CARRIER, 0x21);
+        opl2.setOperatorRegister(0x40, 0, CARRIER, 0x10);
+        opl2.setOperatorRegister(0x60, 0, CARRIER, 0xF2);
+        opl2.setChannelRegister(0xC0, 0, 0x0E);
+    }
+    opl2.playNote(0, 4, NOTE_A);
+    opl2.setOperatorRegister(0x40, 0, CARRIER, 0x20);
+    opl2.setKeyOn(0, false);
+}
+
+
+/**
+ * Test that the recorder logs and keeps the register writes and that write elimination and batching leave the chip in
+ * the same state as writing every register.
+ */
+void test_recorder() {
+    OPLTraceEntry log[4];
+    OPLRecorder reference(log, 4);
+    opl2.setBackend(&reference);
+    opl2.reset();
+    TEST_ASSERT_EQUAL_UINT32(1, reference.getNumResets());
+    TEST_ASSERT_TRUE(reference.isLogFull());
+
+    reference.clear();
+    opl2.setChannelRegister(0xA0, 1, 0x44);
+    TEST_ASSERT_EQUAL_UINT32(1, reference.getLogLength());
+    TEST_ASSERT_EQUAL_INT8(0xA1, reference.getLogEntry(0).reg);
+    TEST_ASSERT_EQUAL_INT8(0x44, reference.getLogEntry(0).value);
+    TEST_ASSERT_EQUAL_INT8(0x44, reference.getRegister(0, 0xA1));
+
+    writeTestSequence();
+    TEST_ASSERT_EQUAL_INT8(opl2.getChannelRegister(0xB0, 0), reference.getRegister(0, 0xB0));
+    TEST_ASSERT_EQUAL_UINT32(4, reference.getLogLength());
+
+    OPLRecorder optimized;
+    opl2.setBackend(&optimized);
+    opl2.reset();
+    opl2.setWriteEliminationEnabled(true);
+    optimized.clear();
+
+    opl2.setChannelRegister(0xA0, 1, 0x44);
+    opl2.beginBatch();
+    writeTestSequence();
+    opl2.commit();
+    opl2.setWriteEliminationEnabled(false);
+
+    TEST_ASSERT_TRUE(optimized.getNumWrites() < reference.getNumWrites());
+    TEST_ASSERT_EQUAL_INT16(OPL_RECORDER_NO_DIFFERENCE, optimized.findDifference(reference));
+
+    opl2.setBackend(&recorder);
+    opl2.reset();
+}
+
+
+/**
+ * Playing a chord with playNotes should give the same registers as calling playNote for each channel, in fewer writes.
+ */
+void test_playNotes() {
+    OPLNote chord[3] = {{ 0, 4, NOTE_C }, { 1, 4, NOTE_E }, { 2, 4, NOTE_G }};
+
+    OPLRecorder reference;
+    opl2.setBackend(&reference);
+    opl2.reset();
+    for (byte i = 0; i < 3; i ++) {
+        opl2.playNote(chord[i].channel, chord[i].octave, chord[i].note);
+    }
+    reference.clear();
+    for (byte i = 0; i < 3; i ++) {
+        opl2.playNote(chord[i].channel, chord[i].octave, chord[i].note);
+    }
+
+    OPLRecorder bulk;
+    opl2.setBackend(&bulk);
+    opl2.reset();
+    bulk.clear();
+    opl2.playNotes(chord, 3);
+    TEST_ASSERT_EQUAL_UINT32(6, bulk.getNumWrites());
+    bulk.clear();
+    opl2.playNotes(chord, 3);
+
+    TEST_ASSERT_EQUAL_UINT32(6, bulk.getNumWrites());
+    TEST_ASSERT_TRUE(bulk.getNumWrites() < reference.getNumWrites());
+    TEST_ASSERT_EQUAL_INT16(OPL_RECORDER_NO_DIFFERENCE, bulk.findDifference(reference));
+    TEST_ASSERT_TRUE(opl2.getKeyOn(2));
+
+    opl2.stopNotes(chord, 3);
+    TEST_ASSERT_FALSE(opl2.getKeyOn(0));
+    TEST_ASSERT_EQUAL_UINT32(9, bulk.getNumWrites());
+
+    opl2.setBackend(&recorder);
+    opl2.reset();
+}
+
+
+/**
+ * Drums that are queued in the same tick should be triggered with one 0xBD write to release and one to start them.
+ */
+void test_triggerDrums() {
+    OPLRecorder drums;
+    opl2.setBackend(&drums);
+    opl2.reset();
+    opl2.setPercussion(true);
+    opl2.setDrums(DRUM_BITS_CYMBAL);
+    drums.clear();
+
+    opl2.queueDrum(DRUM_BASS, 3, NOTE_C);
+    opl2.queueDrum(DRUM_SNARE, 4, NOTE_D);
+    opl2.queueDrum(DRUM_HI_HAT, 4, NOTE_D);
+    opl2.triggerDrums();
+    TEST_ASSERT_EQUAL_UINT32(5, drums.getNumWrites());
+    TEST_ASSERT_EQUAL_INT8(0x20 | DRUM_BITS_BASS | DRUM_BITS_SNARE | DRUM_BITS_HI_HAT | DRUM_BITS_CYMBAL,
+        drums.getRegister(0, 0xBD));
+    TEST_ASSERT_EQUAL_INT8(opl2.getNoteFNumber(NOTE_D) & 0xFF, drums.getRegister(0, 0xA7));
+    TEST_ASSERT_EQUAL_INT8(4, opl2.getBlock(7));
+
+    drums.clear();
+    opl2.queueDrum(DRUM_BASS);
+    opl2.queueDrum(DRUM_SNARE, 4, NOTE_D);
+    opl2.triggerDrums();
+    TEST_ASSERT_EQUAL_UINT32(2, drums.getNumWrites());
+    TEST_ASSERT_EQUAL_INT8(3, opl2.getBlock(6));
+
+    drums.clear();
+    opl2.triggerDrums();
+    TEST_ASSERT_EQUAL_UINT32(0, drums.getNumWrites());
+
+    opl2.setBackend(&recorder);
+    opl2.reset();
+}
+
+
+/**
+ * Restoring a snapshot should only write the registers that changed since it was taken and key-off the changed notes
+ * before anything else is written.
+ */
+void test_snapshot() {
+    OPLTraceEntry log[8];
+    OPLRecorder restored(log, 8);
+    opl2.setBackend(&restored);
+    opl2.reset();
+    TEST_ASSERT_EQUAL_UINT16(OPL2::snapshotSize, opl2.getSnapshotSize());
+
+    opl2.setOperatorRegister(0x40, 0, CARRIER, 0x10);
+    opl2.playNote(0, 4, NOTE_A);
+    byte music[OPL2::snapshotSize];
+    opl2.snapshot(music);
+    TEST_ASSERT_EQUAL_UINT16(0, opl2.diffSnapshot(music));
+
+    opl2.setOperatorRegister(0x40, 0, CARRIER, 0x00);
+    opl2.playNote(0, 5, NOTE_C);
+    opl2.playNote(1, 4, NOTE_C);
+    TEST_ASSERT_EQUAL_UINT16(5, opl2.diffSnapshot(music));
+
+    restored.clear();
+    TEST_ASSERT_EQUAL_UINT16(5, opl2.restore(music));
+    TEST_ASSERT_EQUAL_UINT32(7, restored.getNumWrites());
+    TEST_ASSERT_EQUAL_INT8(0xB0, restored.getLogEntry(0).reg);
+    TEST_ASSERT_EQUAL_INT8(0x00, restored.getLogEntry(0).value & 0x20);
+    TEST_ASSERT_EQUAL_INT8(0xB1, restored.getLogEntry(1).reg);
+    TEST_ASSERT_EQUAL_INT8(0x00, restored.getLogEntry(1).value & 0x20);
+    TEST_ASSERT_EQUAL_INT8(0x10, restored.getRegister(0, 0x43));
+    TEST_ASSERT_EQUAL_INT8(music[3 + 1], restored.getRegister(0, 0xB0));
+    TEST_ASSERT_TRUE(opl2.getKeyOn(0));
+    TEST_ASSERT_FALSE(opl2.getKeyOn(1));
+    TEST_ASSERT_EQUAL_UINT16(0, opl2.diffSnapshot(music));
+
+    restored.clear();
+    TEST_ASSERT_EQUAL_UINT16(0, opl2.restore(music));
+    TEST_ASSERT_EQUAL_UINT32(0, restored.getNumWrites());
+
+    opl2.setBackend(&recorder);
+    opl2.reset();
+}
+
+
+/**
+ * A fast reset should only write 0x08 and the output levels and leave the chip in the same state as a full reset.
+ */
+void test_fastReset() {
+    OPLRecorder fullReset;
+    opl2.setBackend(&fullReset);
+    opl2.reset();
+    TEST_ASSERT_FALSE(opl2.isFastResetEnabled());
+
+    OPLRecorder fastReset;
+    opl2.setBackend(&fastReset);
+    opl2.playNote(0, 4, NOTE_A);
+    opl2.setOperatorRegister(0x60, 0, CARRIER, 0xF2);
+    fastReset.clear();
+    unsigned long skippedWrites = opl2.getSkippedWriteCount();
+    opl2.setFastResetEnabled(true);
+    opl2.reset();
+    TEST_ASSERT_EQUAL_UINT32(1 + 2 * OPL2_NUM_CHANNELS, fastReset.getNumWrites());
+    TEST_ASSERT_TRUE(fastReset.hasSameRegisters(fullReset));
+    TEST_ASSERT_EQUAL_INT8(0x3F, opl2.getOperatorRegister(0x40, 8, CARRIER));
+    TEST_ASSERT_EQUAL_INT8(0x00, opl2.getOperatorRegister(0x60, 0, CARRIER));
+    TEST_ASSERT_EQUAL_UINT32(skippedWrites, opl2.getSkippedWriteCount());
+
+    opl2.setFastResetEnabled(false);
+    opl2.setBackend(&recorder);
+    opl2.reset();
+}
+
+
 /**
  * After OPL2.begin() or OPL2.reset() all registers should be set to 0.
  */
@@ -159,12 +509,26 @@ void setup() {
     RUN_TEST(test_getChipRegisterOffset);
     RUN_TEST(test_getChannelRegisterOffset);
     RUN_TEST(test_getOperatorRegisterOffset);
+    RUN_TEST(test_oplChipRegisterOffsets);
+    RUN_TEST(test_shadowRegisterFootprint);
+    RUN_TEST(test_defaultClockFrequency);
+    RUN_TEST(test_numChannels);
 
+    // Record the register writes in memory, so the tests don't need a board.
+    opl2.setBackend(&recorder);
     opl2.begin();
     RUN_TEST(test_OPL2Begin);
     RUN_TEST(test_chipRegisterRW);
     RUN_TEST(test_channelRegisterRW);
     RUN_TEST(test_operatorRegisterRW);
+    RUN_TEST(test_writeElimination);
+    RUN_TEST(test_batch);
+    RUN_TEST(test_batchKeyOff);
+    RUN_TEST(test_recorder);
+    RUN_TEST(test_playNotes);
+    RUN_TEST(test_triggerDrums);
+    RUN_TEST(test_snapshot);
+    RUN_TEST(test_fastReset);
 
     opl2.reset();
     RUN_TEST(test_OPL2Begin);